@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include "adlist.h"
 #include "zmalloc.h"
+#include "slab.h"
 
 /* Create a new list. The created list can be freed with
  * AlFreeList(), but private value of every node need to be freed
@@ -69,7 +70,7 @@ void listRelease(list *list)
         next = current->next;
         if (list->free) /* 这里调用专用free函数进行释放操作 */
 			list->free(current->value);
-        zfree(current);
+        slabFree(current);
         current = next;
     }
     zfree(list);
@@ -85,7 +86,7 @@ list *listAddNodeHead(list *list, void *value)
 {
     listNode *node;
 
-    if ((node = zmalloc(sizeof(*node))) == NULL)
+    if ((node = slabAlloc(sizeof(*node))) == NULL)
         return NULL;
 	/* 设置负载 */
     node->value = value;
@@ -114,7 +115,7 @@ list *listAddNodeTail(list *list, void *value)
 {
     listNode *node;
 
-    if ((node = zmalloc(sizeof(*node))) == NULL)
+    if ((node = slabAlloc(sizeof(*node))) == NULL)
         return NULL;
 	/* 设置负载值 */
     node->value = value;
@@ -150,7 +151,7 @@ void listDelNode(list *list, listNode *node)
 	
     if (list->free) 
 		list->free(node->value);
-    zfree(node);
+    slabFree(node);
     list->len--;
 }
 
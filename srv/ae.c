@@ -48,6 +48,8 @@ aeEventLoop *aeCreateEventLoop(void) {
     eventLoop->timeEventHead = NULL;
     eventLoop->timeEventNextId = 0;
     eventLoop->stop = 0;
+    eventLoop->beforesleep = NULL;
+    eventLoop->aftersleep = NULL;
     return eventLoop;
 }
 
@@ -283,6 +285,8 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
 		 * 这里巧妙的处理了时间事件的等待超时逻辑
 		 */
         retval = select(maxfd+1, &rfds, &wfds, &efds, tvp);
+        if (eventLoop->aftersleep != NULL)
+            eventLoop->aftersleep(eventLoop);
         if (retval > 0) {
             fe = eventLoop->fileEventHead;
             while(fe != NULL) {
@@ -386,6 +390,17 @@ int aeWait(int fd, int mask, long long milliseconds) {
 void aeMain(aeEventLoop *eventLoop)
 {
     eventLoop->stop = 0;
-    while (!eventLoop->stop)
+    while (!eventLoop->stop) {
+        if (eventLoop->beforesleep != NULL)
+            eventLoop->beforesleep(eventLoop);
         aeProcessEvents(eventLoop, AE_ALL_EVENTS);
+    }
+}
+
+void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep) {
+    eventLoop->beforesleep = beforesleep;
+}
+
+void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeAfterSleepProc *aftersleep) {
+    eventLoop->aftersleep = aftersleep;
 }
@@ -39,6 +39,8 @@ struct aeEventLoop;
 typedef void aeFileProc(struct aeEventLoop *eventLoop, int fd, void *clientData, int mask);
 typedef int aeTimeProc(struct aeEventLoop *eventLoop, long long id, void *clientData);
 typedef void aeEventFinalizerProc(struct aeEventLoop *eventLoop, void *clientData);
+typedef void aeBeforeSleepProc(struct aeEventLoop *eventLoop);
+typedef void aeAfterSleepProc(struct aeEventLoop *eventLoop);
 
 /* File event structure */
 typedef struct aeFileEvent {
@@ -67,6 +69,8 @@ typedef struct aeEventLoop {
     aeFileEvent *fileEventHead;
     aeTimeEvent *timeEventHead;
     int stop;	/* 1:停止 */
+    aeBeforeSleepProc *beforesleep;	/* 每次等待事件之前调用 */
+    aeAfterSleepProc *aftersleep;	/* 每次等待返回之后, 处理事件之前调用 */
 } aeEventLoop;
 
 /* Defines */
@@ -102,5 +106,7 @@ int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id);
 int aeProcessEvents(aeEventLoop *eventLoop, int flags);
 int aeWait(int fd, int mask, long long milliseconds);
 void aeMain(aeEventLoop *eventLoop);
+void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep);
+void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeAfterSleepProc *aftersleep);
 
 #endif
@@ -46,13 +46,14 @@ void oom(const char *msg) {
 void closeTimedoutClients(void) {
     redisClient *c;
     listNode *ln;
-    time_t now = time(NULL);
+    time_t now = server.unixtime;
 
     listRewind(server.clients);
     while ((ln = listYield(server.clients)) != NULL) {
         c = listNodeValue(ln);
         if (!(c->flags & REDIS_SLAVE) &&    /* no timeout for slaves */
             !(c->flags & REDIS_MASTER) &&   /* no timeout for masters */
+            !(c->flags & REDIS_BLOCKED) &&  /* BLPOP has its own timeout */
              (now - c->lastinteraction > server.maxidletime)) {
             redisLog(REDIS_DEBUG,"Closing idle client");
 			/* 关闭client，从相关的队列中移除 */
@@ -109,6 +110,31 @@ void initServerConfig() {
     server.requirepass = NULL;
     server.shareobjects = 0;
     server.maxclients = 0;
+    server.list_max_ziplist_entries = REDIS_LIST_MAX_ZIPLIST_ENTRIES;
+    server.list_max_ziplist_value = REDIS_LIST_MAX_ZIPLIST_VALUE;
+    server.set_max_intset_entries = REDIS_SET_MAX_INTSET_ENTRIES;
+    server.zset_max_ziplist_entries = REDIS_ZSET_MAX_ZIPLIST_ENTRIES;
+    server.zset_max_ziplist_value = REDIS_ZSET_MAX_ZIPLIST_VALUE;
+    server.hash_max_ziplist_entries = REDIS_HASH_MAX_ZIPLIST_ENTRIES;
+    server.hash_max_ziplist_value = REDIS_HASH_MAX_ZIPLIST_VALUE;
+    server.hll_sparse_max_bytes = HLL_SPARSE_MAX_BYTES;
+    server.keyspace_dict_layout = DICT_LAYOUT_CHAINED;
+    server.set_dict_layout = DICT_LAYOUT_CHAINED;
+    server.expire_index = REDIS_EXPIRE_INDEX_SAMPLE;
+    server.maxmemory = 0;
+    server.maxmemory_policy = REDIS_MAXMEMORY_NO_EVICTION;
+    server.maxmemory_samples = REDIS_MAXMEMORY_SAMPLES;
+    server.lazyfree_server_del = 1;
+    /* Output buffer limits: hard, soft, soft seconds */
+    server.client_obuf_limits[REDIS_CLIENT_LIMIT_CLASS_NORMAL].hard_limit_bytes = 0;
+    server.client_obuf_limits[REDIS_CLIENT_LIMIT_CLASS_NORMAL].soft_limit_bytes = 0;
+    server.client_obuf_limits[REDIS_CLIENT_LIMIT_CLASS_NORMAL].soft_limit_seconds = 0;
+    server.client_obuf_limits[REDIS_CLIENT_LIMIT_CLASS_SLAVE].hard_limit_bytes = 1024*1024*256;
+    server.client_obuf_limits[REDIS_CLIENT_LIMIT_CLASS_SLAVE].soft_limit_bytes = 1024*1024*64;
+    server.client_obuf_limits[REDIS_CLIENT_LIMIT_CLASS_SLAVE].soft_limit_seconds = 60;
+    server.client_obuf_limits[REDIS_CLIENT_LIMIT_CLASS_MONITOR].hard_limit_bytes = 1024*1024*32;
+    server.client_obuf_limits[REDIS_CLIENT_LIMIT_CLASS_MONITOR].soft_limit_bytes = 1024*1024*8;
+    server.client_obuf_limits[REDIS_CLIENT_LIMIT_CLASS_MONITOR].soft_limit_seconds = 60;
     ResetServerSaveParams();
 
     appendServerSaveParams(60*60,1);  /* save after 1 hour and 1 change */
@@ -122,27 +148,247 @@ void initServerConfig() {
     server.replstate = REDIS_REPL_NONE;
 }
 
-/* Empty the whole database */
-long long emptyDb() {
+/* server.lruclock以REDIS_LRU_CLOCK_RESOLUTION秒为单位, 24位约194天后回绕 */
+void updateLRUClock(void) {
+    server.lruclock = (server.unixtime/REDIS_LRU_CLOCK_RESOLUTION) &
+                      REDIS_LRU_CLOCK_MAX;
+}
+
+/* 当前的UNIX时间, 单位微秒 */
+long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+/* 当前的UNIX时间, 单位毫秒 */
+long long mstime(void) {
+    return ustime()/1000;
+}
+
+/* 单调时钟, 单位微秒: 只用来计算时间间隔, 不受系统时间调整的影响 */
+long long getMonotonicUs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ((long long)ts.tv_sec)*1000000+ts.tv_nsec/1000;
+}
+
+/* Take the time once per event loop iteration (and in the crons): the
+ * commands, the expires and the client timeouts read these fields instead
+ * of asking the kernel every time. The cached time can only be behind the
+ * real one, so keys are never expired early. */
+void updateCachedTime(void) {
+    server.mstime = mstime();
+    server.unixtime = server.mstime/1000;
+    server.monotonic = getMonotonicUs();
+}
+
+/* Given an object returns the number of seconds since it was last
+ * accessed, using the approximated LRU clock */
+unsigned long estimateObjectIdleTime(robj *o) {
+    if (server.lruclock >= o->lru) {
+        return (server.lruclock - o->lru) * REDIS_LRU_CLOCK_RESOLUTION;
+    } else {
+        /* The clock wrapped around */
+        return ((REDIS_LRU_CLOCK_MAX - o->lru) + server.lruclock) *
+                    REDIS_LRU_CLOCK_RESOLUTION;
+    }
+}
+
+/* ----------------------------- LFU access clock ----------------------------
+ *
+ * With an LFU maxmemory policy the 24 bits of obj->lru are split in two:
+ *
+ *      16 bits      8 bits
+ * +----------------+--------+
+ * + Last decr time | LOG_C  |
+ * +----------------+--------+
+ *
+ * LOG_C is a logarithmic access counter: the more accesses the less likely
+ * it is incremented, so that 255 means about a million hits. It starts at
+ * REDIS_LFU_INIT_VAL so new keys get a chance to be accessed before being
+ * evicted, and is decremented by one every REDIS_LFU_DECAY_TIME minutes the
+ * object stays idle, so keys that were hot long ago can be evicted too. */
+
+/* Time in minutes, only the 16 least significant bits */
+unsigned long LFUGetTimeInMinutes(void) {
+    return (server.unixtime/60) & 65535;
+}
+
+/* Minutes elapsed since 'ldt', handling the wrap around of the 16 bits */
+static unsigned long LFUTimeElapsed(unsigned long ldt) {
+    unsigned long now = LFUGetTimeInMinutes();
+
+    if (now >= ldt) return now-ldt;
+    return 65535-ldt+now;
+}
+
+/* Increment the counter with a probability of 1/((counter-init)*factor+1) */
+static unsigned long LFULogIncr(unsigned long counter) {
+    double r, p, baseval;
+
+    if (counter == 255) return 255;
+    r = (double)rand()/RAND_MAX;
+    baseval = counter > REDIS_LFU_INIT_VAL ? counter-REDIS_LFU_INIT_VAL : 0;
+    p = 1.0/(baseval*REDIS_LFU_LOG_FACTOR+1);
+    if (r < p) counter++;
+    return counter;
+}
+
+/* The counter of 'o' with the decay of the idle time applied. The object
+ * is not modified: only an access stores the new value. */
+unsigned long LFUDecrAndReturn(robj *o) {
+    unsigned long ldt = o->lru >> 8, counter = o->lru & 255;
+    unsigned long periods = LFUTimeElapsed(ldt)/REDIS_LFU_DECAY_TIME;
+
+    return periods > counter ? 0 : counter-periods;
+}
+
+/* Access clock of a new object */
+unsigned int objectAccessInit(void) {
+    if (server.maxmemory_policy & REDIS_MAXMEMORY_FLAG_LFU)
+        return (LFUGetTimeInMinutes()<<8) | REDIS_LFU_INIT_VAL;
+    return server.lruclock;
+}
+
+/* Record an access to 'o' for the maxmemory policy */
+void objectTouch(robj *o) {
+    if (server.maxmemory_policy & REDIS_MAXMEMORY_FLAG_LFU) {
+        unsigned long counter = LFULogIncr(LFUDecrAndReturn(o));
+
+        o->lru = (LFUGetTimeInMinutes()<<8) | counter;
+    } else {
+        o->lru = server.lruclock;
+    }
+}
+
+/* Empty the whole database, with 'async' the old keyspaces are released by
+ * the bio thread */
+long long emptyDb(int async) {
     int j;
     long long removed = 0;
 
     for (j = 0; j < server.dbnum; j++) {
         removed += dictSize(server.db[j].dict);
+        if (async) {
+            emptyDbAsync(server.db+j);
+            continue;
+        }
         dictEmpty(server.db[j].dict);
         dictEmpty(server.db[j].expires);
+        if (server.db[j].wheel) wheelEmpty(server.db[j].wheel);
     }
     return removed;
 }
 
+/* Convert a string representing an amount of memory into the number of
+ * bytes: "1k" is 1000, "1kb" is 1024, and so on for m/mb and g/gb.
+ * On parsing error *err is set to 1, otherwise to 0. */
+long long memtoll(const char *p, int *err) {
+    const char *u;
+    char buf[128];
+    long mul; /* unit multiplier */
+    long long val;
+    unsigned int digits;
+
+    if (err) *err = 0;
+    /* Search the first non digit character. */
+    u = p;
+    if (*u == '-') u++;
+    while(*u && isdigit(*u)) u++;
+    if (*u == '\0' || !strcasecmp(u,"b")) {
+        mul = 1;
+    } else if (!strcasecmp(u,"k")) {
+        mul = 1000;
+    } else if (!strcasecmp(u,"kb")) {
+        mul = 1024;
+    } else if (!strcasecmp(u,"m")) {
+        mul = 1000*1000;
+    } else if (!strcasecmp(u,"mb")) {
+        mul = 1024*1024;
+    } else if (!strcasecmp(u,"g")) {
+        mul = 1000L*1000*1000;
+    } else if (!strcasecmp(u,"gb")) {
+        mul = 1024L*1024*1024;
+    } else {
+        if (err) *err = 1;
+        mul = 1;
+    }
+    digits = u-p;
+    if (digits >= sizeof(buf)) {
+        if (err) *err = 1;
+        return LLONG_MAX;
+    }
+    memcpy(buf,p,digits);
+    buf[digits] = '\0';
+    val = strtoll(buf,NULL,10);
+    return val*mul;
+}
+
 int yesnotoi(char *s) {
     if (!strcasecmp(s,"yes")) return 1;
     else if (!strcasecmp(s,"no")) return 0;
     else return -1;
 }
 
+/* Fill 'p' with 'len' random bytes from /dev/urandom. If it is not
+ * available fall back to random() seeded with the time and the pid:
+ * weaker, but still different at every start. */
+void getRandomBytes(unsigned char *p, size_t len) {
+    FILE *fp = fopen("/dev/urandom","r");
+    size_t j;
+
+    if (fp && fread(p,len,1,fp) == 1) {
+        fclose(fp);
+        return;
+    }
+    if (fp) fclose(fp);
+    {
+        struct timeval tv;
+
+        gettimeofday(&tv,NULL);
+        srandom(tv.tv_sec ^ tv.tv_usec ^ (getpid() << 16));
+        for (j = 0; j < len; j++) p[j] = (unsigned char)random();
+    }
+}
+
 /* I agree, this is a very rudimental(基本的) way to load a configuration...
    will improve later if the config gets more complex */
+static struct {
+    const char *name;
+    int policy;
+} maxmemoryPolicies[] = {
+    {"noeviction", REDIS_MAXMEMORY_NO_EVICTION},
+    {"allkeys-lru", REDIS_MAXMEMORY_ALLKEYS_LRU},
+    {"volatile-lru", REDIS_MAXMEMORY_VOLATILE_LRU},
+    {"allkeys-lfu", REDIS_MAXMEMORY_ALLKEYS_LFU},
+    {"volatile-ttl", REDIS_MAXMEMORY_VOLATILE_TTL},
+    {"allkeys-random", REDIS_MAXMEMORY_ALLKEYS_RANDOM},
+    {"random", REDIS_MAXMEMORY_ALLKEYS_RANDOM},
+    {NULL, 0}
+};
+
+/* REDIS_MAXMEMORY_* policy from its configuration name, -1 if unknown */
+int maxmemoryPolicyFromName(const char *name) {
+    int j;
+
+    for (j = 0; maxmemoryPolicies[j].name; j++)
+        if (!strcasecmp(name,maxmemoryPolicies[j].name))
+            return maxmemoryPolicies[j].policy;
+    return -1;
+}
+
+const char *maxmemoryPolicyName(int policy) {
+    int j;
+
+    for (j = 0; maxmemoryPolicies[j].name; j++)
+        if (maxmemoryPolicies[j].policy == policy)
+            return maxmemoryPolicies[j].name;
+    return "unknown";
+}
+
 void loadServerConfig(char *filename) {
     FILE *fp = fopen(filename,"r");
     char buf[REDIS_CONFIGLINE_MAX+1], *err = NULL;
@@ -232,6 +478,96 @@ void loadServerConfig(char *filename) {
             }
         } else if (!strcasecmp(argv[0],"maxclients") && argc == 2) {
             server.maxclients = atoi(argv[1]);
+        } else if (!strcasecmp(argv[0],"list-max-ziplist-entries") && argc == 2) {
+            server.list_max_ziplist_entries = memtoll(argv[1],NULL);
+        } else if (!strcasecmp(argv[0],"list-max-ziplist-value") && argc == 2) {
+            server.list_max_ziplist_value = memtoll(argv[1],NULL);
+        } else if (!strcasecmp(argv[0],"set-max-intset-entries") && argc == 2) {
+            server.set_max_intset_entries = memtoll(argv[1],NULL);
+        } else if (!strcasecmp(argv[0],"zset-max-ziplist-entries") && argc == 2) {
+            server.zset_max_ziplist_entries = memtoll(argv[1],NULL);
+        } else if (!strcasecmp(argv[0],"zset-max-ziplist-value") && argc == 2) {
+            server.zset_max_ziplist_value = memtoll(argv[1],NULL);
+        } else if (!strcasecmp(argv[0],"hash-max-ziplist-entries") && argc == 2) {
+            server.hash_max_ziplist_entries = memtoll(argv[1],NULL);
+        } else if (!strcasecmp(argv[0],"hash-max-ziplist-value") && argc == 2) {
+            server.hash_max_ziplist_value = memtoll(argv[1],NULL);
+        } else if (!strcasecmp(argv[0],"hll-sparse-max-bytes") && argc == 2) {
+            server.hll_sparse_max_bytes = memtoll(argv[1],NULL);
+        } else if (!strcasecmp(argv[0],"sds-max-prealloc") && argc == 2) {
+            sdsSetMaxPrealloc(memtoll(argv[1],NULL));
+        } else if ((!strcasecmp(argv[0],"keyspace-dict-layout") ||
+                    !strcasecmp(argv[0],"set-dict-layout")) && argc == 2) {
+            int layout;
+
+            if (!strcasecmp(argv[1],"chained")) layout = DICT_LAYOUT_CHAINED;
+            else if (!strcasecmp(argv[1],"open")) layout = DICT_LAYOUT_OPEN;
+            else {
+                err = "Invalid dict layout. Must be one of chained, open";
+                goto loaderr;
+            }
+            if (argv[0][0] == 'k')
+                server.keyspace_dict_layout = layout;
+            else
+                server.set_dict_layout = layout;
+        } else if (!strcasecmp(argv[0],"expire-index") && argc == 2) {
+            if (!strcasecmp(argv[1],"sample")) {
+                server.expire_index = REDIS_EXPIRE_INDEX_SAMPLE;
+            } else if (!strcasecmp(argv[1],"wheel")) {
+                server.expire_index = REDIS_EXPIRE_INDEX_WHEEL;
+            } else {
+                err = "Invalid expire index. Must be one of sample, wheel";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"maxmemory") && argc == 2) {
+            int merr;
+
+            server.maxmemory = memtoll(argv[1],&merr);
+            if (merr) {
+                err = "Invalid maxmemory value"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"maxmemory-policy") && argc == 2) {
+            if ((server.maxmemory_policy =
+                 maxmemoryPolicyFromName(argv[1])) == -1)
+            {
+                err = "Invalid maxmemory policy. Must be one of noeviction, "
+                      "allkeys-lru, volatile-lru, allkeys-lfu, volatile-ttl, "
+                      "allkeys-random";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"maxmemory-samples") && argc == 2) {
+            server.maxmemory_samples = atoi(argv[1]);
+            if (server.maxmemory_samples <= 0) {
+                err = "maxmemory-samples must be 1 or greater"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"client-output-buffer-limit") &&
+                   argc == 5)
+        {
+            int class, soft_seconds, err1, err2;
+            long long hard, soft;
+
+            if (!strcasecmp(argv[1],"normal"))
+                class = REDIS_CLIENT_LIMIT_CLASS_NORMAL;
+            else if (!strcasecmp(argv[1],"slave"))
+                class = REDIS_CLIENT_LIMIT_CLASS_SLAVE;
+            else if (!strcasecmp(argv[1],"monitor"))
+                class = REDIS_CLIENT_LIMIT_CLASS_MONITOR;
+            else {
+                err = "Invalid client class specified in "
+                      "client-output-buffer-limit directive";
+                goto loaderr;
+            }
+            hard = memtoll(argv[2],&err1);
+            soft = memtoll(argv[3],&err2);
+            soft_seconds = atoi(argv[4]);
+            if (err1 || err2 || hard < 0 || soft < 0 || soft_seconds < 0) {
+                err = "Error in hard, soft or soft_seconds setting in "
+                      "client-output-buffer-limit directive";
+                goto loaderr;
+            }
+            server.client_obuf_limits[class].hard_limit_bytes = hard;
+            server.client_obuf_limits[class].soft_limit_bytes = soft;
+            server.client_obuf_limits[class].soft_limit_seconds = soft_seconds;
         } else if (!strcasecmp(argv[0],"slaveof") && argc == 3) {
             server.masterhost = sdsnew(argv[1]);
             server.masterport = atoi(argv[2]);
@@ -240,6 +576,11 @@ void loadServerConfig(char *filename) {
             if ((server.glueoutputbuf = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"lazyfree-lazy-server-del") &&
+                   argc == 2) {
+            if ((server.lazyfree_server_del = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"shareobjects") && argc == 2) {
             if ((server.shareobjects = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
@@ -337,6 +678,7 @@ void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         if (c->sentlen == objlen) {
             listDelNode(c->reply,listFirst(c->reply));
             c->sentlen = 0;
+            c->reply_bytes -= objlen;
         }
     }
 	/* 中途出错了 */
@@ -350,7 +692,7 @@ void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
             return;
         }
     }
-    if (totwritten > 0) c->lastinteraction = time(NULL);
+    if (totwritten > 0) c->lastinteraction = server.unixtime;
     if (listLength(c->reply) == 0) {
         c->sentlen = 0;
         aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);	/* 没有要发送的数据了，关闭fd的WRITABLE事件 */
@@ -381,61 +723,291 @@ int selectDb(redisClient *c, int id) {
 /* ======================= Redis objects implementation ===================== */
 
 robj *createObject(int type, void *ptr) {
-    robj *o;
+    robj *o = slabAlloc(sizeof(*o));
 
-    if (listLength(server.objfreelist)) {
-        listNode *head = listFirst(server.objfreelist);
-        o = listNodeValue(head);
-        listDelNode(server.objfreelist,head);
-    } else {
-        o = zmalloc(sizeof(*o));
-    }
-	
     if (!o) oom("createObject");
     o->type = type;
+    o->encoding = REDIS_ENCODING_RAW;
+    o->lru = objectAccessInit();
     o->ptr = ptr;
     o->refcount = 1;
     return o;
 }
 
-robj *createStringObject(char *ptr, size_t len) {
+robj *createRawStringObject(char *ptr, size_t len) {
     return createObject(REDIS_STRING,sdsnewlen(ptr,len));
 }
 
-robj *createListObject(void) {
-    list *l = listCreate();
+/* 短字符串: robj, sds头和字符串内容放在同一块内存中,只需一次分配,读取时
+ * 也少一次cache miss. ptr仍然指向一个合法的sds,但它不能被修改或单独释放.
+ * 大小不固定,所以用zmalloc()而不是slabAlloc()分配 */
+robj *createEmbeddedStringObject(char *ptr, size_t len) {
+    robj *o = zmalloc(sizeof(robj)+sizeof(struct sdshdr8)+len+1);
+    struct sdshdr8 *sh = (void*)(o+1);
+
+    if (!o) oom("createEmbeddedStringObject");
+    o->type = REDIS_STRING;
+    o->encoding = REDIS_ENCODING_EMBSTR;
+    o->lru = objectAccessInit();
+    o->ptr = sh->buf;
+    o->refcount = 1;
+    sh->len = len;
+    sh->alloc = len;
+    sh->flags = SDS_TYPE_8;
+    if (ptr) memcpy(sh->buf,ptr,len);
+    else memset(sh->buf,0,len);
+    sh->buf[len] = '\0';
+    return o;
+}
+
+robj *createStringObject(char *ptr, size_t len) {
+    if (len <= REDIS_EMBSTR_SIZE_LIMIT)
+        return createEmbeddedStringObject(ptr,len);
+    else
+        return createRawStringObject(ptr,len);
+}
+
+/* Create a string object taking ownership of 's'. Short strings are
+ * copied into an embedded string object and 's' is freed. */
+robj *createStringObjectFromSds(sds s) {
+    robj *o;
+
+    if (sdslen(s) > REDIS_EMBSTR_SIZE_LIMIT)
+        return createObject(REDIS_STRING,s);
+    o = createEmbeddedStringObject(s,sdslen(s));
+    sdsfree(s);
+    return o;
+}
 
-    if (!l) oom("listCreate");
-    listSetFreeMethod(l,decrRefCount);
-    return createObject(REDIS_LIST,l);
+robj *createStringObjectFromLongLong(long long value) {
+    char buf[32];
+    int len = snprintf(buf,sizeof(buf),"%lld",value);
+
+    return createStringObject(buf,len);
+}
+
+/* 返回值为value的INT编码字符串对象, 0..REDIS_SHARED_INTEGERS-1范围内的
+ * 值直接返回共享对象(引用计数已增加). 放不进long的值只能保存为字符串 */
+robj *createIntegerObject(long long value) {
+    robj *o;
+
+    if (value >= 0 && value < REDIS_SHARED_INTEGERS) {
+        incrRefCount(shared.integers[value]);
+        return shared.integers[value];
+    }
+    if (value < LONG_MIN || value > LONG_MAX)
+        return createStringObjectFromLongLong(value);
+    o = createObject(REDIS_STRING,(void*)((long)value));
+    o->encoding = REDIS_ENCODING_INT;
+    return o;
+}
+
+/* Try to encode a string object holding a number as an INT object in
+ * order to save space. The reference to 'o' is consumed: the returned
+ * object may be a different one (a shared integer for example). */
+robj *tryObjectEncoding(robj *o) {
+    long long value;
+
+    if (o->encoding == REDIS_ENCODING_INT) return o; /* already encoded */
+    /* It's not safe to encode shared objects: they may be referenced by
+     * the sharing pool or by other keys */
+    if (o->refcount > 1) return o;
+    if (isObjectRepresentableAsLongLong(o,&value) == REDIS_ERR ||
+        value < LONG_MIN || value > LONG_MAX)
+    {
+        /* Not a number: values don't grow, so at least don't keep the
+         * free space at the end of the string */
+        if (o->encoding == REDIS_ENCODING_RAW && sdsavail(o->ptr))
+            o->ptr = sdsRemoveFreeSpace(o->ptr);
+        return o;
+    }
+
+    if (o->encoding == REDIS_ENCODING_RAW &&
+        (value < 0 || value >= REDIS_SHARED_INTEGERS))
+    {
+        /* 复用对象本身,只释放sds */
+        sdsfree(o->ptr);
+        o->encoding = REDIS_ENCODING_INT;
+        o->ptr = (void*)((long)value);
+        return o;
+    }
+    decrRefCount(o);
+    return createIntegerObject(value);
+}
+
+/* 返回o的字符串形式(sds编码)的一个新引用,用完后需要decrRefCount */
+robj *getDecodedObject(robj *o) {
+    if (o->encoding != REDIS_ENCODING_INT) {
+        incrRefCount(o);
+        return o;
+    }
+    return createStringObjectFromLongLong((long)o->ptr);
+}
+
+/* 判断字符串对象是否恰好是一个long long的十进制表示("007","1 "之类的不算),
+ * 是则存入*llval并返回REDIS_OK */
+int isObjectRepresentableAsLongLong(robj *o, long long *llval) {
+    char *s, *eptr, buf[32];
+    size_t slen;
+    long long value;
+
+    if (o->encoding == REDIS_ENCODING_INT) {
+        if (llval) *llval = (long)o->ptr;
+        return REDIS_OK;
+    }
+    s = o->ptr;
+    slen = sdslen(s);
+    if (slen == 0 || slen >= sizeof(buf)) return REDIS_ERR;
+    errno = 0;
+    value = strtoll(s,&eptr,10);
+    if (eptr[0] != '\0' || errno == ERANGE) return REDIS_ERR;
+    snprintf(buf,sizeof(buf),"%lld",value);
+    if (strlen(buf) != slen || memcmp(buf,s,slen)) return REDIS_ERR;
+    if (llval) *llval = value;
+    return REDIS_OK;
+}
+
+/* 大的list由一串ziplist组成,每个ziplist最多list-max-ziplist-entries个元素 */
+robj *createQuicklistObject(void) {
+    quicklist *ql = quicklistCreate((int)server.list_max_ziplist_entries);
+    robj *o;
+
+    if (!ql) oom("quicklistCreate");
+    o = createObject(REDIS_LIST,ql);
+    o->encoding = REDIS_ENCODING_QUICKLIST;
+    return o;
+}
+
+/* 小的list使用ziplist编码,元素紧凑的存放在一块连续内存中 */
+robj *createZiplistObject(void) {
+    unsigned char *zl = ziplistNew();
+    robj *o = createObject(REDIS_LIST,zl);
+
+    o->encoding = REDIS_ENCODING_ZIPLIST;
+    return o;
 }
 
 static robj *createSetObject(void) {
-    dict *d = dictCreate(&setDictType,NULL);
+    dict *d = dictCreateLayout(&setDictType,NULL,server.set_dict_layout);
+    robj *o;
+
     if (!d) oom("dictCreate");
-    return createObject(REDIS_SET,d);
+    o = createObject(REDIS_SET,d);
+    o->encoding = REDIS_ENCODING_HT;
+    return o;
+}
+
+/* 只包含整数的小set使用intset编码,有序的整数数组 */
+robj *createIntsetObject(void) {
+    intset *is = intsetNew();
+    robj *o;
+
+    if (!is) oom("intsetNew");
+    o = createObject(REDIS_SET,is);
+    o->encoding = REDIS_ENCODING_INTSET;
+    return o;
+}
+
+robj *createZsetObject(void) {
+    zset *zs = zmalloc(sizeof(*zs));
+    robj *o;
+
+    if (!zs) oom("createZsetObject");
+    zs->dict = dictCreateLayout(&zsetDictType,NULL,server.set_dict_layout);
+    if (!zs->dict) oom("dictCreate");
+    zs->zsl = zslCreate();
+    o = createObject(REDIS_ZSET,zs);
+    o->encoding = REDIS_ENCODING_SKIPLIST;
+    return o;
+}
+
+/* 小的sorted set使用ziplist编码, member和score依次存放, 按score排序 */
+robj *createZsetZiplistObject(void) {
+    unsigned char *zl = ziplistNew();
+    robj *o;
+
+    if (!zl) oom("ziplistNew");
+    o = createObject(REDIS_ZSET,zl);
+    o->encoding = REDIS_ENCODING_ZIPLIST;
+    return o;
+}
+
+/* 小的hash使用ziplist编码, field和value依次存放 */
+robj *createHashObject(void) {
+    unsigned char *zl = ziplistNew();
+    robj *o;
+
+    if (!zl) oom("ziplistNew");
+    o = createObject(REDIS_HASH,zl);
+    o->encoding = REDIS_ENCODING_ZIPLIST;
+    return o;
 }
 
 static void freeStringObject(robj *o) {
-    sdsfree(o->ptr);
+    if (o->encoding == REDIS_ENCODING_RAW) sdsfree(o->ptr);
 }
 
 static void freeListObject(robj *o) {
-    listRelease((list*) o->ptr);
+    switch (o->encoding) {
+    case REDIS_ENCODING_QUICKLIST:
+        quicklistRelease((quicklist*) o->ptr);
+        break;
+    case REDIS_ENCODING_ZIPLIST:
+        zfree(o->ptr);
+        break;
+    default:
+        assert(0 != 0);
+    }
 }
 
 static void freeSetObject(robj *o) {
-    dictRelease((dict*) o->ptr);
+    switch (o->encoding) {
+    case REDIS_ENCODING_HT:
+        dictRelease((dict*) o->ptr);
+        break;
+    case REDIS_ENCODING_INTSET:
+        zfree(o->ptr);
+        break;
+    default:
+        assert(0 != 0);
+    }
+}
+
+static void freeZsetObject(robj *o) {
+    zset *zs;
+
+    switch (o->encoding) {
+    case REDIS_ENCODING_SKIPLIST:
+        zs = o->ptr;
+        dictRelease(zs->dict);
+        zslFree(zs->zsl);
+        zfree(zs);
+        break;
+    case REDIS_ENCODING_ZIPLIST:
+        zfree(o->ptr);
+        break;
+    default:
+        assert(0 != 0);
+    }
 }
 
 static void freeHashObject(robj *o) {
-    dictRelease((dict*) o->ptr);
+    switch (o->encoding) {
+    case REDIS_ENCODING_HT:
+        dictRelease((dict*) o->ptr);
+        break;
+    case REDIS_ENCODING_ZIPLIST:
+        zfree(o->ptr);
+        break;
+    default:
+        assert(0 != 0);
+    }
 }
 
 static void incrRefCount(robj *o) {
     o->refcount++;
 #ifdef DEBUG_REFCOUNT
-    if (o->type == REDIS_STRING)
+    if (o->type == REDIS_STRING && o->encoding != REDIS_ENCODING_INT)
         printf("Increment '%s'(%p), now is: %d\n",o->ptr,o,o->refcount);
 #endif
 }
@@ -444,22 +1016,26 @@ static void decrRefCount(void *obj) {
     robj *o = obj;
 
 #ifdef DEBUG_REFCOUNT
-    if (o->type == REDIS_STRING)
+    if (o->type == REDIS_STRING && o->encoding != REDIS_ENCODING_INT)
         printf("Decrement '%s'(%p), now is: %d\n",o->ptr,o,o->refcount-1);
 #endif
 
     if (--(o->refcount) == 0) {
+        if (o->encoding == REDIS_ENCODING_EMBSTR ||
+            o->encoding == REDIS_ENCODING_EMBKEY) {
+            /* The string lives in the same allocation */
+            zfree(o);
+            return;
+        }
         switch(o->type) {
         case REDIS_STRING: freeStringObject(o); break;
         case REDIS_LIST: freeListObject(o); break;
         case REDIS_SET: freeSetObject(o); break;
         case REDIS_HASH: freeHashObject(o); break;
+        case REDIS_ZSET: freeZsetObject(o); break;
         default: assert(0 != 0); break;
         }
-		
-        if (listLength(server.objfreelist) > REDIS_OBJFREELIST_MAX ||
-            !listAddNodeHead(server.objfreelist,o))
-            zfree(o);
+        slabFree(o);
     }
 }
 
@@ -483,6 +1059,13 @@ int sdsDictKeyCompare(void *privdata, const void *key1,
 	decrRefCount(val);
 }
 		
+void dictListDestructor(void *privdata, void *val)
+{
+    DICT_NOTUSED(privdata);
+
+    listRelease((list*)val);
+}
+
 int dictSdsKeyCompare(void *privdata, const void *key1,
 				const void *key2)
 {
@@ -496,6 +1079,8 @@ unsigned int dictSdsHash(const void *key) {
 }
 
 void createSharedObjects(void) {
+    int j;
+
     shared.crlf = createObject(REDIS_STRING,sdsnew("\r\n"));
     shared.ok = createObject(REDIS_STRING,sdsnew("+OK\r\n"));
     shared.err = createObject(REDIS_STRING,sdsnew("-ERR\r\n"));
@@ -530,56 +1115,180 @@ void createSharedObjects(void) {
     shared.select7 = createStringObject("select 7\r\n",10);
     shared.select8 = createStringObject("select 8\r\n",10);
     shared.select9 = createStringObject("select 9\r\n",10);
+    for (j = 0; j < REDIS_SHARED_INTEGERS; j++) {
+        shared.integers[j] = createObject(REDIS_STRING,(void*)((long)j));
+        shared.integers[j]->encoding = REDIS_ENCODING_INT;
+    }
+}
+
+/* Return the object to use as key in db->dict for 'key' (a new reference).
+ * Keyspace keys are a single allocation with the sds bytes right after
+ * the robj header (EMBSTR, shared as it is when 'key' already is one);
+ * volatile keys also keep their expire time between the two (EMBKEY), so
+ * the expire is read from the entry found by the main lookup. With
+ * expire-index wheel that's the wheel node linking the key in db->wheel. */
+robj *createKeyObject(robj *key, long long when) {
+    size_t len, extra = 0;
+    robj *o;
+
+    if (when == -1 && key->encoding == REDIS_ENCODING_EMBSTR) {
+        incrRefCount(key);
+        return key;
+    }
+    if (key->encoding == REDIS_ENCODING_INT) {
+        robj *dec = getDecodedObject(key);
+
+        o = createKeyObject(dec,when);
+        decrRefCount(dec);
+        return o;
+    }
+    if (when != -1) {
+        /* The wheel node starts with the expire time as well */
+        extra = (server.expire_index == REDIS_EXPIRE_INDEX_WHEEL) ?
+                sizeof(wheelNode) : sizeof(long long);
+    }
+    len = sdslen(key->ptr);
+    o = zmalloc(sizeof(robj)+extra+sdsEmbeddedSize(len));
+    if (!o) oom("createKeyObject");
+    o->type = REDIS_STRING;
+    o->encoding = extra ? REDIS_ENCODING_EMBKEY : REDIS_ENCODING_EMBSTR;
+    o->lru = objectAccessInit();
+    o->refcount = 1;
+    if (extra) {
+        *(long long*)(o+1) = when;
+        if (extra == sizeof(wheelNode)) keyGetWheelNode(o)->pprev = NULL;
+    }
+    o->ptr = sdsNewEmbedded((char*)(o+1)+extra,key->ptr,len);
+    return o;
+}
+
+/* Update the access time. Don't do it while a child is saving the DB:
+ * it would copy on write every page we touch. */
+static robj *touchEntryVal(dictEntry *de) {
+    robj *val = dictGetEntryVal(de);
+
+    if (!server.bgsaveinprogress) objectTouch(val);
+    return val;
 }
 
 robj *lookupKey(redisDb *db, robj *key) {
-    dictEntry *de = dictFind(db->dict,key);
-    return de ? dictGetEntryVal(de) : NULL;
+    dictEntry *de = objDictFind(db->dict,key);
+
+    return de ? touchEntryVal(de) : NULL;
 }
 
+/* Reads see a key as long as it is not expired: a single lookup, the
+ * expire time comes with the key */
 robj *lookupKeyRead(redisDb *db, robj *key) {
-    expireIfNeeded(db,key);
-    return lookupKey(db,key);
+    dictEntry *de = objDictFind(db->dict,key);
+    long long when;
+
+    if (!de) {
+        server.stat_keyspace_misses++;
+        return NULL;
+    }
+    when = keyGetExpire((robj*)dictGetEntryKey(de));
+    if (when != -1 && server.mstime > when) {
+        server.stat_expiredkeys++;
+        server.stat_keyspace_misses++;
+        deleteKey(db,key);
+        return NULL;
+    }
+    server.stat_keyspace_hits++;
+    return touchEntryVal(de);
+}
+
+/* Writes against volatile keys delete them first, see deleteIfVolatile().
+ * Returns the entry of the key, NULL if it does not exist (anymore). */
+dictEntry *lookupKeyWriteEntry(redisDb *db, robj *key) {
+    dictEntry *de = objDictFind(db->dict,key);
+
+    if (!de) return NULL;
+    if (keyGetExpire((robj*)dictGetEntryKey(de)) != -1) {
+        server.dirty++;
+        deleteKey(db,key);
+        return NULL;
+    }
+    touchEntryVal(de);
+    return de;
 }
 
 robj *lookupKeyWrite(redisDb *db, robj *key) {
-    deleteIfVolatile(db,key);
-    return lookupKey(db,key);
+    dictEntry *de = lookupKeyWriteEntry(db,key);
+
+    return de ? dictGetEntryVal(de) : NULL;
+}
+
+/* Add 'key' with value 'val' if it does not exist. The reference to 'val'
+ * passes to the keyspace, the key is copied or shared as needed. */
+int dbAdd(redisDb *db, robj *key, robj *val) {
+    unsigned int h = objDictHashKey(db->dict,key);
+
+    if (objDictFindHashed(db->dict,key,h)) return DICT_ERR;
+    dictAddHashed(db->dict,createKeyObject(key,-1),val,h);
+    return DICT_OK;
+}
+
+/* Set 'key' to 'val' (reference passed as with dbAdd) whether it exists or
+ * not, clearing its expire. One hash lookup unless the key is volatile.
+ * Returns 1 if the key was added, 0 if overwritten. */
+int dbSetKey(redisDb *db, robj *key, robj *val) {
+    unsigned int h = objDictHashKey(db->dict,key);
+    dictEntry *de = objDictFindHashed(db->dict,key,h);
+    robj *old;
+
+    if (de == NULL) {
+        dictAddHashed(db->dict,createKeyObject(key,-1),val,h);
+        return 1;
+    }
+    if (keyGetExpire((robj*)dictGetEntryKey(de)) != -1)
+        removeExpireEntry(db,de);
+    old = dictGetEntryVal(de);
+    dictGetEntryVal(de) = val;
+    decrRefCountLazy(old);
+    return 0;
 }
 
 /* 如果key过期则删除 */
 int expireIfNeeded(redisDb *db, robj *key) {
-    time_t when;
+    long long when;
     dictEntry *de;
 
     /* No expire? return ASAP */
-    if (dictSize(db->expires) == 0 ||
-       (de = dictFind(db->expires,key)) == NULL) return 0;
+    if (dbVolatileKeys(db) == 0 ||
+       (de = objDictFind(db->dict,key)) == NULL) return 0;
 
-    /* Lookup the expire */
-    when = (time_t) dictGetEntryVal(de);
-    if (time(NULL) <= when) return 0;
+    /* The expire lives in the key object */
+    when = keyGetExpire((robj*)dictGetEntryKey(de));
+    if (when == -1 || server.mstime <= when) return 0;
 
     /* Delete the key */
-    dictDelete(db->expires,key);
-    return dictDelete(db->dict,key) == DICT_OK;
+    server.stat_expiredkeys++;
+    return deleteKey(db,key);
 }
 
 int deleteIfVolatile(redisDb *db, robj *key) {
     dictEntry *de;
 
     /* No expire? return ASAP */
-    if (dictSize(db->expires) == 0 ||
-       (de = dictFind(db->expires,key)) == NULL) return 0;
+    if (dbVolatileKeys(db) == 0 ||
+       (de = objDictFind(db->dict,key)) == NULL ||
+       keyGetExpire((robj*)dictGetEntryKey(de)) == -1) return 0;
 
     /* Delete the key */
     server.dirty++;
-    dictDelete(db->expires,key);
-    return dictDelete(db->dict,key) == DICT_OK;
+    return deleteKey(db,key);
 }
 
 int deleteKey(redisDb *db, robj *key) {
-    int retval;
+    return deleteKeyGeneric(db,key,1);
+}
+
+/* With 'lazy' a big value may be left to the bio thread, see
+ * decrRefCountLazy() */
+int deleteKeyGeneric(redisDb *db, robj *key, int lazy) {
+    unsigned int h;
+    dictEntry *de;
 
     /* We need to protect key from destruction: after the first dictDelete()
      * it may happen that 'key' is no longer valid if we don't increment
@@ -587,14 +1296,24 @@ int deleteKey(redisDb *db, robj *key) {
      * from the hash table with dictRandomKey() or dict iterators 
      * 这里的注释不是太明白 */
     incrRefCount(key);
-	
-    if (dictSize(db->expires))
-		dictDelete(db->expires,key);
-	
-    retval = dictDelete(db->dict,key);
+    h = objDictHashKey(db->dict,key);
+    de = objDictFindHashed(db->dict,key,h);
+    if (de) {
+        /* Volatile keys are also in the expire index */
+        robj *dkey = dictGetEntryKey(de), *val = dictGetEntryVal(de);
+
+        if (keyGetExpire(dkey) != -1)
+            expireIndexRemove(db,dkey);
+        if (lazy) {
+            dictDeleteEntry(db->dict,de,h,1);
+            decrRefCount(dkey);
+            decrRefCountLazy(val);
+        } else {
+            dictDeleteEntry(db->dict,de,h,0);
+        }
+    }
     decrRefCount(key);
-
-    return retval == DICT_OK;
+    return de != NULL;
 }
 
 
@@ -8,8 +8,25 @@ struct saveparam {
 
 int expireIfNeeded(redisDb *db, robj *key);
 int removeExpire(redisDb *db, robj *key);
+void removeExpireEntry(redisDb *db, dictEntry *de);
+void expireIndexAdd(redisDb *db, robj *key);
+void expireIndexRemove(redisDb *db, robj *key);
 robj *createStringObject(char *ptr, size_t len);
+robj *createRawStringObject(char *ptr, size_t len);
+robj *createEmbeddedStringObject(char *ptr, size_t len);
+robj *createStringObjectFromSds(sds s);
+robj *createStringObjectFromLongLong(long long value);
+robj *createIntegerObject(long long value);
+robj *tryObjectEncoding(robj *o);
+robj *getDecodedObject(robj *o);
+int isObjectRepresentableAsLongLong(robj *o, long long *llval);
 robj *createObject(int type, void *ptr);
+robj *createQuicklistObject(void);
+robj *createZiplistObject(void);
+robj *createIntsetObject(void);
+robj *createZsetObject(void);
+robj *createZsetZiplistObject(void);
+robj *createHashObject(void);
 void freeStringObject(robj *o);
 void freeListObject(robj *o);
 void freeSetObject(robj *o);
@@ -22,8 +39,24 @@ void tryResizeHashTables(void);
 void appendServerSaveParams(time_t seconds, int changes);
 void ResetServerSaveParams();
 void initServerConfig();
-long long emptyDb();
+void updateLRUClock(void);
+long long ustime(void);
+long long mstime(void);
+long long getMonotonicUs(void);
+void updateCachedTime(void);
+unsigned long estimateObjectIdleTime(robj *o);
+unsigned long LFUGetTimeInMinutes(void);
+unsigned long LFUDecrAndReturn(robj *o);
+unsigned int objectAccessInit(void);
+void objectTouch(robj *o);
+long long emptyDb(int async);
+void emptyDbAsync(redisDb *db);
+void decrRefCountLazy(robj *o);
+long long memtoll(const char *p, int *err);
 int yesnotoi(char *s);
+int maxmemoryPolicyFromName(const char *name);
+const char *maxmemoryPolicyName(int policy);
+void getRandomBytes(unsigned char *p, size_t len);
 void loadServerConfig(char *filename);
 void glueReplyBuffersIfNeeded(redisClient *c);
 void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask);
@@ -34,16 +67,42 @@ robj *createObject(int type, void *ptr)
 int sdsDictKeyCompare(void *privdata, const void *key1,
 			const void *key2);
 void dictRedisObjectDestructor(void *privdata, void *val);
+void dictListDestructor(void *privdata, void *val);
 int dictSdsKeyCompare(void *privdata, const void *key1,
 				const void *key2);
 unsigned int dictSdsHash(const void *key);
+
+/* The keyspace, expires and set dicts (hashDictType, setDictType) all use
+ * robj keys holding an sds: objDictFind(), objDictAdd(), objDictReplace()
+ * and objDictDelete() do what the dict.c API does for them, with the hash
+ * (dictSdsHash) and the compare (dictSdsKeyCompare) expanded inline. */
+#define objDictHashKey(ht,key) \
+    ((unsigned int)_dictSipHash((const unsigned char*)((const robj*)(key))->ptr, \
+        sdslen((sds)((const robj*)(key))->ptr), dict_hash_function_seed))
+
+static inline int objDictCompareKeys(dict *ht, const void *key1,
+        const void *key2)
+{
+    sds s1 = ((const robj*)key1)->ptr, s2 = ((const robj*)key2)->ptr;
+    size_t l1 = sdslen(s1);
+
+    DICT_NOTUSED(ht);
+    return l1 == sdslen(s2) && memcmp(s1, s2, l1) == 0;
+}
+
+DICT_SPECIALIZE(objDict, objDictHashKey, objDictCompareKeys)
 void createSharedObjects(void);
 robj *lookupKey(redisDb *db, robj *key);
 robj *lookupKeyRead(redisDb *db, robj *key);
 robj *lookupKeyWrite(redisDb *db, robj *key);
+dictEntry *lookupKeyWriteEntry(redisDb *db, robj *key);
+robj *createKeyObject(robj *key, long long when);
+int dbAdd(redisDb *db, robj *key, robj *val);
+int dbSetKey(redisDb *db, robj *key, robj *val);
 int expireIfNeeded(redisDb *db, robj *key);
 int deleteIfVolatile(redisDb *db, robj *key);
 int deleteKey(redisDb *db, robj *key);
+int deleteKeyGeneric(redisDb *db, robj *key, int lazy);
 
 
 
@@ -295,3 +295,19 @@ int anetAccept(char *err, int serversock, char *ip, int *port)
     if (port) *port = ntohs(sa.sin_port);
     return fd;
 }
+
+/* 获取已连接socket的对端地址,失败时ip为"?",port为0 */
+int anetPeerToString(int fd, char *ip, int *port)
+{
+    struct sockaddr_in sa;
+    unsigned int salen = sizeof(sa);
+
+    if (getpeername(fd,(struct sockaddr*)&sa,&salen) == -1) {
+        if (port) *port = 0;
+        if (ip) strcpy(ip,"?");
+        return ANET_ERR;
+    }
+    if (ip) strcpy(ip,inet_ntoa(sa.sin_addr));
+    if (port) *port = ntohs(sa.sin_port);
+    return ANET_OK;
+}
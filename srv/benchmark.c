@@ -38,6 +38,7 @@
 #include <sys/time.h>
 #include <signal.h>
 #include <assert.h>
+#include <math.h>
 
 #include "ae.h"
 #include "anet.h"
@@ -66,6 +67,12 @@ static struct config {
     int datasize;
     int randomkeys;
     int randomkeys_keyspacelen;
+    double zipf;        /* Zipf exponent of the random keys, 0 = uniform */
+    double *zipfcdf;    /* cumulative distribution of the key popularity */
+    int cache;          /* run only the GET/SET cache workload */
+    sds cachedata;      /* value of the cache SETs, with the final CRLF */
+    long long hits;     /* cache workload GETs that found the key */
+    long long misses;
     aeEventLoop *el;
     char *hostip;
     int hostport;
@@ -76,6 +83,7 @@ static struct config {
     list *clients;
     int quiet;
     int loop;
+    int bigvalues;
 } config;
 
 typedef struct _client {
@@ -87,6 +95,8 @@ typedef struct _client {
     unsigned int written;        /* bytes of 'obuf' already written */
     int replytype;
     long long start;    /* start time in milliseconds */
+    long key;           /* cache workload: key of the last GET */
+    int miss;           /* cache workload: the last GET was a miss */
 } *client;
 
 /* Prototypes */
@@ -142,6 +152,37 @@ static void resetClient(client c) {
     createMissingClients(c);
 }
 
+/* Zipfian popularity of the keys: the probability of key k (from 0) is
+ * proportional to 1/(k+1)^zipf. Real workloads look like this, a few hot
+ * keys and a long tail, which is what the maxmemory policies rely on. */
+static void initZipf(void) {
+    long n = config.randomkeys_keyspacelen, j;
+    double sum = 0;
+
+    config.zipfcdf = zmalloc(sizeof(double)*n);
+    for (j = 0; j < n; j++) {
+        sum += 1.0/pow(j+1,config.zipf);
+        config.zipfcdf[j] = sum;
+    }
+    for (j = 0; j < n; j++) config.zipfcdf[j] /= sum;
+}
+
+/* A random key between 0 and keyspacelen-1, uniform or Zipfian with -z */
+static long randomKeyIndex(void) {
+    long lo = 0, hi = config.randomkeys_keyspacelen-1;
+    double u;
+
+    if (!config.zipfcdf) return random() % config.randomkeys_keyspacelen;
+    u = (double)random()/((double)RAND_MAX+1);
+    while (lo < hi) {
+        long mid = (lo+hi)/2;
+
+        if (config.zipfcdf[mid] < u) lo = mid+1;
+        else hi = mid;
+    }
+    return lo;
+}
+
 static void randomizeClientKey(client c) {
     char *p;
     char buf[32];
@@ -150,13 +191,38 @@ static void randomizeClientKey(client c) {
     p = strstr(c->obuf, "_rand");
     if (!p) return;
     p += 5;
-    r = random() % config.randomkeys_keyspacelen;
+    r = randomKeyIndex();
     sprintf(buf,"%ld",r);
     memcpy(p,buf,strlen(buf));
 }
 
+/* Cache workload: GET a random key, and SET it after a miss like an
+ * application filling its cache from the backing store would. The hit
+ * ratio shows how good the server maxmemory policy is at keeping the
+ * popular keys. */
+static void prepareCacheQuery(client c) {
+    sdsfree(c->obuf);
+    if (c->miss) {
+        c->obuf = sdscatprintf(sdsempty(),"SET cache:%012ld %d\r\n",
+            c->key,config.datasize);
+        c->obuf = sdscatlen(c->obuf,config.cachedata,
+            sdslen(config.cachedata));
+        c->replytype = REPLY_RETCODE;
+        c->miss = 0;
+    } else {
+        c->key = randomKeyIndex();
+        c->obuf = sdscatprintf(sdsempty(),"GET cache:%012ld\r\n",c->key);
+        c->replytype = REPLY_BULK;
+    }
+}
+
 static void clientDone(client c) {
     long long latency;
+
+    if (config.cache && c->replytype == REPLY_BULK) {
+        if (c->miss) config.misses++;
+        else config.hits++;
+    }
     config.donerequests ++;
     latency = mstime() - c->start;
     if (latency > MAX_LATENCY) latency = MAX_LATENCY;
@@ -168,8 +234,9 @@ static void clientDone(client c) {
         return;
     }
     if (config.keepalive) {
+        if (config.cache) prepareCacheQuery(c);
         resetClient(c);
-        if (config.randomkeys) randomizeClientKey(c);
+        if (config.randomkeys && !config.cache) randomizeClientKey(c);
     } else {
         config.liveclients--;
         createMissingClients(c);
@@ -211,6 +278,7 @@ static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask)
                 *(p-1) = '\0';
                 c->readlen = atoi(c->ibuf+1)+2;
                 if (c->readlen-2 == -1) {
+                    c->miss = 1;
                     clientDone(c);
                     return;
                 }
@@ -243,6 +311,8 @@ static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask)
         int len = sdslen(c->obuf) - c->written;
         int nwritten = write(c->fd, ptr, len);
         if (nwritten == -1) {
+            /* Big payloads don't fit the socket buffer in a single write */
+            if (errno == EAGAIN) return;
             fprintf(stderr, "Writing to socket: %s\n", strerror(errno));
             freeClient(c);
             return;
@@ -271,6 +341,8 @@ static client createClient(void) {
     c->ibuf = sdsempty();
     c->readlen = 0;
     c->written = 0;
+    c->key = 0;
+    c->miss = 0;
     c->state = CLIENT_CONNECTING;
     aeCreateFileEvent(config.el, c->fd, AE_WRITABLE, writeHandler, c, NULL);
     config.liveclients++;
@@ -284,6 +356,7 @@ static void createMissingClients(client c) {
         if (!new) continue;
         sdsfree(new->obuf);
         new->obuf = sdsdup(c->obuf);
+        new->key = c->key;
         if (config.randomkeys) randomizeClientKey(c);
         new->replytype = c->replytype;
         if (c->replytype == REPLY_BULK)
@@ -330,6 +403,41 @@ static void endBenchmark(char *title) {
     freeAllClients();
 }
 
+/* SET with a big value. The number of requests and of parallel clients is
+ * reduced for big payloads so that the benchmark moves at most about 1GB
+ * of data and every client buffer stays in memory at the same time. */
+static void benchmarkBigSet(char *title, int size) {
+    int orignumclients = config.numclients, origrequests = config.requests;
+    int numclients = orignumclients, requests = origrequests;
+    client c;
+    char *data;
+
+    if (requests > (1024*1024*1024)/size) requests = (1024*1024*1024)/size;
+    if (requests < 10) requests = 10;
+    if (numclients > (64*1024*1024)/size) numclients = (64*1024*1024)/size;
+    if (numclients < 1) numclients = 1;
+    config.requests = requests;
+    config.numclients = numclients;
+
+    prepareForBenchmark();
+    c = createClient();
+    if (!c) exit(1);
+    c->obuf = sdscatprintf(c->obuf,"SET foo_rand000000000000 %d\r\n",size);
+    data = zmalloc(size+2);
+    memset(data,'x',size);
+    data[size] = '\r';
+    data[size+1] = '\n';
+    c->obuf = sdscatlen(c->obuf,data,size+2);
+    zfree(data);
+    c->replytype = REPLY_RETCODE;
+    createMissingClients(c);
+    aeMain(config.el);
+    endBenchmark(title);
+
+    config.requests = origrequests;
+    config.numclients = orignumclients;
+}
+
 void parseOptions(int argc, char **argv) {
     int i;
 
@@ -360,17 +468,25 @@ void parseOptions(int argc, char **argv) {
             config.datasize = atoi(argv[i+1]);
             i++;
             if (config.datasize < 1) config.datasize=1;
-            if (config.datasize > 1024*1024) config.datasize = 1024*1024;
+            if (config.datasize > 1024*1024*1024) config.datasize = 1024*1024*1024;
         } else if (!strcmp(argv[i],"-r") && !lastarg) {
             config.randomkeys = 1;
             config.randomkeys_keyspacelen = atoi(argv[i+1]);
             if (config.randomkeys_keyspacelen < 0)
                 config.randomkeys_keyspacelen = 0;
             i++;
+        } else if (!strcmp(argv[i],"-z") && !lastarg) {
+            config.zipf = atof(argv[i+1]);
+            if (config.zipf < 0) config.zipf = 0;
+            i++;
+        } else if (!strcmp(argv[i],"-H")) {
+            config.cache = 1;
         } else if (!strcmp(argv[i],"-q")) {
             config.quiet = 1;
         } else if (!strcmp(argv[i],"-l")) {
             config.loop = 1;
+        } else if (!strcmp(argv[i],"-B")) {
+            config.bigvalues = 1;
         } else {
             printf("Wrong option '%s' or option argument missing\n\n",argv[i]);
             printf("Usage: redis-benchmark [-h <host>] [-p <port>] [-c <clients>] [-n <requests]> [-k <boolean>]\n\n");
@@ -387,8 +503,15 @@ void parseOptions(int argc, char **argv) {
             printf("  number of values for the random number. For instance\n");
             printf("  if set to 10 only rand000000000000 - rand000000000009\n");
             printf("  range will be allowed.\n");
+            printf(" -z <exponent>      Zipfian random keys: key N is requested with a\n");
+            printf("  probability proportional to 1/(N+1)^<exponent>, 0.99 is\n");
+            printf("  a typical cache workload. Needs -r\n");
+            printf(" -H                 Only run the cache workload: GET a random key and\n");
+            printf("  SET it when missing, then report the hit ratio. Use it\n");
+            printf("  with -r and -z against a server with maxmemory set\n");
             printf(" -q                 Quiet. Just show query/sec values\n");
             printf(" -l                 Loop. Run the tests forever\n");
+            printf(" -B                 Also benchmark SET with 1KB, 100KB and 10MB values\n");
             exit(1);
         }
     }
@@ -409,8 +532,14 @@ int main(int argc, char **argv) {
     config.datasize = 3;
     config.randomkeys = 0;
     config.randomkeys_keyspacelen = 0;
+    config.zipf = 0;
+    config.zipfcdf = NULL;
+    config.cache = 0;
+    config.hits = 0;
+    config.misses = 0;
     config.quiet = 0;
     config.loop = 0;
+    config.bigvalues = 0;
     config.latency = NULL;
     config.clients = listCreate();
     config.latency = zmalloc(sizeof(int)*(MAX_LATENCY+1));
@@ -423,8 +552,42 @@ int main(int argc, char **argv) {
     if (config.keepalive == 0) {
         printf("WARNING: keepalive disabled, you probably need 'echo 1 > /proc/sys/net/ipv4/tcp_tw_reuse' in order to use a lot of clients/requests\n");
     }
+    if ((config.zipf > 0 || config.cache) &&
+        config.randomkeys_keyspacelen == 0)
+    {
+        printf("-z and -H need the keyspace length, see -r\n");
+        exit(1);
+    }
+    if (config.cache && config.keepalive == 0) {
+        printf("-H needs keep alive\n");
+        exit(1);
+    }
+    if (config.zipf > 0) initZipf();
+    if (config.cache) {
+        config.cachedata = sdsnewlen(NULL,config.datasize+2);
+        memset(config.cachedata,'x',config.datasize);
+        config.cachedata[config.datasize] = '\r';
+        config.cachedata[config.datasize+1] = '\n';
+    }
 
     do {
+        if (config.cache) {
+            config.hits = config.misses = 0;
+            prepareForBenchmark();
+            c = createClient();
+            if (!c) exit(1);
+            prepareCacheQuery(c);
+            c->readlen = -1;
+            createMissingClients(c);
+            aeMain(config.el);
+            endBenchmark("GET/SET cache");
+            printf("cache hit ratio: %.2f%% (%lld hits, %lld misses)\n\n",
+                (config.hits+config.misses) ?
+                (double)config.hits*100/(config.hits+config.misses) : 0,
+                config.hits, config.misses);
+            continue;
+        }
+
         prepareForBenchmark();
         c = createClient();
         if (!c) exit(1);
@@ -450,6 +613,12 @@ int main(int argc, char **argv) {
         aeMain(config.el);
         endBenchmark("SET");
 
+        if (config.bigvalues) {
+            benchmarkBigSet("SET (1KB value)",1024);
+            benchmarkBigSet("SET (100KB value)",1024*100);
+            benchmarkBigSet("SET (10MB value)",1024*1024*10);
+        }
+
         prepareForBenchmark();
         c = createClient();
         if (!c) exit(1);
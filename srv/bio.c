@@ -0,0 +1,127 @@
+/* bio.c - Background jobs thread
+ *
+ * Copyright (c) 2006-2009, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/* The jobs are pushed by the main thread to a lock free stack (a CAS on its
+ * head), the background thread takes the whole stack at once and runs it in
+ * reverse, that is in submission order. The mutex and the condition are only
+ * used to sleep when there is nothing to do: submitting never waits for the
+ * thread. */
+
+#include "fmacros.h"
+
+#include <pthread.h>
+
+#include "bio.h"
+#include "zmalloc.h"
+#include "slab.h"
+
+typedef struct bioJob {
+    struct bioJob *next;
+    bioJobProc *proc;
+    void *arg;
+} bioJob;
+
+static bioJob *bio_jobs = NULL;
+static unsigned long bio_pending = 0;
+static pthread_mutex_t bio_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bio_cond = PTHREAD_COND_INITIALIZER;
+
+static void *bioThreadMain(void *arg) {
+    bioJob *job, *next, *list;
+
+    (void) arg;
+    slabSetRemoteThread();
+    while(1) {
+        pthread_mutex_lock(&bio_mutex);
+        while (__atomic_load_n(&bio_jobs,__ATOMIC_ACQUIRE) == NULL)
+            pthread_cond_wait(&bio_cond,&bio_mutex);
+        pthread_mutex_unlock(&bio_mutex);
+
+        /* Take all the jobs, newest first, and reverse them */
+        job = __atomic_exchange_n(&bio_jobs,NULL,__ATOMIC_ACQUIRE);
+        list = NULL;
+        while (job) {
+            next = job->next;
+            job->next = list;
+            list = job;
+            job = next;
+        }
+        while (list) {
+            next = list->next;
+            list->proc(list->arg);
+            zfree(list);
+            __atomic_sub_fetch(&bio_pending,1,__ATOMIC_RELEASE);
+            list = next;
+        }
+    }
+    return NULL;
+}
+
+int bioInit(void) {
+    pthread_attr_t attr;
+    pthread_t thread;
+    int retval;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_DETACHED);
+    retval = pthread_create(&thread,&attr,bioThreadMain,NULL);
+    pthread_attr_destroy(&attr);
+    return retval == 0 ? 0 : -1;
+}
+
+void bioSubmit(bioJobProc *proc, void *arg) {
+    bioJob *job = zmalloc(sizeof(*job));
+    bioJob *head;
+
+    if (job == NULL) {
+        /* Better late than never: run it here */
+        proc(arg);
+        return;
+    }
+    job->proc = proc;
+    job->arg = arg;
+    __atomic_add_fetch(&bio_pending,1,__ATOMIC_RELAXED);
+    head = __atomic_load_n(&bio_jobs,__ATOMIC_RELAXED);
+    do {
+        job->next = head;
+    } while (!__atomic_compare_exchange_n(&bio_jobs,&head,job,1,
+                __ATOMIC_RELEASE,__ATOMIC_RELAXED));
+
+    /* Taking the mutex makes sure the thread is either still running or
+     * already waiting on the condition, so the signal is not lost */
+    pthread_mutex_lock(&bio_mutex);
+    pthread_cond_signal(&bio_cond);
+    pthread_mutex_unlock(&bio_mutex);
+}
+
+unsigned long bioPendingJobs(void) {
+    return __atomic_load_n(&bio_pending,__ATOMIC_ACQUIRE);
+}
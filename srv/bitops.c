@@ -0,0 +1,508 @@
+/* Popcount and bitwise kernels for the bitmap commands (BITCOUNT, BITOP,
+ * BITPOS) and the HyperLogLog registers merge, with AVX2, SSE and portable
+ * implementations chosen at runtime.
+ *
+ * Copyright (c) 2006-2009, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Every implementation provides the same five kernels. bitopsInit() points
+ * bitops_impl to the fastest one the CPU supports, as told by cpuid: the
+ * x86 kernels are compiled with a target attribute, so the binary still
+ * runs on CPUs without AVX2 or SSSE3 and no -m flag is needed.
+ *
+ * popcount:  nibble lookup table in a register (pshufb), eight bits counted
+ *            per byte lane, the lanes summed with psadbw every 31 rounds
+ *            before they can overflow.
+ * combine:   the sources are read a vector at a time and combined in a
+ *            register, so the destination is written just once.
+ * firstbyte: skip the bytes equal to 0 (looking for a one) or to 0xff
+ *            (looking for a zero) a vector at a time.
+ * maxbytes:  unsigned byte max (pmaxub), SWAR in the portable version.
+ * unpack6:   4 fields of 6 bits from every 3 bytes: pshufb spreads 12 bytes
+ *            to 4 dwords, then every field is shifted to its byte. */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "bitops.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BITOPS_X86
+#include <immintrin.h>
+#endif
+
+typedef struct bitopsImpl {
+    const char *name;
+    size_t (*popcount)(const unsigned char *p, size_t len);
+    /* Combine the first 'len' bytes of every source, returns the number of
+     * bytes done (the rest is done a byte at a time) */
+    size_t (*combine)(int op, unsigned char *dst, const unsigned char **src,
+                      int numsrc, size_t len);
+    /* Index of the first byte not equal to 'skip', 'len' if none */
+    size_t (*firstbyte)(const unsigned char *p, size_t len, unsigned char skip);
+    /* dst[i] = max(dst[i],src[i]), returns the number of bytes done */
+    size_t (*maxbytes)(unsigned char *dst, const unsigned char *src, size_t len);
+    /* Unpack 6 bit fields to bytes, returns the number of fields done */
+    size_t (*unpack6)(unsigned char *dst, const unsigned char *src, size_t count);
+} bitopsImpl;
+
+/* ------------------------------ Portable ---------------------------------- */
+
+static const unsigned char bitopsNibbleCount[16] = {
+    0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4
+};
+
+static inline uint64_t bitopsLoad64(const unsigned char *p) {
+    uint64_t v;
+
+    memcpy(&v,p,8);
+    return v;
+}
+
+/* Bits set in a 64 bit word (SWAR) */
+static inline unsigned int bitopsPopcount64(uint64_t v) {
+    v = v - ((v >> 1) & 0x5555555555555555ULL);
+    v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+    v = (v + (v >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (unsigned int)((v * 0x0101010101010101ULL) >> 56);
+}
+
+static size_t popcountPortable(const unsigned char *p, size_t len) {
+    size_t bits = 0;
+
+    for (; len >= 32; p += 32, len -= 32) {
+        bits += bitopsPopcount64(bitopsLoad64(p));
+        bits += bitopsPopcount64(bitopsLoad64(p+8));
+        bits += bitopsPopcount64(bitopsLoad64(p+16));
+        bits += bitopsPopcount64(bitopsLoad64(p+24));
+    }
+    for (; len >= 8; p += 8, len -= 8)
+        bits += bitopsPopcount64(bitopsLoad64(p));
+    while (len--) {
+        bits += bitopsNibbleCount[*p & 15] + bitopsNibbleCount[*p >> 4];
+        p++;
+    }
+    return bits;
+}
+
+/* One vector loop for every operation, so that the operation is not tested
+ * per vector. 'vec' is the vector type, LOAD/STORE/OP work on it. */
+#define BITOPS_COMBINE_LOOP(vec, LOAD, STORE, OP) do { \
+    for (; i+sizeof(vec) <= len; i += sizeof(vec)) { \
+        vec v = LOAD(src[0]+i); \
+        int k; \
+        for (k = 1; k < numsrc; k++) v = OP(v,LOAD(src[k]+i)); \
+        STORE(dst+i,v); \
+    } \
+} while(0)
+
+#define BITOPS_COMBINE(vec, LOAD, STORE, AND, OR, XOR, NOT) do { \
+    switch(op) { \
+    case BITOPS_AND: BITOPS_COMBINE_LOOP(vec,LOAD,STORE,AND); break; \
+    case BITOPS_OR: BITOPS_COMBINE_LOOP(vec,LOAD,STORE,OR); break; \
+    case BITOPS_XOR: BITOPS_COMBINE_LOOP(vec,LOAD,STORE,XOR); break; \
+    case BITOPS_NOT: \
+        for (; i+sizeof(vec) <= len; i += sizeof(vec)) \
+            STORE(dst+i,NOT(LOAD(src[0]+i))); \
+        break; \
+    } \
+} while(0)
+
+#define P_AND(a,b) ((a)&(b))
+#define P_OR(a,b) ((a)|(b))
+#define P_XOR(a,b) ((a)^(b))
+#define P_NOT(a) (~(a))
+
+static inline void bitopsStore64(unsigned char *p, uint64_t v) {
+    memcpy(p,&v,8);
+}
+
+static size_t combinePortable(int op, unsigned char *dst,
+        const unsigned char **src, int numsrc, size_t len)
+{
+    size_t i = 0;
+
+    BITOPS_COMBINE(uint64_t,bitopsLoad64,bitopsStore64,P_AND,P_OR,P_XOR,P_NOT);
+    return i;
+}
+
+static size_t firstbytePortable(const unsigned char *p, size_t len,
+        unsigned char skip)
+{
+    uint64_t skipword = skip ? ~(uint64_t)0 : 0;
+    size_t i = 0;
+
+    while (i+8 <= len && bitopsLoad64(p+i) == skipword) i += 8;
+    while (i < len && p[i] == skip) i++;
+    return i;
+}
+
+/* Per byte max of two words: the borrow of a-b computed in every byte lane
+ * without crossing lanes tells where b is greater */
+static size_t maxbytesPortable(unsigned char *dst, const unsigned char *src,
+        size_t len)
+{
+    const uint64_t high = 0x8080808080808080ULL;
+    size_t i = 0;
+
+    for (; i+8 <= len; i += 8) {
+        uint64_t a = bitopsLoad64(dst+i), b = bitopsLoad64(src+i);
+        uint64_t diff = ((a | high) - (b & ~high)) ^ ((a ^ ~b) & high);
+        uint64_t borrow = ((~a & b) | (~(a ^ b) & diff)) & high;
+        uint64_t mask = (borrow >> 7) * 0xff;
+
+        bitopsStore64(dst+i,(b & mask) | (a & ~mask));
+    }
+    return i;
+}
+
+static size_t unpack6Portable(unsigned char *dst, const unsigned char *src,
+        size_t count)
+{
+    size_t i;
+
+    for (i = 0; i+4 <= count; i += 4, src += 3) {
+        unsigned int b0 = src[0], b1 = src[1], b2 = src[2];
+
+        dst[i] = b0 & 63;
+        dst[i+1] = ((b0 >> 6) | (b1 << 2)) & 63;
+        dst[i+2] = ((b1 >> 4) | (b2 << 4)) & 63;
+        dst[i+3] = b2 >> 2;
+    }
+    return i;
+}
+
+/* --------------------------------- SSE ------------------------------------ */
+
+#ifdef BITOPS_X86
+#define SSE_TARGET __attribute__((target("ssse3")))
+#define SSE_LOAD(p) _mm_loadu_si128((const __m128i*)(p))
+#define SSE_STORE(p,v) _mm_storeu_si128((__m128i*)(p),(v))
+#define SSE_NOT(a) _mm_xor_si128((a),_mm_set1_epi8(-1))
+
+SSE_TARGET static size_t popcountSse(const unsigned char *p, size_t len) {
+    const __m128i lookup = _mm_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m128i low = _mm_set1_epi8(0x0f);
+    __m128i acc = _mm_setzero_si128();
+    uint64_t sum[2];
+
+    while (len >= 16) {
+        __m128i local = _mm_setzero_si128();
+        int j;
+
+        /* At most 8 per byte lane a round: 31 rounds fit in a byte */
+        for (j = 0; j < 31 && len >= 16; j++, p += 16, len -= 16) {
+            __m128i v = SSE_LOAD(p);
+            __m128i lo = _mm_and_si128(v,low);
+            __m128i hi = _mm_and_si128(_mm_srli_epi16(v,4),low);
+
+            local = _mm_add_epi8(local,_mm_shuffle_epi8(lookup,lo));
+            local = _mm_add_epi8(local,_mm_shuffle_epi8(lookup,hi));
+        }
+        acc = _mm_add_epi64(acc,_mm_sad_epu8(local,_mm_setzero_si128()));
+    }
+    _mm_storeu_si128((__m128i*)sum,acc);
+    return (size_t)(sum[0]+sum[1]) + popcountPortable(p,len);
+}
+
+SSE_TARGET static size_t combineSse(int op, unsigned char *dst,
+        const unsigned char **src, int numsrc, size_t len)
+{
+    size_t i = 0;
+
+    BITOPS_COMBINE(__m128i,SSE_LOAD,SSE_STORE,_mm_and_si128,_mm_or_si128,
+                   _mm_xor_si128,SSE_NOT);
+    return i;
+}
+
+SSE_TARGET static size_t firstbyteSse(const unsigned char *p, size_t len,
+        unsigned char skip)
+{
+    const __m128i skipvec = _mm_set1_epi8((char)skip);
+    size_t i = 0;
+
+    for (; i+16 <= len; i += 16) {
+        unsigned int eq = (unsigned int)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(SSE_LOAD(p+i),skipvec));
+
+        if (eq != 0xffff) return i + __builtin_ctz(~eq);
+    }
+    return i + firstbytePortable(p+i,len-i,skip);
+}
+
+SSE_TARGET static size_t maxbytesSse(unsigned char *dst,
+        const unsigned char *src, size_t len)
+{
+    size_t i = 0;
+
+    for (; i+64 <= len; i += 64) {
+        SSE_STORE(dst+i,_mm_max_epu8(SSE_LOAD(dst+i),SSE_LOAD(src+i)));
+        SSE_STORE(dst+i+16,_mm_max_epu8(SSE_LOAD(dst+i+16),SSE_LOAD(src+i+16)));
+        SSE_STORE(dst+i+32,_mm_max_epu8(SSE_LOAD(dst+i+32),SSE_LOAD(src+i+32)));
+        SSE_STORE(dst+i+48,_mm_max_epu8(SSE_LOAD(dst+i+48),SSE_LOAD(src+i+48)));
+    }
+    for (; i+16 <= len; i += 16)
+        SSE_STORE(dst+i,_mm_max_epu8(SSE_LOAD(dst+i),SSE_LOAD(src+i)));
+    return i;
+}
+
+/* Every dword holds 3 source bytes (24 bits, 4 fields), the field k is
+ * moved from bit 6k to bit 8k */
+#define BITOPS_UNPACK6(w, AND, OR, SLL, SET1) \
+    OR(OR(AND((w),SET1(0x3f)),AND(SLL((w),2),SET1(0x3f00))), \
+       OR(AND(SLL((w),4),SET1(0x3f0000)),AND(SLL((w),6),SET1(0x3f000000))))
+
+SSE_TARGET static size_t unpack6Sse(unsigned char *dst,
+        const unsigned char *src, size_t count)
+{
+    const __m128i spread = _mm_setr_epi8(0,1,2,-1,3,4,5,-1,6,7,8,-1,9,10,11,-1);
+    size_t i = 0;
+
+    /* 16 fields from 12 bytes, but 16 bytes are loaded */
+    for (; i+16 <= count && (i+16)*6/8+4 <= count*6/8; i += 16, src += 12) {
+        __m128i w = _mm_shuffle_epi8(SSE_LOAD(src),spread);
+
+        SSE_STORE(dst+i,BITOPS_UNPACK6(w,_mm_and_si128,_mm_or_si128,
+                                       _mm_slli_epi32,_mm_set1_epi32));
+    }
+    return i;
+}
+
+/* -------------------------------- AVX2 ------------------------------------ */
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+#define AVX2_LOAD(p) _mm256_loadu_si256((const __m256i*)(p))
+#define AVX2_STORE(p,v) _mm256_storeu_si256((__m256i*)(p),(v))
+#define AVX2_NOT(a) _mm256_xor_si256((a),_mm256_set1_epi8(-1))
+
+AVX2_TARGET static size_t popcountAvx2(const unsigned char *p, size_t len) {
+    const __m256i lookup = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+                                            0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i acc = _mm256_setzero_si256();
+    uint64_t sum[4];
+
+    while (len >= 32) {
+        __m256i local = _mm256_setzero_si256();
+        int j;
+
+        for (j = 0; j < 31 && len >= 32; j++, p += 32, len -= 32) {
+            __m256i v = AVX2_LOAD(p);
+            __m256i lo = _mm256_and_si256(v,low);
+            __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v,4),low);
+
+            local = _mm256_add_epi8(local,_mm256_shuffle_epi8(lookup,lo));
+            local = _mm256_add_epi8(local,_mm256_shuffle_epi8(lookup,hi));
+        }
+        acc = _mm256_add_epi64(acc,_mm256_sad_epu8(local,_mm256_setzero_si256()));
+    }
+    _mm256_storeu_si256((__m256i*)sum,acc);
+    return (size_t)(sum[0]+sum[1]+sum[2]+sum[3]) + popcountPortable(p,len);
+}
+
+AVX2_TARGET static size_t combineAvx2(int op, unsigned char *dst,
+        const unsigned char **src, int numsrc, size_t len)
+{
+    size_t i = 0;
+
+    BITOPS_COMBINE(__m256i,AVX2_LOAD,AVX2_STORE,_mm256_and_si256,
+                   _mm256_or_si256,_mm256_xor_si256,AVX2_NOT);
+    return i;
+}
+
+AVX2_TARGET static size_t firstbyteAvx2(const unsigned char *p, size_t len,
+        unsigned char skip)
+{
+    const __m256i skipvec = _mm256_set1_epi8((char)skip);
+    size_t i = 0;
+
+    for (; i+32 <= len; i += 32) {
+        unsigned int eq = (unsigned int)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(AVX2_LOAD(p+i),skipvec));
+
+        if (eq != 0xffffffff) return i + __builtin_ctz(~eq);
+    }
+    return i + firstbytePortable(p+i,len-i,skip);
+}
+
+AVX2_TARGET static size_t maxbytesAvx2(unsigned char *dst,
+        const unsigned char *src, size_t len)
+{
+    size_t i = 0;
+
+    for (; i+64 <= len; i += 64) {
+        AVX2_STORE(dst+i,_mm256_max_epu8(AVX2_LOAD(dst+i),AVX2_LOAD(src+i)));
+        AVX2_STORE(dst+i+32,
+                   _mm256_max_epu8(AVX2_LOAD(dst+i+32),AVX2_LOAD(src+i+32)));
+    }
+    for (; i+32 <= len; i += 32)
+        AVX2_STORE(dst+i,_mm256_max_epu8(AVX2_LOAD(dst+i),AVX2_LOAD(src+i)));
+    return i;
+}
+AVX2_TARGET static size_t unpack6Avx2(unsigned char *dst,
+        const unsigned char *src, size_t count)
+{
+    const __m256i spread = _mm256_setr_epi8(0,1,2,-1,3,4,5,-1,6,7,8,-1,9,10,11,-1,
+                                            0,1,2,-1,3,4,5,-1,6,7,8,-1,9,10,11,-1);
+    size_t i = 0;
+
+    /* 32 fields from 24 bytes: 12 bytes to every 128 bit lane, as pshufb
+     * doesn't cross the lanes */
+    for (; i+32 <= count && (i+32)*6/8+4 <= count*6/8; i += 32, src += 24) {
+        __m256i w = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(SSE_LOAD(src)),SSE_LOAD(src+12),1);
+
+        w = _mm256_shuffle_epi8(w,spread);
+        AVX2_STORE(dst+i,BITOPS_UNPACK6(w,_mm256_and_si256,_mm256_or_si256,
+                                        _mm256_slli_epi32,_mm256_set1_epi32));
+    }
+    return i + unpack6Sse(dst+i,src,count-i);
+}
+#endif /* BITOPS_X86 */
+
+/* ------------------------------ Dispatch ---------------------------------- */
+
+static const bitopsImpl bitopsImpls[] = {
+#ifdef BITOPS_X86
+    {"avx2", popcountAvx2, combineAvx2, firstbyteAvx2, maxbytesAvx2,
+     unpack6Avx2},
+    {"sse", popcountSse, combineSse, firstbyteSse, maxbytesSse, unpack6Sse},
+#endif
+    {"portable", popcountPortable, combinePortable, firstbytePortable,
+     maxbytesPortable, unpack6Portable}
+};
+
+#define BITOPS_IMPLS (sizeof(bitopsImpls)/sizeof(bitopsImpls[0]))
+
+static const bitopsImpl *bitops_impl = &bitopsImpls[BITOPS_IMPLS-1];
+
+static int bitopsSupported(const bitopsImpl *impl) {
+#ifdef BITOPS_X86
+    __builtin_cpu_init();
+    if (!strcmp(impl->name,"avx2")) return __builtin_cpu_supports("avx2");
+    if (!strcmp(impl->name,"sse")) return __builtin_cpu_supports("ssse3");
+#endif
+    return !strcmp(impl->name,"portable");
+}
+
+void bitopsInit(void) {
+    size_t j;
+
+    /* The table is ordered from the fastest */
+    for (j = 0; j < BITOPS_IMPLS; j++) {
+        if (bitopsSupported(&bitopsImpls[j])) {
+            bitops_impl = &bitopsImpls[j];
+            return;
+        }
+    }
+}
+
+int bitopsSelect(const char *name) {
+    size_t j;
+
+    for (j = 0; j < BITOPS_IMPLS; j++) {
+        if (!strcmp(bitopsImpls[j].name,name)) {
+            if (!bitopsSupported(&bitopsImpls[j])) return -1;
+            bitops_impl = &bitopsImpls[j];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *bitopsImplName(void) {
+    return bitops_impl->name;
+}
+
+/* ------------------------------- API -------------------------------------- */
+
+size_t bitopsPopcount(const unsigned char *p, size_t len) {
+    return bitops_impl->popcount(p,len);
+}
+
+void bitopsCombine(int op, unsigned char *dst, const unsigned char **src,
+                   const size_t *len, int numsrc, size_t maxlen)
+{
+    size_t minlen = maxlen, i;
+    int k;
+
+    for (k = 0; k < numsrc; k++)
+        if (len[k] < minlen) minlen = len[k];
+    i = bitops_impl->combine(op,dst,src,numsrc,minlen);
+
+    /* The bytes the kernel left, and the ones past the shortest source */
+    if (op == BITOPS_AND && minlen < maxlen) {
+        for (; i < minlen; i++) {
+            unsigned char b = src[0][i];
+
+            for (k = 1; k < numsrc; k++) b &= src[k][i];
+            dst[i] = b;
+        }
+        memset(dst+minlen,0,maxlen-minlen);
+        return;
+    }
+    for (; i < maxlen; i++) {
+        unsigned char b = (i < len[0]) ? src[0][i] : 0;
+
+        for (k = 1; k < numsrc; k++) {
+            unsigned char o = (i < len[k]) ? src[k][i] : 0;
+
+            switch(op) {
+            case BITOPS_AND: b &= o; break;
+            case BITOPS_OR: b |= o; break;
+            case BITOPS_XOR: b ^= o; break;
+            }
+        }
+        dst[i] = (op == BITOPS_NOT) ? (unsigned char)~b : b;
+    }
+}
+
+long long bitopsFirstBit(const unsigned char *p, size_t len, int bit) {
+    unsigned char skip = bit ? 0 : 0xff, b;
+    size_t i = bitops_impl->firstbyte(p,len,skip);
+    int j;
+
+    if (i == len) return -1;
+    b = bit ? p[i] : (unsigned char)~p[i];
+    for (j = 0; !(b & (0x80 >> j)); j++);
+    return (long long)i*8+j;
+}
+
+void bitopsMaxBytes(unsigned char *dst, const unsigned char *src, size_t len) {
+    size_t i = bitops_impl->maxbytes(dst,src,len);
+
+    for (; i < len; i++)
+        if (src[i] > dst[i]) dst[i] = src[i];
+}
+
+void bitopsUnpack6(unsigned char *dst, const unsigned char *src, size_t count) {
+    size_t i = bitops_impl->unpack6(dst,src,count);
+
+    /* The last fields the vector loads would read past */
+    unpack6Portable(dst+i,src+i*6/8,count-i);
+}
@@ -0,0 +1,64 @@
+/* bitops.h - Popcount and bitwise kernels for the bitmap commands
+ *
+ * Copyright (c) 2006-2009, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __BITOPS_H__
+#define __BITOPS_H__
+
+#include <stddef.h>
+
+/* Operations of bitopsCombine() */
+#define BITOPS_AND 0
+#define BITOPS_OR 1
+#define BITOPS_XOR 2
+#define BITOPS_NOT 3
+
+/* Pick the fastest kernels the CPU supports (AVX2, SSE, portable) */
+void bitopsInit(void);
+/* Force the kernels by name ("avx2", "sse", "portable"). Returns 0 on
+ * success, -1 if unknown or not supported by this CPU. */
+int bitopsSelect(const char *name);
+const char *bitopsImplName(void);
+
+/* Number of bits set in the 'len' bytes at 'p' */
+size_t bitopsPopcount(const unsigned char *p, size_t len);
+/* dst = src[0] op src[1] op ... src[numsrc-1] over 'maxlen' bytes, the
+ * sources shorter than maxlen being zero padded. NOT takes one source. */
+void bitopsCombine(int op, unsigned char *dst, const unsigned char **src,
+                   const size_t *len, int numsrc, size_t maxlen);
+/* Position of the first bit set to 'bit' (the most significant bit of a
+ * byte comes first), -1 if none */
+long long bitopsFirstBit(const unsigned char *p, size_t len, int bit);
+/* dst[i] = max(dst[i],src[i]) for the 'len' bytes (HyperLogLog merge) */
+void bitopsMaxBytes(unsigned char *dst, const unsigned char *src, size_t len);
+/* Unpack 'count' (a multiple of 4) 6 bit fields, the least significant bits
+ * first, to a byte each (HyperLogLog dense registers) */
+void bitopsUnpack6(unsigned char *dst, const unsigned char *src, size_t count);
+
+#endif /* __BITOPS_H__ */
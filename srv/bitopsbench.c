@@ -0,0 +1,129 @@
+/* Bitmap kernels benchmark: BITCOUNT, BITOP and BITPOS throughput of every
+ * implementation the CPU supports, on 100 MB bitmaps by default.
+ *
+ * Copyright (c) 2006-2009, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "bitops.h"
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+/* Print the throughput in GB/s of the input bytes processed */
+static void report(const char *what, size_t bytes, long long us) {
+    printf("  %-22s %8.2f GB/s\n", what, (double)bytes/(us ? us : 1)/1000);
+}
+
+static void benchImpl(const char *name, unsigned char **bitmaps, size_t len,
+        int rounds)
+{
+    const unsigned char *src[4];
+    size_t lens[4], bits = 0;
+    long long start, pos = 0;
+    int j, op;
+    static const char *opnames[] = {"AND","OR","XOR","NOT"};
+
+    if (bitopsSelect(name) == -1) {
+        printf("%s: not supported by this CPU\n", name);
+        return;
+    }
+    printf("%s\n", name);
+
+    start = ustime();
+    for (j = 0; j < rounds; j++) bits += bitopsPopcount(bitmaps[0],len);
+    report("BITCOUNT",len*rounds,ustime()-start);
+
+    for (j = 0; j < 4; j++) {
+        src[j] = bitmaps[j];
+        lens[j] = len;
+    }
+    for (op = BITOPS_AND; op <= BITOPS_NOT; op++) {
+        int numsrc = (op == BITOPS_NOT) ? 1 : 2;
+        char what[32];
+
+        start = ustime();
+        for (j = 0; j < rounds; j++)
+            bitopsCombine(op,bitmaps[4],src,lens,numsrc,len);
+        snprintf(what,sizeof(what),"BITOP %s (%d key%s)",opnames[op],numsrc,
+            numsrc > 1 ? "s" : "");
+        report(what,len*numsrc*rounds,ustime()-start);
+    }
+    start = ustime();
+    for (j = 0; j < rounds; j++)
+        bitopsCombine(BITOPS_OR,bitmaps[4],src,lens,4,len);
+    report("BITOP OR (4 keys)",len*4*rounds,ustime()-start);
+
+    /* Worst case: the only bit set is the last one */
+    memset(bitmaps[4],0,len);
+    bitmaps[4][len-1] = 1;
+    start = ustime();
+    for (j = 0; j < rounds; j++) pos += bitopsFirstBit(bitmaps[4],len,1);
+    report("BITPOS 1",len*rounds,ustime()-start);
+
+    /* Keep the results alive */
+    if (bits == 0 && pos == 0) printf("?\n");
+}
+
+int main(int argc, char **argv) {
+    size_t mb = (argc > 1) ? (size_t)atol(argv[1]) : 100, len = mb*1024*1024;
+    unsigned char *bitmaps[5];
+    int rounds = 5, j;
+    size_t k;
+
+    if (mb == 0) {
+        fprintf(stderr,"Usage: bitops-benchmark [bitmap size in MB]\n");
+        exit(1);
+    }
+    srandom(1234);
+    for (j = 0; j < 5; j++) {
+        if ((bitmaps[j] = malloc(len)) == NULL) {
+            fprintf(stderr,"Out of memory\n");
+            exit(1);
+        }
+        for (k = 0; k < len; k++) bitmaps[j][k] = random();
+    }
+
+    bitopsInit();
+    printf("%zu MB bitmaps, best of the CPU: %s\n", mb, bitopsImplName());
+
+    benchImpl("portable",bitmaps,len,rounds);
+    benchImpl("sse",bitmaps,len,rounds);
+    benchImpl("avx2",bitmaps,len,rounds);
+    return 0;
+}
@@ -41,9 +41,12 @@
 #include <stdarg.h>
 #include <assert.h>
 #include <limits.h>
+#include <stdint.h>
 
 #include "dict.h"
 #include "zmalloc.h"
+#include "slab.h"
+#include "dictspec.h"
 
 /* ---------------------------- Utility(公共) funcitons --------------------------- */
 
@@ -72,13 +75,29 @@ static void _dictFree(void *ptr) {
     zfree(ptr);
 }
 
+/* dictEntry是固定大小的小结构,使用slab分配 */
+static dictEntry *_dictAllocEntry(void)
+{
+    dictEntry *he = slabAlloc(sizeof(dictEntry));
+    if (he == NULL)
+        _dictPanic("Out of memory");
+    return he;
+}
+
 /* -------------------------- private prototypes ---------------------------- */
 
 static int _dictExpandIfNeeded(dict *ht);
 static unsigned long _dictNextPower(unsigned long size);
-static int _dictKeyIndex(dict *ht, const void *key);
 static int _dictInit(dict *ht, dictType *type, void *privDataPtr);
 
+static int _dictOaExpand(dict *ht, unsigned long size);
+static dictEntry *_dictOaInsert(dict *ht, unsigned int h);
+static void _dictOaErase(dict *ht, unsigned long i);
+static void _dictOaClear(dict *ht);
+static dictEntry *_dictOaNext(dictIterator *iter);
+static dictEntry *_dictOaGetRandomKey(dict *ht);
+static void _dictOaPrintStats(dict *ht);
+
 /* -------------------------- hash functions -------------------------------- */
 
 /* Thomas Wang's 32 bit Mix Function 
@@ -100,15 +119,55 @@ unsigned int dictIdentityHashFunction(unsigned int key)
     return key;
 }
 
-/* Generic hash function (a popular one from Bernstein).
- * I tested a few and this was the best. 
- * 这个函数有个印象就行 */
+/* Seed of the keyed string hash functions below. The server fills it
+ * with random bytes at startup, before creating the first dict, so the
+ * bucket of a given key can't be predicted by clients (hash flooding). */
+unsigned char dict_hash_function_seed[16];
+
+void dictSetHashFunctionSeed(const unsigned char *seed) {
+    memcpy(dict_hash_function_seed,seed,sizeof(dict_hash_function_seed));
+}
+
+unsigned char *dictGetHashFunctionSeed(void) {
+    return dict_hash_function_seed;
+}
+
+/* SipHash-1-3 keyed with 'seed', see _dictSipHash() in dictspec.h */
+uint64_t dictSipHash(const unsigned char *buf, int len, const unsigned char *seed) {
+    return _dictSipHash(buf,len,seed);
+}
+
+/* Generic hash function for binary safe keys, seeded SipHash-1-3.
+ * (used to be DJB hash*33+c: unseeded, trivial to flood with "Ez"/"FY"
+ * style collisions) */
 unsigned int dictGenHashFunction(const unsigned char *buf, int len) {
-    unsigned int hash = 5381;	/* Ox1505 */
+    return (unsigned int)_dictSipHash(buf,len,dict_hash_function_seed);
+}
+
+/* Fast non cryptographic variant (MurmurHash64A, seeded) for internal
+ * tables whose keys are not controlled by clients. About 2x the speed of
+ * SipHash on short keys but collisions can be computed. */
+unsigned int dictGenFastHashFunction(const unsigned char *buf, int len) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    uint64_t h = _dictLoad64(dict_hash_function_seed,8) ^ (len*m);
 
-    while (len--)
-        hash = ((hash << 5) + hash) + (*buf++); /* hash * 33 + c */
-    return hash;
+    for (; len >= 8; len -= 8, buf += 8) {
+        uint64_t k = _dictLoad64(buf,8);
+
+        k *= m;
+        k ^= k >> 47;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    if (len) {
+        h ^= _dictLoad64(buf,len);
+        h *= m;
+    }
+    h ^= h >> 47;
+    h *= m;
+    h ^= h >> 47;
+    return (unsigned int)h;
 }
 
 /* ----------------------------- API implementation ------------------------- */
@@ -122,7 +181,10 @@ static void _dictReset(dict *ht)
     ht->size = 0;
     ht->sizemask = 0;
     ht->used = 0;
-	/* type，private没有处理 */
+    ht->slots = NULL;
+    ht->ctrl = NULL;
+    ht->deleted = 0;
+	/* type，private，layout没有处理 */
 }
 
 /* Create a new hash table */
@@ -135,6 +197,17 @@ dict *dictCreate(dictType *type,
     return ht;
 }
 
+/* Create a new hash table with the given layout. Open addressing tables
+ * keep the entries inline in the slot array, so a lookup touches the
+ * control bytes and one slot instead of bucket -> entry -> next... */
+dict *dictCreateLayout(dictType *type, void *privDataPtr, int layout)
+{
+    dict *ht = dictCreate(type,privDataPtr);
+
+    ht->layout = layout;
+    return ht;
+}
+
 /* Initialize the hash table */
 int _dictInit(dict *ht, dictType *type,
         void *privDataPtr)
@@ -142,6 +215,7 @@ int _dictInit(dict *ht, dictType *type,
     _dictReset(ht);
     ht->type = type;
     ht->privdata = privDataPtr;
+    ht->layout = DICT_LAYOUT_CHAINED;
     return DICT_OK;
 }
 
@@ -168,6 +242,8 @@ int dictExpand(dict *ht, unsigned long size)
      * elements already inside the hashtable */
     if (ht->used > size)
         return DICT_ERR;
+    if (ht->layout == DICT_LAYOUT_OPEN)
+        return _dictOaExpand(ht, size);
 
     _dictInit(&n, ht->type, ht->privdata);
     n.size = realsize;
@@ -191,10 +267,10 @@ int dictExpand(dict *ht, unsigned long size)
         while(he) {
             unsigned int h;
 
-            nextHe = he->next;
+            nextHe = he->u.next;
             /* Get the new element index */
             h = dictHashKey(ht, he->key) & n.sizemask;
-            he->next = n.table[h];
+            he->u.next = n.table[h];
             n.table[h] = he;
             ht->used--;
             /* Pass to the next element */
@@ -209,87 +285,79 @@ int dictExpand(dict *ht, unsigned long size)
     return DICT_OK;
 }
 
-/* Add an element to the target hash table */
-int dictAdd(dict *ht, void *key, void *val)
+/* The generic API is the DICT_SPECIALIZE() instance that hashes and
+ * compares the keys with the dictType callbacks (see dictspec.h) */
+DICT_SPECIALIZE(_dictGeneric, dictHashKey, dictCompareHashKeys)
+
+/* Insert a key that is known not to be in the table, 'h' being the value
+ * the type hashFunction returns for it. Returns the new entry, or NULL if
+ * the table can't be expanded. 自动进行size调整 */
+dictEntry *dictAddHashed(dict *ht, void *key, void *val, unsigned int h)
 {
-    int index;
     dictEntry *entry;
 
-    /* Get the index of the new element, or -1 if
-     * the element already exists.
-     * 自动进行size调整 */
-    if ((index = _dictKeyIndex(ht, key)) == -1)		/* 已经存在或腾挪MEM失败(for key,val) 时返回 -1 */
-        return DICT_ERR;
-
-    /* Allocates the memory and stores key */
-    entry = _dictAlloc(sizeof(*entry));
-    entry->next = ht->table[index];
-    ht->table[index] = entry;
+    if (ht->layout == DICT_LAYOUT_OPEN) {
+        entry = _dictOaInsert(ht, h);
+    } else {
+        unsigned long index;
+
+        if (_dictExpandIfNeeded(ht) == DICT_ERR)
+            return NULL;
+        index = h & ht->sizemask;
+        /* Allocates the memory and stores key */
+        entry = _dictAllocEntry();
+        entry->u.next = ht->table[index];
+        ht->table[index] = entry;
+    }
 
     /* Set the hash entry fields. */
     dictSetHashKey(ht, entry, key);
     dictSetHashVal(ht, entry, val);
     ht->used++;
-    return DICT_OK;
+    return entry;
+}
+
+/* Add an element to the target hash table, DICT_ERR if it already exists */
+int dictAdd(dict *ht, void *key, void *val)
+{
+    return _dictGenericAdd(ht, key, val);
 }
 
 /* Add an element, discarding(丢弃) the old if the key already exists 
  * 不存在则直接插入，存在着替换val */
 int dictReplace(dict *ht, void *key, void *val)
 {
-    dictEntry *entry;
-
-    /* Try to add the element. If the key
-     * does not exists dictAdd will suceed. */
-    if (dictAdd(ht, key, val) == DICT_OK)
-        return DICT_OK;
-    /* It already exists, get the entry */
-    entry = dictFind(ht, key);
-    /* Free the old value and set the new one */
-    dictFreeEntryVal(ht, entry);
-    dictSetHashVal(ht, entry, val);
-    return DICT_OK;
+    return _dictGenericReplace(ht, key, val);
 }
 
-/* Search and remove an element */
-static int dictGenericDelete(dict *ht, const void *key, int nofree)
+/* Remove 'he', returned by a lookup of a key whose hash is 'h', freeing
+ * the key and the value unless 'nofree' is set */
+void dictDeleteEntry(dict *ht, dictEntry *he, unsigned int h, int nofree)
 {
-    unsigned int h;
-    dictEntry *he, *prevHe;
-
-    if (ht->size == 0)
-        return DICT_ERR;
-    h = dictHashKey(ht, key) & ht->sizemask;
-    he = ht->table[h];
-
-    prevHe = NULL;
-    while(he) {
-        if (dictCompareHashKeys(ht, key, he->key)) {
-            /* Unlink the element from the list */
-            if (prevHe)
-                prevHe->next = he->next;
-            else
-                ht->table[h] = he->next;
-            if (!nofree) {
-                dictFreeEntryKey(ht, he);
-                dictFreeEntryVal(ht, he);
-            }
-            _dictFree(he);
-            ht->used--;
-            return DICT_OK;
-        }
-        prevHe = he;
-        he = he->next;
+    if (!nofree) {
+        dictFreeEntryKey(ht, he);
+        dictFreeEntryVal(ht, he);
+    }
+    if (ht->layout == DICT_LAYOUT_OPEN) {
+        _dictOaErase(ht, he-ht->slots);
+    } else {
+        dictEntry **link = &ht->table[h & ht->sizemask];
+
+        /* Unlink the element from the list */
+        while (*link != he) link = &(*link)->u.next;
+        *link = he->u.next;
+        slabFree(he);
     }
-    return DICT_ERR; /* not found */
+    ht->used--;
 }
 
+/* Search and remove an element */
 int dictDelete(dict *ht, const void *key) {
-    return dictGenericDelete(ht,key,0);
+    return _dictGenericDelete(ht,key);
 }
 
 int dictDeleteNoFree(dict *ht, const void *key) {
-    return dictGenericDelete(ht,key,1);
+    return _dictGenericDeleteNoFree(ht,key);
 }
 
 /* Destroy an entire hash table 
@@ -298,16 +366,20 @@ int _dictClear(dict *ht)
 {
     unsigned long i;
 
+    if (ht->layout == DICT_LAYOUT_OPEN) {
+        _dictOaClear(ht);
+        return DICT_OK;
+    }
     /* Free all the elements */
     for (i = 0; i < ht->size && ht->used > 0; i++) {
         dictEntry *he, *nextHe;
 
         if ((he = ht->table[i]) == NULL) continue;
         while(he) {
-            nextHe = he->next;
+            nextHe = he->u.next;
             dictFreeEntryKey(ht, he);
             dictFreeEntryVal(ht, he);
-            _dictFree(he);
+            slabFree(he);
             ht->used--;
             he = nextHe;
         }
@@ -329,18 +401,7 @@ void dictRelease(dict *ht)
 /* 查找对应的entry */
 dictEntry *dictFind(dict *ht, const void *key)
 {
-    dictEntry *he;
-    unsigned int h;
-
-    if (ht->size == 0) return NULL;
-    h = dictHashKey(ht, key) & ht->sizemask;
-    he = ht->table[h];
-    while(he) {
-        if (dictCompareHashKeys(ht, key, he->key))
-            return he;
-        he = he->next;
-    }
-    return NULL;
+    return _dictGenericFind(ht, key);
 }
 
 dictIterator *dictGetIterator(dict *ht)
@@ -356,6 +417,8 @@ dictIterator *dictGetIterator(dict *ht)
 /* 搞明白这个函数，蛮有意思的哈,结合上面的dictGetIterator函数一起看更容易理解 */
 dictEntry *dictNext(dictIterator *iter)
 {
+    if (iter->ht->layout == DICT_LAYOUT_OPEN)
+        return _dictOaNext(iter);
     while (1) {
         if (iter->entry == NULL) {
             iter->index++;
@@ -368,7 +431,7 @@ dictEntry *dictNext(dictIterator *iter)
         if (iter->entry) {
             /* We need to save the 'next' here, the iterator user
              * may delete the entry we are returning. */
-            iter->nextEntry = iter->entry->next;
+            iter->nextEntry = iter->entry->u.next;
             return iter->entry;
         }
     }
@@ -390,6 +453,7 @@ dictEntry *dictGetRandomKey(dict *ht)
     int listlen, listele;
 
     if (ht->used == 0) return NULL;
+    if (ht->layout == DICT_LAYOUT_OPEN) return _dictOaGetRandomKey(ht);
     do {
         h = random() & ht->sizemask;
         he = ht->table[h];
@@ -401,12 +465,12 @@ dictEntry *dictGetRandomKey(dict *ht)
      * select a random index. */
     listlen = 0;
     while(he) {
-        he = he->next;
+        he = he->u.next;
         listlen++;
     }
     listele = random() % listlen;
     he = ht->table[h];
-    while(listele--) he = he->next;
+    while(listele--) he = he->u.next;
     return he;
 }
 
@@ -437,29 +501,6 @@ static unsigned long _dictNextPower(unsigned long size)
     }
 }
 
-/* Returns the index of a free slot that can be populated with
- * an hash entry for the given 'key'.
- * If the key already exists, -1 is returned. */
-static int _dictKeyIndex(dict *ht, const void *key)
-{
-    unsigned int h;
-    dictEntry *he;
-
-    /* Expand the hashtable if needed */
-    if (_dictExpandIfNeeded(ht) == DICT_ERR)
-        return -1;
-    /* Compute the key hash value */
-    h = dictHashKey(ht, key) & ht->sizemask;
-    /* Search if this slot does not already contain the given key */
-    he = ht->table[h];
-    while(he) {
-        if (dictCompareHashKeys(ht, key, he->key))
-            return -1;	/* key已存在，返回失败 */
-        he = he->next;
-    }
-    return h;
-}
-
 void dictEmpty(dict *ht) {
     _dictClear(ht);
 }
@@ -474,6 +515,10 @@ void dictPrintStats(dict *ht) {
         printf("No stats available for empty dictionaries\n");
         return;
     }
+    if (ht->layout == DICT_LAYOUT_OPEN) {
+        _dictOaPrintStats(ht);
+        return;
+    }
 
     for (i = 0; i < DICT_STATS_VECTLEN; i++) clvector[i] = 0;
     for (i = 0; i < ht->size; i++) {
@@ -489,7 +534,7 @@ void dictPrintStats(dict *ht) {
         he = ht->table[i];
         while(he) {
             chainlen++;
-            he = he->next;
+            he = he->u.next;
         }
         clvector[(chainlen < DICT_STATS_VECTLEN) ? chainlen : (DICT_STATS_VECTLEN-1)]++;
         if (chainlen > maxchainlen) maxchainlen = chainlen;
@@ -509,11 +554,195 @@ void dictPrintStats(dict *ht) {
     }
 }
 
+/* ------------------------ Open addressing tables --------------------------
+ *
+ * Slots are grouped DICT_GROUP_WIDTH at a time. Every slot has a control
+ * byte: EMPTY, DELETED (tombstone) or, for a used slot, the low 7 bits of
+ * the hash (tag). A lookup hashes once, jumps to the home group and
+ * compares the tag against all 16 control bytes with a single SSE2
+ * compare; only the slots whose tag matches are looked at, and of those
+ * only the ones whose cached full hash matches reach keyCompare. Probing
+ * stops at the first group with an EMPTY byte. Groups are visited in
+ * triangular order (+1, +2, +3 ...), which covers every group of a power
+ * of two table. The table grows when used+deleted reaches 7/8 of the
+ * slots; since the full hash lives in the entry, growing never calls the
+ * hash function again. */
+
+/* Returns the first EMPTY or DELETED slot on the probe path of 'h'. The
+ * table is never full (load <= 7/8) so this always succeeds. */
+static unsigned long _dictOaFreeSlot(dict *ht, unsigned int h)
+{
+    unsigned long gmask = (ht->size/DICT_GROUP_WIDTH)-1;
+    unsigned long g = (h >> 7) & gmask, step = 0;
+
+    while (1) {
+        unsigned long base = g*DICT_GROUP_WIDTH;
+        unsigned int mask = _dictGroupMatchFree(ht->ctrl+base);
+
+        if (mask) return base+_dictCtz(mask);
+        g = (g+(++step)) & gmask;
+    }
+}
+
+/* Rebuild the table with room for 'size' elements below the 7/8 load.
+ * Also used to drop the tombstones without growing. */
+static int _dictOaExpand(dict *ht, unsigned long size)
+{
+    unsigned long realsize = _dictNextPower(size+size/7+1), i;
+    dictEntry *oldslots = ht->slots;
+    unsigned char *oldctrl = ht->ctrl;
+    unsigned long oldsize = ht->size;
+
+    if (realsize == ht->size && ht->deleted == 0)
+        return DICT_OK;
+    /* slots and control bytes share one allocation */
+    ht->slots = _dictAlloc(realsize*(sizeof(dictEntry)+1));
+    ht->ctrl = (unsigned char*)(ht->slots+realsize);
+    memset(ht->ctrl, DICT_CTRL_EMPTY, realsize);
+    ht->size = realsize;
+    ht->sizemask = realsize-1;
+    ht->deleted = 0;
+
+    /* Move the entries using the cached hashes: no hashFunction calls */
+    for (i = 0; i < oldsize; i++) {
+        unsigned long j;
+
+        if (!DICT_CTRL_FULL(oldctrl[i])) continue;
+        j = _dictOaFreeSlot(ht, oldslots[i].u.hash);
+        ht->ctrl[j] = oldctrl[i];
+        ht->slots[j] = oldslots[i];
+    }
+    if (oldslots) _dictFree(oldslots);
+    return DICT_OK;
+}
+
+/* Take the slot for a new entry of hash 'h' (as returned by the type
+ * hashFunction): the caller sets key and value. Grows the table, or just
+ * purges the tombstones if most of the load is made of them, when the
+ * insertion would exceed 7/8 of the slots. */
+static dictEntry *_dictOaInsert(dict *ht, unsigned int h)
+{
+    unsigned long i;
+    dictEntry *entry;
+
+    if (ht->size == 0) {
+        _dictOaExpand(ht, DICT_HT_INITIAL_SIZE/2);
+    } else if ((ht->used+ht->deleted+1)*8 > ht->size*7) {
+        if (ht->deleted > ht->used/2)
+            _dictOaExpand(ht, ht->used+1);
+        else
+            _dictOaExpand(ht, ht->size);
+    }
+
+    h = _dictOaMix(h);
+    i = _dictOaFreeSlot(ht, h);
+    if (ht->ctrl[i] == DICT_CTRL_DELETED) ht->deleted--;
+    ht->ctrl[i] = h & 0x7f;
+    entry = ht->slots+i;
+    entry->u.hash = h;
+    return entry;
+}
+
+static void _dictOaErase(dict *ht, unsigned long i)
+{
+    unsigned long base = i & ~(unsigned long)(DICT_GROUP_WIDTH-1);
+
+    /* If the group still has an EMPTY byte no probe ever walked past it,
+     * so the slot can go back to EMPTY instead of becoming a tombstone */
+    if (_dictGroupMatch(ht->ctrl+base, DICT_CTRL_EMPTY)) {
+        ht->ctrl[i] = DICT_CTRL_EMPTY;
+    } else {
+        ht->ctrl[i] = DICT_CTRL_DELETED;
+        ht->deleted++;
+    }
+}
+
+static void _dictOaClear(dict *ht)
+{
+    unsigned long i;
+
+    for (i = 0; i < ht->size && ht->used > 0; i++) {
+        if (!DICT_CTRL_FULL(ht->ctrl[i])) continue;
+        dictFreeEntryKey(ht, ht->slots+i);
+        dictFreeEntryVal(ht, ht->slots+i);
+        ht->used--;
+    }
+    if (ht->slots) _dictFree(ht->slots);
+    _dictReset(ht);
+}
+
+/* Deleting the returned entry only changes its control byte, so it is
+ * safe while iterating like with the chained layout */
+static dictEntry *_dictOaNext(dictIterator *iter)
+{
+    dict *ht = iter->ht;
+
+    while (++iter->index < (signed)ht->size) {
+        if (DICT_CTRL_FULL(ht->ctrl[iter->index]))
+            return iter->entry = ht->slots+iter->index;
+    }
+    return NULL;
+}
+
+/* Pick a random group until a non empty one is found, then a random used
+ * slot inside it: the same bias as picking a random bucket in the chained
+ * layout. */
+static dictEntry *_dictOaGetRandomKey(dict *ht)
+{
+    unsigned long gmask = (ht->size/DICT_GROUP_WIDTH)-1;
+
+    while (1) {
+        unsigned long base = (random() & gmask)*DICT_GROUP_WIDTH;
+        unsigned int full = ~_dictGroupMatchFree(ht->ctrl+base) & 0xffff;
+        unsigned int m;
+        int n = 0, pick;
+
+        if (full == 0) continue;
+        for (m = full; m; m &= m-1) n++;
+        pick = random() % n;
+        while (pick--) full &= full-1;
+        return ht->slots+base+_dictCtz(full);
+    }
+}
+
+/* Probe length is the number of groups visited before reaching the one
+ * holding the entry (0 = home group) */
+static void _dictOaPrintStats(dict *ht)
+{
+    unsigned long gmask = (ht->size/DICT_GROUP_WIDTH)-1;
+    unsigned long i, maxprobe = 0, totprobe = 0;
+    unsigned long clvector[DICT_STATS_VECTLEN];
+
+    for (i = 0; i < DICT_STATS_VECTLEN; i++) clvector[i] = 0;
+    for (i = 0; i < ht->size; i++) {
+        unsigned long g, step = 0;
+
+        if (!DICT_CTRL_FULL(ht->ctrl[i])) continue;
+        g = (ht->slots[i].u.hash >> 7) & gmask;
+        while (g != i/DICT_GROUP_WIDTH) g = (g+(++step)) & gmask;
+        clvector[(step < DICT_STATS_VECTLEN) ? step : (DICT_STATS_VECTLEN-1)]++;
+        if (step > maxprobe) maxprobe = step;
+        totprobe += step;
+    }
+    printf("Hash table stats (open addressing):\n");
+    printf(" table size: %ld\n", ht->size);
+    printf(" number of elements: %ld\n", ht->used);
+    printf(" tombstones: %ld\n", ht->deleted);
+    printf(" load factor: %.02f\n", (float)ht->used/ht->size);
+    printf(" max probe length: %ld\n", maxprobe);
+    printf(" avg probe length: %.02f\n", (float)totprobe/ht->used);
+    printf(" Probe length distribution:\n");
+    for (i = 0; i < DICT_STATS_VECTLEN; i++) {
+        if (clvector[i] == 0) continue;
+        printf("   %s%ld: %ld (%.02f%%)\n",(i == DICT_STATS_VECTLEN-1)?">= ":"", i, clvector[i], ((float)clvector[i]/ht->used)*100);
+    }
+}
+
 /* ----------------------- StringCopy Hash Table Type ------------------------*/
 
 static unsigned int _dictStringCopyHTHashFunction(const void *key)
 {
-    return dictGenHashFunction(key, strlen(key));
+    return dictGenFastHashFunction(key, strlen(key));
 }
 
 static void *_dictStringCopyHTKeyDup(void *privdata, const void *key)
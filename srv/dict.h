@@ -36,16 +36,25 @@
 #ifndef __DICT_H
 #define __DICT_H
 
+#include <stdint.h>
+
 #define DICT_OK 0
 #define DICT_ERR 1
 
 /* Unused arguments generate annoying warnings... */
 #define DICT_NOTUSED(V) ((void) V)
 
+/* Table layouts: separate chaining (default) or open addressing */
+#define DICT_LAYOUT_CHAINED 0
+#define DICT_LAYOUT_OPEN 1
+
 typedef struct dictEntry {
     void *key;
     void *val;
-    struct dictEntry *next;
+    union {
+        struct dictEntry *next; /* chained: 同一个桶里的下一个entry */
+        unsigned int hash;      /* open: 缓存的hash值,扩容时不用重算 */
+    } u;
 } dictEntry;
 
 /* dict相关事务的处理句柄原型 */
@@ -65,6 +74,13 @@ typedef struct dict {
     unsigned long sizemask; 
     unsigned long used;		/* 实际包含元素的个数 */
     void *privdata;
+    int layout;             /* DICT_LAYOUT_CHAINED or DICT_LAYOUT_OPEN */
+    /* Open addressing only: 'size' entries stored inline plus one control
+     * byte per slot (EMPTY, DELETED or 7 bits of the hash), probed 16 at
+     * a time. */
+    dictEntry *slots;
+    unsigned char *ctrl;
+    unsigned long deleted;  /* tombstones */
 } dict;
 
 typedef struct dictIterator {
@@ -76,6 +92,12 @@ typedef struct dictIterator {
 /* This is the initial size of every hash table */
 #define DICT_HT_INITIAL_SIZE     16
 
+/* Open addressing tables are probed one group of control bytes at a time.
+ * NOTE: entries live inside the slot array, so a dictEntry returned by
+ * dictFind()/dictNext() on an open table is only valid until the next
+ * insertion or resize of that table. */
+#define DICT_GROUP_WIDTH         16
+
 /* ------------------------------- Macros ------------------------------------*/
 #define dictFreeEntryVal(ht, entry) \
     if ((ht)->type->valDestructor) \
@@ -115,11 +137,14 @@ typedef struct dictIterator {
 
 /* API */
 dict *dictCreate(dictType *type, void *privDataPtr);
+dict *dictCreateLayout(dictType *type, void *privDataPtr, int layout);
 int dictExpand(dict *ht, unsigned long size);
 int dictAdd(dict *ht, void *key, void *val);
 int dictReplace(dict *ht, void *key, void *val);
 int dictDelete(dict *ht, const void *key);
 int dictDeleteNoFree(dict *ht, const void *key);
+dictEntry *dictAddHashed(dict *ht, void *key, void *val, unsigned int h);
+void dictDeleteEntry(dict *ht, dictEntry *he, unsigned int h, int nofree);
 void dictRelease(dict *ht);
 dictEntry * dictFind(dict *ht, const void *key);
 int dictResize(dict *ht);
@@ -129,6 +154,10 @@ void dictReleaseIterator(dictIterator *iter);
 dictEntry *dictGetRandomKey(dict *ht);
 void dictPrintStats(dict *ht);
 unsigned int dictGenHashFunction(const unsigned char *buf, int len);
+unsigned int dictGenFastHashFunction(const unsigned char *buf, int len);
+uint64_t dictSipHash(const unsigned char *buf, int len, const unsigned char *seed);
+void dictSetHashFunctionSeed(const unsigned char *seed);
+unsigned char *dictGetHashFunctionSeed(void);
 void dictEmpty(dict *ht);
 
 /* Hash table types */
@@ -0,0 +1,388 @@
+/* Hash table micro benchmark: chained vs open addressing dict layouts,
+ * hash function throughput, chain length distribution and the cost of a
+ * lookup through the dictType callbacks vs a DICT_SPECIALIZE instance.
+ *
+ * Copyright (c) 2006-2009, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "dict.h"
+#include "dictspec.h"
+#include "sds.h"
+#include "zmalloc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+/* Keys are sds strings like "key:000000123", the same shape the keyspace
+ * gets from redis-benchmark -r. Lookups use different sds copies of the
+ * keys so that every hit really compares the bytes. */
+
+static unsigned int benchHash(const void *key) {
+    return dictGenHashFunction((const unsigned char*)key, sdslen((sds)key));
+}
+
+/* The unseeded DJB hash (hash*33+c) dictGenHashFunction used to be, kept
+ * here as the reference point */
+static unsigned int djbHash(const unsigned char *buf, int len) {
+    unsigned int hash = 5381;
+
+    while (len--)
+        hash = ((hash << 5) + hash) + (*buf++);
+    return hash;
+}
+
+static unsigned int benchDjbHash(const void *key) {
+    return djbHash((const unsigned char*)key, sdslen((sds)key));
+}
+
+static unsigned int benchFastHash(const void *key) {
+    return dictGenFastHashFunction((const unsigned char*)key, sdslen((sds)key));
+}
+
+static int benchKeyCompare(void *privdata, const void *key1, const void *key2) {
+    size_t l1 = sdslen((sds)key1), l2 = sdslen((sds)key2);
+
+    DICT_NOTUSED(privdata);
+    if (l1 != l2) return 0;
+    return memcmp(key1, key2, l1) == 0;
+}
+
+static void benchKeyDestructor(void *privdata, void *key) {
+    DICT_NOTUSED(privdata);
+    sdsfree(key);
+}
+
+static dictType benchDictType = {
+    benchHash,                  /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    benchKeyCompare,            /* key compare */
+    benchKeyDestructor,         /* key destructor */
+    NULL                        /* val destructor */
+};
+
+static dictType djbDictType = {
+    benchDjbHash, NULL, NULL, benchKeyCompare, benchKeyDestructor, NULL
+};
+
+static dictType fastDictType = {
+    benchFastHash, NULL, NULL, benchKeyCompare, benchKeyDestructor, NULL
+};
+
+/* Same hash and compare as benchDictType, expanded inline */
+#define benchDictHashKey(ht,key) \
+    ((unsigned int)_dictSipHash((const unsigned char*)(key), \
+        sdslen((sds)(key)), dict_hash_function_seed))
+
+static inline int benchDictCompareKeys(dict *ht, const void *key1,
+        const void *key2)
+{
+    size_t l1 = sdslen((sds)key1);
+
+    DICT_NOTUSED(ht);
+    return l1 == sdslen((sds)key2) && memcmp(key1, key2, l1) == 0;
+}
+
+DICT_SPECIALIZE(benchDict, benchDictHashKey, benchDictCompareKeys)
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+static sds *makeKeys(long n, long offset) {
+    sds *keys = zmalloc(sizeof(sds)*n);
+    long j;
+
+    for (j = 0; j < n; j++)
+        keys[j] = sdscatprintf(sdsempty(),"key:%09ld",j+offset);
+    return keys;
+}
+
+static void shuffleKeys(sds *keys, long n) {
+    long j;
+
+    for (j = n-1; j > 0; j--) {
+        long r = random() % (j+1);
+        sds tmp = keys[j];
+
+        keys[j] = keys[r];
+        keys[r] = tmp;
+    }
+}
+
+static void freeKeys(sds *keys, long n) {
+    long j;
+
+    for (j = 0; j < n; j++) sdsfree(keys[j]);
+    zfree(keys);
+}
+
+#define report(name,start,ops) \
+    printf("  %-14s %8.1f ns/op\n", name, \
+        (double)(ustime()-(start))*1000/(ops))
+
+static void benchLayout(const char *name, int layout, long n) {
+    dict *d = dictCreateLayout(&benchDictType,NULL,layout);
+    sds *hits = makeKeys(n,0), *misses = makeKeys(n,n);
+    size_t mem = zmalloc_used_memory();
+    long long start;
+    long j, found = 0;
+    dictIterator *di;
+    dictEntry *de;
+
+    printf("%s, %ld keys\n", name, n);
+    start = ustime();
+    for (j = 0; j < n; j++)
+        dictAdd(d,sdsdup(hits[j]),(void*)j);
+    report("add",start,n);
+    printf("  %-14s %8.1f bytes/key\n", "memory",
+        (double)(zmalloc_used_memory()-mem)/n);
+
+    shuffleKeys(hits,n);
+    start = ustime();
+    for (j = 0; j < n; j++)
+        if (dictFind(d,hits[j])) found++;
+    report("find (hit)",start,n);
+
+    start = ustime();
+    for (j = 0; j < n; j++)
+        if (dictFind(d,misses[j])) found++;
+    report("find (miss)",start,n);
+
+    start = ustime();
+    for (j = 0; j < n; j++)
+        if (dictGetRandomKey(d)) found++;
+    report("random key",start,n);
+
+    start = ustime();
+    di = dictGetIterator(d);
+    while((de = dictNext(di)) != NULL) found++;
+    dictReleaseIterator(di);
+    report("iterate",start,n);
+
+    start = ustime();
+    for (j = 0; j < n; j++)
+        dictDelete(d,hits[j]);
+    report("delete",start,n);
+
+    if (found != 3*n) printf("  BUG: %ld hits, expected %ld\n", found, 3*n);
+    dictRelease(d);
+    freeKeys(hits,n);
+    freeKeys(misses,n);
+}
+
+/* Hash throughput over 'len' byte keys, in MB/s and ns per hash */
+static void benchHashLen(int len) {
+    unsigned char *buf = zmalloc(len+64);
+    long j, iter = 64*1024*1024/(len+16);
+    unsigned int acc = 0;
+    long long start, t[3];
+    int k;
+
+    for (j = 0; j < len+64; j++) buf[j] = random();
+    for (k = 0; k < 3; k++) {
+        start = ustime();
+        for (j = 0; j < iter; j++) {
+            const unsigned char *p = buf+(j & 63);
+
+            if (k == 0) acc += djbHash(p,len);
+            else if (k == 1) acc += dictGenHashFunction(p,len);
+            else acc += dictGenFastHashFunction(p,len);
+        }
+        t[k] = ustime()-start;
+        if (t[k] == 0) t[k] = 1;
+    }
+    printf("  %5d bytes", len);
+    for (k = 0; k < 3; k++)
+        printf("  %7.1f ns %7.0f MB/s", (double)t[k]*1000/iter,
+            (double)len*iter/t[k]);
+    printf("%s\n", acc == 42 ? " " : "");
+    zfree(buf);
+}
+
+static void benchHashFunctions(void) {
+    int lens[] = {4, 12, 32, 128, 1024}, j;
+
+    printf("hash throughput       djb (unseeded)           siphash-1-3               fast (murmur64a)\n");
+    for (j = 0; j < (int)(sizeof(lens)/sizeof(int)); j++)
+        benchHashLen(lens[j]);
+}
+
+/* Fill a chained dict and print how the entries are spread on the chains */
+static void benchChains(const char *name, dictType *type, sds *keys, long n) {
+    dict *d = dictCreate(type,NULL);
+    unsigned long clvector[8], maxchain = 0, i;
+    long long start = ustime();
+    long j;
+
+    for (j = 0; j < n; j++)
+        dictAdd(d,sdsdup(keys[j]),NULL);
+    start = ustime()-start;
+    for (i = 0; i < 8; i++) clvector[i] = 0;
+    for (i = 0; i < d->size; i++) {
+        unsigned long len = 0;
+        dictEntry *he;
+
+        for (he = d->table[i]; he; he = he->u.next) len++;
+        if (len > maxchain) maxchain = len;
+        clvector[len < 7 ? len : 7] += len;
+    }
+    printf("  %-8s add %8.1f ns/op, max chain %6lu, keys in chains of 1..6,7+:",
+        name, (double)start*1000/n, maxchain);
+    for (i = 1; i < 8; i++)
+        printf(" %4.1f%%", (double)clvector[i]*100/n);
+    printf("\n");
+    dictRelease(d);
+}
+
+/* 2^bits keys that all collide under djb: "Ez" and "FY" have the same
+ * hash*33+c value, and so does every concatenation of them */
+static sds *makeDjbCollisions(int bits) {
+    long n = 1L << bits, j;
+    sds *keys = zmalloc(sizeof(sds)*n);
+    int b;
+
+    for (j = 0; j < n; j++) {
+        keys[j] = sdsempty();
+        for (b = 0; b < bits; b++)
+            keys[j] = sdscat(keys[j], (j & (1L << b)) ? "Ez" : "FY");
+    }
+    return keys;
+}
+
+static void benchChainLengths(long n) {
+    sds *keys = makeKeys(n,0);
+    int bits = 13;
+
+    printf("chain lengths, %ld sequential keys\n", n);
+    benchChains("djb",&djbDictType,keys,n);
+    benchChains("siphash",&benchDictType,keys,n);
+    benchChains("fast",&fastDictType,keys,n);
+    freeKeys(keys,n);
+
+    keys = makeDjbCollisions(bits);
+    printf("chain lengths, %ld djb colliding keys\n", 1L << bits);
+    benchChains("djb",&djbDictType,keys,1L << bits);
+    benchChains("siphash",&benchDictType,keys,1L << bits);
+    benchChains("fast",&fastDictType,keys,1L << bits);
+    freeKeys(keys,1L << bits);
+}
+
+/* Time source for the per lookup cost: TSC cycles where available */
+static unsigned long long cycles(void) {
+#ifdef HAVE_RDTSC
+    return __rdtsc();
+#else
+    return ustime()*1000;
+#endif
+}
+
+/* Cost of a successful lookup in a table of n keys, generic dictFind()
+ * vs the specialized benchDictFind(), same table and same keys */
+static void benchSpecializedLookups(const char *name, int layout, long n) {
+    dict *d = dictCreateLayout(&benchDictType,NULL,layout);
+    sds *keys = makeKeys(n,0);
+    long j, found = 0, ops = (n < 4000000) ? 4000000 : n, k;
+    unsigned long long start, t[2];
+    int pass;
+
+    for (j = 0; j < n; j++)
+        dictAdd(d,sdsdup(keys[j]),NULL);
+    shuffleKeys(keys,n);
+    /* Interleave the two variants over a few passes to even out noise */
+    t[0] = t[1] = 0;
+    for (pass = 0; pass < 6; pass++) {
+        int v = pass & 1;
+
+        start = cycles();
+        for (k = 0; k < ops/3; k++) {
+            sds key = keys[k % n];
+
+            if (v == 0) found += dictFind(d,key) != NULL;
+            else found += benchDictFind(d,key) != NULL;
+        }
+        t[v] += cycles()-start;
+    }
+    printf("  %-8s %8ld keys  generic %7.1f  specialized %7.1f %s/lookup (%+.0f%%)\n",
+        name, n, (double)t[0]/(ops), (double)t[1]/(ops),
+#ifdef HAVE_RDTSC
+        "cycles",
+#else
+        "ns",
+#endif
+        (double)t[1]*100/t[0]-100.0);
+    if (found != (ops/3)*6) printf("  BUG: %ld hits\n", found);
+    dictRelease(d);
+    freeKeys(keys,n);
+}
+
+static void benchSpecialized(long n) {
+    long sizes[] = {1000, 100000, n};
+    int j;
+
+    printf("dictFind vs DICT_SPECIALIZE lookups\n");
+    for (j = 0; j < 3; j++) {
+        benchSpecializedLookups("chained",DICT_LAYOUT_CHAINED,sizes[j]);
+        benchSpecializedLookups("open",DICT_LAYOUT_OPEN,sizes[j]);
+    }
+}
+
+int main(int argc, char **argv) {
+    long n = (argc > 1) ? atol(argv[1]) : 1000000;
+    unsigned char seed[16];
+    int j;
+
+    if (n <= 0) {
+        fprintf(stderr,"Usage: dict-benchmark [number of keys]\n");
+        exit(1);
+    }
+    srandom(1234);
+    for (j = 0; j < 16; j++) seed[j] = random();
+    dictSetHashFunctionSeed(seed);
+
+    benchHashFunctions();
+    benchChainLengths(n);
+    benchSpecialized(n);
+    srandom(1234);
+    benchLayout("chained",DICT_LAYOUT_CHAINED,n);
+    srandom(1234);
+    benchLayout("open addressing",DICT_LAYOUT_OPEN,n);
+    return 0;
+}
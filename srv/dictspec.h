@@ -0,0 +1,276 @@
+/* Compile time specialized dict operations.
+ *
+ * Every dictFind()/dictAdd() goes through the dictType function pointers,
+ * so the compiler can't inline the hash and the key compare even for the
+ * hottest tables. DICT_SPECIALIZE() expands the lookup, add, replace and
+ * delete code for a given hash and compare (functions or macros taking the
+ * dict as first argument), so that for a known key type they get inlined.
+ * dict.c instantiates it with the dictType callbacks for the generic API.
+ *
+ * The instance must only be used on dicts whose dictType hashes and
+ * compares keys exactly like 'hashfn' and 'cmpfn': both layouts are
+ * supported, dup/destructor callbacks still go through the dictType.
+ *
+ * Copyright (c) 2006-2009, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __DICTSPEC_H
+#define __DICTSPEC_H
+
+#include <string.h>
+#include <stdint.h>
+
+#include "dict.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* --------------------------- Keyed string hash ---------------------------- */
+
+extern unsigned char dict_hash_function_seed[16];
+
+#define ROTL64(x,b) (uint64_t)(((x) << (b)) | ((x) >> (64-(b))))
+
+/* Little endian 64 bit load of 'len' (<= 8) bytes */
+static inline uint64_t _dictLoad64(const unsigned char *p, int len) {
+    uint64_t v = 0;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (len == 8) {
+        memcpy(&v,p,8);
+        return v;
+    }
+#endif
+    while (len--) v |= ((uint64_t)p[len]) << (len*8);
+    return v;
+}
+
+#define SIPROUND do { \
+    v0 += v1; v1 = ROTL64(v1,13); v1 ^= v0; v0 = ROTL64(v0,32); \
+    v2 += v3; v3 = ROTL64(v3,16); v3 ^= v2; \
+    v0 += v3; v3 = ROTL64(v3,21); v3 ^= v0; \
+    v2 += v1; v1 = ROTL64(v1,17); v1 ^= v2; v2 = ROTL64(v2,32); \
+} while(0)
+
+/* SipHash-1-3 (one compression round per 8 byte block, three finalization
+ * rounds) keyed with the 128 bit seed. Used for every table whose keys come
+ * from clients: the keyspace, the expires and the sets. */
+static inline uint64_t _dictSipHash(const unsigned char *buf, int len,
+        const unsigned char *seed)
+{
+    uint64_t k0 = _dictLoad64(seed,8), k1 = _dictLoad64(seed+8,8);
+    uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+    uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+    uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+    uint64_t v3 = 0x7465646279746573ULL ^ k1;
+    uint64_t m, b = ((uint64_t)len) << 56;
+
+    for (; len >= 8; len -= 8, buf += 8) {
+        m = _dictLoad64(buf,8);
+        v3 ^= m;
+        SIPROUND;
+        v0 ^= m;
+    }
+    b |= _dictLoad64(buf,len);
+    v3 ^= b;
+    SIPROUND;
+    v0 ^= b;
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/* ----------------------- Open addressing control bytes -------------------- */
+
+#define DICT_CTRL_EMPTY   0x80
+#define DICT_CTRL_DELETED 0xFE
+#define DICT_CTRL_FULL(c) (((c) & 0x80) == 0)
+
+/* Not every hashFunction is good in the low bits (the integer ones for
+ * instance), while we take the tag from the low bits and the group from
+ * the rest: mix the hash once before storing it. (murmur3 finalizer) */
+static inline unsigned int _dictOaMix(unsigned int h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static inline int _dictCtz(unsigned int mask)
+{
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int i = 0;
+
+    while (!(mask & 1)) { mask >>= 1; i++; }
+    return i;
+#endif
+}
+
+/* Bit i of the result is set if group[i] == c */
+static inline unsigned int _dictGroupMatch(const unsigned char *group,
+        unsigned char c)
+{
+#if defined(__SSE2__)
+    __m128i g = _mm_loadu_si128((const __m128i*)group);
+    return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)c)));
+#else
+    unsigned int mask = 0;
+    int i;
+
+    for (i = 0; i < DICT_GROUP_WIDTH; i++)
+        if (group[i] == c) mask |= 1u << i;
+    return mask;
+#endif
+}
+
+/* Bit i of the result is set if group[i] is EMPTY or DELETED (high bit set) */
+static inline unsigned int _dictGroupMatchFree(const unsigned char *group)
+{
+#if defined(__SSE2__)
+    return (unsigned int)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+    unsigned int mask = 0;
+    int i;
+
+    for (i = 0; i < DICT_GROUP_WIDTH; i++)
+        if (group[i] & 0x80) mask |= 1u << i;
+    return mask;
+#endif
+}
+
+/* ------------------------------- Template ---------------------------------
+ *
+ * DICT_SPECIALIZE(name, hashfn, cmpfn) defines:
+ *
+ *   dictEntry *nameFindHashed(dict *ht, const void *key, unsigned int h);
+ *   dictEntry *nameFind(dict *ht, const void *key);
+ *   int nameAdd(dict *ht, void *key, void *val);
+ *   int nameReplace(dict *ht, void *key, void *val);
+ *   int nameDelete(dict *ht, const void *key);
+ *   int nameDeleteNoFree(dict *ht, const void *key);
+ *
+ * with the same semantic of the dict.c API. hashfn(ht,key) must return the
+ * value the dictType hashFunction returns, cmpfn(ht,key1,key2) non zero if
+ * the keys are equal. Only the lookup is expanded: inserting a key known to
+ * be missing (dictAddHashed) and unlinking a found entry (dictDeleteEntry)
+ * need neither the hash function nor the compare. */
+
+#define DICT_SPECIALIZE(name, hashfn, cmpfn) \
+static inline dictEntry *name##FindHashed(dict *ht, const void *key, \
+        unsigned int h) \
+{ \
+    dictEntry *he; \
+\
+    if (ht->size == 0) return NULL; \
+    if (ht->layout == DICT_LAYOUT_OPEN) { \
+        unsigned long gmask = (ht->size/DICT_GROUP_WIDTH)-1, g, step; \
+        unsigned char tag; \
+\
+        h = _dictOaMix(h); \
+        g = (h >> 7) & gmask; \
+        tag = h & 0x7f; \
+        for (step = 0; step <= gmask; step++) { \
+            unsigned long base = g*DICT_GROUP_WIDTH; \
+            unsigned int mask = _dictGroupMatch(ht->ctrl+base, tag); \
+\
+            while (mask) { \
+                he = ht->slots+base+_dictCtz(mask); \
+                if (he->u.hash == h && cmpfn(ht, key, he->key)) return he; \
+                mask &= mask-1; \
+            } \
+            if (_dictGroupMatch(ht->ctrl+base, DICT_CTRL_EMPTY)) break; \
+            g = (g+step+1) & gmask; \
+        } \
+        return NULL; \
+    } \
+    he = ht->table[h & ht->sizemask]; \
+    while (he) { \
+        if (cmpfn(ht, key, he->key)) return he; \
+        he = he->u.next; \
+    } \
+    return NULL; \
+} \
+\
+static inline dictEntry *name##Find(dict *ht, const void *key) \
+{ \
+    if (ht->size == 0) return NULL; \
+    return name##FindHashed(ht, key, hashfn(ht, key)); \
+} \
+\
+static inline int name##Add(dict *ht, void *key, void *val) \
+{ \
+    unsigned int h = hashfn(ht, key); \
+\
+    if (name##FindHashed(ht, key, h)) return DICT_ERR; \
+    return dictAddHashed(ht, key, val, h) ? DICT_OK : DICT_ERR; \
+} \
+\
+static inline int name##Replace(dict *ht, void *key, void *val) \
+{ \
+    unsigned int h = hashfn(ht, key); \
+    dictEntry *he = name##FindHashed(ht, key, h); \
+\
+    if (he == NULL) \
+        return dictAddHashed(ht, key, val, h) ? DICT_OK : DICT_ERR; \
+    /* Free the old value and set the new one */ \
+    dictFreeEntryVal(ht, he); \
+    dictSetHashVal(ht, he, val); \
+    return DICT_OK; \
+} \
+\
+static inline int name##GenericDelete(dict *ht, const void *key, int nofree) \
+{ \
+    unsigned int h; \
+    dictEntry *he; \
+\
+    if (ht->size == 0) return DICT_ERR; \
+    h = hashfn(ht, key); \
+    if ((he = name##FindHashed(ht, key, h)) == NULL) return DICT_ERR; \
+    dictDeleteEntry(ht, he, h, nofree); \
+    return DICT_OK; \
+} \
+\
+static inline int name##Delete(dict *ht, const void *key) \
+{ \
+    return name##GenericDelete(ht, key, 0); \
+} \
+\
+static inline int name##DeleteNoFree(dict *ht, const void *key) \
+{ \
+    return name##GenericDelete(ht, key, 1); \
+}
+
+#endif /* __DICTSPEC_H */
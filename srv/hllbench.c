@@ -0,0 +1,173 @@
+/* HyperLogLog benchmark: estimate error from 10 to 10M elements, PFADD and
+ * PFCOUNT speed, and PFMERGE with every registers max implementation.
+ *
+ * Copyright (c) 2006-2009, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+
+#include "sds.h"
+#include "bitops.h"
+#include "hyperloglog.h"
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+/* Add 'count' distinct elements of the given 'trial' */
+static sds addElements(sds hll, int trial, long count) {
+    char buf[64];
+    long j;
+
+    for (j = 0; j < count; j++) {
+        int len = snprintf(buf,sizeof(buf),"trial:%d:ele:%ld",trial,j);
+
+        hllAdd(&hll,(unsigned char*)buf,len,HLL_SPARSE_MAX_BYTES);
+    }
+    return hll;
+}
+
+static void accuracy(void) {
+    static const long cards[] = {10,100,1000,10000,100000,1000000,10000000};
+    int trials = 5, i, t;
+
+    printf("Accuracy (%d trials each, standard error %.2f%%)\n", trials,
+        104.0/sqrt(HLL_REGISTERS));
+    printf("  %10s %12s %10s %10s %8s\n","elements","estimated","mean err",
+        "max err","bytes");
+    for (i = 0; i < (int)(sizeof(cards)/sizeof(cards[0])); i++) {
+        double sumerr = 0, maxerr = 0;
+        long long est = 0;
+        size_t bytes = 0;
+
+        for (t = 0; t < trials; t++) {
+            sds hll = addElements(hllCreate(),t,cards[i]);
+            double err;
+
+            est = hllCount(hll);
+            err = fabs((double)est-cards[i])/cards[i]*100;
+            sumerr += err;
+            if (err > maxerr) maxerr = err;
+            bytes = sdslen(hll);
+            sdsfree(hll);
+        }
+        printf("  %10ld %12lld %9.3f%% %9.3f%% %8zu\n", cards[i], est,
+            sumerr/trials, maxerr, bytes);
+    }
+}
+
+static void throughput(void) {
+    long count = 1000000, rounds = 1000, j;
+    long long start, us, card = 0;
+    sds sparse, dense;
+
+    printf("Throughput\n");
+    /* Sparse all along: the first 1000 elements, many times */
+    start = ustime();
+    for (j = 0; j < rounds; j++) {
+        sparse = addElements(hllCreate(),(int)j,1000);
+        sdsfree(sparse);
+    }
+    us = ustime()-start;
+    printf("  %-32s %8.1f ns/element\n", "PFADD sparse (1000 elements)",
+        (double)us*1000/(rounds*1000));
+
+    dense = addElements(hllCreate(),0,count);
+    start = ustime();
+    dense = addElements(dense,1,count);
+    us = ustime()-start;
+    printf("  %-32s %8.1f ns/element\n", "PFADD dense", (double)us*1000/count);
+
+    sparse = addElements(hllCreate(),0,1000);
+    start = ustime();
+    for (j = 0; j < rounds; j++) {
+        sparse[15] |= (char)0x80;   /* Stale cache: count again */
+        card += hllCount(sparse);
+    }
+    printf("  %-32s %8.1f us\n", "PFCOUNT sparse, not cached",
+        (double)(ustime()-start)/rounds);
+    start = ustime();
+    for (j = 0; j < rounds; j++) {
+        dense[15] |= (char)0x80;
+        card += hllCount(dense);
+    }
+    printf("  %-32s %8.1f us\n", "PFCOUNT dense, not cached",
+        (double)(ustime()-start)/rounds);
+    sdsfree(sparse);
+    sdsfree(dense);
+    if (card == 0) printf("?\n");
+}
+
+/* PFMERGE/PFCOUNT of many keys: unpack every dense HyperLogLog to a byte
+ * per register and take the max */
+static void merge(const char *impl, sds *hlls, int numhlls) {
+    unsigned char regs[HLL_REGISTERS];
+    int rounds = 200, j, k;
+    long long start;
+    uint64_t card = 0;
+
+    if (bitopsSelect(impl) == -1) {
+        printf("  %-10s not supported by this CPU\n", impl);
+        return;
+    }
+    start = ustime();
+    for (j = 0; j < rounds; j++) {
+        memset(regs,0,sizeof(regs));
+        for (k = 0; k < numhlls; k++) hllMergeRegisters(regs,hlls[k]);
+        card += hllCountRegisters(regs);
+    }
+    printf("  %-10s %8.2f us per key\n", impl,
+        (double)(ustime()-start)/rounds/numhlls);
+    if (card == 0) printf("?\n");
+}
+
+int main(void) {
+    sds hlls[100];
+    int numhlls = 100, j;
+
+    bitopsInit();
+    accuracy();
+    throughput();
+
+    printf("PFMERGE of %d dense keys\n", numhlls);
+    for (j = 0; j < numhlls; j++) hlls[j] = addElements(hllCreate(),j,20000);
+    merge("portable",hlls,numhlls);
+    merge("sse",hlls,numhlls);
+    merge("avx2",hlls,numhlls);
+    for (j = 0; j < numhlls; j++) sdsfree(hlls[j]);
+    return 0;
+}
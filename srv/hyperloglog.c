@@ -0,0 +1,569 @@
+/* HyperLogLog cardinality estimator, stored in a string value so that it is
+ * persisted and replicated like any other string.
+ *
+ * Copyright (c) 2006-2009, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Layout: a 16 bytes header followed by the registers.
+ *
+ * +------+---+-----+----------+
+ * | HYLL | E | N/U | Cardin.  |
+ * +------+---+-----+----------+
+ *
+ * E is the encoding (dense or sparse), N/U unused, Cardin. the last
+ * cardinality computed, 64 bit little endian: its most significant bit set
+ * means the cache is stale (a register changed since).
+ *
+ * The element hash (64 bit) gives a register index from its low HLL_P bits,
+ * and from the rest the count of the trailing zeros plus one, at most
+ * HLL_Q+1 = 51, that is stored in the register if greater than the current
+ * value.
+ *
+ * Dense: HLL_REGISTERS 6 bit registers, 12k, register i at bit i*6 with the
+ * least significant bits first, so every 3 bytes hold 4 registers.
+ *
+ * Sparse: run length encoded with three opcodes, good while most registers
+ * are zero. A new HyperLogLog is a single XZERO opcode: 18 bytes.
+ *
+ *   ZERO:  00xxxxxx           1..64 registers set to 0
+ *   XZERO: 01xxxxxx yyyyyyyy  1..16384 registers set to 0
+ *   VAL:   1vvvvvxx           1..4 registers set to the value 1..32
+ *
+ * It is converted to dense once larger than hll-sparse-max-bytes or a
+ * register greater than 32 is set. The conversion is one way.
+ *
+ * The cardinality is estimated from the histogram of the register values
+ * with the estimator of Otmar Ertl, "New cardinality estimation algorithms
+ * for HyperLogLog sketches", that has no bias correction table and is
+ * accurate for small and large cardinalities alike. Standard error is
+ * 1.04/sqrt(HLL_REGISTERS) = 0.81%.
+ *
+ * Merging (PFMERGE, PFCOUNT of many keys) turns every input into one byte
+ * per register (bitopsUnpack6() for the dense ones) and takes the max of the
+ * bytes with bitopsMaxBytes(), both vectorized. */
+
+#include <string.h>
+#include <math.h>
+
+#include "hyperloglog.h"
+#include "bitops.h"
+
+#define HLL_Q (64-HLL_P)        /* Bits left for the run of zeros */
+#define HLL_P_MASK (HLL_REGISTERS-1)
+#define HLL_BITS 6
+#define HLL_REGISTER_MAX ((1<<HLL_BITS)-1)
+#define HLL_HDR_SIZE 16
+#define HLL_DENSE_SIZE (HLL_HDR_SIZE+((HLL_REGISTERS*HLL_BITS+7)/8))
+#define HLL_DENSE 0
+#define HLL_SPARSE 1
+
+#define HLL_ENCODING(s) ((unsigned char)(s)[4])
+#define HLL_REGS(s) ((unsigned char*)(s)+HLL_HDR_SIZE)
+#define HLL_INVALIDATE_CACHE(s) ((s)[15] |= (char)(1<<7))
+#define HLL_VALID_CACHE(s) (((s)[15] & (1<<7)) == 0)
+
+/* Sparse opcodes */
+#define HLL_SPARSE_XZERO_BIT 0x40
+#define HLL_SPARSE_VAL_BIT 0x80
+#define HLL_SPARSE_IS_ZERO(p) (((*(p)) & 0xc0) == 0)
+#define HLL_SPARSE_IS_XZERO(p) (((*(p)) & 0xc0) == HLL_SPARSE_XZERO_BIT)
+#define HLL_SPARSE_IS_VAL(p) ((*(p)) & HLL_SPARSE_VAL_BIT)
+#define HLL_SPARSE_ZERO_LEN(p) (((*(p)) & 0x3f)+1)
+#define HLL_SPARSE_XZERO_LEN(p) (((((*(p)) & 0x3f) << 8) | (*((p)+1)))+1)
+#define HLL_SPARSE_VAL_VALUE(p) ((((*(p)) >> 2) & 0x1f)+1)
+#define HLL_SPARSE_VAL_LEN(p) (((*(p)) & 0x3)+1)
+#define HLL_SPARSE_VAL_MAX_VALUE 32
+#define HLL_SPARSE_VAL_MAX_LEN 4
+#define HLL_SPARSE_ZERO_MAX_LEN 64
+#define HLL_SPARSE_XZERO_MAX_LEN 16384
+#define HLL_SPARSE_VAL(v,len) \
+    ((unsigned char)(HLL_SPARSE_VAL_BIT | (((v)-1) << 2) | ((len)-1)))
+
+/* ------------------------------- Hashing ---------------------------------- */
+
+/* MurmurHash2, 64 bit version (MurmurHash64A), by Austin Appleby. Endian
+ * neutral: the same element gives the same register on every host, so the
+ * strings can be moved between them. */
+static uint64_t hllMurmurHash64A(const void *key, size_t len, uint64_t seed) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = seed ^ (len * m);
+    const unsigned char *data = key;
+    const unsigned char *end = data + (len-(len&7));
+
+    while (data != end) {
+        uint64_t k = (uint64_t)data[0] | ((uint64_t)data[1] << 8) |
+                     ((uint64_t)data[2] << 16) | ((uint64_t)data[3] << 24) |
+                     ((uint64_t)data[4] << 32) | ((uint64_t)data[5] << 40) |
+                     ((uint64_t)data[6] << 48) | ((uint64_t)data[7] << 56);
+
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+        data += 8;
+    }
+
+    switch(len & 7) {
+    case 7: h ^= (uint64_t)data[6] << 48; /* fall through */
+    case 6: h ^= (uint64_t)data[5] << 40; /* fall through */
+    case 5: h ^= (uint64_t)data[4] << 32; /* fall through */
+    case 4: h ^= (uint64_t)data[3] << 24; /* fall through */
+    case 3: h ^= (uint64_t)data[2] << 16; /* fall through */
+    case 2: h ^= (uint64_t)data[1] << 8; /* fall through */
+    case 1: h ^= (uint64_t)data[0];
+            h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+/* Register index and count (trailing zeros + 1) of an element */
+static int hllPatLen(const unsigned char *ele, size_t len, long *index) {
+    uint64_t hash = hllMurmurHash64A(ele,len,0xadc83b19ULL);
+    int count = 1;
+
+    *index = (long)(hash & HLL_P_MASK);
+    hash >>= HLL_P;
+    hash |= (uint64_t)1 << HLL_Q;   /* Stop at HLL_Q+1 at most */
+#if defined(__GNUC__)
+    count += __builtin_ctzll(hash);
+#else
+    while (!(hash & 1)) {
+        count++;
+        hash >>= 1;
+    }
+#endif
+    return count;
+}
+
+/* -------------------------------- Dense ----------------------------------- */
+
+/* Register i. The byte after the last register is always readable: it is
+ * the sds null term. */
+static inline int hllDenseGet(const unsigned char *r, long i) {
+    unsigned long byte = (unsigned long)i*HLL_BITS/8;
+    unsigned int fb = ((unsigned long)i*HLL_BITS) & 7;
+
+    return ((r[byte] >> fb) | (r[byte+1] << (8-fb))) & HLL_REGISTER_MAX;
+}
+
+static inline void hllDenseSetRegister(unsigned char *r, long i, int val) {
+    unsigned long byte = (unsigned long)i*HLL_BITS/8;
+    unsigned int fb = ((unsigned long)i*HLL_BITS) & 7;
+
+    r[byte] &= ~(HLL_REGISTER_MAX << fb);
+    r[byte] |= val << fb;
+    r[byte+1] &= ~(HLL_REGISTER_MAX >> (8-fb));
+    r[byte+1] |= val >> (8-fb);
+}
+
+static int hllDenseSet(unsigned char *r, long index, int count) {
+    if (count <= hllDenseGet(r,index)) return 0;
+    hllDenseSetRegister(r,index,count);
+    return 1;
+}
+
+/* -------------------------------- Sparse ---------------------------------- */
+
+/* Length of the opcode at 'p' and the number of registers it covers */
+#define HLL_SPARSE_OPCODE(p,oplen,span) do { \
+    if (HLL_SPARSE_IS_ZERO(p)) { \
+        (oplen) = 1; (span) = HLL_SPARSE_ZERO_LEN(p); \
+    } else if (HLL_SPARSE_IS_XZERO(p)) { \
+        (oplen) = 2; (span) = HLL_SPARSE_XZERO_LEN(p); \
+    } else { \
+        (oplen) = 1; (span) = HLL_SPARSE_VAL_LEN(p); \
+    } \
+} while(0)
+
+/* Append to 'p' the opcodes for a run of 'len' zeros, returns the bytes
+ * written */
+static int hllSparseZeros(unsigned char *p, long len) {
+    int n = 0;
+
+    while (len > 0) {
+        if (len > HLL_SPARSE_ZERO_MAX_LEN) {
+            long l = len > HLL_SPARSE_XZERO_MAX_LEN ? HLL_SPARSE_XZERO_MAX_LEN : len;
+
+            if (p) {
+                p[n] = HLL_SPARSE_XZERO_BIT | ((l-1) >> 8);
+                p[n+1] = (l-1) & 0xff;
+            }
+            n += 2;
+            len -= l;
+        } else {
+            if (p) p[n] = len-1;
+            n++;
+            len = 0;
+        }
+    }
+    return n;
+}
+
+/* Append the opcodes for a run of 'len' registers set to 'val' (1..32) */
+static int hllSparseVals(unsigned char *p, int val, long len) {
+    int n = 0;
+
+    while (len > 0) {
+        long l = len > HLL_SPARSE_VAL_MAX_LEN ? HLL_SPARSE_VAL_MAX_LEN : len;
+
+        if (p) p[n] = HLL_SPARSE_VAL(val,l);
+        n++;
+        len -= l;
+    }
+    return n;
+}
+
+/* Encode one byte per register as sparse into 'p' (or just measure it if
+ * 'p' is NULL). Returns the length, -1 if a register is greater than 32. */
+static long hllSparseEncode(unsigned char *p, const unsigned char *regs) {
+    long i = 0, n = 0;
+
+    while (i < HLL_REGISTERS) {
+        int val = regs[i];
+        long j = i+1;
+
+        if (val > HLL_SPARSE_VAL_MAX_VALUE) return -1;
+        while (j < HLL_REGISTERS && regs[j] == val) j++;
+        if (val == 0)
+            n += hllSparseZeros(p ? p+n : NULL,j-i);
+        else
+            n += hllSparseVals(p ? p+n : NULL,val,j-i);
+        i = j;
+    }
+    return n;
+}
+
+/* Run BODY for every opcode with the registers first..first+span-1 set to
+ * val. At the end 'first' is HLL_REGISTERS unless the string is corrupted
+ * (an opcode cut by the end of the string or going past the last register
+ * sets it to -1). */
+#define HLL_SPARSE_FOREACH(s,first,span,val,BODY) do { \
+    unsigned char *_p = HLL_REGS(s), *_end = (unsigned char*)(s)+sdslen(s); \
+    long _oplen; \
+    (first) = 0; \
+    while (_p < _end) { \
+        HLL_SPARSE_OPCODE(_p,_oplen,span); \
+        if (_p+_oplen > _end || (first)+(span) > HLL_REGISTERS) { \
+            (first) = -1; \
+            break; \
+        } \
+        (val) = HLL_SPARSE_IS_VAL(_p) ? HLL_SPARSE_VAL_VALUE(_p) : 0; \
+        BODY; \
+        (first) += (span); \
+        _p += _oplen; \
+    } \
+} while(0)
+
+/* Convert a sparse HyperLogLog to dense, -1 if corrupted */
+static int hllSparseToDense(sds *sp) {
+    sds s = *sp, dense;
+    long first, span, i;
+    int val;
+
+    dense = sdsnewlen(NULL,HLL_DENSE_SIZE);
+    memcpy(dense,s,HLL_HDR_SIZE);
+    dense[4] = HLL_DENSE;
+    HLL_SPARSE_FOREACH(s,first,span,val,
+        if (val) for (i = 0; i < span; i++)
+            hllDenseSetRegister(HLL_REGS(dense),first+i,val));
+    if (first != HLL_REGISTERS) {
+        sdsfree(dense);
+        return -1;
+    }
+    sdsfree(s);
+    *sp = dense;
+    return 0;
+}
+
+/* Set register 'index' to 'count' if greater, splitting the opcode that
+ * covers it in up to three (the registers before, the new value, the ones
+ * after), then merging the VAL opcodes around that can be merged. */
+static int hllSparseSet(sds *sp, long index, int count, size_t sparse_max) {
+    sds s = *sp;
+    unsigned char *p, *end, *prev = NULL, seq[5];
+    long first = 0, span = 0, oplen = 0, before, after, off, prevoff, oldlen;
+    int n = 0, scan;
+
+    if (count > HLL_SPARSE_VAL_MAX_VALUE) goto promote;
+
+    /* Find the opcode covering 'index' */
+    p = HLL_REGS(s);
+    end = (unsigned char*)s+sdslen(s);
+    while (p < end) {
+        HLL_SPARSE_OPCODE(p,oplen,span);
+        if (p+oplen > end) return -1;
+        if (index < first+span) break;
+        first += span;
+        prev = p;
+        p += oplen;
+    }
+    if (p >= end) return -1;
+
+    if (HLL_SPARSE_IS_VAL(p)) {
+        int oldval = HLL_SPARSE_VAL_VALUE(p);
+
+        if (oldval >= count) return 0;
+        if (span == 1) {
+            *p = HLL_SPARSE_VAL(count,1);
+            goto merge;
+        }
+        before = index-first;
+        after = first+span-1-index;
+        n += hllSparseVals(seq+n,oldval,before);
+        n += hllSparseVals(seq+n,count,1);
+        n += hllSparseVals(seq+n,oldval,after);
+    } else {
+        before = index-first;
+        after = first+span-1-index;
+        n += hllSparseZeros(seq+n,before);
+        n += hllSparseVals(seq+n,count,1);
+        n += hllSparseZeros(seq+n,after);
+    }
+
+    /* Replace the opcode with the new sequence */
+    oldlen = sdslen(s);
+    if ((size_t)(oldlen+n-oplen) > sparse_max) goto promote;
+    off = p-(unsigned char*)s;
+    prevoff = prev ? prev-(unsigned char*)s : -1;
+    if (n > oplen) s = sdsGrowZero(s,oldlen+n-oplen);
+    p = (unsigned char*)s+off;
+    prev = (prevoff == -1) ? NULL : (unsigned char*)s+prevoff;
+    memmove(p+n,p+oplen,oldlen-off-oplen);
+    memcpy(p,seq,n);
+    sdssetlen(s,oldlen+n-oplen);
+    s[oldlen+n-oplen] = '\0';
+
+merge:
+    /* Merge adjacent VAL opcodes with the same value, starting from the one
+     * before the change, just a few opcodes far */
+    if (prev) p = prev;
+    end = (unsigned char*)s+sdslen(s);
+    for (scan = 0; scan < 5 && p < end; scan++) {
+        if (HLL_SPARSE_IS_VAL(p) && p+1 < end && HLL_SPARSE_IS_VAL(p+1)) {
+            int v1 = HLL_SPARSE_VAL_VALUE(p), l1 = HLL_SPARSE_VAL_LEN(p);
+            int v2 = HLL_SPARSE_VAL_VALUE(p+1), l2 = HLL_SPARSE_VAL_LEN(p+1);
+
+            if (v1 == v2 && l1+l2 <= HLL_SPARSE_VAL_MAX_LEN) {
+                *p = HLL_SPARSE_VAL(v1,l1+l2);
+                memmove(p+1,p+2,end-(p+2));
+                end--;
+                continue;
+            }
+        }
+        p += HLL_SPARSE_IS_XZERO(p) ? 2 : 1;
+    }
+    sdssetlen(s,end-(unsigned char*)s);
+    s[sdslen(s)] = '\0';
+    *sp = s;
+    return 1;
+
+promote:
+    if (hllSparseToDense(sp) == -1) return -1;
+    return hllDenseSet(HLL_REGS(*sp),index,count);
+}
+
+/* ------------------------------ Estimator --------------------------------- */
+
+static double hllTau(double x) {
+    double zprime, y = 1.0, z;
+
+    if (x == 0. || x == 1.) return 0.;
+    z = 1-x;
+    do {
+        x = sqrt(x);
+        zprime = z;
+        y *= 0.5;
+        z -= pow(1-x,2)*y;
+    } while (zprime != z);
+    return z/3;
+}
+
+static double hllSigma(double x) {
+    double zprime, y = 1, z;
+
+    if (x == 1.) return INFINITY;
+    z = x;
+    do {
+        x *= x;
+        zprime = z;
+        z += x*y;
+        y += y;
+    } while (zprime != z);
+    return z;
+}
+
+/* Histogram of one byte per register. Four partial histograms, so that
+ * runs of equal registers don't wait on the same counter. */
+static void hllHistogram(const unsigned char *regs, long *reghisto) {
+    long h[4][64], i;
+    int j;
+
+    memset(h,0,sizeof(h));
+    for (i = 0; i < HLL_REGISTERS; i += 4) {
+        h[0][regs[i] & 63]++;
+        h[1][regs[i+1] & 63]++;
+        h[2][regs[i+2] & 63]++;
+        h[3][regs[i+3] & 63]++;
+    }
+    for (j = 0; j < 64; j++) reghisto[j] = h[0][j]+h[1][j]+h[2][j]+h[3][j];
+}
+
+/* Cardinality from the histogram of the register values */
+static uint64_t hllEstimate(const long *reghisto) {
+    double m = HLL_REGISTERS, z;
+    int j;
+
+    z = m*hllTau((m-reghisto[HLL_Q+1])/m);
+    for (j = HLL_Q; j >= 1; j--) {
+        z += reghisto[j];
+        z *= 0.5;
+    }
+    z += m*hllSigma(reghisto[0]/m);
+    return (uint64_t)llround(0.5/log(2)*m*m/z);
+}
+
+/* ---------------------------------- API ----------------------------------- */
+
+sds hllCreate(void) {
+    sds s = sdsnewlen(NULL,HLL_HDR_SIZE+2);
+
+    memcpy(s,"HYLL",4);
+    s[4] = HLL_SPARSE;
+    hllSparseZeros(HLL_REGS(s),HLL_REGISTERS);
+    return s;   /* Cached cardinality 0, valid */
+}
+
+int hllIsValid(sds s) {
+    size_t len = sdslen(s);
+
+    if (len < HLL_HDR_SIZE || memcmp(s,"HYLL",4)) return 0;
+    if (HLL_ENCODING(s) == HLL_DENSE) return len == HLL_DENSE_SIZE;
+    if (HLL_ENCODING(s) == HLL_SPARSE) {
+        /* Every opcode complete, the spans covering all the registers */
+        long first, span;
+        int val;
+
+        HLL_SPARSE_FOREACH(s,first,span,val,(void)val);
+        return first == HLL_REGISTERS;
+    }
+    return 0;
+}
+
+int hllIsSparse(sds s) {
+    return HLL_ENCODING(s) == HLL_SPARSE;
+}
+
+int hllAdd(sds *s, const unsigned char *ele, size_t len, size_t sparse_max) {
+    long index;
+    int count = hllPatLen(ele,len,&index), retval;
+
+    if (HLL_ENCODING(*s) == HLL_DENSE)
+        retval = hllDenseSet(HLL_REGS(*s),index,count);
+    else
+        retval = hllSparseSet(s,index,count,sparse_max);
+    if (retval == 1) HLL_INVALIDATE_CACHE(*s);
+    return retval;
+}
+
+long long hllCount(sds s) {
+    unsigned char *c = (unsigned char*)s+8;
+    long reghisto[64] = {0};
+    uint64_t card;
+    int j;
+
+    if (HLL_VALID_CACHE(s)) {
+        for (card = 0, j = 7; j >= 0; j--) card = (card << 8) | c[j];
+        return (long long)card;
+    }
+
+    if (HLL_ENCODING(s) == HLL_DENSE) {
+        unsigned char regs[HLL_REGISTERS];
+
+        bitopsUnpack6(regs,HLL_REGS(s),HLL_REGISTERS);
+        hllHistogram(regs,reghisto);
+    } else {
+        long first, span;
+        int val;
+
+        HLL_SPARSE_FOREACH(s,first,span,val,reghisto[val] += span);
+        if (first != HLL_REGISTERS) return -1;
+    }
+    card = hllEstimate(reghisto);
+    for (j = 0; j < 8; j++) c[j] = (card >> (j*8)) & 0xff;
+    return (long long)card;
+}
+
+int hllMergeRegisters(unsigned char *regs, sds s) {
+    if (HLL_ENCODING(s) == HLL_DENSE) {
+        unsigned char tmp[HLL_REGISTERS];
+
+        bitopsUnpack6(tmp,HLL_REGS(s),HLL_REGISTERS);
+        bitopsMaxBytes(regs,tmp,HLL_REGISTERS);
+    } else {
+        long first, span, i;
+        int val;
+
+        HLL_SPARSE_FOREACH(s,first,span,val,
+            if (val) for (i = first; i < first+span; i++)
+                if (regs[i] < val) regs[i] = val);
+        if (first != HLL_REGISTERS) return -1;
+    }
+    return 0;
+}
+
+uint64_t hllCountRegisters(const unsigned char *regs) {
+    long reghisto[64];
+
+    hllHistogram(regs,reghisto);
+    return hllEstimate(reghisto);
+}
+
+sds hllFromRegisters(const unsigned char *regs, size_t sparse_max) {
+    long len = hllSparseEncode(NULL,regs), i;
+    sds s;
+
+    if (len != -1 && (size_t)(HLL_HDR_SIZE+len) <= sparse_max) {
+        s = sdsnewlen(NULL,HLL_HDR_SIZE+len);
+        s[4] = HLL_SPARSE;
+        hllSparseEncode(HLL_REGS(s),regs);
+    } else {
+        s = sdsnewlen(NULL,HLL_DENSE_SIZE);
+        s[4] = HLL_DENSE;
+        for (i = 0; i < HLL_REGISTERS; i++)
+            if (regs[i]) hllDenseSetRegister(HLL_REGS(s),i,regs[i]);
+    }
+    memcpy(s,"HYLL",4);
+    HLL_INVALIDATE_CACHE(s);
+    return s;
+}
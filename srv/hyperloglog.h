@@ -0,0 +1,63 @@
+/* hyperloglog.h - HyperLogLog cardinality estimator stored in a string
+ *
+ * Copyright (c) 2006-2009, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __HYPERLOGLOG_H__
+#define __HYPERLOGLOG_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sds.h"
+
+#define HLL_P 14                            /* Index bits: 2^14 registers */
+#define HLL_REGISTERS (1<<HLL_P)
+#define HLL_SPARSE_MAX_BYTES 3000           /* Default sparse size limit */
+
+/* An empty (sparse) HyperLogLog */
+sds hllCreate(void);
+/* Non zero if 's' has a valid HyperLogLog header and size, and for the
+ * sparse encoding complete opcodes covering exactly HLL_REGISTERS */
+int hllIsValid(sds s);
+int hllIsSparse(sds s);
+/* Add an element. Returns 1 if a register changed, 0 if not, -1 if the
+ * sparse representation is corrupted. The string may be reallocated, and
+ * is converted to dense once the sparse form gets larger than 'sparse_max'
+ * bytes or a register too large for it is set. */
+int hllAdd(sds *s, const unsigned char *ele, size_t len, size_t sparse_max);
+/* Estimated cardinality, cached in the header (so 's' is written if the
+ * cache is stale). -1 if the sparse representation is corrupted. */
+long long hllCount(sds s);
+
+/* Merging works on HLL_REGISTERS bytes, one per register */
+int hllMergeRegisters(unsigned char *regs, sds s);
+uint64_t hllCountRegisters(const unsigned char *regs);
+sds hllFromRegisters(const unsigned char *regs, size_t sparse_max);
+
+#endif /* __HYPERLOGLOG_H__ */
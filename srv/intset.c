@@ -0,0 +1,299 @@
+/* intset.c - A sorted set of integers stored in a single allocation
+ *
+ * The integers are kept sorted in a packed array, all with the same width:
+ * 16, 32 or 64 bits. The array is upgraded to a bigger width as soon as a
+ * value that does not fit is added, and never downgraded. Lookups are
+ * binary searches. Values are stored in host byte order: intsets are
+ * never written to disk as they are.
+ *
+ * Copyright (c) 2006-2009, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "zmalloc.h"
+#include "intset.h"
+
+#define INTSET_ENC_INT16 (sizeof(int16_t))
+#define INTSET_ENC_INT32 (sizeof(int32_t))
+#define INTSET_ENC_INT64 (sizeof(int64_t))
+
+/* Smallest encoding able to store 'v' */
+static uint8_t _intsetValueEncoding(int64_t v) {
+    if (v < INT32_MIN || v > INT32_MAX)
+        return INTSET_ENC_INT64;
+    else if (v < INT16_MIN || v > INT16_MAX)
+        return INTSET_ENC_INT32;
+    return INTSET_ENC_INT16;
+}
+
+static int64_t _intsetGetEncoded(intset *is, int pos, uint8_t enc) {
+    if (enc == INTSET_ENC_INT64)
+        return ((int64_t*)is->contents)[pos];
+    else if (enc == INTSET_ENC_INT32)
+        return ((int32_t*)is->contents)[pos];
+    return ((int16_t*)is->contents)[pos];
+}
+
+static int64_t _intsetGet(intset *is, int pos) {
+    return _intsetGetEncoded(is,pos,is->encoding);
+}
+
+static void _intsetSet(intset *is, int pos, int64_t value) {
+    if (is->encoding == INTSET_ENC_INT64)
+        ((int64_t*)is->contents)[pos] = value;
+    else if (is->encoding == INTSET_ENC_INT32)
+        ((int32_t*)is->contents)[pos] = (int32_t)value;
+    else
+        ((int16_t*)is->contents)[pos] = (int16_t)value;
+}
+
+static intset *_intsetCreate(uint8_t enc, uint32_t len) {
+    intset *is = zmalloc(sizeof(intset)+(size_t)len*enc);
+
+    is->encoding = enc;
+    is->length = 0;
+    return is;
+}
+
+intset *intsetNew(void) {
+    return _intsetCreate(INTSET_ENC_INT16,0);
+}
+
+static intset *intsetResize(intset *is, uint32_t len) {
+    return zrealloc(is,sizeof(intset)+(size_t)len*is->encoding);
+}
+
+/* Binary search. Return 1 when found, and set 'pos' to the position of the
+ * value or to the position where it should be inserted. */
+static uint8_t intsetSearch(intset *is, int64_t value, uint32_t *pos) {
+    int min = 0, max = (int)is->length-1, mid = -1;
+    int64_t cur = -1;
+
+    if (is->length == 0) {
+        if (pos) *pos = 0;
+        return 0;
+    }
+    /* Check for the cases where we know we cannot find the value, but
+     * do know the insert position: appending in order is common. */
+    if (value > _intsetGet(is,max)) {
+        if (pos) *pos = is->length;
+        return 0;
+    } else if (value < _intsetGet(is,0)) {
+        if (pos) *pos = 0;
+        return 0;
+    }
+
+    while (max >= min) {
+        mid = (min+max)/2;
+        cur = _intsetGet(is,mid);
+        if (value > cur) {
+            min = mid+1;
+        } else if (value < cur) {
+            max = mid-1;
+        } else {
+            break;
+        }
+    }
+
+    if (value == cur) {
+        if (pos) *pos = mid;
+        return 1;
+    } else {
+        if (pos) *pos = min;
+        return 0;
+    }
+}
+
+/* Upgrade the encoding and add 'value', that is either smaller or bigger
+ * than every element because it did not fit the old encoding. */
+static intset *intsetUpgradeAndAdd(intset *is, int64_t value) {
+    uint8_t curenc = is->encoding;
+    int length = is->length;
+    int prepend = value < 0 ? 1 : 0;
+
+    is->encoding = _intsetValueEncoding(value);
+    is = intsetResize(is,is->length+1);
+
+    /* Upgrade back-to-front so we don't overwrite values */
+    while(length--)
+        _intsetSet(is,length+prepend,_intsetGetEncoded(is,length,curenc));
+
+    if (prepend)
+        _intsetSet(is,0,value);
+    else
+        _intsetSet(is,is->length,value);
+    is->length++;
+    return is;
+}
+
+static void intsetMoveTail(intset *is, uint32_t from, uint32_t to) {
+    size_t bytes = (size_t)(is->length-from)*is->encoding;
+
+    memmove(is->contents+(size_t)to*is->encoding,
+            is->contents+(size_t)from*is->encoding,bytes);
+}
+
+intset *intsetAdd(intset *is, int64_t value, uint8_t *success) {
+    uint8_t valenc = _intsetValueEncoding(value);
+    uint32_t pos;
+
+    if (success) *success = 1;
+    if (valenc > is->encoding)
+        return intsetUpgradeAndAdd(is,value);
+
+    if (intsetSearch(is,value,&pos)) {
+        if (success) *success = 0;
+        return is;
+    }
+    is = intsetResize(is,is->length+1);
+    if (pos < is->length) intsetMoveTail(is,pos,pos+1);
+    _intsetSet(is,pos,value);
+    is->length++;
+    return is;
+}
+
+intset *intsetRemove(intset *is, int64_t value, int *success) {
+    uint8_t valenc = _intsetValueEncoding(value);
+    uint32_t pos;
+
+    if (success) *success = 0;
+    if (valenc <= is->encoding && intsetSearch(is,value,&pos)) {
+        if (success) *success = 1;
+        if (pos < is->length-1) intsetMoveTail(is,pos+1,pos);
+        is->length--;
+        is = intsetResize(is,is->length);
+    }
+    return is;
+}
+
+uint8_t intsetFind(intset *is, int64_t value) {
+    uint8_t valenc = _intsetValueEncoding(value);
+    return valenc <= is->encoding && intsetSearch(is,value,NULL);
+}
+
+uint8_t intsetGet(intset *is, uint32_t pos, int64_t *value) {
+    if (pos < is->length) {
+        *value = _intsetGet(is,pos);
+        return 1;
+    }
+    return 0;
+}
+
+uint32_t intsetLen(intset *is) {
+    return is->length;
+}
+
+size_t intsetBlobLen(intset *is) {
+    return sizeof(intset)+(size_t)is->length*is->encoding;
+}
+
+intset *intsetDup(intset *is) {
+    intset *copy = zmalloc(intsetBlobLen(is));
+
+    memcpy(copy,is,intsetBlobLen(is));
+    return copy;
+}
+
+/* The merge operations below walk the sorted arrays once and append the
+ * result to a new intset allocated for the worst case, that is shrunk to
+ * the final length at the end. */
+
+static void _intsetAppend(intset *is, int64_t value) {
+    _intsetSet(is,is->length,value);
+    is->length++;
+}
+
+intset *intsetUnion(intset *a, intset *b) {
+    uint8_t enc = a->encoding > b->encoding ? a->encoding : b->encoding;
+    intset *r = _intsetCreate(enc,a->length+b->length);
+    uint32_t i = 0, j = 0;
+
+    while (i < a->length && j < b->length) {
+        int64_t va = _intsetGet(a,i), vb = _intsetGet(b,j);
+
+        if (va < vb) {
+            _intsetAppend(r,va); i++;
+        } else if (va > vb) {
+            _intsetAppend(r,vb); j++;
+        } else {
+            _intsetAppend(r,va); i++; j++;
+        }
+    }
+    while (i < a->length) _intsetAppend(r,_intsetGet(a,i++));
+    while (j < b->length) _intsetAppend(r,_intsetGet(b,j++));
+    return intsetResize(r,r->length);
+}
+
+intset *intsetIntersect(intset *a, intset *b) {
+    intset *r;
+    uint32_t i = 0, j = 0;
+
+    if (a->length > b->length) {
+        intset *tmp = a; a = b; b = tmp;
+    }
+    r = _intsetCreate(a->encoding,a->length);
+    if (a->length && (b->length/a->length) >= 16) {
+        /* 'b' is much bigger: a binary search for every element of 'a'
+         * is cheaper than scanning the whole 'b' */
+        for (i = 0; i < a->length; i++) {
+            int64_t va = _intsetGet(a,i);
+            if (intsetFind(b,va)) _intsetAppend(r,va);
+        }
+    } else {
+        while (i < a->length && j < b->length) {
+            int64_t va = _intsetGet(a,i), vb = _intsetGet(b,j);
+
+            if (va < vb) {
+                i++;
+            } else if (va > vb) {
+                j++;
+            } else {
+                _intsetAppend(r,va); i++; j++;
+            }
+        }
+    }
+    return intsetResize(r,r->length);
+}
+
+/* Elements of 'a' that are not in 'b' */
+intset *intsetDiff(intset *a, intset *b) {
+    intset *r = _intsetCreate(a->encoding,a->length);
+    uint32_t i = 0, j = 0;
+
+    while (i < a->length) {
+        int64_t va = _intsetGet(a,i);
+
+        while (j < b->length && _intsetGet(b,j) < va) j++;
+        if (j == b->length || _intsetGet(b,j) != va) _intsetAppend(r,va);
+        i++;
+    }
+    return intsetResize(r,r->length);
+}
@@ -0,0 +1,337 @@
+/* quicklist.c - A doubly linked list of ziplists
+ *
+ * Long lists are stored as a chain of small ziplists. Every node knows how
+ * many entries it holds, so reaching the Nth element of the list means
+ * skipping whole nodes and then walking at most 'fill' entries inside a
+ * single contiguous ziplist, instead of chasing one pointer per element.
+ * Pushing and popping at both ends only touches the head or the tail node,
+ * and deleting a range frees the nodes that are completely inside it
+ * without looking at their entries.
+ *
+ * Copyright (c) 2006-2009, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "zmalloc.h"
+#include "ziplist.h"
+#include "quicklist.h"
+
+/* Don't grow a node over this size. A bigger entry gets a node of its own. */
+#define QUICKLIST_MAX_NODE_BYTES 8192
+/* Upper bound of the bytes a ziplist needs to store the entry header */
+#define QUICKLIST_ENTRY_OVERHEAD 10
+
+quicklist *quicklistCreate(int fill) {
+    quicklist *ql = zmalloc(sizeof(*ql));
+
+    ql->head = ql->tail = NULL;
+    ql->count = 0;
+    ql->len = 0;
+    ql->fill = (fill < 1) ? 1 : fill;
+    return ql;
+}
+
+static quicklistNode *quicklistCreateNode(void) {
+    quicklistNode *node = zmalloc(sizeof(*node));
+
+    node->prev = node->next = NULL;
+    node->zl = ziplistNew();
+    node->count = 0;
+    node->sz = ziplistBlobLen(node->zl);
+    return node;
+}
+
+void quicklistRelease(quicklist *ql) {
+    quicklistNode *node = ql->head, *next;
+
+    while (node) {
+        next = node->next;
+        zfree(node->zl);
+        zfree(node);
+        node = next;
+    }
+    zfree(ql);
+}
+
+/* Link 'node' before (where == QUICKLIST_HEAD) or after 'old'. A NULL 'old'
+ * means the list is empty. */
+static void __quicklistLinkNode(quicklist *ql, quicklistNode *old, quicklistNode *node, int where) {
+    if (old == NULL) {
+        ql->head = ql->tail = node;
+    } else if (where == QUICKLIST_HEAD) {
+        node->next = old;
+        node->prev = old->prev;
+        if (old->prev) old->prev->next = node;
+        old->prev = node;
+        if (ql->head == old) ql->head = node;
+    } else {
+        node->prev = old;
+        node->next = old->next;
+        if (old->next) old->next->prev = node;
+        old->next = node;
+        if (ql->tail == old) ql->tail = node;
+    }
+    ql->len++;
+}
+
+static void __quicklistDelNode(quicklist *ql, quicklistNode *node) {
+    if (node->prev) node->prev->next = node->next;
+    else ql->head = node->next;
+    if (node->next) node->next->prev = node->prev;
+    else ql->tail = node->prev;
+    ql->count -= node->count;
+    ql->len--;
+    zfree(node->zl);
+    zfree(node);
+}
+
+static int __quicklistNodeAllowInsert(quicklist *ql, quicklistNode *node, unsigned int slen) {
+    if (node == NULL || node->count >= (unsigned int)ql->fill) return 0;
+    return node->sz+slen+QUICKLIST_ENTRY_OVERHEAD <= QUICKLIST_MAX_NODE_BYTES;
+}
+
+void quicklistPush(quicklist *ql, unsigned char *s, unsigned int slen, int where) {
+    quicklistNode *node = (where == QUICKLIST_HEAD) ? ql->head : ql->tail;
+
+    if (!__quicklistNodeAllowInsert(ql,node,slen)) {
+        quicklistNode *new = quicklistCreateNode();
+
+        __quicklistLinkNode(ql,node,new,where);
+        node = new;
+    }
+    node->zl = ziplistPush(node->zl,s,slen,
+        (where == QUICKLIST_HEAD) ? ZIPLIST_HEAD : ZIPLIST_TAIL);
+    node->count++;
+    node->sz = ziplistBlobLen(node->zl);
+    ql->count++;
+}
+
+/* Find the entry at 'index', skipping whole nodes. The walk starts from the
+ * end of the list nearest to the index. */
+int quicklistIndex(quicklist *ql, long index, quicklistEntry *entry) {
+    quicklistNode *node;
+    int forward = index >= 0;
+    unsigned long i = forward ? (unsigned long)index : (unsigned long)(-index)-1;
+    unsigned long accum = 0;
+
+    if (i >= ql->count) return 0;
+    if (i > ql->count/2) {
+        forward = !forward;
+        i = ql->count-1-i;
+    }
+    node = forward ? ql->head : ql->tail;
+    while (accum+node->count <= i) {
+        accum += node->count;
+        node = forward ? node->next : node->prev;
+    }
+
+    entry->ql = ql;
+    entry->node = node;
+    entry->offset = forward ? i-accum : node->count-1-(i-accum);
+    if (entry->offset > node->count/2)
+        entry->zi = ziplistIndex(node->zl,(int)entry->offset-(int)node->count);
+    else
+        entry->zi = ziplistIndex(node->zl,(int)entry->offset);
+    ziplistGet(entry->zi,&entry->value,&entry->sz);
+    return 1;
+}
+
+/* Move the entries of 'node' from 'offset' on to a new node linked after
+ * it. 0 < offset < node->count. */
+static void __quicklistSplitNode(quicklist *ql, quicklistNode *node, unsigned int offset) {
+    quicklistNode *new = zmalloc(sizeof(*new));
+    size_t len = ziplistBlobLen(node->zl);
+
+    new->prev = new->next = NULL;
+    new->zl = zmalloc(len);
+    memcpy(new->zl,node->zl,len);
+    new->zl = ziplistDeleteRange(new->zl,0,offset);
+    new->count = node->count-offset;
+    new->sz = ziplistBlobLen(new->zl);
+    node->zl = ziplistDeleteRange(node->zl,offset,new->count);
+    node->count = offset;
+    node->sz = ziplistBlobLen(node->zl);
+    __quicklistLinkNode(ql,node,new,QUICKLIST_TAIL);
+}
+
+/* The entry is replaced in place. If that makes the node larger than
+ * QUICKLIST_MAX_NODE_BYTES the new entry gets a node of its own, as it
+ * would when pushed, the entries around it staying in their own nodes. */
+int quicklistReplaceAtIndex(quicklist *ql, long index, unsigned char *s, unsigned int slen) {
+    quicklistEntry entry;
+    quicklistNode *node;
+    unsigned char *p;
+
+    if (!quicklistIndex(ql,index,&entry)) return 0;
+    node = entry.node;
+    p = entry.zi;
+    node->zl = ziplistDelete(node->zl,&p);
+    node->zl = ziplistInsert(node->zl,p,s,slen);
+    node->sz = ziplistBlobLen(node->zl);
+    if (node->sz > QUICKLIST_MAX_NODE_BYTES && node->count > 1) {
+        if (entry.offset+1 < node->count)
+            __quicklistSplitNode(ql,node,entry.offset+1);
+        if (entry.offset > 0)
+            __quicklistSplitNode(ql,node,entry.offset);
+    }
+    return 1;
+}
+
+/* Delete 'count' entries starting at 'start'. Nodes completely inside the
+ * range are released without touching their entries. Returns the number
+ * of entries deleted. */
+unsigned long quicklistDelRange(quicklist *ql, long start, unsigned long count) {
+    quicklistEntry entry;
+    quicklistNode *node, *next;
+    unsigned long extent, deleted = 0;
+    unsigned int offset;
+
+    if (count == 0 || !quicklistIndex(ql,start,&entry)) return 0;
+    if (start < 0) start = (long)ql->count+start;
+    extent = ql->count-(unsigned long)start;
+    if (count > extent) count = extent;
+
+    node = entry.node;
+    offset = entry.offset;
+    while (deleted < count) {
+        unsigned long todel = count-deleted;
+
+        next = node->next;
+        if (offset == 0 && todel >= node->count) {
+            deleted += node->count;
+            __quicklistDelNode(ql,node);
+        } else {
+            if (todel > node->count-offset) todel = node->count-offset;
+            node->zl = ziplistDeleteRange(node->zl,offset,(unsigned int)todel);
+            node->count -= todel;
+            node->sz = ziplistBlobLen(node->zl);
+            ql->count -= todel;
+            deleted += todel;
+        }
+        node = next;
+        offset = 0;
+    }
+    return deleted;
+}
+
+quicklistIter *quicklistGetIterator(quicklist *ql, int direction) {
+    quicklistIter *iter = zmalloc(sizeof(*iter));
+
+    iter->ql = ql;
+    iter->direction = direction;
+    iter->current = (direction == QUICKLIST_HEAD) ? ql->head : ql->tail;
+    iter->zi = NULL;
+    if (iter->current)
+        iter->zi = ziplistIndex(iter->current->zl,
+            (direction == QUICKLIST_HEAD) ? 0 : -1);
+    return iter;
+}
+
+/* Iterator starting at 'index'. Out of range indexes give an iterator that
+ * returns nothing. */
+quicklistIter *quicklistGetIteratorAtIdx(quicklist *ql, int direction, long index) {
+    quicklistIter *iter = quicklistGetIterator(ql,direction);
+    quicklistEntry entry;
+
+    if (quicklistIndex(ql,index,&entry)) {
+        iter->current = entry.node;
+        iter->zi = entry.zi;
+    } else {
+        iter->current = NULL;
+        iter->zi = NULL;
+    }
+    return iter;
+}
+
+int quicklistNext(quicklistIter *iter, quicklistEntry *entry) {
+    int forward = iter->direction == QUICKLIST_HEAD;
+
+    while (iter->current) {
+        if (iter->zi) {
+            entry->ql = iter->ql;
+            entry->node = iter->current;
+            entry->zi = iter->zi;
+            entry->offset = 0;
+            ziplistGet(entry->zi,&entry->value,&entry->sz);
+            iter->zi = forward ? ziplistNext(iter->current->zl,iter->zi) :
+                                 ziplistPrev(iter->current->zl,iter->zi);
+            return 1;
+        }
+        iter->current = forward ? iter->current->next : iter->current->prev;
+        if (iter->current)
+            iter->zi = ziplistIndex(iter->current->zl,forward ? 0 : -1);
+    }
+    return 0;
+}
+
+void quicklistDelEntry(quicklistIter *iter, quicklistEntry *entry) {
+    quicklist *ql = entry->ql;
+    quicklistNode *node = entry->node;
+    quicklistNode *prev = node->prev, *next = node->next;
+    unsigned char *p = entry->zi, *vstr;
+    unsigned int vlen;
+    int forward;
+
+    if (node->count == 1) {
+        __quicklistDelNode(ql,node);
+        node = NULL;
+    } else {
+        node->zl = ziplistDelete(node->zl,&p);
+        node->count--;
+        node->sz = ziplistBlobLen(node->zl);
+        ql->count--;
+    }
+    if (iter == NULL) return;
+
+    /* The ziplist may have been reallocated: compute again the position of
+     * the iterator. 'p' is the entry that followed the deleted one. */
+    forward = iter->direction == QUICKLIST_HEAD;
+    if (node == NULL) {
+        iter->current = forward ? next : prev;
+        iter->zi = NULL;
+        if (iter->current)
+            iter->zi = ziplistIndex(iter->current->zl,forward ? 0 : -1);
+    } else {
+        iter->current = node;
+        if (forward)
+            iter->zi = ziplistGet(p,&vstr,&vlen) ? p : NULL;
+        else
+            iter->zi = ziplistPrev(node->zl,p);
+    }
+}
+
+void quicklistReleaseIterator(quicklistIter *iter) {
+    zfree(iter);
+}
+
+unsigned long quicklistCount(quicklist *ql) {
+    return ql->count;
+}
@@ -0,0 +1,87 @@
+/* quicklist.h - A doubly linked list of ziplists
+ *
+ * Copyright (c) 2006-2009, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __QUICKLIST_H__
+#define __QUICKLIST_H__
+
+#define QUICKLIST_HEAD 0
+#define QUICKLIST_TAIL 1
+
+/* A node is a ziplist holding up to 'fill' entries. Nodes are never empty. */
+typedef struct quicklistNode {
+    struct quicklistNode *prev;
+    struct quicklistNode *next;
+    unsigned char *zl;
+    unsigned int count;     /* number of entries in zl */
+    unsigned int sz;        /* ziplist size in bytes */
+} quicklistNode;
+
+typedef struct quicklist {
+    quicklistNode *head;
+    quicklistNode *tail;
+    unsigned long count;    /* total entries in all the ziplists */
+    unsigned long len;      /* number of nodes */
+    int fill;               /* max entries per node */
+} quicklist;
+
+typedef struct quicklistIter {
+    quicklist *ql;
+    quicklistNode *current;
+    unsigned char *zi;      /* next entry to return in current, NULL: go to the next node */
+    int direction;          /* QUICKLIST_HEAD: head to tail, QUICKLIST_TAIL: tail to head */
+} quicklistIter;
+
+typedef struct quicklistEntry {
+    quicklist *ql;
+    quicklistNode *node;
+    unsigned char *zi;
+    unsigned char *value;
+    unsigned int sz;
+    unsigned int offset;    /* position of the entry inside node */
+} quicklistEntry;
+
+quicklist *quicklistCreate(int fill);
+void quicklistRelease(quicklist *ql);
+void quicklistPush(quicklist *ql, unsigned char *s, unsigned int slen, int where);
+/* 0:head, -1:tail, 越界返回0 */
+int quicklistIndex(quicklist *ql, long index, quicklistEntry *entry);
+int quicklistReplaceAtIndex(quicklist *ql, long index, unsigned char *s, unsigned int slen);
+/* 删除从start开始的count个元素,整块的节点直接释放 */
+unsigned long quicklistDelRange(quicklist *ql, long start, unsigned long count);
+quicklistIter *quicklistGetIterator(quicklist *ql, int direction);
+quicklistIter *quicklistGetIteratorAtIdx(quicklist *ql, int direction, long index);
+int quicklistNext(quicklistIter *iter, quicklistEntry *entry);
+/* 删除entry,iter非NULL时更新iter使迭代可以继续 */
+void quicklistDelEntry(quicklistIter *iter, quicklistEntry *entry);
+void quicklistReleaseIterator(quicklistIter *iter);
+unsigned long quicklistCount(quicklist *ql);
+
+#endif /* __QUICKLIST_H__ */
@@ -73,6 +73,8 @@ static struct redisCommand cmdTable[] = {
     {"lpush",3,REDIS_CMD_BULK},
     {"rpop",2,REDIS_CMD_INLINE},
     {"lpop",2,REDIS_CMD_INLINE},
+    {"blpop",-3,REDIS_CMD_INLINE},
+    {"brpop",-3,REDIS_CMD_INLINE},
     {"llen",2,REDIS_CMD_INLINE},
     {"lindex",3,REDIS_CMD_INLINE},
     {"lset",4,REDIS_CMD_BULK},
@@ -91,6 +93,31 @@ static struct redisCommand cmdTable[] = {
     {"sdiff",-2,REDIS_CMD_INLINE},
     {"sdiffstore",-3,REDIS_CMD_INLINE},
     {"smembers",2,REDIS_CMD_INLINE},
+    {"zadd",4,REDIS_CMD_BULK},
+    {"zincrby",4,REDIS_CMD_BULK},
+    {"zrem",3,REDIS_CMD_BULK},
+    {"zscore",3,REDIS_CMD_BULK},
+    {"zrank",3,REDIS_CMD_BULK},
+    {"zrevrank",3,REDIS_CMD_BULK},
+    {"zrange",-4,REDIS_CMD_INLINE},
+    {"zrevrange",-4,REDIS_CMD_INLINE},
+    {"zrangebyscore",-4,REDIS_CMD_INLINE},
+    {"zcard",2,REDIS_CMD_INLINE},
+    {"hset",4,REDIS_CMD_BULK},
+    {"hget",3,REDIS_CMD_BULK},
+    {"hmget",-3,REDIS_CMD_INLINE},
+    {"hincrby",4,REDIS_CMD_INLINE},
+    {"hdel",3,REDIS_CMD_BULK},
+    {"hlen",2,REDIS_CMD_INLINE},
+    {"hgetall",2,REDIS_CMD_INLINE},
+    {"setbit",4,REDIS_CMD_INLINE},
+    {"getbit",3,REDIS_CMD_INLINE},
+    {"bitcount",-2,REDIS_CMD_INLINE},
+    {"bitop",-4,REDIS_CMD_INLINE},
+    {"bitpos",-3,REDIS_CMD_INLINE},
+    {"pfadd",-3,REDIS_CMD_INLINE},
+    {"pfcount",-2,REDIS_CMD_INLINE},
+    {"pfmerge",-3,REDIS_CMD_INLINE},
     {"incrby",3,REDIS_CMD_INLINE},
     {"decrby",3,REDIS_CMD_INLINE},
     {"getset",3,REDIS_CMD_BULK},
@@ -108,13 +135,17 @@ static struct redisCommand cmdTable[] = {
     {"shutdown",1,REDIS_CMD_INLINE},
     {"lastsave",1,REDIS_CMD_INLINE},
     {"type",2,REDIS_CMD_INLINE},
-    {"flushdb",1,REDIS_CMD_INLINE},
-    {"flushall",1,REDIS_CMD_INLINE},
+    {"object",3,REDIS_CMD_INLINE},
+    {"flushdb",-1,REDIS_CMD_INLINE},
+    {"flushall",-1,REDIS_CMD_INLINE},
     {"sort",-2,REDIS_CMD_INLINE},
     {"info",1,REDIS_CMD_INLINE},
+    {"client",-2,REDIS_CMD_INLINE},
     {"mget",-2,REDIS_CMD_INLINE},
     {"expire",3,REDIS_CMD_INLINE},
+    {"pexpire",3,REDIS_CMD_INLINE},
     {"ttl",2,REDIS_CMD_INLINE},
+    {"pttl",2,REDIS_CMD_INLINE},
     {"slaveof",3,REDIS_CMD_INLINE},
     {NULL,0,0}
 };
@@ -42,6 +42,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <inttypes.h>
 #include <arpa/inet.h>
 #include <sys/stat.h>
@@ -49,13 +50,23 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <limits.h>
+#include <math.h>
 
 #include "ae.h"     /* Event driven programming library */
 #include "sds.h"    /* Dynamic safe strings */
 #include "anet.h"   /* Networking the easy way */
 #include "dict.h"   /* Hash tables */
+#include "dictspec.h" /* Hash tables specialized for a key type */
 #include "adlist.h" /* Linked lists */
 #include "zmalloc.h" /* total memory usage aware version of malloc/free */
+#include "slab.h"   /* Pools for robj, dictEntry and listNode */
+#include "bio.h"    /* Background jobs thread */
+#include "bitops.h" /* Popcount and bitwise kernels for bitmaps */
+#include "hyperloglog.h"
+#include "ziplist.h" /* Compact list data structure */
+#include "quicklist.h" /* Chain of ziplists for big lists */
+#include "intset.h" /* Compact integer set structure */
+#include "timewheel.h" /* Expire time index */
 #include "lzf.h"    /* LZF compression library */
 #include "pqsort.h" /* Partial qsort for SORT+LIMIT */
 #include "aid.h"	/* aid function */
@@ -69,13 +80,47 @@
 #define REDIS_SERVERPORT        6379    /* TCP port */
 #define REDIS_MAXIDLETIME       (60*5)  /* default client timeout */
 #define REDIS_IOBUF_LEN         1024
+#define REDIS_MBULK_BIG_ARG     (1024*32) /* 大于此值的bulk参数直接读入querybuf */
 #define REDIS_LOADBUF_LEN       1024
 #define REDIS_STATIC_ARGS       4
 #define REDIS_DEFAULT_DBNUM     16		/* 默认数据库数量 */
 #define REDIS_CONFIGLINE_MAX    1024	
-#define REDIS_OBJFREELIST_MAX   1000000 /* Max number of objects to cache */
 #define REDIS_MAX_SYNC_TIME     60      /* Slave can't take more to sync */
-#define REDIS_EXPIRELOOKUPS_PER_CRON    100 /* try to expire 100 keys/second */
+#define REDIS_EXPIRELOOKUPS_PER_CRON    20  /* volatile keys sampled per loop */
+#define REDIS_EXPIRE_CYCLE_HZ   10      /* slow expire cycles per second */
+#define REDIS_BLOCKED_TIMEOUT_HZ 10     /* BLPOP/BRPOP timeout checks per second */
+#define REDIS_BLOCKED_MAX_QUERYBUF (1024*64) /* input read from a blocked client */
+#define REDIS_EXPIRE_CYCLE_SLOW_TIME_PERC 25 /* CPU share of the slow cycle */
+#define REDIS_EXPIRE_CYCLE_FAST_DURATION 1000 /* microseconds */
+#define REDIS_EXPIRE_CYCLE_ACCEPTABLE_STALE 10 /* % of expired keys tolerated */
+
+/* How the active expire cycle finds the expired keys */
+#define REDIS_EXPIRE_INDEX_SAMPLE 0 /* random samples of db->expires */
+#define REDIS_EXPIRE_INDEX_WHEEL 1  /* timing wheel ordered by expire time */
+
+/* Maxmemory policies, see freeMemoryIfNeeded() */
+#define REDIS_MAXMEMORY_FLAG_VOLATILE (1<<0) /* only keys with an expire */
+#define REDIS_MAXMEMORY_FLAG_LRU (1<<1)     /* least recently used first */
+#define REDIS_MAXMEMORY_FLAG_LFU (1<<2)     /* least frequently used first */
+#define REDIS_MAXMEMORY_FLAG_TTL (1<<3)     /* nearest expire first */
+#define REDIS_MAXMEMORY_FLAG_RANDOM (1<<4)
+#define REDIS_MAXMEMORY_NO_EVICTION 0       /* refuse the writes instead */
+#define REDIS_MAXMEMORY_ALLKEYS_LRU REDIS_MAXMEMORY_FLAG_LRU
+#define REDIS_MAXMEMORY_VOLATILE_LRU \
+    (REDIS_MAXMEMORY_FLAG_LRU|REDIS_MAXMEMORY_FLAG_VOLATILE)
+#define REDIS_MAXMEMORY_ALLKEYS_LFU REDIS_MAXMEMORY_FLAG_LFU
+#define REDIS_MAXMEMORY_VOLATILE_TTL \
+    (REDIS_MAXMEMORY_FLAG_TTL|REDIS_MAXMEMORY_FLAG_VOLATILE)
+#define REDIS_MAXMEMORY_ALLKEYS_RANDOM REDIS_MAXMEMORY_FLAG_RANDOM
+#define REDIS_MAXMEMORY_SAMPLES 5       /* keys sampled per db and eviction */
+#define REDIS_LAZYFREE_THRESHOLD 64     /* free effort over which a value is freed
+                                           by the bio thread */
+#define REDIS_LAZYFREE_BATCH 1024       /* references handed back per batch */
+#define REDIS_EVICTION_POOL_SIZE 16     /* best candidates kept across calls */
+#define REDIS_LFU_INIT_VAL 5            /* counter of new objects */
+#define REDIS_LFU_LOG_FACTOR 10         /* 计数器增长的对数因子 */
+#define REDIS_LFU_DECAY_TIME 1          /* idle minutes per counter decrement */
+#define REDIS_SHARED_INTEGERS   10000   /* 0..9999的整数值共享同一个对象 */
 
 /* Hash table parameters */
 #define REDIS_HT_MINFILL        10      /* Minimal hash table fill 10% */
@@ -84,15 +129,43 @@
 /* Command flags */
 #define REDIS_CMD_BULK          1
 #define REDIS_CMD_INLINE        2
+#define REDIS_CMD_DENYOOM       4   /* may grow memory: refused over maxmemory */
 
 /* Object types */
 #define REDIS_STRING 0
 #define REDIS_LIST 1
 #define REDIS_SET 2
 #define REDIS_HASH 3
+#define REDIS_ZSET 4
+
+/* Objects encoding. Some kind of objects like lists can be internally
+ * represented in multiple ways. The 'encoding' field of the object
+ * is set to one of this fields for this object. */
+#define REDIS_ENCODING_RAW 0        /* Raw representation */
+#define REDIS_ENCODING_HT 1         /* Encoded as hash table */
+#define REDIS_ENCODING_LINKEDLIST 2 /* No longer used: old list encoding */
+#define REDIS_ENCODING_ZIPLIST 3    /* Encoded as ziplist */
+#define REDIS_ENCODING_QUICKLIST 4  /* Encoded as linked list of ziplists */
+#define REDIS_ENCODING_INTSET 5     /* Encoded as sorted array of integers */
+#define REDIS_ENCODING_EMBSTR 6     /* Embedded sds string encoding */
+#define REDIS_ENCODING_INT 7        /* Long stored directly in the ptr field */
+#define REDIS_ENCODING_EMBKEY 8     /* Keyspace key: embedded sds plus expire time */
+#define REDIS_ENCODING_SKIPLIST 9   /* Encoded as skiplist plus dict */
+
+/* Defaults for the compact encodings */
+#define REDIS_LIST_MAX_ZIPLIST_ENTRIES 128
+#define REDIS_LIST_MAX_ZIPLIST_VALUE 64
+#define REDIS_SET_MAX_INTSET_ENTRIES 512
+#define REDIS_ZSET_MAX_ZIPLIST_ENTRIES 128
+#define REDIS_ZSET_MAX_ZIPLIST_VALUE 64
+#define REDIS_HASH_MAX_ZIPLIST_ENTRIES 128
+#define REDIS_HASH_MAX_ZIPLIST_VALUE 64
+#define REDIS_EMBSTR_SIZE_LIMIT 39  /* Longer strings use a separate sds */
+#define REDIS_BITMAP_MAX_BYTES (512*1024*1024) /* SETBIT offsets limit */
 
 /* Object types only used for dumping to disk */
-#define REDIS_EXPIRETIME 253	/* 过期时间戳 */
+#define REDIS_EXPIRETIME_MS 252	/* 过期时间戳(毫秒, 64位), RDB版本2 */
+#define REDIS_EXPIRETIME 253	/* 过期时间戳(秒, 32位), 只在加载时使用 */
 #define REDIS_SELECTDB 254		/* 数据库选择符 */
 #define REDIS_EOF 255			/* 数据库写入完毕标识符 */
 
@@ -128,6 +201,15 @@
 #define REDIS_SLAVE 2       /* This client is a slave server */
 #define REDIS_MASTER 4      /* This client is a master server */
 #define REDIS_MONITOR 8      /* This client is a slave monitor, see MONITOR */
+#define REDIS_CLOSE_ASAP 16 /* Close this client from serverCron(), see freeClientAsync() */
+#define REDIS_BLOCKED 32    /* The client is waiting in a BLPOP/BRPOP */
+#define REDIS_UNBLOCKED 64  /* Unblocked, its input is processed from beforeSleep() */
+
+/* Client classes for the output buffer limits */
+#define REDIS_CLIENT_LIMIT_CLASS_NORMAL 0
+#define REDIS_CLIENT_LIMIT_CLASS_SLAVE 1
+#define REDIS_CLIENT_LIMIT_CLASS_MONITOR 2
+#define REDIS_CLIENT_LIMIT_NUM_CLASSES 3
 
 /* Slave replication(复制) state - slave side */
 #define REDIS_REPL_NONE 0   /* No active replication */
@@ -166,20 +248,41 @@
 
 /*================================= Data types ============================== */
 
-/* A redis object, that is a type able to hold a string / list / set */
+/* A redis object, that is a type able to hold a string / list / set.
+ * type, encoding and lru share a single 32 bit word so the object is still
+ * 16 bytes on 64 bit systems */
+#define REDIS_LRU_CLOCK_MAX ((1<<24)-1) /* Max value of obj->lru */
+#define REDIS_LRU_CLOCK_RESOLUTION 1    /* LRU clock resolution in seconds */
 typedef struct redisObject {
-    void *ptr;
-	/* REDIS_STRING, REDIS_LIST, REDIS_SET, REDIS_HASH */
-    int type;
+	/* REDIS_STRING, REDIS_LIST, REDIS_SET, REDIS_HASH, REDIS_ZSET */
+    unsigned type:4;
+    unsigned encoding:4;	/* REDIS_ENCODING_*, ptr的实际内存结构 */
+    unsigned lru:24;	/* 最近一次被访问时的server.lruclock, LFU策略下见LFULogIncr() */
     int refcount;	/* 引用计数 */
+    void *ptr;
 } robj;
 
+/* Expire time (unix time in milliseconds) of a key object of the keyspace,
+ * -1 if not volatile. It is stored right after the robj header of EMBKEY
+ * keys, see createKeyObject(): with expire-index wheel as the 'when' of the
+ * wheelNode found there */
+#define keyGetExpire(o) ((o)->encoding == REDIS_ENCODING_EMBKEY ? \
+    *(long long*)((o)+1) : -1LL)
+#define keyGetWheelNode(o) ((wheelNode*)((o)+1))
+#define wheelNodeGetKey(n) (((robj*)(n))-1)
+
 typedef struct redisDb {
     dict *dict;		/* key-val */
-    dict *expires;	/* key的过期信息 */
+    dict *expires;	/* 过期key的索引(expire-index sample) */
+    timeWheel *wheel;	/* 过期key的索引(expire-index wheel), 否则为NULL */
+    dict *blockingkeys;	/* BLPOP/BRPOP等待中的key -> 等待的client的list(FIFO) */
     int id;
 } redisDb;
 
+/* Number of volatile keys of the db */
+#define dbVolatileKeys(db) ((db)->wheel ? wheelCount((db)->wheel) : \
+    dictSize((db)->expires))
+
 /* With multiplexing we need to take per-clinet state.
  * Clients are taken in a liked list. */
 typedef struct redisClient {
@@ -199,11 +302,13 @@ typedef struct redisClient {
 	
 	/* 待发往客户端的回复的数据 */
     list *reply;
+    unsigned long reply_bytes; /* 所有reply对象的字节数之和 */
     int sentlen;
+    time_t obuf_soft_limit_reached_time; /* 首次超过软限制的时间,0:未超过 */
 	
     time_t lastinteraction; /* time of the last interaction, used for timeout */
 	
-    int flags;              /* REDIS_CLOSE | REDIS_SLAVE | REDIS_MONITOR */
+    int flags;              /* REDIS_CLOSE | REDIS_SLAVE | REDIS_MONITOR | REDIS_CLOSE_ASAP */
 	
     int slaveseldb;         /* slave selected db, if this client is a slave */
 	
@@ -213,8 +318,35 @@ typedef struct redisClient {
     int repldbfd;           /* replication DB file descriptor */
     long repldboff;          /* replication DB file offset */
     off_t repldbsize;       /* replication DB file size */
+
+    /* BLPOP/BRPOP, see blockForKeys() */
+    robj **blockingkeys;    /* the keys the client is waiting for */
+    int blockingkeysnum;
+    int blockingwhere;      /* REDIS_HEAD or REDIS_TAIL */
+    wheelNode blockingtimeout; /* .when: unix time in ms, in server.blocked_timeouts
+                                * unless 0 (wait forever) */
 } redisClient;
 
+#define wheelNodeGetClient(n) \
+    ((redisClient*)((char*)(n)-offsetof(redisClient,blockingtimeout)))
+
+/* Output buffer limits of a client class. A client is disconnected as soon
+ * as its output buffer reaches the hard limit, or when it stays over the soft
+ * limit for more than soft_limit_seconds. A zero limit is disabled. */
+struct clientBufferLimitsConfig {
+    unsigned long hard_limit_bytes;
+    unsigned long soft_limit_bytes;
+    time_t soft_limit_seconds;
+};
+
+/* A candidate of the maxmemory eviction: the pool is sorted by 'idle'
+ * ascending, so the best key to evict is the last one */
+struct evictionPoolEntry {
+    unsigned long long idle;    /* LRU idle time, 255-LFU counter or -ttl */
+    sds key;                    /* a copy of the key, NULL if empty */
+    int dbid;
+};
+
 /* Global server state structure */
 struct redisServer {
     int port;
@@ -228,6 +360,10 @@ struct redisServer {
 	
     list *clients;
     list *slaves, *monitors;
+    list *clients_to_close;     /* clients to free from serverCron() */
+    list *unblocked_clients;    /* REDIS_UNBLOCKED clients, see beforeSleep() */
+    unsigned int blocked_clients;   /* clients in a BLPOP/BRPOP */
+    timeWheel *blocked_timeouts;    /* the blocked clients with a timeout */
 	
     char neterr[ANET_ERR_LEN];
 	
@@ -235,16 +371,33 @@ struct redisServer {
 	
     int cronloops;              /* number of times the cron function run */
 	
-    list *objfreelist;          /* A list of freed objects to avoid malloc() */
+    unsigned lruclock:24;       /* Clock for the objects LRU, see updateLRUClock() */
+    /* Cached clocks, see updateCachedTime() */
+    time_t unixtime;            /* wall clock, seconds */
+    long long mstime;           /* wall clock, milliseconds */
+    long long monotonic;        /* monotonic clock, microseconds */
 	
     time_t lastsave;            /* Unix time of last save succeeede */
 	
     size_t usedmemory;             /* Used memory in megabytes */
+    /* Eviction pool of freeMemoryIfNeeded() */
+    struct evictionPoolEntry *evictionpool;
 	
     /* Fields used only for stats */
     time_t stat_starttime;         /* server start time */
     long long stat_numcommands;    /* number of processed commands */
     long long stat_numconnections; /* number of connections received */
+    long long stat_expiredkeys;    /* number of expired keys, lazy or active */
+    long long stat_expiredkeys_last; /* stat_expiredkeys at the last cron */
+    long long stat_expired_per_sec; /* keys expired during the last second */
+    double stat_expired_stale_perc; /* % of expired keys in the samples */
+    long long stat_expired_time_cap_reached_count; /* cycles out of time */
+    long long stat_evictedkeys;    /* keys evicted because of maxmemory */
+    long long stat_keyspace_hits;  /* reads of existing keys */
+    long long stat_keyspace_misses; /* reads of missing keys */
+    /* Updated by the bio thread too, atomic access only */
+    unsigned long lazyfree_pending_objects; /* values waiting to be freed */
+    unsigned long stat_lazyfreed_objects; /* values freed by the bio thread */
 	
     /* Configuration */
     int verbosity;
@@ -276,12 +429,30 @@ struct redisServer {
     redisClient *master;    /* client that is master for this slave */
     int replstate;
     unsigned int maxclients;
+    struct clientBufferLimitsConfig client_obuf_limits[REDIS_CLIENT_LIMIT_NUM_CLASSES];
 	
     /* Sort parameters - qsort_r() is only available under BSD so we
      * have to take this state global, in order to pass it to sortCompare() */
     int sort_desc;
     int sort_alpha;
     int sort_bypattern;
+    /* Small lists encoding thresholds */
+    size_t list_max_ziplist_entries;
+    size_t list_max_ziplist_value;
+    size_t set_max_intset_entries;
+    size_t zset_max_ziplist_entries;
+    size_t zset_max_ziplist_value;
+    size_t hash_max_ziplist_entries;
+    size_t hash_max_ziplist_value;
+    size_t hll_sparse_max_bytes;
+    /* Hash table layout of the keyspace/expires and of the set dicts */
+    int keyspace_dict_layout;
+    int set_dict_layout;
+    int expire_index;           /* REDIS_EXPIRE_INDEX_* */
+    unsigned long long maxmemory; /* 0: no limit */
+    int maxmemory_policy;       /* REDIS_MAXMEMORY_* */
+    int maxmemory_samples;
+    int lazyfree_server_del;    /* free big values in the bio thread */
 };
 
 typedef void redisCommandProc(redisClient *c);
@@ -305,29 +476,95 @@ typedef struct _redisSortOperation {
     robj *pattern;
 } redisSortOperation;
 
+/* Structure to hold list iteration abstraction, it hides the actual list
+ * encoding (ziplist or quicklist) to the callers. */
+typedef struct {
+    robj *subject;
+    unsigned char encoding;
+    unsigned char direction; /* AL_START_HEAD or AL_START_TAIL */
+    unsigned char *zi;
+    quicklistIter *iter;
+} listTypeIterator;
+
+/* Structure for an entry while iterating over a list */
+typedef struct {
+    listTypeIterator *li;
+    unsigned char *zi;  /* Entry in ziplist */
+    quicklistEntry entry;   /* Entry in quicklist */
+} listTypeEntry;
+
+/* Structure to hold set iteration abstraction */
+typedef struct {
+    robj *subject;
+    int encoding;
+    uint32_t ii;    /* intset iterator */
+    dictIterator *di;
+} setTypeIterator;
+
+/* Sorted sets: a skiplist ordered by (score, member) whose nodes also count
+ * the elements they skip (span), so that the rank of a node is the sum of
+ * the spans followed to reach it, plus a dict member -> &node->score for the
+ * O(1) ZSCORE and the updates. Small sorted sets are a ziplist of member,
+ * score pairs in the same order instead. */
+#define ZSKIPLIST_MAXLEVEL 32   /* Enough for 2^64 elements */
+#define ZSKIPLIST_P 0.25        /* Skiplist P = 1/4 */
+
+typedef struct zskiplistNode {
+    robj *obj;
+    double score;
+    struct zskiplistNode *backward;
+    struct zskiplistLevel {
+        struct zskiplistNode *forward;
+        unsigned long span;     /* nodes between this one and forward */
+    } level[];
+} zskiplistNode;
+
+typedef struct zskiplist {
+    struct zskiplistNode *header, *tail;
+    unsigned long length;
+    int level;
+} zskiplist;
+
+typedef struct zset {
+    dict *dict;
+    zskiplist *zsl;
+} zset;
+
+/* Score range of ZRANGEBYSCORE, min and max inclusive unless *ex is set */
+typedef struct {
+    double min, max;
+    int minex, maxex;
+} zrangespec;
+
 struct sharedObjectsStruct {
     robj *crlf, *ok, *err, *emptybulk, *czero, *cone, *pong, *space,
     *colon, *nullbulk, *nullmultibulk,
     *emptymultibulk, *wrongtypeerr, *nokeyerr, *syntaxerr, *sameobjecterr,
     *outofrangeerr, *plus,
     *select0, *select1, *select2, *select3, *select4,
-    *select5, *select6, *select7, *select8, *select9;
+    *select5, *select6, *select7, *select8, *select9,
+    *integers[REDIS_SHARED_INTEGERS];
 } shared;
 
 /*================================ Prototypes =============================== */
 
 static void freeClient(redisClient *c);
+static void processInputBuffer(redisClient *c);
+static void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask);
+static void freeClientsInAsyncFreeQueue(void);
 static int rdbLoad(char *filename);
 static void addReply(redisClient *c, robj *obj);
 static void addReplySds(redisClient *c, sds s);
+static void addReplyBulk(redisClient *c, robj *obj);
 static int rdbSaveBackground(char *filename);
 static void replicationFeedSlaves(list *slaves, struct redisCommand *cmd, int dictid, robj **argv, int argc);
 static int syncWithMaster(void);
 static robj *tryObjectSharing(robj *o);
 static int deleteIfVolatile(redisDb *db, robj *key);
 static int deleteKey(redisDb *db, robj *key);
-static time_t getExpire(redisDb *db, robj *key);
-static int setExpire(redisDb *db, robj *key, time_t when);
+static int deleteKeyGeneric(redisDb *db, robj *key, int lazy);
+static long long getExpire(redisDb *db, robj *key);
+static int setExpire(redisDb *db, robj *key, long long when);
 static void updateSalvesWaitingBgsave(int bgsaveerr);
 
 
@@ -337,44 +574,72 @@ static void updateSalvesWaitingBgsave(int bgsaveerr);
 struct redisServer server; /* server global state */
 static struct redisCommand cmdTable[] = {
     {"get",getCommand,2,REDIS_CMD_INLINE},
-    {"set",setCommand,3,REDIS_CMD_BULK},
-    {"setnx",setnxCommand,3,REDIS_CMD_BULK},
+    {"set",setCommand,3,REDIS_CMD_BULK|REDIS_CMD_DENYOOM},
+    {"setnx",setnxCommand,3,REDIS_CMD_BULK|REDIS_CMD_DENYOOM},
     {"del",delCommand,-2,REDIS_CMD_INLINE},
     {"exists",existsCommand,2,REDIS_CMD_INLINE},
-    {"incr",incrCommand,2,REDIS_CMD_INLINE},
-    {"decr",decrCommand,2,REDIS_CMD_INLINE},
+    {"incr",incrCommand,2,REDIS_CMD_INLINE|REDIS_CMD_DENYOOM},
+    {"decr",decrCommand,2,REDIS_CMD_INLINE|REDIS_CMD_DENYOOM},
     {"mget",mgetCommand,-2,REDIS_CMD_INLINE},
-    {"rpush",rpushCommand,3,REDIS_CMD_BULK},
-    {"lpush",lpushCommand,3,REDIS_CMD_BULK},
+    {"rpush",rpushCommand,3,REDIS_CMD_BULK|REDIS_CMD_DENYOOM},
+    {"lpush",lpushCommand,3,REDIS_CMD_BULK|REDIS_CMD_DENYOOM},
     {"rpop",rpopCommand,2,REDIS_CMD_INLINE},
     {"lpop",lpopCommand,2,REDIS_CMD_INLINE},
+    {"blpop",blpopCommand,-3,REDIS_CMD_INLINE},
+    {"brpop",brpopCommand,-3,REDIS_CMD_INLINE},
     {"llen",llenCommand,2,REDIS_CMD_INLINE},
     {"lindex",lindexCommand,3,REDIS_CMD_INLINE},
-    {"lset",lsetCommand,4,REDIS_CMD_BULK},
+    {"lset",lsetCommand,4,REDIS_CMD_BULK|REDIS_CMD_DENYOOM},
     {"lrange",lrangeCommand,4,REDIS_CMD_INLINE},
     {"ltrim",ltrimCommand,4,REDIS_CMD_INLINE},
     {"lrem",lremCommand,4,REDIS_CMD_BULK},
-    {"sadd",saddCommand,3,REDIS_CMD_BULK},
+    {"sadd",saddCommand,3,REDIS_CMD_BULK|REDIS_CMD_DENYOOM},
     {"srem",sremCommand,3,REDIS_CMD_BULK},
     {"smove",smoveCommand,4,REDIS_CMD_BULK},
     {"sismember",sismemberCommand,3,REDIS_CMD_BULK},
     {"scard",scardCommand,2,REDIS_CMD_INLINE},
     {"sinter",sinterCommand,-2,REDIS_CMD_INLINE},
-    {"sinterstore",sinterstoreCommand,-3,REDIS_CMD_INLINE},
+    {"sinterstore",sinterstoreCommand,-3,REDIS_CMD_INLINE|REDIS_CMD_DENYOOM},
     {"sunion",sunionCommand,-2,REDIS_CMD_INLINE},
-    {"sunionstore",sunionstoreCommand,-3,REDIS_CMD_INLINE},
+    {"sunionstore",sunionstoreCommand,-3,REDIS_CMD_INLINE|REDIS_CMD_DENYOOM},
     {"sdiff",sdiffCommand,-2,REDIS_CMD_INLINE},
-    {"sdiffstore",sdiffstoreCommand,-3,REDIS_CMD_INLINE},
+    {"sdiffstore",sdiffstoreCommand,-3,REDIS_CMD_INLINE|REDIS_CMD_DENYOOM},
     {"smembers",sinterCommand,2,REDIS_CMD_INLINE},
-    {"incrby",incrbyCommand,3,REDIS_CMD_INLINE},
-    {"decrby",decrbyCommand,3,REDIS_CMD_INLINE},
-    {"getset",getSetCommand,3,REDIS_CMD_BULK},
+    {"zadd",zaddCommand,4,REDIS_CMD_BULK|REDIS_CMD_DENYOOM},
+    {"zincrby",zincrbyCommand,4,REDIS_CMD_BULK|REDIS_CMD_DENYOOM},
+    {"zrem",zremCommand,3,REDIS_CMD_BULK},
+    {"zscore",zscoreCommand,3,REDIS_CMD_BULK},
+    {"zrank",zrankCommand,3,REDIS_CMD_BULK},
+    {"zrevrank",zrevrankCommand,3,REDIS_CMD_BULK},
+    {"zrange",zrangeCommand,-4,REDIS_CMD_INLINE},
+    {"zrevrange",zrevrangeCommand,-4,REDIS_CMD_INLINE},
+    {"zrangebyscore",zrangebyscoreCommand,-4,REDIS_CMD_INLINE},
+    {"zcard",zcardCommand,2,REDIS_CMD_INLINE},
+    {"hset",hsetCommand,4,REDIS_CMD_BULK|REDIS_CMD_DENYOOM},
+    {"hget",hgetCommand,3,REDIS_CMD_BULK},
+    {"hmget",hmgetCommand,-3,REDIS_CMD_INLINE},
+    {"hincrby",hincrbyCommand,4,REDIS_CMD_INLINE|REDIS_CMD_DENYOOM},
+    {"hdel",hdelCommand,3,REDIS_CMD_BULK},
+    {"hlen",hlenCommand,2,REDIS_CMD_INLINE},
+    {"hgetall",hgetallCommand,2,REDIS_CMD_INLINE},
+    {"setbit",setbitCommand,4,REDIS_CMD_INLINE|REDIS_CMD_DENYOOM},
+    {"getbit",getbitCommand,3,REDIS_CMD_INLINE},
+    {"bitcount",bitcountCommand,-2,REDIS_CMD_INLINE},
+    {"bitop",bitopCommand,-4,REDIS_CMD_INLINE|REDIS_CMD_DENYOOM},
+    {"bitpos",bitposCommand,-3,REDIS_CMD_INLINE},
+    {"pfadd",pfaddCommand,-3,REDIS_CMD_INLINE|REDIS_CMD_DENYOOM},
+    {"pfcount",pfcountCommand,-2,REDIS_CMD_INLINE},
+    {"pfmerge",pfmergeCommand,-3,REDIS_CMD_INLINE|REDIS_CMD_DENYOOM},
+    {"incrby",incrbyCommand,3,REDIS_CMD_INLINE|REDIS_CMD_DENYOOM},
+    {"decrby",decrbyCommand,3,REDIS_CMD_INLINE|REDIS_CMD_DENYOOM},
+    {"getset",getSetCommand,3,REDIS_CMD_BULK|REDIS_CMD_DENYOOM},
     {"randomkey",randomkeyCommand,1,REDIS_CMD_INLINE},
     {"select",selectCommand,2,REDIS_CMD_INLINE},
     {"move",moveCommand,3,REDIS_CMD_INLINE},
     {"rename",renameCommand,3,REDIS_CMD_INLINE},
     {"renamenx",renamenxCommand,3,REDIS_CMD_INLINE},
     {"expire",expireCommand,3,REDIS_CMD_INLINE},
+    {"pexpire",pexpireCommand,3,REDIS_CMD_INLINE},
     {"keys",keysCommand,2,REDIS_CMD_INLINE},
     {"dbsize",dbsizeCommand,1,REDIS_CMD_INLINE},
     {"auth",authCommand,2,REDIS_CMD_INLINE},
@@ -385,13 +650,16 @@ static struct redisCommand cmdTable[] = {
     {"shutdown",shutdownCommand,1,REDIS_CMD_INLINE},
     {"lastsave",lastsaveCommand,1,REDIS_CMD_INLINE},
     {"type",typeCommand,2,REDIS_CMD_INLINE},
+    {"object",objectCommand,3,REDIS_CMD_INLINE},
     {"sync",syncCommand,1,REDIS_CMD_INLINE},
-    {"flushdb",flushdbCommand,1,REDIS_CMD_INLINE},
-    {"flushall",flushallCommand,1,REDIS_CMD_INLINE},
+    {"flushdb",flushdbCommand,-1,REDIS_CMD_INLINE},
+    {"flushall",flushallCommand,-1,REDIS_CMD_INLINE},
     {"sort",sortCommand,-2,REDIS_CMD_INLINE},
     {"info",infoCommand,1,REDIS_CMD_INLINE},
     {"monitor",monitorCommand,1,REDIS_CMD_INLINE},
+    {"client",clientCommand,-2,REDIS_CMD_INLINE},
     {"ttl",ttlCommand,2,REDIS_CMD_INLINE},
+    {"pttl",pttlCommand,2,REDIS_CMD_INLINE},
     {"slaveof",slaveofCommand,3,REDIS_CMD_INLINE},
     {NULL,NULL,0,0}
 };
@@ -539,6 +807,28 @@ static dictType setDictType = {
     NULL                       /* val destructor */
 };
 
+/* Sorted set members -> pointer to the score in their skiplist node. The
+ * member objects are owned by the skiplist, see zslFreeNode() */
+static dictType zsetDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    NULL,                       /* key destructor */
+    NULL                        /* val destructor */
+};
+
+/* Keys with clients blocked in BLPOP/BRPOP -> list of the clients */
+static dictType keylistDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictRedisObjectDestructor,  /* key destructor */
+    dictListDestructor          /* val destructor */
+};
+
+/* The keyspace and the hash table encoded hashes: robj keys and values */
 static dictType hashDictType = {
     dictSdsHash,                /* hash function */
     NULL,                       /* key dup */
@@ -548,6 +838,228 @@ static dictType hashDictType = {
     dictRedisObjectDestructor   /* val destructor */
 };
 
+/* ================================ Lazy free ===============================
+ *
+ * Releasing a value with millions of elements blocks the server for seconds.
+ * With lazyfree-lazy-server-del the keyspace deletions (DEL, expires,
+ * overwrites, FLUSHDB/FLUSHALL ASYNC) just unlink the value, and if its free
+ * effort is over REDIS_LAZYFREE_THRESHOLD it is released by the bio thread.
+ * Eviction stays synchronous: it wants the memory back before the command.
+ *
+ * The bio thread must not change a refcount the main thread can change too.
+ * An object whose refcount equals the references held by the structure being
+ * released is unreachable from anywhere else: it is freed in the bio thread.
+ * The others (set members shared with other sets or with the sharing pool,
+ * the shared integers...) are handed back to the main thread in batches, and
+ * decremented there by lazyfreeProcessDeferred(). The slab slots freed by the
+ * bio thread are given back by the main thread as well, see slabReclaim(). */
+
+typedef struct lazyfreeBatch {
+    struct lazyfreeBatch *next;
+    int count;
+    robj *objs[REDIS_LAZYFREE_BATCH];
+} lazyfreeBatch;
+
+/* A keyspace released by FLUSHDB/FLUSHALL ASYNC */
+typedef struct lazyfreeDb {
+    dict *dict;
+    dict *expires;
+    int sampled;            /* the volatile keys are in 'expires' too */
+} lazyfreeDb;
+
+static lazyfreeBatch *lazyfree_deferred = NULL; /* to the main thread */
+static lazyfreeBatch *lazyfree_batch = NULL;    /* bio thread only */
+
+static void lazyfreeObjectDestructor(void *privdata, void *val);
+static void lazyfreeKeyDestructor(void *privdata, void *key);
+
+static dictType lazyfreeSetDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    lazyfreeObjectDestructor,   /* key destructor */
+    NULL                        /* val destructor */
+};
+
+static dictType lazyfreeHashDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    lazyfreeObjectDestructor,   /* key destructor */
+    lazyfreeObjectDestructor    /* val destructor */
+};
+
+/* The keys are counted by lazyfreeKeyDestructor() with db->dict */
+static dictType lazyfreeExpiresDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    NULL,                       /* key destructor */
+    NULL                        /* val destructor */
+};
+
+static dictType lazyfreeKeyspaceDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    lazyfreeKeyDestructor,      /* key destructor */
+    lazyfreeObjectDestructor    /* val destructor */
+};
+
+/* Roughly the number of allocations to free */
+static size_t lazyfreeEffort(robj *o) {
+    if (o->type == REDIS_LIST && o->encoding == REDIS_ENCODING_QUICKLIST)
+        return ((quicklist*)o->ptr)->len;
+    if ((o->type == REDIS_SET || o->type == REDIS_HASH) &&
+        o->encoding == REDIS_ENCODING_HT)
+        return dictSize((dict*)o->ptr);
+    if (o->type == REDIS_ZSET && o->encoding == REDIS_ENCODING_SKIPLIST)
+        return ((zset*)o->ptr)->zsl->length;
+    return 1;
+}
+
+/* Bio thread: push the current batch to the main thread */
+static void lazyfreeFlushDeferred(void) {
+    lazyfreeBatch *head;
+
+    if (lazyfree_batch == NULL) return;
+    head = __atomic_load_n(&lazyfree_deferred,__ATOMIC_RELAXED);
+    do {
+        lazyfree_batch->next = head;
+    } while (!__atomic_compare_exchange_n(&lazyfree_deferred,&head,
+                lazyfree_batch,1,__ATOMIC_RELEASE,__ATOMIC_RELAXED));
+    lazyfree_batch = NULL;
+}
+
+/* Bio thread: hand a reference back to the main thread */
+static void lazyfreeDefer(robj *o) {
+    if (lazyfree_batch == NULL) {
+        lazyfree_batch = zmalloc(sizeof(lazyfreeBatch));
+        if (!lazyfree_batch) oom("lazyfreeDefer");
+        lazyfree_batch->count = 0;
+    }
+    lazyfree_batch->objs[lazyfree_batch->count++] = o;
+    if (lazyfree_batch->count == REDIS_LAZYFREE_BATCH) lazyfreeFlushDeferred();
+}
+
+/* Bio thread: drop the 'owned' references to 'o' held by the structure being
+ * released, freeing it if nobody else has one */
+static void lazyfreeRelease(robj *o, int owned) {
+    if (__atomic_load_n(&o->refcount,__ATOMIC_ACQUIRE) == owned) {
+        /* The elements are released with the same rule */
+        if (o->type == REDIS_SET && o->encoding == REDIS_ENCODING_HT)
+            ((dict*)o->ptr)->type = &lazyfreeSetDictType;
+        else if (o->type == REDIS_HASH && o->encoding == REDIS_ENCODING_HT)
+            ((dict*)o->ptr)->type = &lazyfreeHashDictType;
+        else if (o->type == REDIS_ZSET &&
+                 o->encoding == REDIS_ENCODING_SKIPLIST)
+        {
+            zskiplistNode *x = ((zset*)o->ptr)->zsl->header->level[0].forward;
+
+            /* The dict only points to the members, zslFreeNode() skips
+             * the ones released here */
+            for (; x; x = x->level[0].forward) {
+                lazyfreeRelease(x->obj,1);
+                x->obj = NULL;
+            }
+        }
+        o->refcount = 1;
+        decrRefCount(o);
+    } else {
+        while (owned--) lazyfreeDefer(o);
+    }
+}
+
+static void lazyfreeObjectDestructor(void *privdata, void *val) {
+    DICT_NOTUSED(privdata);
+    lazyfreeRelease(val,1);
+}
+
+/* In a sampled expire index a volatile key is referenced by db->expires too */
+static void lazyfreeKeyDestructor(void *privdata, void *key) {
+    lazyfreeDb *ldb = privdata;
+    robj *o = key;
+
+    lazyfreeRelease(o,(ldb->sampled && keyGetExpire(o) != -1) ? 2 : 1);
+}
+
+static void lazyfreeObjectJob(void *arg) {
+    lazyfreeRelease(arg,1);
+    lazyfreeFlushDeferred();
+    __atomic_add_fetch(&server.stat_lazyfreed_objects,1,__ATOMIC_RELAXED);
+    __atomic_sub_fetch(&server.lazyfree_pending_objects,1,__ATOMIC_RELAXED);
+}
+
+static void lazyfreeDbJob(void *arg) {
+    lazyfreeDb *ldb = arg;
+    unsigned long keys = dictSize(ldb->dict);
+
+    ldb->expires->type = &lazyfreeExpiresDictType;
+    dictRelease(ldb->expires);
+    ldb->dict->type = &lazyfreeKeyspaceDictType;
+    ldb->dict->privdata = ldb;
+    dictRelease(ldb->dict);
+    zfree(ldb);
+    lazyfreeFlushDeferred();
+    __atomic_add_fetch(&server.stat_lazyfreed_objects,keys,__ATOMIC_RELAXED);
+    __atomic_sub_fetch(&server.lazyfree_pending_objects,keys,__ATOMIC_RELAXED);
+}
+
+/* Like decrRefCount(), but if this is the last reference to a big value it is
+ * freed by the bio thread */
+void decrRefCountLazy(robj *o) {
+    if (o->refcount == 1 && server.lazyfree_server_del &&
+        lazyfreeEffort(o) > REDIS_LAZYFREE_THRESHOLD)
+    {
+        __atomic_add_fetch(&server.lazyfree_pending_objects,1,
+            __ATOMIC_RELAXED);
+        bioSubmit(lazyfreeObjectJob,o);
+    } else {
+        decrRefCount(o);
+    }
+}
+
+/* Empty 'db' at once, the old keyspace is released by the bio thread */
+void emptyDbAsync(redisDb *db) {
+    lazyfreeDb *ldb;
+
+    if (dictSize(db->dict) == 0) return;
+    if ((ldb = zmalloc(sizeof(*ldb))) == NULL) oom("emptyDbAsync");
+    ldb->dict = db->dict;
+    ldb->expires = db->expires;
+    ldb->sampled = db->wheel == NULL;
+    db->dict = dictCreateLayout(&hashDictType,NULL,server.keyspace_dict_layout);
+    db->expires = dictCreateLayout(&setDictType,NULL,
+        server.keyspace_dict_layout);
+    if (!db->dict || !db->expires) oom("emptyDbAsync");
+    if (db->wheel) wheelEmpty(db->wheel);
+    __atomic_add_fetch(&server.lazyfree_pending_objects,dictSize(ldb->dict),
+        __ATOMIC_RELAXED);
+    bioSubmit(lazyfreeDbJob,ldb);
+}
+
+/* Main thread: drop the references handed back by the bio thread and take
+ * back the slab slots it freed. Called before sleeping and by the cron. */
+static void lazyfreeProcessDeferred(void) {
+    lazyfreeBatch *b, *next;
+    int j;
+
+    if (__atomic_load_n(&lazyfree_deferred,__ATOMIC_RELAXED) != NULL) {
+        b = __atomic_exchange_n(&lazyfree_deferred,NULL,__ATOMIC_ACQUIRE);
+        while (b) {
+            next = b->next;
+            for (j = 0; j < b->count; j++) decrRefCount(b->objs[j]);
+            zfree(b);
+            b = next;
+        }
+    }
+    slabReclaim();
+}
+
 
 /* ====================== Redis server networking stuff(东西，部分) ===================== */
 
@@ -557,6 +1069,10 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     REDIS_NOTUSED(id);
     REDIS_NOTUSED(clientData);
 
+    updateCachedTime();
+    updateLRUClock();
+    lazyfreeProcessDeferred();
+
     /* Update the global state with the amount of used memory */
     server.usedmemory = zmalloc_used_memory();
 
@@ -566,7 +1082,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 
         size = dictSlots(server.db[j].dict);
         used = dictSize(server.db[j].dict);
-        vkeys = dictSize(server.db[j].expires);
+        vkeys = dbVolatileKeys(server.db+j);
         if (!(loops % 5) && used > 0) {
             redisLog(REDIS_DEBUG,"DB %d: %d keys (%d volatile) in %d slots HT.",j,used,vkeys,size);
             /* dictPrintStats(server.dict); */
@@ -594,6 +1110,9 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     if (server.maxidletime && !(loops % 10))
         closeTimedoutClients();
 
+    /* Free the clients that overcame their output buffer limits */
+    freeClientsInAsyncFreeQueue();
+
     /* Check if a background saving in progress terminated
      * 如果有子进程在saveback则检查是否以完成，没有saveback则检查是否能开启saveback */
     if (server.bgsaveinprogress) {
@@ -630,57 +1149,435 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
          }
     }
 
-    /* Try to expire a few timed out keys 
-	 * 随机删除一批过期的数据 */
-    for (j = 0; j < server.dbnum; j++) {
-        redisDb *db = server.db+j;
-        int num = dictSize(db->expires);
+    /* Keys expired during the last second, the cron runs once a second */
+    server.stat_expired_per_sec =
+        server.stat_expiredkeys-server.stat_expiredkeys_last;
+    server.stat_expiredkeys_last = server.stat_expiredkeys;
+
+    /* Check if we should connect to a MASTER */
+    if (server.replstate == REDIS_REPL_CONNECT) {
+        redisLog(REDIS_NOTICE,"Connecting to MASTER...");
+        if (syncWithMaster() == REDIS_OK) {
+            redisLog(REDIS_NOTICE,"MASTER <-> SLAVE sync succeeded");
+        }
+    }
+	/* 返回1秒而不是 AE_NOMORE,表示重新开一个周期一秒的定时器 */
+    return 1000;
+}
 
-        if (num) {
-            time_t now = time(NULL);
+/* ========================= Active expire cycle ============================
+ *
+ * Volatile keys that are never accessed again must be removed by the server
+ * itself. Every db is sampled REDIS_EXPIRELOOKUPS_PER_CRON keys at a time:
+ * while more than REDIS_EXPIRE_CYCLE_ACCEPTABLE_STALE percent of a sample is
+ * expired there are probably many more, so the db is sampled again. The
+ * work is bounded by a time budget, and the next cycle starts from the db
+ * where the last one stopped so that all the dbs get the same attention.
+ *
+ * The slow cycle runs REDIS_EXPIRE_CYCLE_HZ times per second and can use
+ * REDIS_EXPIRE_CYCLE_SLOW_TIME_PERC percent of the CPU. When it had to stop
+ * because of its budget the fast cycle (at most
+ * REDIS_EXPIRE_CYCLE_FAST_DURATION microseconds) also runs before every
+ * wait of the event loop, to keep up with mass expires.
+ *
+ * With expire-index wheel there is nothing to sample: the keys due are
+ * popped from db->wheel, so the work is exactly one deletion per expired
+ * key and volatile keys never outlive their expire by more than a cycle
+ * (unless the time budget is not enough). */
+
+#define ACTIVE_EXPIRE_CYCLE_SLOW 0
+#define ACTIVE_EXPIRE_CYCLE_FAST 1
+
+static void activeExpireCycle(int type) {
+    static int current_db = 0;          /* 上次处理到的db */
+    static int timelimit_exit = 0;      /* 上次是否因为超时而结束 */
+    static long long last_fast_cycle = 0;
+    long long start = getMonotonicUs(), timelimit;
+    long long sampled = 0, expired = 0, now = server.mstime;
+    double perc;
+    int j, iteration = 0;
+
+    if (type == ACTIVE_EXPIRE_CYCLE_FAST) {
+        /* Only when there is a backlog, and not more often than the
+         * slow cycle would leave room for */
+        if (!timelimit_exit) return;
+        if (start < last_fast_cycle+REDIS_EXPIRE_CYCLE_FAST_DURATION*2)
+            return;
+        last_fast_cycle = start;
+        timelimit = REDIS_EXPIRE_CYCLE_FAST_DURATION;
+    } else {
+        timelimit = 1000000*REDIS_EXPIRE_CYCLE_SLOW_TIME_PERC/
+                    REDIS_EXPIRE_CYCLE_HZ/100;
+    }
+    timelimit_exit = 0;
+
+    for (j = 0; j < server.dbnum && !timelimit_exit; j++) {
+        redisDb *db = server.db+(current_db % server.dbnum);
+        long long db_expired;
+
+        current_db++;
+        if (db->wheel) {
+            wheelNode *node;
+
+            while ((node = wheelPop(db->wheel,now-1)) != NULL) {
+                deleteKey(db,wheelNodeGetKey(node));
+                server.stat_expiredkeys++;
+                if ((++iteration & 15) == 0 &&
+                    getMonotonicUs()-start > timelimit)
+                {
+                    timelimit_exit = 1;
+                    server.stat_expired_time_cap_reached_count++;
+                    break;
+                }
+            }
+            continue;
+        }
+        do {
+            unsigned long num = dictSize(db->expires), n;
 
+            if (num == 0) break;
             if (num > REDIS_EXPIRELOOKUPS_PER_CRON)
                 num = REDIS_EXPIRELOOKUPS_PER_CRON;
-            while (num--) {
+            db_expired = 0;
+            for (n = 0; n < num; n++) {
                 dictEntry *de;
-                time_t t;
+                robj *key;
 
                 if ((de = dictGetRandomKey(db->expires)) == NULL) break;
-                t = (time_t) dictGetEntryVal(de);
-                if (now > t) {
-                    deleteKey(db,dictGetEntryKey(de));
+                key = dictGetEntryKey(de);
+                if (now > keyGetExpire(key)) {
+                    deleteKey(db,key);
+                    db_expired++;
                 }
             }
+            sampled += n;
+            expired += db_expired;
+            server.stat_expiredkeys += db_expired;
+
+            /* Checking the time costs a syscall: only every 16 samples */
+            if ((++iteration & 15) == 0 &&
+                getMonotonicUs()-start > timelimit)
+            {
+                timelimit_exit = 1;
+                server.stat_expired_time_cap_reached_count++;
+                break;
+            }
+        } while (db_expired*100 >
+                 REDIS_EXPIRELOOKUPS_PER_CRON*REDIS_EXPIRE_CYCLE_ACCEPTABLE_STALE);
+    }
+
+    /* Running average of the expired share of the samples: multiplied by
+     * the number of volatile keys it estimates the keys waiting to expire */
+    perc = sampled ? (double)expired/sampled*100 : 0;
+    server.stat_expired_stale_perc =
+        perc*0.05 + server.stat_expired_stale_perc*0.95;
+}
+
+static int expireCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
+    REDIS_NOTUSED(eventLoop);
+    REDIS_NOTUSED(id);
+    REDIS_NOTUSED(clientData);
+
+    updateCachedTime();
+    activeExpireCycle(ACTIVE_EXPIRE_CYCLE_SLOW);
+    return 1000/REDIS_EXPIRE_CYCLE_HZ;
+}
+
+/* Reply nil to the BLPOP/BRPOP whose timeout elapsed */
+static int blockedClientsCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
+    REDIS_NOTUSED(eventLoop);
+    REDIS_NOTUSED(id);
+    REDIS_NOTUSED(clientData);
+
+    updateCachedTime();
+    handleBlockedClientsTimeout();
+    return 1000/REDIS_BLOCKED_TIMEOUT_HZ;
+}
+
+/* ========================== Maxmemory eviction ============================
+ *
+ * When used memory is over 'maxmemory' the keys are evicted according to
+ * maxmemory-policy before every command that can grow memory. There is no
+ * global LRU list: the server samples maxmemory-samples keys per db and
+ * keeps the best candidates found so far in an eviction pool that survives
+ * across calls, so the approximation gets better the more keys are evicted.
+ *
+ * The candidates are ranked by the access clock stored in obj->lru: the
+ * seconds since the last access with the LRU policies, 255 minus the
+ * logarithmic access counter with allkeys-lfu, the expire time with
+ * volatile-ttl. With expire-index wheel there is no dict of the volatile
+ * keys to sample, the volatile policies sample the keyspace and skip the
+ * keys without an expire.
+ *
+ * A slave doesn't evict by itself: the master sends the DELs of its own
+ * evictions, so that the dataset stays the same. */
+
+static void evictionPoolAlloc(void) {
+    int j;
+
+    server.evictionpool = zmalloc(sizeof(struct evictionPoolEntry)*
+                                  REDIS_EVICTION_POOL_SIZE);
+    if (!server.evictionpool) oom("evictionPoolAlloc");
+    for (j = 0; j < REDIS_EVICTION_POOL_SIZE; j++) {
+        server.evictionpool[j].idle = 0;
+        server.evictionpool[j].key = NULL;
+        server.evictionpool[j].dbid = 0;
+    }
+}
+
+/* Insert 'key' in the pool if it is better than the worst candidate, or
+ * if there is still a free slot */
+static void evictionPoolInsert(unsigned long long idle, robj *key, int dbid) {
+    struct evictionPoolEntry *pool = server.evictionpool;
+    int k = 0;
+
+    while (k < REDIS_EVICTION_POOL_SIZE && pool[k].key &&
+           pool[k].idle < idle) k++;
+    if (k == 0 && pool[REDIS_EVICTION_POOL_SIZE-1].key != NULL) {
+        /* Worse than everything in a full pool */
+        return;
+    } else if (k < REDIS_EVICTION_POOL_SIZE && pool[k].key == NULL) {
+        /* Free slot at the insertion point */
+    } else if (pool[REDIS_EVICTION_POOL_SIZE-1].key == NULL) {
+        /* Free slot at the end: shift right the candidates from k */
+        memmove(pool+k+1,pool+k,
+            sizeof(pool[0])*(REDIS_EVICTION_POOL_SIZE-k-1));
+    } else {
+        /* Full pool: drop the worst candidate shifting left up to k */
+        k--;
+        sdsfree(pool[0].key);
+        memmove(pool,pool+1,sizeof(pool[0])*k);
+    }
+    pool[k].idle = idle;
+    pool[k].key = sdsdup(key->ptr);
+    if (!pool[k].key) oom("evictionPoolInsert");
+    pool[k].dbid = dbid;
+}
+
+/* Sample 'db' and add the candidates to the eviction pool. Returns the
+ * number of keys sampled. */
+static int evictionPoolPopulate(redisDb *db) {
+    int policy = server.maxmemory_policy;
+    int samples = server.maxmemory_samples, tries = samples*10, sampled = 0;
+    dictEntry *de;
+
+    while (samples > 0 && tries-- > 0) {
+        unsigned long long idle;
+        robj *key, *val;
+
+        if ((policy & REDIS_MAXMEMORY_FLAG_VOLATILE) && !db->wheel) {
+            /* db->expires holds the same key objects as db->dict */
+            if ((de = dictGetRandomKey(db->expires)) == NULL) break;
+            key = dictGetEntryKey(de);
+            if ((de = objDictFind(db->dict,key)) == NULL) continue;
+        } else {
+            if ((de = dictGetRandomKey(db->dict)) == NULL) break;
+            key = dictGetEntryKey(de);
+            if ((policy & REDIS_MAXMEMORY_FLAG_VOLATILE) &&
+                keyGetExpire(key) == -1) continue;
         }
+        samples--;
+        sampled++;
+        val = dictGetEntryVal(de);
+        if (policy & REDIS_MAXMEMORY_FLAG_LRU)
+            idle = estimateObjectIdleTime(val);
+        else if (policy & REDIS_MAXMEMORY_FLAG_LFU)
+            idle = 255-LFUDecrAndReturn(val);
+        else
+            idle = ULLONG_MAX-keyGetExpire(key);
+        evictionPoolInsert(idle,key,db->id);
     }
+    return sampled;
+}
 
-    /* Check if we should connect to a MASTER */
-    if (server.replstate == REDIS_REPL_CONNECT) {
-        redisLog(REDIS_NOTICE,"Connecting to MASTER...");
-        if (syncWithMaster() == REDIS_OK) {
-            redisLog(REDIS_NOTICE,"MASTER <-> SLAVE sync succeeded");
+/* Pop the best candidate of the pool that still exists. Returns the key
+ * object of the keyspace, NULL if the pool is empty. */
+static robj *evictionPoolPop(int *dbid) {
+    struct evictionPoolEntry *pool = server.evictionpool;
+    int k;
+
+    for (k = REDIS_EVICTION_POOL_SIZE-1; k >= 0; k--) {
+        robj keyobj;
+        dictEntry *de;
+
+        if (pool[k].key == NULL) continue;
+        keyobj.type = REDIS_STRING;
+        keyobj.encoding = REDIS_ENCODING_RAW;
+        keyobj.lru = 0;
+        keyobj.refcount = 1;
+        keyobj.ptr = pool[k].key;
+        de = objDictFind(server.db[pool[k].dbid].dict,&keyobj);
+        sdsfree(pool[k].key);
+        pool[k].key = NULL;
+        if (de) {
+            *dbid = pool[k].dbid;
+            return dictGetEntryKey(de);
         }
     }
-	/* 返回1秒而不是 AE_NOMORE,表示重新开一个周期一秒的定时器 */
-    return 1000;
+    return NULL;
+}
+
+/* Send DEL 'key' to the slaves, as if a client evicted the key */
+static void propagateEviction(redisDb *db, robj *key) {
+    static struct redisCommand *delcmd = NULL;
+    robj *argv[2];
+
+    if (listLength(server.slaves) == 0 && listLength(server.monitors) == 0)
+        return;
+    if (delcmd == NULL) delcmd = lookupCommand("del");
+    argv[0] = createStringObject("DEL",3);
+    argv[1] = key;
+    incrRefCount(key);
+    if (listLength(server.slaves))
+        replicationFeedSlaves(server.slaves,delcmd,db->id,argv,2);
+    if (listLength(server.monitors))
+        replicationFeedSlaves(server.monitors,delcmd,db->id,argv,2);
+    decrRefCount(argv[0]);
+    decrRefCount(argv[1]);
+}
+
+/* Memory counted against maxmemory. The output buffers of the slaves are
+ * left out: they grow with the DELs of the evictions and hold the evicted
+ * keys until sent, so evicting because of them would only make them
+ * bigger. */
+static size_t evictionUsedMemory(void) {
+    size_t used = zmalloc_used_memory(), overhead = 0;
+    listNode *ln;
+
+    listRewind(server.slaves);
+    while ((ln = listYield(server.slaves))) {
+        redisClient *slave = listNodeValue(ln);
+
+        /* reply_bytes only counts the strings, not the objects holding
+         * them and the list nodes */
+        overhead += slave->reply_bytes +
+            listLength(slave->reply)*(sizeof(listNode)+sizeof(robj));
+    }
+    return used > overhead ? used-overhead : 0;
+}
+
+/* Evict keys until the used memory is under maxmemory. Returns REDIS_ERR
+ * if that was not possible (noeviction, or no more keys to evict).
+ *
+ * The memory is measured again after every eviction instead of adding up
+ * what each deletion released: the objects freed to the slab pools and the
+ * keys still referenced by the slave buffers don't lower the used memory
+ * right away. */
+static int freeMemoryIfNeeded(void) {
+    static int next_db = 0;     /* allkeys-random: 轮流从每个db中淘汰 */
+    int policy = server.maxmemory_policy;
+
+    if (server.maxmemory == 0 || zmalloc_used_memory() <= server.maxmemory)
+        return REDIS_OK;
+    if (server.masterhost) return REDIS_OK;
+    if (evictionUsedMemory() <= server.maxmemory) return REDIS_OK;
+    if (policy == REDIS_MAXMEMORY_NO_EVICTION) return REDIS_ERR;
+
+    do {
+        robj *bestkey = NULL;
+        int bestdbid = 0, j;
+
+        if (policy & REDIS_MAXMEMORY_FLAG_RANDOM) {
+            for (j = 0; j < server.dbnum && !bestkey; j++) {
+                redisDb *db = server.db+(next_db++ % server.dbnum);
+                dictEntry *de = dictGetRandomKey(db->dict);
+
+                if (de) {
+                    bestkey = dictGetEntryKey(de);
+                    bestdbid = db->id;
+                }
+            }
+        } else {
+            /* The pool may only hold keys deleted in the meantime: they
+             * are dropped by evictionPoolPop(), so sample again */
+            while (bestkey == NULL) {
+                int sampled = 0;
+
+                for (j = 0; j < server.dbnum; j++) {
+                    redisDb *db = server.db+j;
+
+                    if (dictSize(db->dict) == 0 ||
+                        ((policy & REDIS_MAXMEMORY_FLAG_VOLATILE) &&
+                         dbVolatileKeys(db) == 0)) continue;
+                    sampled += evictionPoolPopulate(db);
+                }
+                if (sampled == 0) break;
+                bestkey = evictionPoolPop(&bestdbid);
+            }
+        }
+        if (bestkey == NULL) return REDIS_ERR;
+
+        propagateEviction(server.db+bestdbid,bestkey);
+        deleteKeyGeneric(server.db+bestdbid,bestkey,0);
+        server.stat_evictedkeys++;
+        server.dirty++;
+    } while (evictionUsedMemory() > server.maxmemory);
+    return REDIS_OK;
+}
+
+/* Called by the event loop every time before waiting for events */
+static void beforeSleep(struct aeEventLoop *eventLoop) {
+    REDIS_NOTUSED(eventLoop);
+
+    /* The clients served by a push or timed out may have more commands in
+     * their query buffer, read while they were blocked */
+    while (listLength(server.unblocked_clients)) {
+        listNode *ln = listFirst(server.unblocked_clients);
+        redisClient *c = listNodeValue(ln);
+
+        c->flags &= ~REDIS_UNBLOCKED;
+        listDelNode(server.unblocked_clients,ln);
+        if (c->flags & REDIS_CLOSE_ASAP) continue;
+        if (sdslen(c->querybuf) >= REDIS_BLOCKED_MAX_QUERYBUF) {
+            /* Reading may have been stopped, see readQueryFromClient() */
+            aeDeleteFileEvent(server.el,c->fd,AE_READABLE);
+            if (aeCreateFileEvent(server.el,c->fd,AE_READABLE,
+                readQueryFromClient,c,NULL) == AE_ERR)
+            {
+                freeClient(c);
+                continue;
+            }
+        }
+        if (sdslen(c->querybuf)) processInputBuffer(c);
+    }
+    /* Don't let the clients over their output limits (slaves in
+     * particular) queue replies until the next serverCron() */
+    freeClientsInAsyncFreeQueue();
+    activeExpireCycle(ACTIVE_EXPIRE_CYCLE_FAST);
+    lazyfreeProcessDeferred();
+}
+
+/* Called by the event loop when it's done waiting, before the events */
+static void afterSleep(struct aeEventLoop *eventLoop) {
+    REDIS_NOTUSED(eventLoop);
+
+    updateCachedTime();
 }
 
 static void initServer() {
     int j;
+    unsigned char hashseed[16];
 
     signal(SIGHUP, SIG_IGN);
     signal(SIGPIPE, SIG_IGN);
+    updateCachedTime();
+
+    /* Seed the dict hash function before the first dictCreate() */
+    getRandomBytes(hashseed,sizeof(hashseed));
+    dictSetHashFunctionSeed(hashseed);
 
     server.clients = listCreate();
     server.slaves = listCreate();
     server.monitors = listCreate();
-    server.objfreelist = listCreate();
+    server.clients_to_close = listCreate();
+    server.unblocked_clients = listCreate();
+    server.blocked_clients = 0;
     createSharedObjects();
     server.el = aeCreateEventLoop();
     server.db = zmalloc(sizeof(redisDb)*server.dbnum);
     server.sharingpool = dictCreate(&setDictType,NULL);
     server.sharingpoolsize = 1024;
-    if (!server.db || !server.clients || !server.slaves || !server.monitors || !server.el || !server.objfreelist)
+    if (!server.db || !server.clients || !server.slaves || !server.monitors || !server.clients_to_close || !server.unblocked_clients || !server.el)
         oom("server initialization"); /* Fatal OOM */
     server.fd = anetTcpServer(server.neterr, server.port, server.bindaddr);
     if (server.fd == -1) {
@@ -688,21 +1585,53 @@ static void initServer() {
         exit(1);
     }
     for (j = 0; j < server.dbnum; j++) {
-        server.db[j].dict = dictCreate(&hashDictType,NULL);
-        server.db[j].expires = dictCreate(&setDictType,NULL);
+        server.db[j].dict = dictCreateLayout(&hashDictType,NULL,
+            server.keyspace_dict_layout);
+        server.db[j].expires = dictCreateLayout(&setDictType,NULL,
+            server.keyspace_dict_layout);
+        server.db[j].wheel = NULL;
+        server.db[j].blockingkeys = dictCreate(&keylistDictType,NULL);
+        if (server.expire_index == REDIS_EXPIRE_INDEX_WHEEL &&
+            (server.db[j].wheel = wheelCreate(server.mstime)) == NULL)
+            oom("wheelCreate");
         server.db[j].id = j;
     }
+    if ((server.blocked_timeouts = wheelCreate(server.mstime)) == NULL)
+        oom("wheelCreate");
+    evictionPoolAlloc();
+    bitopsInit();
+    if (bioInit() == -1) {
+        redisLog(REDIS_WARNING, "Can't create the background jobs thread");
+        exit(1);
+    }
     server.cronloops = 0;
+    updateLRUClock();
     server.bgsaveinprogress = 0;
     server.lastsave = time(NULL);
     server.dirty = 0;
     server.usedmemory = 0;
     server.stat_numcommands = 0;
     server.stat_numconnections = 0;
+    server.stat_expiredkeys = 0;
+    server.stat_expiredkeys_last = 0;
+    server.stat_expired_per_sec = 0;
+    server.stat_evictedkeys = 0;
+    server.stat_keyspace_hits = 0;
+    server.stat_keyspace_misses = 0;
+    server.lazyfree_pending_objects = 0;
+    server.stat_lazyfreed_objects = 0;
+    server.stat_expired_stale_perc = 0;
+    server.stat_expired_time_cap_reached_count = 0;
     server.stat_starttime = time(NULL);
 	
 	/* 创建一个1秒的定时器 */
     aeCreateTimeEvent(server.el, 1000, serverCron, NULL, NULL);
+    aeCreateTimeEvent(server.el, 1000/REDIS_EXPIRE_CYCLE_HZ, expireCron,
+        NULL, NULL);
+    aeCreateTimeEvent(server.el, 1000/REDIS_BLOCKED_TIMEOUT_HZ,
+        blockedClientsCron, NULL, NULL);
+    aeSetBeforeSleepProc(server.el, beforeSleep);
+    aeSetAfterSleepProc(server.el, afterSleep);
 }
 
 /* socket断开后，释放client */
@@ -736,12 +1665,115 @@ static void freeClient(redisClient *c) {
         server.master = NULL;
         server.replstate = REDIS_REPL_CONNECT;
     }
+    if (c->flags & REDIS_CLOSE_ASAP) {
+        ln = listSearchKey(server.clients_to_close,c);
+        assert(ln != NULL);
+        listDelNode(server.clients_to_close,ln);
+    }
+    if (c->flags & REDIS_BLOCKED) unblockClientWaitingData(c);
+    if (c->flags & REDIS_UNBLOCKED) {
+        ln = listSearchKey(server.unblocked_clients,c);
+        assert(ln != NULL);
+        listDelNode(server.unblocked_clients,ln);
+    }
     zfree(c->argv);
     zfree(c);
 }
 
+/* Schedule the client to be freed by beforeSleep()/serverCron(). Used when
+ * the client can't be freed synchronously, for instance from addReply()
+ * while the caller may be iterating the slaves list. No further command of
+ * the client is executed and nothing more is sent to it. */
+static void freeClientAsync(redisClient *c) {
+    if (c->flags & REDIS_CLOSE_ASAP) return;
+    c->flags |= REDIS_CLOSE_ASAP;
+    aeDeleteFileEvent(server.el,c->fd,AE_READABLE);
+    aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
+    if (!listAddNodeTail(server.clients_to_close,c)) oom("listAddNodeTail");
+}
+
+static void freeClientsInAsyncFreeQueue(void) {
+    while (listLength(server.clients_to_close)) {
+        listNode *ln = listFirst(server.clients_to_close);
+        redisClient *c = listNodeValue(ln);
+
+        c->flags &= ~REDIS_CLOSE_ASAP;
+        listDelNode(server.clients_to_close,ln);
+        freeClient(c);
+    }
+}
+
+static int getClientLimitClass(redisClient *c) {
+    if (c->flags & REDIS_MONITOR) return REDIS_CLIENT_LIMIT_CLASS_MONITOR;
+    if (c->flags & REDIS_SLAVE) return REDIS_CLIENT_LIMIT_CLASS_SLAVE;
+    return REDIS_CLIENT_LIMIT_CLASS_NORMAL;
+}
+
+static char *getClientLimitClassName(int class) {
+    switch(class) {
+    case REDIS_CLIENT_LIMIT_CLASS_NORMAL: return "normal";
+    case REDIS_CLIENT_LIMIT_CLASS_SLAVE: return "slave";
+    case REDIS_CLIENT_LIMIT_CLASS_MONITOR: return "monitor";
+    default: return NULL;
+    }
+}
+
+/* Return 1 if the client reached the hard limit of its class, or if it is
+ * over the soft limit since more than soft_limit_seconds. As a side effect
+ * the time the soft limit was reached is set or cleared. */
+static int checkClientOutputBufferLimits(redisClient *c) {
+    struct clientBufferLimitsConfig *l =
+        server.client_obuf_limits+getClientLimitClass(c);
+    int hard = 0, soft = 0;
+
+    if (l->hard_limit_bytes && c->reply_bytes >= l->hard_limit_bytes)
+        hard = 1;
+    if (l->soft_limit_bytes && c->reply_bytes >= l->soft_limit_bytes)
+        soft = 1;
+
+    if (soft) {
+        time_t now = server.unixtime;
+
+        if (c->obuf_soft_limit_reached_time == 0) {
+            c->obuf_soft_limit_reached_time = now;
+            soft = 0; /* First time we see the soft limit reached */
+        } else if (now - c->obuf_soft_limit_reached_time <=
+                   l->soft_limit_seconds) {
+            soft = 0; /* Not over the limit for long enough */
+        }
+    } else {
+        c->obuf_soft_limit_reached_time = 0;
+    }
+    return hard || soft;
+}
+
+/* Called every time something is appended to the output list of the
+ * client. The client can't be freed here, as addReply() is called in the
+ * middle of command execution and while iterating the slaves list, so it
+ * is scheduled for asynchronous freeing. */
+static void closeClientOnOutputBufferLimitReached(redisClient *c) {
+    if (c->flags & REDIS_MASTER) return;
+    if (checkClientOutputBufferLimits(c)) {
+        redisLog(REDIS_WARNING,
+            "Client fd=%d (%s) scheduled to be closed for overcoming of output buffer limits (%lu bytes in %d objects)",
+            c->fd, getClientLimitClassName(getClientLimitClass(c)),
+            c->reply_bytes, listLength(c->reply));
+        freeClientAsync(c);
+    }
+}
+
 
 
+/* Big bulk arguments are read straight into a query buffer allocated once
+ * at their final size, but only for authenticated clients: anybody else
+ * could make us allocate up to 1GB per connection with a single
+ * "SET key 1073741823" line. The others are read in REDIS_IOBUF_LEN chunks,
+ * so the buffer only grows with the data really received. */
+static int clientCanPreallocBulk(redisClient *c) {
+    return c->bulklen >= REDIS_MBULK_BIG_ARG &&
+           (!server.requirepass || c->authenticated);
+}
+
 /* If this function gets called we already read a whole
  * command, argments are in the client argv/argc fields.
  * processCommand() execute the command or prepare the
@@ -754,6 +1786,13 @@ static int processCommand(redisClient *c) {
     struct redisCommand *cmd;
     long long dirty;
 
+    /* A client scheduled to be closed (see freeClientAsync()) doesn't run
+     * commands anymore, not even the ones already in its query buffer */
+    if (c->flags & REDIS_CLOSE_ASAP) {
+        resetClient(c);
+        return 1;
+    }
+
     /* The QUIT command is handled as a special case. Normal command
      * procs are unable to close the client connection safely */
     if (!strcasecmp(c->argv[0]->ptr,"quit")) {
@@ -790,6 +1829,14 @@ static int processCommand(redisClient *c) {
             c->argc++;
             c->querybuf = sdsrange(c->querybuf,c->bulklen,-1);
         } else {
+            /* Big argument: allocate the query buffer once so that
+             * readQueryFromClient() can read the payload straight into
+             * it and later turn it into the argument without copying. */
+            if (clientCanPreallocBulk(c)) {
+                c->querybuf = sdsMakeRoomForExact(c->querybuf,
+                    c->bulklen-sdslen(c->querybuf));
+                if (c->querybuf == NULL) oom("sdsMakeRoomForExact");
+            }
             return 1;
         }
     }
@@ -806,6 +1853,16 @@ static int processCommand(redisClient *c) {
         return 1;
     }
 
+    /* Evict keys if we are over maxmemory. When that's not possible the
+     * commands that may grow memory are refused, the others still run. */
+    if (server.maxmemory && freeMemoryIfNeeded() == REDIS_ERR &&
+        (cmd->flags & REDIS_CMD_DENYOOM))
+    {
+        addReplySds(c,sdsnew("-ERR command not allowed when used memory > 'maxmemory'\r\n"));
+        resetClient(c);
+        return 1;
+    }
+
     /* Exec the command */
     dirty = server.dirty;
     cmd->proc(c);
@@ -843,11 +1900,12 @@ static void replicationFeedSlaves(list *slaves, struct redisCommand *cmd, int di
     for (j = 0; j < argc; j++) {
         if (j != 0) outv[outc++] = shared.space;
         if ((cmd->flags & REDIS_CMD_BULK) && j == argc-1) {
-            robj *lenobj;
+            robj *lenobj, *decoded = getDecodedObject(argv[j]);
 
             lenobj = createObject(REDIS_STRING,
-                sdscatprintf(sdsempty(),"%d\r\n",sdslen(argv[j]->ptr)));
+                sdscatprintf(sdsempty(),"%d\r\n",(int)sdslen(decoded->ptr)));
             lenobj->refcount = 0;
+            decrRefCount(decoded);
             outv[outc++] = lenobj;
         }
         outv[outc++] = argv[j];
@@ -898,11 +1956,25 @@ static void replicationFeedSlaves(list *slaves, struct redisCommand *cmd, int di
 static void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     redisClient *c = (redisClient*) privdata;
     char buf[REDIS_IOBUF_LEN];
-    int nread;
+    int nread, bigread = 0;
+    size_t qblen = 0;
     REDIS_NOTUSED(el);
     REDIS_NOTUSED(mask);
 
-    nread = read(fd, buf, REDIS_IOBUF_LEN);
+    /* 正在读取一个大的bulk参数:querybuf已经在processCommand()中按最终长度
+     * 分配好了,这里只读取剩余的字节并直接写入querybuf,避免经由栈上的小
+     * buffer反复拷贝与sds扩容。小的命令仍然走原来的路径。 */
+    if (clientCanPreallocBulk(c) &&
+        (signed)sdslen(c->querybuf) < c->bulklen)
+    {
+        bigread = 1;
+        qblen = sdslen(c->querybuf);
+        c->querybuf = sdsMakeRoomForExact(c->querybuf, c->bulklen-qblen);
+        if (c->querybuf == NULL) oom("sdsMakeRoomForExact");
+        nread = read(fd, c->querybuf+qblen, c->bulklen-qblen);
+    } else {
+        nread = read(fd, buf, REDIS_IOBUF_LEN);
+    }
     if (nread == -1) {
         if (errno == EAGAIN) {
             nread = 0;
@@ -918,12 +1990,28 @@ static void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mas
     }
 	/* */
     if (nread) {
-        c->querybuf = sdscatlen(c->querybuf, buf, nread);
-        c->lastinteraction = time(NULL);
+        if (bigread)
+            sdsIncrLen(c->querybuf, nread);
+        else
+            c->querybuf = sdscatlen(c->querybuf, buf, nread);
+        c->lastinteraction = server.unixtime;
     } else {
         return;
     }
+    /* A blocked client just accumulates its input until it is served. We
+     * keep reading (to see it disconnecting) up to a limit, then stop and
+     * let TCP push back: reading starts again in beforeSleep(). */
+    if (c->flags & REDIS_BLOCKED) {
+        if (sdslen(c->querybuf) >= REDIS_BLOCKED_MAX_QUERYBUF)
+            aeDeleteFileEvent(server.el,c->fd,AE_READABLE);
+        return;
+    }
+    processInputBuffer(c);
+}
 
+/* Execute the commands in the query buffer of the client */
+static void processInputBuffer(redisClient *c) {
+    if (c->flags & REDIS_CLOSE_ASAP) return;
 again:
     if (c->bulklen == -1) {
         /* Read the first line of the query */
@@ -960,7 +2048,7 @@ again:
 
             for (j = 0; j < argc; j++) {
                 if (sdslen(argv[j])) {
-                    c->argv[c->argc] = createObject(REDIS_STRING,argv[j]);
+                    c->argv[c->argc] = createStringObjectFromSds(argv[j]);
                     c->argc++;
                 } else {
                     sdsfree(argv[j]);
@@ -970,7 +2058,9 @@ again:
             /* Execute the command. If the client is still valid
              * after processCommand() return and there is something
              * on the query buffer try to process the next command. */
-            if (processCommand(c) && sdslen(c->querybuf)) goto again;
+            if (processCommand(c) &&
+                !(c->flags & (REDIS_BLOCKED|REDIS_CLOSE_ASAP)) &&
+                sdslen(c->querybuf)) goto again;
             return;
         } else if (sdslen(c->querybuf) >= 1024*32) {
             redisLog(REDIS_DEBUG, "Client protocol error");
@@ -984,7 +2074,17 @@ again:
            argument of the command. */
         int qbl = sdslen(c->querybuf);
 
-        if (c->bulklen <= qbl) {
+        if (c->bulklen == qbl && c->bulklen >= REDIS_MBULK_BIG_ARG) {
+            /* The query buffer contains exactly the big argument: use
+             * it as the argument itself, dropping the final CRLF, and
+             * start again with a fresh query buffer. */
+            sdsIncrLen(c->querybuf,-2);
+            c->argv[c->argc] = createObject(REDIS_STRING,c->querybuf);
+            c->argc++;
+            c->querybuf = sdsempty();
+            processCommand(c);
+            return;
+        } else if (c->bulklen <= qbl) {
             /* Copy everything but the final CRLF as final argument */
             c->argv[c->argc] = createStringObject(c->querybuf,c->bulklen-2);
             c->argc++;
@@ -1016,10 +2116,15 @@ static redisClient *createClient(int fd) {
     c->argv = NULL;
     c->bulklen = -1;
     c->sentlen = 0;
+    c->reply_bytes = 0;
+    c->obuf_soft_limit_reached_time = 0;
     c->flags = 0;
-    c->lastinteraction = time(NULL);
+    c->lastinteraction = server.unixtime;
     c->authenticated = 0;
     c->replstate = REDIS_REPL_NONE;
+    c->blockingkeys = NULL;
+    c->blockingkeysnum = 0;
+    c->blockingtimeout.pprev = NULL;
     if ((c->reply = listCreate()) == NULL) oom("listCreate");
     listSetFreeMethod(c->reply,decrRefCount);
     listSetDupMethod(c->reply,dupClientReplyValue);
@@ -1033,13 +2138,30 @@ static redisClient *createClient(int fd) {
 }
 
 static void addReply(redisClient *c, robj *obj) {
+    if (c->flags & REDIS_CLOSE_ASAP) {
+        /* Never sent, but still referenced by the reply list like for any
+         * other client: the callers filling a deferred length after
+         * addReply() rely on it. Released by freeClient(). */
+        incrRefCount(obj);
+        if (!listAddNodeTail(c->reply,obj)) oom("listAddNodeTail");
+        return;
+    }
     if (listLength(c->reply) == 0 &&
         (c->replstate == REDIS_REPL_NONE ||
          c->replstate == REDIS_REPL_ONLINE) &&
         aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
         sendReplyToClient, c, NULL) == AE_ERR) return;
+    /* Integer encoded values are turned into a string only here, when
+     * the bytes are really needed */
+    if (obj->encoding == REDIS_ENCODING_INT)
+        obj = getDecodedObject(obj);
+    else
+        incrRefCount(obj);
     if (!listAddNodeTail(c->reply,obj)) oom("listAddNodeTail");
-    incrRefCount(obj);
+    /* Objects with a NULL ptr are deferred lengths filled later by the
+     * command itself, that accounts for them (see keysCommand()). */
+    if (obj->ptr) c->reply_bytes += sdslen(obj->ptr);
+    closeClientOnOutputBufferLimitReached(c);
 }
 
 static void addReplySds(redisClient *c, sds s) {
@@ -1048,6 +2170,15 @@ static void addReplySds(redisClient *c, sds s) {
     decrRefCount(o);
 }
 
+/* 以bulk格式回复一个字符串对象: $<len>\r\n<data>\r\n */
+static void addReplyBulk(redisClient *c, robj *obj) {
+    obj = getDecodedObject(obj);
+    addReplySds(c,sdscatprintf(sdsempty(),"$%d\r\n",(int)sdslen(obj->ptr)));
+    addReply(c,obj);
+    addReply(c,shared.crlf);
+    decrRefCount(obj);
+}
+
 static void acceptHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     int cport, cfd;
     char cip[128];
@@ -1090,7 +2221,7 @@ static robj *tryObjectSharing(robj *o) {
     if (o == NULL || server.shareobjects == 0) return o;
 
     assert(o->type == REDIS_STRING);
-    de = dictFind(server.sharingpool,o);
+    de = objDictFind(server.sharingpool,o);
     if (de) {
         robj *shared = dictGetEntryKey(de);
 
@@ -1111,7 +2242,7 @@ static robj *tryObjectSharing(robj *o) {
             c = ((unsigned long) dictGetEntryVal(de))-1;
             dictGetEntryVal(de) = (void*) c;
             if (c == 0) {
-                dictDelete(server.sharingpool,de->key);
+                objDictDelete(server.sharingpool,de->key);
             }
         } else {
             c = 0; /* If the pool is empty we want to add this object */
@@ -1119,7 +2250,7 @@ static robj *tryObjectSharing(robj *o) {
         if (c == 0) {
             int retval;
 
-            retval = dictAdd(server.sharingpool,o,(void*)1);
+            retval = objDictAdd(server.sharingpool,o,(void*)1);
             assert(retval == DICT_OK);
             incrRefCount(o);
         }
@@ -1132,19 +2263,49 @@ static robj *tryObjectSharing(robj *o) {
 
 /*================================== Commands =============================== */
 static int qsortCompareSetsByCardinality(const void *s1, const void *s2) {
-    dict **d1 = (void*) s1, **d2 = (void*) s2;
+    robj **o1 = (void*) s1, **o2 = (void*) s2;
+
+    return (int)setTypeSize(*o1)-(int)setTypeSize(*o2);
+}
+
+/* Append an integer set member to the reply */
+static void addReplyIntsetMember(redisClient *c, int64_t llele) {
+    char buf[32];
+    int len = snprintf(buf,sizeof(buf),"%lld",(long long)llele);
+
+    addReplySds(c,sdscatprintf(sdsempty(),"$%d\r\n%s\r\n",len,buf));
+}
+
+/* Reply with the members of 'is', or store it as a set into 'dstkey'.
+ * When storing 'is' becomes the value of the key. */
+static void replyOrStoreIntset(redisClient *c, intset *is, robj *dstkey) {
+    uint32_t ii = 0;
+    int64_t llele;
+
+    if (!dstkey) {
+        addReplySds(c,sdscatprintf(sdsempty(),"*%u\r\n",intsetLen(is)));
+        while (intsetGet(is,ii++,&llele))
+            addReplyIntsetMember(c,llele);
+    } else {
+        robj *dstset = createObject(REDIS_SET,is);
 
-    return dictSize(*d1)-dictSize(*d2);
+        dstset->encoding = REDIS_ENCODING_INTSET;
+        if (intsetLen(is) > server.set_max_intset_entries)
+            setTypeConvert(dstset,REDIS_ENCODING_HT);
+        deleteKey(c->db,dstkey);
+        dbAdd(c->db,dstkey,dstset);
+        addReplySds(c,sdscatprintf(sdsempty(),":%lu\r\n",setTypeSize(dstset)));
+        server.dirty++;
+    }
 }
 
 static void sinterGenericCommand(redisClient *c, robj **setskeys, int setsnum, robj *dstkey) {
-    dict **dv = zmalloc(sizeof(dict*)*setsnum);
-    dictIterator *di;
-    dictEntry *de;
-    robj *lenobj = NULL, *dstset = NULL;
+    robj **sets = zmalloc(sizeof(robj*)*setsnum);
+    setTypeIterator *si;
+    robj *ele, *lenobj = NULL, *dstset = NULL;
     int j, cardinality = 0;
 
-    if (!dv) oom("sinterGenericCommand");
+    if (!sets) oom("sinterGenericCommand");
     for (j = 0; j < setsnum; j++) {
         robj *setobj;
 
@@ -1152,7 +2313,7 @@ static void sinterGenericCommand(redisClient *c, robj **setskeys, int setsnum, r
                     lookupKeyWrite(c->db,setskeys[j]) :
                     lookupKeyRead(c->db,setskeys[j]);
         if (!setobj) {
-            zfree(dv);
+            zfree(sets);
             if (dstkey) {
                 deleteKey(c->db,dstkey);
                 addReply(c,shared.ok);
@@ -1162,15 +2323,36 @@ static void sinterGenericCommand(redisClient *c, robj **setskeys, int setsnum, r
             return;
         }
         if (setobj->type != REDIS_SET) {
-            zfree(dv);
+            zfree(sets);
             addReply(c,shared.wrongtypeerr);
             return;
         }
-        dv[j] = setobj->ptr;
+        sets[j] = setobj;
     }
     /* Sort sets from the smallest to largest, this will improve our
      * algorithm's performace */
-    qsort(dv,setsnum,sizeof(dict*),qsortCompareSetsByCardinality);
+    qsort(sets,setsnum,sizeof(robj*),qsortCompareSetsByCardinality);
+
+    /* When all the sets are intsets intersect the sorted arrays directly,
+     * starting from the smallest one. */
+    for (j = 0; j < setsnum; j++)
+        if (sets[j]->encoding != REDIS_ENCODING_INTSET) break;
+    if (j == setsnum) {
+        intset *is = sets[0]->ptr, *tmp;
+        int owned = 0;
+
+        for (j = 1; j < setsnum && intsetLen(is); j++) {
+            tmp = intsetIntersect(is,sets[j]->ptr);
+            if (owned) zfree(is);
+            is = tmp;
+            owned = 1;
+        }
+        if (dstkey && !owned) is = intsetDup(is);
+        replyOrStoreIntset(c,is,dstkey);
+        if (!dstkey && owned) zfree(is);
+        zfree(sets);
+        return;
+    }
 
     /* The first thing we should output is the total number of elements...
      * since this is a multi-bulk write, but at this stage we don't know
@@ -1184,50 +2366,45 @@ static void sinterGenericCommand(redisClient *c, robj **setskeys, int setsnum, r
     } else {
         /* If we have a target key where to store the resulting set
          * create this key with an empty set inside */
-        dstset = createSetObject();
+        dstset = createIntsetObject();
     }
 
     /* Iterate all the elements of the first (smallest) set, and test
      * the element against all the other sets, if at least one set does
      * not include the element it is discarded */
-    di = dictGetIterator(dv[0]);
-    if (!di) oom("dictGetIterator");
-
-    while((de = dictNext(di)) != NULL) {
-        robj *ele;
-
+    si = setTypeInitIterator(sets[0]);
+    while((ele = setTypeNext(si)) != NULL) {
         for (j = 1; j < setsnum; j++)
-            if (dictFind(dv[j],dictGetEntryKey(de)) == NULL) break;
-        if (j != setsnum)
-            continue; /* at least one set does not contain the member */
-        ele = dictGetEntryKey(de);
-        if (!dstkey) {
-            addReplySds(c,sdscatprintf(sdsempty(),"$%d\r\n",sdslen(ele->ptr)));
-            addReply(c,ele);
-            addReply(c,shared.crlf);
-            cardinality++;
-        } else {
-            dictAdd(dstset->ptr,ele,NULL);
-            incrRefCount(ele);
+            if (!setTypeIsMember(sets[j],ele)) break;
+        if (j == setsnum) {
+            if (!dstkey) {
+                addReplySds(c,sdscatprintf(sdsempty(),"$%d\r\n",sdslen(ele->ptr)));
+                addReply(c,ele);
+                addReply(c,shared.crlf);
+                cardinality++;
+            } else {
+                setTypeAdd(dstset,ele);
+            }
         }
+        decrRefCount(ele);
     }
-    dictReleaseIterator(di);
+    setTypeReleaseIterator(si);
 
     if (dstkey) {
         /* Store the resulting set into the target */
         deleteKey(c->db,dstkey);
-        dictAdd(c->db->dict,dstkey,dstset);
-        incrRefCount(dstkey);
+        dbAdd(c->db,dstkey,dstset);
     }
 
     if (!dstkey) {
         lenobj->ptr = sdscatprintf(sdsempty(),"*%d\r\n",cardinality);
+        c->reply_bytes += sdslen(lenobj->ptr); /* deferred length */
     } else {
-        addReplySds(c,sdscatprintf(sdsempty(),":%d\r\n",
-            dictSize((dict*)dstset->ptr)));
+        addReplySds(c,sdscatprintf(sdsempty(),":%lu\r\n",
+            setTypeSize(dstset)));
         server.dirty++;
     }
-    zfree(dv);
+    zfree(sets);
 }
 
 static void sinterCommand(redisClient *c) {
@@ -1242,13 +2419,12 @@ static void sinterstoreCommand(redisClient *c) {
 #define REDIS_OP_DIFF 1
 
 static void sunionDiffGenericCommand(redisClient *c, robj **setskeys, int setsnum, robj *dstkey, int op) {
-    dict **dv = zmalloc(sizeof(dict*)*setsnum);
-    dictIterator *di;
-    dictEntry *de;
-    robj *dstset = NULL;
+    robj **sets = zmalloc(sizeof(robj*)*setsnum);
+    setTypeIterator *si;
+    robj *ele, *dstset = NULL;
     int j, cardinality = 0;
 
-    if (!dv) oom("sunionDiffGenericCommand");
+    if (!sets) oom("sunionDiffGenericCommand");
     for (j = 0; j < setsnum; j++) {
         robj *setobj;
 
@@ -1256,48 +2432,63 @@ static void sunionDiffGenericCommand(redisClient *c, robj **setskeys, int setsnu
                     lookupKeyWrite(c->db,setskeys[j]) :
                     lookupKeyRead(c->db,setskeys[j]);
         if (!setobj) {
-            dv[j] = NULL;
+            sets[j] = NULL;
             continue;
         }
         if (setobj->type != REDIS_SET) {
-            zfree(dv);
+            zfree(sets);
             addReply(c,shared.wrongtypeerr);
             return;
         }
-        dv[j] = setobj->ptr;
+        sets[j] = setobj;
+    }
+
+    /* When all the sets are intsets merge the sorted arrays directly */
+    for (j = 0; j < setsnum; j++)
+        if (sets[j] && sets[j]->encoding != REDIS_ENCODING_INTSET) break;
+    if (j == setsnum) {
+        intset *is = intsetNew(), *tmp;
+
+        for (j = 0; j < setsnum; j++) {
+            if (op == REDIS_OP_DIFF && j == 0 && !sets[j]) break; /* result set is empty */
+            if (!sets[j]) continue; /* non existing keys are like empty sets */
+
+            if (op == REDIS_OP_UNION || j == 0)
+                tmp = intsetUnion(is,sets[j]->ptr);
+            else
+                tmp = intsetDiff(is,sets[j]->ptr);
+            zfree(is);
+            is = tmp;
+            if (op == REDIS_OP_DIFF && intsetLen(is) == 0) break; /* result set is empty */
+        }
+        replyOrStoreIntset(c,is,dstkey);
+        if (!dstkey) zfree(is);
+        zfree(sets);
+        return;
     }
 
     /* We need a temp set object to store our union. If the dstkey
      * is not NULL (that is, we are inside an SUNIONSTORE operation) then
      * this set object will be the resulting object to set into the target key*/
-    dstset = createSetObject();
+    dstset = createIntsetObject();
 
     /* Iterate all the elements of all the sets, add every element a single
      * time to the result set */
     for (j = 0; j < setsnum; j++) {
-        if (op == REDIS_OP_DIFF && j == 0 && !dv[j]) break; /* result set is empty */
-        if (!dv[j]) continue; /* non existing keys are like empty sets */
+        if (op == REDIS_OP_DIFF && j == 0 && !sets[j]) break; /* result set is empty */
+        if (!sets[j]) continue; /* non existing keys are like empty sets */
 
-        di = dictGetIterator(dv[j]);
-        if (!di) oom("dictGetIterator");
-
-        while((de = dictNext(di)) != NULL) {
-            robj *ele;
-
-            /* dictAdd will not add the same element multiple times */
-            ele = dictGetEntryKey(de);
+        si = setTypeInitIterator(sets[j]);
+        while((ele = setTypeNext(si)) != NULL) {
+            /* setTypeAdd will not add the same element multiple times */
             if (op == REDIS_OP_UNION || j == 0) {
-                if (dictAdd(dstset->ptr,ele,NULL) == DICT_OK) {
-                    incrRefCount(ele);
-                    cardinality++;
-                }
+                if (setTypeAdd(dstset,ele)) cardinality++;
             } else if (op == REDIS_OP_DIFF) {
-                if (dictDelete(dstset->ptr,ele) == DICT_OK) {
-                    cardinality--;
-                }
+                if (setTypeRemove(dstset,ele)) cardinality--;
             }
+            decrRefCount(ele);
         }
-        dictReleaseIterator(di);
+        setTypeReleaseIterator(si);
 
         if (op == REDIS_OP_DIFF && cardinality == 0) break; /* result set is empty */
     }
@@ -1305,35 +2496,31 @@ static void sunionDiffGenericCommand(redisClient *c, robj **setskeys, int setsnu
     /* Output the content of the resulting set, if not in STORE mode */
     if (!dstkey) {
         addReplySds(c,sdscatprintf(sdsempty(),"*%d\r\n",cardinality));
-        di = dictGetIterator(dstset->ptr);
-        if (!di) oom("dictGetIterator");
-        while((de = dictNext(di)) != NULL) {
-            robj *ele;
-
-            ele = dictGetEntryKey(de);
+        si = setTypeInitIterator(dstset);
+        while((ele = setTypeNext(si)) != NULL) {
             addReplySds(c,sdscatprintf(sdsempty(),
                     "$%d\r\n",sdslen(ele->ptr)));
             addReply(c,ele);
             addReply(c,shared.crlf);
+            decrRefCount(ele);
         }
-        dictReleaseIterator(di);
+        setTypeReleaseIterator(si);
     } else {
         /* If we have a target key where to store the resulting set
          * create this key with the result set inside */
         deleteKey(c->db,dstkey);
-        dictAdd(c->db->dict,dstkey,dstset);
-        incrRefCount(dstkey);
+        dbAdd(c->db,dstkey,dstset);
     }
 
     /* Cleanup */
     if (!dstkey) {
         decrRefCount(dstset);
     } else {
-        addReplySds(c,sdscatprintf(sdsempty(),":%d\r\n",
-            dictSize((dict*)dstset->ptr)));
+        addReplySds(c,sdscatprintf(sdsempty(),":%lu\r\n",
+            setTypeSize(dstset)));
         server.dirty++;
     }
-    zfree(dv);
+    zfree(sets);
 }
 
 static void sunionCommand(redisClient *c) {
@@ -1352,15 +2539,40 @@ static void sdiffstoreCommand(redisClient *c) {
     sunionDiffGenericCommand(c,c->argv+2,c->argc-2,c->argv[1],REDIS_OP_DIFF);
 }
 
+/* FLUSHDB/FLUSHALL [ASYNC]: with ASYNC the keyspace is released by the bio
+ * thread. Sets *async, replies with an error and returns REDIS_ERR on a bad
+ * argument. */
+static int getFlushAsyncFlag(redisClient *c, int *async) {
+    *async = 0;
+    if (c->argc == 1) return REDIS_OK;
+    if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"async")) {
+        *async = 1;
+        return REDIS_OK;
+    }
+    addReply(c,shared.syntaxerr);
+    return REDIS_ERR;
+}
+
 static void flushdbCommand(redisClient *c) {
+    int async;
+
+    if (getFlushAsyncFlag(c,&async) == REDIS_ERR) return;
     server.dirty += dictSize(c->db->dict);
-    dictEmpty(c->db->dict);
-    dictEmpty(c->db->expires);
+    if (async) {
+        emptyDbAsync(c->db);
+    } else {
+        dictEmpty(c->db->dict);
+        dictEmpty(c->db->expires);
+        if (c->db->wheel) wheelEmpty(c->db->wheel);
+    }
     addReply(c,shared.ok);
 }
 
 static void flushallCommand(redisClient *c) {
-    server.dirty += emptyDb();
+    int async;
+
+    if (getFlushAsyncFlag(c,&async) == REDIS_ERR) return;
+    server.dirty += emptyDb(async);
     addReply(c,shared.ok);
     rdbSave(server.dbfilename);
     server.dirty++;
@@ -1382,11 +2594,8 @@ robj *lookupKeyByPattern(redisDb *db, robj *pattern, robj *subst) {
     robj keyobj;
     int prefixlen, sublen, postfixlen;
     /* Expoit the internal sds representation to create a sds string allocated on the stack in order to make this function faster */
-    struct {
-        long len;
-        long free;
-        char buf[REDIS_SORTKEY_MAX+1];
-    } keyname;
+    char keyhdr[sizeof(struct sdshdr16)+REDIS_SORTKEY_MAX+1];
+    struct sdshdr16 *keyname = (void*)keyhdr;
 
     spat = pattern->ptr;
     ssub = subst->ptr;
@@ -1397,15 +2606,19 @@ robj *lookupKeyByPattern(redisDb *db, robj *pattern, robj *subst) {
     prefixlen = p-spat;
     sublen = sdslen(ssub);
     postfixlen = sdslen(spat)-(prefixlen+1);
-    memcpy(keyname.buf,spat,prefixlen);
-    memcpy(keyname.buf+prefixlen,ssub,sublen);
-    memcpy(keyname.buf+prefixlen+sublen,p+1,postfixlen);
-    keyname.buf[prefixlen+sublen+postfixlen] = '\0';
-    keyname.len = prefixlen+sublen+postfixlen;
+    memcpy(keyname->buf,spat,prefixlen);
+    memcpy(keyname->buf+prefixlen,ssub,sublen);
+    memcpy(keyname->buf+prefixlen+sublen,p+1,postfixlen);
+    keyname->buf[prefixlen+sublen+postfixlen] = '\0';
+    keyname->len = prefixlen+sublen+postfixlen;
+    keyname->alloc = keyname->len;
+    keyname->flags = SDS_TYPE_16;
 
     keyobj.refcount = 1;
     keyobj.type = REDIS_STRING;
-    keyobj.ptr = ((char*)&keyname)+(sizeof(long)*2);
+    keyobj.encoding = REDIS_ENCODING_RAW;
+    keyobj.lru = 0;
+    keyobj.ptr = keyname->buf;
 
     /* printf("lookup '%s' => %p\n", keyname.buf,de); */
     return lookupKeyRead(db,&keyobj);
@@ -1531,37 +2744,35 @@ static void sortCommand(redisClient *c) {
 
     /* Load the sorting vector with all the objects to sort */
     vectorlen = (sortval->type == REDIS_LIST) ?
-        listLength((list*)sortval->ptr) :
-        dictSize((dict*)sortval->ptr);
+        listTypeLength(sortval) :
+        setTypeSize(sortval);
     vector = zmalloc(sizeof(redisSortObject)*vectorlen);
     if (!vector) oom("allocating objects vector for SORT");
     j = 0;
     if (sortval->type == REDIS_LIST) {
-        list *list = sortval->ptr;
-        listNode *ln;
+        /* listTypeGet() returns a new reference, released at cleanup */
+        listTypeIterator *li = listTypeInitIterator(sortval,0,AL_START_HEAD);
+        listTypeEntry entry;
 
-        listRewind(list);
-        while((ln = listYield(list))) {
-            robj *ele = ln->value;
-            vector[j].obj = ele;
+        while(listTypeNext(li,&entry)) {
+            vector[j].obj = listTypeGet(&entry);
             vector[j].u.score = 0;
             vector[j].u.cmpobj = NULL;
             j++;
         }
+        listTypeReleaseIterator(li);
     } else {
-        dict *set = sortval->ptr;
-        dictIterator *di;
-        dictEntry *setele;
-
-        di = dictGetIterator(set);
-        if (!di) oom("dictGetIterator");
-        while((setele = dictNext(di)) != NULL) {
-            vector[j].obj = dictGetEntryKey(setele);
+        /* setTypeNext() returns a new reference as well */
+        setTypeIterator *si = setTypeInitIterator(sortval);
+        robj *ele;
+
+        while((ele = setTypeNext(si)) != NULL) {
+            vector[j].obj = ele;
             vector[j].u.score = 0;
             vector[j].u.cmpobj = NULL;
             j++;
         }
-        dictReleaseIterator(di);
+        setTypeReleaseIterator(si);
     }
     assert(j == vectorlen);
 
@@ -1574,8 +2785,9 @@ static void sortCommand(redisClient *c) {
                 byval = lookupKeyByPattern(c->db,sortby,vector[j].obj);
                 if (!byval || byval->type != REDIS_STRING) continue;
                 if (alpha) {
-                    vector[j].u.cmpobj = byval;
-                    incrRefCount(byval);
+                    vector[j].u.cmpobj = getDecodedObject(byval);
+                } else if (byval->encoding == REDIS_ENCODING_INT) {
+                    vector[j].u.score = (long)byval->ptr;
                 } else {
                     vector[j].u.score = strtod(byval->ptr,NULL);
                 }
@@ -1627,10 +2839,7 @@ static void sortCommand(redisClient *c) {
                 if (!val || val->type != REDIS_STRING) {
                     addReply(c,shared.nullbulk);
                 } else {
-                    addReplySds(c,sdscatprintf(sdsempty(),"$%d\r\n",
-                        sdslen(val->ptr)));
-                    addReply(c,val);
-                    addReply(c,shared.crlf);
+                    addReplyBulk(c,val);
                 }
             } else if (sop->type == REDIS_SORT_DEL) {
                 /* TODO */
@@ -1639,18 +2848,40 @@ static void sortCommand(redisClient *c) {
     }
 
     /* Cleanup */
-    decrRefCount(sortval);
-    listRelease(operations);
     for (j = 0; j < vectorlen; j++) {
         if (sortby && alpha && vector[j].u.cmpobj)
             decrRefCount(vector[j].u.cmpobj);
+        decrRefCount(vector[j].obj);
     }
+    decrRefCount(sortval);
+    listRelease(operations);
     zfree(vector);
 }
 
 static void infoCommand(redisClient *c) {
     sds info;
-    time_t uptime = time(NULL)-server.stat_starttime;
+    time_t uptime = server.unixtime-server.stat_starttime;
+    unsigned long lol = 0, bib = 0, bob = 0;
+    listNode *ln;
+    slabStats ss;
+    size_t rss = zmalloc_get_rss(), al_allocated, al_active;
+    long long volatile_keys = 0;
+    int j;
+
+    server.usedmemory = zmalloc_used_memory();
+    slabGetStats(&ss);
+    for (j = 0; j < server.dbnum; j++)
+        volatile_keys += dbVolatileKeys(server.db+j);
+    zmalloc_get_allocator_info(&al_allocated,&al_active);
+    /* Biggest input and output buffers among the connected clients */
+    listRewind(server.clients);
+    while((ln = listYield(server.clients))) {
+        redisClient *cl = listNodeValue(ln);
+
+        if (listLength(cl->reply) > lol) lol = listLength(cl->reply);
+        if (sdslen(cl->querybuf) > bib) bib = sdslen(cl->querybuf);
+        if (cl->reply_bytes > bob) bob = cl->reply_bytes;
+    }
     
     info = sdscatprintf(sdsempty(),
         "redis_version:%s\r\n"
@@ -1658,24 +2889,76 @@ static void infoCommand(redisClient *c) {
         "uptime_in_days:%d\r\n"
         "connected_clients:%d\r\n"
         "connected_slaves:%d\r\n"
+        "blocked_clients:%u\r\n"
+        "client_longest_output_list:%lu\r\n"
+        "client_biggest_output_buf:%lu\r\n"
+        "client_biggest_input_buf:%lu\r\n"
         "used_memory:%zu\r\n"
+        "used_memory_rss:%zu\r\n"
+        "mem_fragmentation_ratio:%.2f\r\n"
+        "mem_allocator:%s\r\n"
+        "allocator_allocated:%zu\r\n"
+        "allocator_active:%zu\r\n"
+        "allocator_frag_ratio:%.2f\r\n"
+        "slab_pages:%zu\r\n"
+        "slab_allocated_bytes:%zu\r\n"
+        "slab_used_bytes:%zu\r\n"
+        "slab_fragmentation_ratio:%.2f\r\n"
         "changes_since_last_save:%lld\r\n"
         "bgsave_in_progress:%d\r\n"
         "last_save_time:%d\r\n"
         "total_connections_received:%lld\r\n"
         "total_commands_processed:%lld\r\n"
+        "expired_keys:%lld\r\n"
+        "expired_keys_per_sec:%lld\r\n"
+        "expired_stale_perc:%.2f\r\n"
+        "expired_stale_keys_estimate:%lld\r\n"
+        "expired_time_cap_reached_count:%lld\r\n"
+        "evicted_keys:%lld\r\n"
+        "keyspace_hits:%lld\r\n"
+        "keyspace_misses:%lld\r\n"
+        "maxmemory:%llu\r\n"
+        "maxmemory_policy:%s\r\n"
+        "lazyfree_pending_objects:%lu\r\n"
+        "lazyfreed_objects:%lu\r\n"
+        "bitops_kernels:%s\r\n"
         "role:%s\r\n"
         ,REDIS_VERSION,
         uptime,
         uptime/(3600*24),
         listLength(server.clients)-listLength(server.slaves),
         listLength(server.slaves),
+        server.blocked_clients,
+        lol, bob, bib,
         server.usedmemory,
+        rss,
+        server.usedmemory ? (double)rss/server.usedmemory : 0,
+        ZMALLOC_LIB,
+        al_allocated,
+        al_active,
+        al_allocated ? (double)al_active/al_allocated : 0,
+        ss.pages,
+        ss.allocated,
+        ss.used,
+        ss.used ? (double)ss.allocated/ss.used : 0,
         server.dirty,
         server.bgsaveinprogress,
         server.lastsave,
         server.stat_numconnections,
         server.stat_numcommands,
+        server.stat_expiredkeys,
+        server.stat_expired_per_sec,
+        server.stat_expired_stale_perc,
+        (long long)(server.stat_expired_stale_perc/100*volatile_keys),
+        server.stat_expired_time_cap_reached_count,
+        server.stat_evictedkeys,
+        server.stat_keyspace_hits,
+        server.stat_keyspace_misses,
+        server.maxmemory,
+        maxmemoryPolicyName(server.maxmemory_policy),
+        __atomic_load_n(&server.lazyfree_pending_objects,__ATOMIC_RELAXED),
+        __atomic_load_n(&server.stat_lazyfreed_objects,__ATOMIC_RELAXED),
+        bitopsImplName(),
         server.masterhost == NULL ? "master" : "slave"
     );
     if (server.masterhost) {
@@ -1688,7 +2971,7 @@ static void infoCommand(redisClient *c) {
             server.masterport,
             (server.replstate == REDIS_REPL_CONNECTED) ?
                 "up" : "down",
-            (int)(time(NULL)-server.master->lastinteraction)
+            (int)(server.unixtime-server.master->lastinteraction)
         );
     }
     addReplySds(c,sdscatprintf(sdsempty(),"$%d\r\n",sdslen(info)));
@@ -1707,6 +2990,49 @@ static void monitorCommand(redisClient *c) {
 }
 
 
+/* Append to 's' a line describing the client, used by CLIENT LIST */
+static sds catClientInfoString(sds s, redisClient *c) {
+    char ip[32], flags[8], *p = flags;
+    int port;
+    time_t now = server.unixtime;
+
+    anetPeerToString(c->fd,ip,&port);
+    if (c->flags & REDIS_MONITOR) *p++ = 'O';
+    else if (c->flags & REDIS_SLAVE) *p++ = 'S';
+    if (c->flags & REDIS_MASTER) *p++ = 'M';
+    if (c->flags & REDIS_CLOSE_ASAP) *p++ = 'A';
+    if (c->flags & REDIS_BLOCKED) *p++ = 'b';
+    if (p == flags) *p++ = 'N';
+    *p = '\0';
+    return sdscatprintf(s,
+        "addr=%s:%d fd=%d idle=%ld flags=%s db=%d class=%s qbuf=%lu qbuf-free=%lu oll=%lu omem=%lu\n",
+        ip, port, c->fd,
+        (long)(now - c->lastinteraction),
+        flags,
+        c->db->id,
+        getClientLimitClassName(getClientLimitClass(c)),
+        (unsigned long) sdslen(c->querybuf),
+        (unsigned long) sdsavail(c->querybuf),
+        (unsigned long) listLength(c->reply),
+        c->reply_bytes);
+}
+
+static void clientCommand(redisClient *c) {
+    if (!strcasecmp(c->argv[1]->ptr,"list") && c->argc == 2) {
+        sds o = sdsempty();
+        listNode *ln;
+
+        listRewind(server.clients);
+        while((ln = listYield(server.clients)))
+            o = catClientInfoString(o,listNodeValue(ln));
+        addReplySds(c,sdscatprintf(sdsempty(),"$%d\r\n",sdslen(o)));
+        addReplySds(c,o);
+        addReply(c,shared.crlf);
+    } else {
+        addReplySds(c,sdsnew("-ERR Syntax error, try CLIENT LIST\r\n"));
+    }
+}
+
 /* =============================== Replication  ============================= */
 
 static int syncWrite(int fd, char *ptr, ssize_t size, int timeout) {
@@ -1807,6 +3133,7 @@ static void syncCommand(redisClient *c) {
             listRelease(c->reply);
             c->reply = listDup(slave->reply);
             if (!c->reply) oom("listDup copying slave reply list");
+            c->reply_bytes = slave->reply_bytes;
             c->replstate = REDIS_REPL_WAIT_BGSAVE_END;
             redisLog(REDIS_NOTICE,"Waiting for end of BGSAVE for SYNC");
         } else {
@@ -1997,7 +3324,7 @@ static int syncWithMaster(void) {
         close(fd);
         return REDIS_ERR;
     }
-    emptyDb();
+    emptyDb(server.lazyfree_server_del);
     if (rdbLoad(server.dbfilename) != REDIS_OK) {
         redisLog(REDIS_WARNING,"Failed trying to load the MASTER synchronization DB from disk");
         close(fd);
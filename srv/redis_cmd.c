@@ -35,23 +35,18 @@ void echoCommand(redisClient *c) {
 }
 
 void setGenericCommand(redisClient *c, int nx) {
-    int retval;
-
-    retval = dictAdd(c->db->dict,c->argv[1],c->argv[2]);
-    if (retval == DICT_ERR) {
-        if (!nx) {
-            dictReplace(c->db->dict,c->argv[1],c->argv[2]);
-            incrRefCount(c->argv[2]);
-        } else {
+    c->argv[2] = tryObjectEncoding(c->argv[2]);
+    incrRefCount(c->argv[2]);
+    if (nx) {
+        if (dbAdd(c->db,c->argv[1],c->argv[2]) == DICT_ERR) {
+            decrRefCount(c->argv[2]);
             addReply(c,shared.czero);
             return;
         }
     } else {
-        incrRefCount(c->argv[1]);
-        incrRefCount(c->argv[2]);
+        dbSetKey(c->db,c->argv[1],c->argv[2]);
     }
     server.dirty++;
-    removeExpire(c->db,c->argv[1]);
     addReply(c, nx ? shared.cone : shared.ok);
 }
 
@@ -72,23 +67,17 @@ void getCommand(redisClient *c) {
         if (o->type != REDIS_STRING) {
             addReply(c,shared.wrongtypeerr);
         } else {
-            addReplySds(c,sdscatprintf(sdsempty(),"$%d\r\n",(int)sdslen(o->ptr)));
-            addReply(c,o);
-            addReply(c,shared.crlf);
+            addReplyBulk(c,o);
         }
     }
 }
 
 void getSetCommand(redisClient *c) {
     getCommand(c);
-    if (dictAdd(c->db->dict,c->argv[1],c->argv[2]) == DICT_ERR) {
-        dictReplace(c->db->dict,c->argv[1],c->argv[2]);
-    } else {
-        incrRefCount(c->argv[1]);
-    }
+    c->argv[2] = tryObjectEncoding(c->argv[2]);
     incrRefCount(c->argv[2]);
+    dbSetKey(c->db,c->argv[1],c->argv[2]);
     server.dirty++;
-    removeExpire(c->db,c->argv[1]);
 }
 
 void mgetCommand(redisClient *c) {
@@ -103,9 +92,7 @@ void mgetCommand(redisClient *c) {
             if (o->type != REDIS_STRING) {
                 addReply(c,shared.nullbulk);
             } else {
-                addReplySds(c,sdscatprintf(sdsempty(),"$%d\r\n",(int)sdslen(o->ptr)));
-                addReply(c,o);
-                addReply(c,shared.crlf);
+                addReplyBulk(c,o);
             }
         }
     }
@@ -114,15 +101,18 @@ void mgetCommand(redisClient *c) {
 
 void incrDecrCommand(redisClient *c, long long incr) {
     long long value;
-    int retval;
+    dictEntry *de;
     robj *o;
     
-    o = lookupKeyWrite(c->db,c->argv[1]);
+    de = lookupKeyWriteEntry(c->db,c->argv[1]);
+    o = de ? dictGetEntryVal(de) : NULL;
     if (o == NULL) {
         value = 0;
     } else {
         if (o->type != REDIS_STRING) {
             value = 0;
+        } else if (o->encoding == REDIS_ENCODING_INT) {
+            value = (long)o->ptr;
         } else {
             char *eptr;
 
@@ -131,13 +121,29 @@ void incrDecrCommand(redisClient *c, long long incr) {
     }
 
     value += incr;
-    o = createObject(REDIS_STRING,sdscatprintf(sdsempty(),"%lld",value));
-    retval = dictAdd(c->db->dict,c->argv[1],o);
-    if (retval == DICT_ERR) {
-        dictReplace(c->db->dict,c->argv[1],o);
-        removeExpire(c->db,c->argv[1]);
+    /* 计数器的常见情况: 对象没有被共享且新值不在共享整数范围内,
+     * 直接修改ptr中的值,不需要任何分配 */
+    if (o && o->type == REDIS_STRING && o->encoding == REDIS_ENCODING_INT &&
+        o->refcount == 1 &&
+        (value < 0 || value >= REDIS_SHARED_INTEGERS) &&
+        value >= LONG_MIN && value <= LONG_MAX)
+    {
+        o->ptr = (void*)((long)value);
+        server.dirty++;
+        addReply(c,shared.colon);
+        addReply(c,o);
+        addReply(c,shared.crlf);
+        return;
+    }
+    o = createIntegerObject(value);
+    if (de) {
+        /* Non volatile (see lookupKeyWriteEntry): just swap the value */
+        robj *old = dictGetEntryVal(de);
+
+        dictGetEntryVal(de) = o;
+        decrRefCount(old);
     } else {
-        incrRefCount(c->argv[1]);
+        dbAdd(c->db,c->argv[1],o);
     }
     server.dirty++;
     addReply(c,shared.colon);
@@ -247,6 +253,7 @@ void keysCommand(redisClient *c) {
     }
     dictReleaseIterator(di);
     lenobj->ptr = sdscatprintf(sdsempty(),"$%lu\r\n",keyslen+(numkeys ? (numkeys-1) : 0));
+    c->reply_bytes += sdslen(lenobj->ptr); /* deferred length */
     addReply(c,shared.crlf);
 }
 
@@ -272,6 +279,8 @@ void typeCommand(redisClient *c) {
         case REDIS_STRING: type = "+string"; break;
         case REDIS_LIST: type = "+list"; break;
         case REDIS_SET: type = "+set"; break;
+        case REDIS_ZSET: type = "+zset"; break;
+        case REDIS_HASH: type = "+hash"; break;
         default: type = "unknown"; break;
         }
     }
@@ -279,6 +288,61 @@ void typeCommand(redisClient *c) {
     addReply(c,shared.crlf);
 }
 
+/* 返回对象内部编码的名字,供OBJECT ENCODING使用 */
+char *strEncoding(int encoding) {
+    switch(encoding) {
+    case REDIS_ENCODING_RAW: return "raw";
+    case REDIS_ENCODING_HT: return "hashtable";
+    case REDIS_ENCODING_LINKEDLIST: return "linkedlist";
+    case REDIS_ENCODING_ZIPLIST: return "ziplist";
+    case REDIS_ENCODING_QUICKLIST: return "quicklist";
+    case REDIS_ENCODING_INTSET: return "intset";
+    case REDIS_ENCODING_SKIPLIST: return "skiplist";
+    case REDIS_ENCODING_EMBSTR: return "embstr";
+    case REDIS_ENCODING_INT: return "int";
+    default: return "unknown";
+    }
+}
+
+/* OBJECT ENCODING <key> */
+void objectCommand(redisClient *c) {
+    dictEntry *de;
+    robj *o;
+
+    if (c->argc != 3 || (strcasecmp(c->argv[1]->ptr,"encoding") &&
+                         strcasecmp(c->argv[1]->ptr,"idletime") &&
+                         strcasecmp(c->argv[1]->ptr,"freq")))
+    {
+        addReplySds(c,sdsnew("-ERR syntax error, try OBJECT ENCODING|IDLETIME|FREQ <key>\r\n"));
+        return;
+    }
+    /* Not lookupKeyRead(): looking at the object must not touch it */
+    expireIfNeeded(c->db,c->argv[2]);
+    if ((de = objDictFind(c->db->dict,c->argv[2])) == NULL) {
+        addReply(c,shared.nullbulk);
+        return;
+    }
+    o = dictGetEntryVal(de);
+    if (!strcasecmp(c->argv[1]->ptr,"encoding")) {
+        addReplySds(c,sdscatprintf(sdsempty(),"+%s\r\n",strEncoding(o->encoding)));
+        return;
+    }
+    /* obj->lru is either the LRU clock or the LFU counter, see objectTouch() */
+    if (!strcasecmp(c->argv[1]->ptr,"idletime")) {
+        if (server.maxmemory_policy & REDIS_MAXMEMORY_FLAG_LFU) {
+            addReplySds(c,sdsnew("-ERR an LFU maxmemory policy is selected, idle time not tracked\r\n"));
+            return;
+        }
+        addReplySds(c,sdscatprintf(sdsempty(),":%lu\r\n",estimateObjectIdleTime(o)));
+    } else {
+        if (!(server.maxmemory_policy & REDIS_MAXMEMORY_FLAG_LFU)) {
+            addReplySds(c,sdsnew("-ERR an LFU maxmemory policy is not selected, access frequency not tracked\r\n"));
+            return;
+        }
+        addReplySds(c,sdscatprintf(sdsempty(),":%lu\r\n",LFUDecrAndReturn(o)));
+    }
+}
+
 void saveCommand(redisClient *c) {
     if (server.bgsaveinprogress) {
         addReplySds(c,sdsnew("-ERR background save in progress\r\n"));
@@ -335,15 +399,14 @@ void renameGenericCommand(redisClient *c, int nx) {
     }
     incrRefCount(o);
     deleteIfVolatile(c->db,c->argv[2]);
-    if (dictAdd(c->db->dict,c->argv[2],o) == DICT_ERR) {
-        if (nx) {
+    if (nx) {
+        if (dbAdd(c->db,c->argv[2],o) == DICT_ERR) {
             decrRefCount(o);
             addReply(c,shared.czero);
             return;
         }
-        dictReplace(c->db->dict,c->argv[2],o);
     } else {
-        incrRefCount(c->argv[2]);
+        dbSetKey(c->db,c->argv[2],o);
     }
     deleteKey(c->db,c->argv[1]);
     server.dirty++;
@@ -389,12 +452,12 @@ void moveCommand(redisClient *c) {
 
     /* Try to add the element to the target DB */
     deleteIfVolatile(dst,c->argv[1]);
-    if (dictAdd(dst->dict,c->argv[1],o) == DICT_ERR) {
+    incrRefCount(o);
+    if (dbAdd(dst,c->argv[1],o) == DICT_ERR) {
+        decrRefCount(o);
         addReply(c,shared.czero);
         return;
     }
-    incrRefCount(c->argv[1]);
-    incrRefCount(o);
 
     /* OK! key moved, free the entry in the source DB */
     deleteKey(src,c->argv[1]);
@@ -403,37 +466,411 @@ void moveCommand(redisClient *c) {
 }
 
 /* =================================== Lists ================================ */
-void pushGenericCommand(redisClient *c, int where) {
-    robj *lobj;
-    list *list;
 
-    lobj = lookupKeyWrite(c->db,c->argv[1]);
-    if (lobj == NULL) {
-        lobj = createListObject();
-        list = lobj->ptr;
-        if (where == REDIS_HEAD) {
-            if (!listAddNodeHead(list,c->argv[2])) oom("listAddNodeHead");
-        } else {
-            if (!listAddNodeTail(list,c->argv[2])) oom("listAddNodeTail");
+/*----------------------------------------------------------------------------
+ * List API
+ *
+ * Lists are created ziplist encoded and converted to quicklists once they
+ * get more than list-max-ziplist-entries elements or an element longer than
+ * list-max-ziplist-value bytes. A quicklist is a linked list of ziplists,
+ * every one holding up to list-max-ziplist-entries elements. The commands
+ * use the functions below and don't care about the encoding.
+ *----------------------------------------------------------------------------*/
+
+/* Convert the list to a quicklist if 'value' is too big for a ziplist */
+void listTypeTryConversion(robj *subject, robj *value) {
+    if (subject->encoding != REDIS_ENCODING_ZIPLIST) return;
+    if (sdslen(value->ptr) > server.list_max_ziplist_value)
+        listTypeConvert(subject,REDIS_ENCODING_QUICKLIST);
+}
+
+void listTypePush(robj *subject, robj *value, int where) {
+    /* Check if we need to convert the ziplist */
+    listTypeTryConversion(subject,value);
+    if (subject->encoding == REDIS_ENCODING_ZIPLIST &&
+        ziplistLen(subject->ptr) >= server.list_max_ziplist_entries)
+            listTypeConvert(subject,REDIS_ENCODING_QUICKLIST);
+
+    if (subject->encoding == REDIS_ENCODING_ZIPLIST) {
+        int pos = (where == REDIS_HEAD) ? ZIPLIST_HEAD : ZIPLIST_TAIL;
+        subject->ptr = ziplistPush(subject->ptr,value->ptr,sdslen(value->ptr),pos);
+    } else if (subject->encoding == REDIS_ENCODING_QUICKLIST) {
+        int pos = (where == REDIS_HEAD) ? QUICKLIST_HEAD : QUICKLIST_TAIL;
+        quicklistPush(subject->ptr,value->ptr,sdslen(value->ptr),pos);
+    } else {
+        assert(0 != 0);
+    }
+}
+
+/* Remove and return the element at the head or at the tail of the list.
+ * The caller owns the returned reference. NULL if the list is empty. */
+robj *listTypePop(robj *subject, int where) {
+    robj *value = NULL;
+
+    if (subject->encoding == REDIS_ENCODING_ZIPLIST) {
+        unsigned char *p, *vstr;
+        unsigned int vlen;
+        int pos = (where == REDIS_HEAD) ? 0 : -1;
+
+        p = ziplistIndex(subject->ptr,pos);
+        if (ziplistGet(p,&vstr,&vlen)) {
+            value = createStringObject((char*)vstr,vlen);
+            subject->ptr = ziplistDelete(subject->ptr,&p);
+        }
+    } else if (subject->encoding == REDIS_ENCODING_QUICKLIST) {
+        quicklistEntry entry;
+
+        if (quicklistIndex(subject->ptr,(where == REDIS_HEAD) ? 0 : -1,&entry)) {
+            value = createStringObject((char*)entry.value,entry.sz);
+            quicklistDelEntry(NULL,&entry);
+        }
+    } else {
+        assert(0 != 0);
+    }
+    return value;
+}
+
+unsigned long listTypeLength(robj *subject) {
+    if (subject->encoding == REDIS_ENCODING_ZIPLIST) {
+        return ziplistLen(subject->ptr);
+    } else if (subject->encoding == REDIS_ENCODING_QUICKLIST) {
+        return quicklistCount(subject->ptr);
+    } else {
+        assert(0 != 0);
+        return 0;
+    }
+}
+
+/* Initialize an iterator at the specified index */
+listTypeIterator *listTypeInitIterator(robj *subject, int index, unsigned char direction) {
+    listTypeIterator *li = zmalloc(sizeof(listTypeIterator));
+
+    if (!li) oom("listTypeInitIterator");
+    li->subject = subject;
+    li->encoding = subject->encoding;
+    li->direction = direction;
+    li->zi = NULL;
+    li->iter = NULL;
+    if (li->encoding == REDIS_ENCODING_ZIPLIST) {
+        li->zi = ziplistIndex(subject->ptr,index);
+    } else if (li->encoding == REDIS_ENCODING_QUICKLIST) {
+        int qdir = (direction == AL_START_HEAD) ? QUICKLIST_HEAD : QUICKLIST_TAIL;
+
+        li->iter = quicklistGetIteratorAtIdx(subject->ptr,qdir,index);
+        if (!li->iter) oom("quicklistGetIteratorAtIdx");
+    } else {
+        assert(0 != 0);
+    }
+    return li;
+}
+
+void listTypeReleaseIterator(listTypeIterator *li) {
+    if (li->iter) quicklistReleaseIterator(li->iter);
+    zfree(li);
+}
+
+/* Store the current entry in 'entry' and advance the iterator.
+ * Return 1 when the current entry is valid, 0 at the end of the list. */
+int listTypeNext(listTypeIterator *li, listTypeEntry *entry) {
+    /* Protect from converting when iterating */
+    assert(li->subject->encoding == li->encoding);
+
+    entry->li = li;
+    if (li->encoding == REDIS_ENCODING_ZIPLIST) {
+        entry->zi = li->zi;
+        if (entry->zi != NULL) {
+            if (li->direction == AL_START_HEAD)
+                li->zi = ziplistNext(li->subject->ptr,li->zi);
+            else
+                li->zi = ziplistPrev(li->subject->ptr,li->zi);
+            return 1;
+        }
+    } else if (li->encoding == REDIS_ENCODING_QUICKLIST) {
+        return quicklistNext(li->iter,&entry->entry);
+    } else {
+        assert(0 != 0);
+    }
+    return 0;
+}
+
+/* Return the entry value. The caller owns the returned reference. */
+robj *listTypeGet(listTypeEntry *entry) {
+    listTypeIterator *li = entry->li;
+    robj *value = NULL;
+
+    if (li->encoding == REDIS_ENCODING_ZIPLIST) {
+        unsigned char *vstr;
+        unsigned int vlen;
+
+        assert(entry->zi != NULL);
+        if (ziplistGet(entry->zi,&vstr,&vlen))
+            value = createStringObject((char*)vstr,vlen);
+    } else if (li->encoding == REDIS_ENCODING_QUICKLIST) {
+        value = createStringObject((char*)entry->entry.value,entry->entry.sz);
+    } else {
+        assert(0 != 0);
+    }
+    return value;
+}
+
+/* Compare the given object with the entry at the current position */
+int listTypeEqual(listTypeEntry *entry, robj *o) {
+    listTypeIterator *li = entry->li;
+
+    if (li->encoding == REDIS_ENCODING_ZIPLIST) {
+        return ziplistCompare(entry->zi,o->ptr,sdslen(o->ptr));
+    } else {
+        return ziplistCompare(entry->entry.zi,o->ptr,sdslen(o->ptr));
+    }
+}
+
+/* Delete the element pointed to, keeping the iterator valid */
+void listTypeDelete(listTypeEntry *entry) {
+    listTypeIterator *li = entry->li;
+
+    if (li->encoding == REDIS_ENCODING_ZIPLIST) {
+        unsigned char *p = entry->zi, *vstr;
+        unsigned int vlen;
+
+        li->subject->ptr = ziplistDelete(li->subject->ptr,&p);
+        /* The ziplist may have been reallocated: update the position of
+         * the iterator depending on the direction. 'p' is now the entry
+         * that followed the deleted one, or the end of the ziplist. */
+        if (li->direction == AL_START_HEAD)
+            li->zi = ziplistGet(p,&vstr,&vlen) ? p : NULL;
+        else
+            li->zi = ziplistPrev(li->subject->ptr,p);
+    } else if (li->encoding == REDIS_ENCODING_QUICKLIST) {
+        quicklistDelEntry(li->iter,&entry->entry);
+    } else {
+        assert(0 != 0);
+    }
+}
+
+void listTypeConvert(robj *subject, int enc) {
+    assert(subject->type == REDIS_LIST);
+    assert(subject->encoding == REDIS_ENCODING_ZIPLIST);
+    if (enc == REDIS_ENCODING_QUICKLIST) {
+        quicklist *ql = quicklistCreate((int)server.list_max_ziplist_entries);
+        unsigned char *zl = subject->ptr;
+        unsigned char *p = ziplistIndex(zl,0), *vstr;
+        unsigned int vlen;
+
+        if (!ql) oom("quicklistCreate");
+        while (ziplistGet(p,&vstr,&vlen)) {
+            quicklistPush(ql,vstr,vlen,QUICKLIST_TAIL);
+            p = ziplistNext(zl,p);
         }
-        dictAdd(c->db->dict,c->argv[1],lobj);
-		/* 自己终于到这里为止理解了一点Ref的作用了 
-		 * 同一份数据不用反复的拷贝了，（从接收命令到存到MEM */
-        incrRefCount(c->argv[1]);
-        incrRefCount(c->argv[2]);
+        subject->encoding = REDIS_ENCODING_QUICKLIST;
+        zfree(zl);
+        subject->ptr = ql;
     } else {
-        if (lobj->type != REDIS_LIST) {
+        assert(0 != 0);
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * Blocking list pops (BLPOP/BRPOP)
+ *
+ * A BLPOP whose keys are all missing or empty lists blocks the client: it is
+ * appended to the FIFO of the waiting clients of every key, in
+ * db->blockingkeys, and its input is not processed until it is served (by
+ * a push to one of the keys) or times out (blockedClientsCron()).
+ *
+ * Only the effective pops reach the slaves: a BLPOP served right away is
+ * propagated as the LPOP/RPOP of the key it popped, a blocked one is not
+ * propagated, and a push handed to a waiting client is not propagated as it
+ * doesn't change the list.
+ *----------------------------------------------------------------------------*/
+
+/* Block the client on 'numkeys' keys, until unblockClientWaitingData() */
+static void blockForKeys(redisClient *c, robj **keys, int numkeys,
+        long long timeout, int where)
+{
+    dictEntry *de;
+    list *l;
+    int j;
+
+    c->blockingkeys = zmalloc(sizeof(robj*)*numkeys);
+    if (c->blockingkeys == NULL) oom("blockForKeys");
+    c->blockingkeysnum = numkeys;
+    c->blockingtimeout.when = timeout;
+    if (timeout) wheelAdd(server.blocked_timeouts,&c->blockingtimeout);
+    c->blockingwhere = where;
+    for (j = 0; j < numkeys; j++) {
+        c->blockingkeys[j] = keys[j];
+        incrRefCount(keys[j]);
+
+        de = dictFind(c->db->blockingkeys,keys[j]);
+        if (de == NULL) {
+            if ((l = listCreate()) == NULL) oom("listCreate");
+            incrRefCount(keys[j]);
+            if (dictAdd(c->db->blockingkeys,keys[j],l) != DICT_OK)
+                assert(0 != 0);
+        } else {
+            l = dictGetEntryVal(de);
+        }
+        if (!listAddNodeTail(l,c)) oom("listAddNodeTail");
+    }
+    c->flags |= REDIS_BLOCKED;
+    server.blocked_clients++;
+}
+
+/* Remove the client from the waiting lists of its keys. The commands it sent
+ * meanwhile are processed by beforeSleep() (not here: we are in the middle
+ * of another client's command, or of freeClient()). */
+void unblockClientWaitingData(redisClient *c) {
+    dictEntry *de;
+    listNode *ln;
+    list *l;
+    int j;
+
+    for (j = 0; j < c->blockingkeysnum; j++) {
+        de = dictFind(c->db->blockingkeys,c->blockingkeys[j]);
+        assert(de != NULL);
+        l = dictGetEntryVal(de);
+        ln = listSearchKey(l,c);
+        assert(ln != NULL);
+        listDelNode(l,ln);
+        if (listLength(l) == 0)
+            dictDelete(c->db->blockingkeys,c->blockingkeys[j]);
+        decrRefCount(c->blockingkeys[j]);
+    }
+    zfree(c->blockingkeys);
+    c->blockingkeys = NULL;
+    c->blockingkeysnum = 0;
+    wheelRemove(server.blocked_timeouts,&c->blockingtimeout);
+    c->flags &= ~REDIS_BLOCKED;
+    server.blocked_clients--;
+    c->flags |= REDIS_UNBLOCKED;
+    if (!listAddNodeTail(server.unblocked_clients,c)) oom("listAddNodeTail");
+}
+
+/* Hand 'ele' pushed to 'key' to the first client blocked on it. Returns 0 if
+ * nobody is waiting: the caller pushes it. The pushes coming from our master
+ * are always applied, so that the dataset stays the same of the master's. */
+static int handleClientsWaitingListPush(redisClient *c, robj *key, robj *ele) {
+    redisClient *receiver = NULL;
+    dictEntry *de;
+    listNode *ln;
+
+    if (dictSize(c->db->blockingkeys) == 0 || (c->flags & REDIS_MASTER))
+        return 0;
+    if ((de = dictFind(c->db->blockingkeys,key)) == NULL) return 0;
+
+    /* Skip the clients going to be closed, they can't get replies */
+    listRewind(dictGetEntryVal(de));
+    while ((ln = listYield(dictGetEntryVal(de))) != NULL) {
+        redisClient *waiting = listNodeValue(ln);
+
+        if (!(waiting->flags & REDIS_CLOSE_ASAP)) {
+            receiver = waiting;
+            break;
+        }
+    }
+    if (receiver == NULL) return 0;
+
+    addReplySds(receiver,sdsnew("*2\r\n"));
+    addReplyBulk(receiver,key);
+    addReplyBulk(receiver,ele);
+    unblockClientWaitingData(receiver);
+    return 1;
+}
+
+/* Reply nil to the blocked clients whose timeout elapsed: they are popped
+ * from server.blocked_timeouts, the others are not even looked at */
+void handleBlockedClientsTimeout(void) {
+    wheelNode *node;
+
+    while ((node = wheelPop(server.blocked_timeouts,server.mstime)) != NULL) {
+        redisClient *c = wheelNodeGetClient(node);
+
+        addReply(c,shared.nullmultibulk);
+        unblockClientWaitingData(c);
+    }
+}
+
+/* BLPOP key [key ...] timeout
+ *
+ * The timeout is in seconds, 0 to wait forever. The reply is the key and the
+ * element popped, or nil on timeout. */
+static void blockingPopGenericCommand(redisClient *c, int where) {
+    long long timeout;
+    robj *o;
+    int j;
+
+    if (isObjectRepresentableAsLongLong(c->argv[c->argc-1],&timeout) == REDIS_ERR ||
+        timeout > (LLONG_MAX-server.mstime)/1000)
+    {
+        addReplySds(c,sdsnew("-ERR timeout is not an integer or out of range\r\n"));
+        return;
+    } else if (timeout < 0) {
+        addReplySds(c,sdsnew("-ERR timeout is negative\r\n"));
+        return;
+    }
+
+    for (j = 1; j < c->argc-1; j++) {
+        o = lookupKeyWrite(c->db,c->argv[j]);
+        if (o == NULL) continue;
+        if (o->type != REDIS_LIST) {
             addReply(c,shared.wrongtypeerr);
             return;
         }
-        list = lobj->ptr;
-        if (where == REDIS_HEAD) {
-            if (!listAddNodeHead(list,c->argv[2])) oom("listAddNodeHead");
-        } else {
-            if (!listAddNodeTail(list,c->argv[2])) oom("listAddNodeTail");
+        if (listTypeLength(o) != 0) {
+            robj *ele = listTypePop(o,where), *key = c->argv[j];
+
+            addReplySds(c,sdsnew("*2\r\n"));
+            addReplyBulk(c,key);
+            addReplyBulk(c,ele);
+            decrRefCount(ele);
+            server.dirty++;
+
+            /* Replicated as the pop it turned out to be */
+            incrRefCount(key);
+            freeClientArgv(c);
+            c->argv[0] = createStringObject(where == REDIS_HEAD ? "LPOP" : "RPOP",4);
+            c->argv[1] = key;
+            c->argc = 2;
+            return;
         }
-        incrRefCount(c->argv[2]);
     }
+    blockForKeys(c,c->argv+1,c->argc-2,
+        timeout ? server.mstime+timeout*1000 : 0,where);
+}
+
+void blpopCommand(redisClient *c) {
+    blockingPopGenericCommand(c,REDIS_HEAD);
+}
+
+void brpopCommand(redisClient *c) {
+    blockingPopGenericCommand(c,REDIS_TAIL);
+}
+
+/*----------------------------------------------------------------------------
+ * List Commands
+ *----------------------------------------------------------------------------*/
+
+void pushGenericCommand(redisClient *c, int where) {
+    robj *lobj;
+
+    lobj = lookupKeyWrite(c->db,c->argv[1]);
+    if (lobj != NULL && lobj->type != REDIS_LIST) {
+        addReply(c,shared.wrongtypeerr);
+        return;
+    }
+    /* Clients blocked on a missing or empty list get the element straight
+     * away, the list is not touched: no change to replicate either */
+    if ((lobj == NULL || listTypeLength(lobj) == 0) &&
+        handleClientsWaitingListPush(c,c->argv[1],c->argv[2]))
+    {
+        addReply(c,shared.ok);
+        return;
+    }
+    if (lobj == NULL) {
+        lobj = createZiplistObject();
+        dbAdd(c->db,c->argv[1],lobj);
+    }
+    listTypePush(lobj,c->argv[2],where);
     server.dirty++;
     addReply(c,shared.ok);
 }
@@ -448,7 +885,6 @@ void rpushCommand(redisClient *c) {
 
 void llenCommand(redisClient *c) {
     robj *o;
-    list *l;
     
     o = lookupKeyRead(c->db,c->argv[1]);
     if (o == NULL) {
@@ -458,8 +894,7 @@ void llenCommand(redisClient *c) {
         if (o->type != REDIS_LIST) {
             addReply(c,shared.wrongtypeerr);
         } else {
-            l = o->ptr;
-            addReplySds(c,sdscatprintf(sdsempty(),":%d\r\n",listLength(l)));
+            addReplySds(c,sdscatprintf(sdsempty(),":%lu\r\n",listTypeLength(o)));
         }
     }
 }
@@ -475,16 +910,26 @@ void lindexCommand(redisClient *c) {
         if (o->type != REDIS_LIST) {
             addReply(c,shared.wrongtypeerr);
         } else {
-            list *list = o->ptr;
-            listNode *ln;
-            
-            ln = listIndex(list, index);
-            if (ln == NULL) {
+            unsigned char *vstr = NULL;
+            unsigned int vlen = 0;
+            int found;
+
+            if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+                found = ziplistGet(ziplistIndex(o->ptr,index),&vstr,&vlen);
+            } else {
+                quicklistEntry entry;
+
+                found = quicklistIndex(o->ptr,index,&entry);
+                if (found) {
+                    vstr = entry.value;
+                    vlen = entry.sz;
+                }
+            }
+            if (!found) {
                 addReply(c,shared.nullbulk);
             } else {
-                robj *ele = listNodeValue(ln);
-                addReplySds(c,sdscatprintf(sdsempty(),"$%d\r\n",(int)sdslen(ele->ptr)));
-                addReply(c,ele);
+                addReplySds(c,sdscatprintf(sdsempty(),"$%u\r\n",vlen));
+                addReplySds(c,sdsnewlen(vstr,vlen));
                 addReply(c,shared.crlf);
             }
         }
@@ -502,18 +947,26 @@ void lsetCommand(redisClient *c) {
         if (o->type != REDIS_LIST) {
             addReply(c,shared.wrongtypeerr);
         } else {
-            list *list = o->ptr;
-            listNode *ln;
-            
-            ln = listIndex(list, index);
-            if (ln == NULL) {
+            robj *value = c->argv[3];
+            int replaced;
+
+            listTypeTryConversion(o,value);
+            if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+                unsigned char *p, *zl = o->ptr;
+
+                p = ziplistIndex(zl,index);
+                replaced = p != NULL;
+                if (replaced) {
+                    zl = ziplistDelete(zl,&p);
+                    o->ptr = ziplistInsert(zl,p,value->ptr,sdslen(value->ptr));
+                }
+            } else {
+                replaced = quicklistReplaceAtIndex(o->ptr,index,
+                    value->ptr,sdslen(value->ptr));
+            }
+            if (!replaced) {
                 addReply(c,shared.outofrangeerr);
             } else {
-                robj *ele = listNodeValue(ln);
-
-                decrRefCount(ele);
-                listNodeValue(ln) = c->argv[3];
-                incrRefCount(c->argv[3]);
                 addReply(c,shared.ok);
                 server.dirty++;
             }
@@ -532,22 +985,15 @@ void popGenericCommand(redisClient *c, int where) {
         if (o->type != REDIS_LIST) {
             addReply(c,shared.wrongtypeerr);
         } else {
-            list *list = o->ptr;
-            listNode *ln;
-
-            if (where == REDIS_HEAD)
-                ln = listFirst(list);
-            else
-                ln = listLast(list);
+            robj *ele = listTypePop(o,where);
 
-            if (ln == NULL) {
+            if (ele == NULL) {
                 addReply(c,shared.nullbulk);
             } else {
-                robj *ele = listNodeValue(ln);
                 addReplySds(c,sdscatprintf(sdsempty(),"$%d\r\n",(int)sdslen(ele->ptr)));
                 addReply(c,ele);
                 addReply(c,shared.crlf);
-                listDelNode(list,ln);	/* 这里要有decrRefCount的操作啊？ */
+                decrRefCount(ele);
                 server.dirty++;
             }
         }
@@ -575,11 +1021,8 @@ void lrangeCommand(redisClient *c) {
         if (o->type != REDIS_LIST) {
             addReply(c,shared.wrongtypeerr);
         } else {
-            list *list = o->ptr;
-            listNode *ln;
-            int llen = listLength(list);
+            int llen = listTypeLength(o);
             int rangelen, j;
-            robj *ele;
 
             /* convert negative indexes */
             if (start < 0) start = llen+start;
@@ -597,14 +1040,31 @@ void lrangeCommand(redisClient *c) {
             rangelen = (end-start)+1;
 
             /* Return the result in form of a multi-bulk reply */
-            ln = listIndex(list, start);
             addReplySds(c,sdscatprintf(sdsempty(),"*%d\r\n",rangelen));
-            for (j = 0; j < rangelen; j++) {
-                ele = listNodeValue(ln);
-                addReplySds(c,sdscatprintf(sdsempty(),"$%d\r\n",(int)sdslen(ele->ptr)));
-                addReply(c,ele);
-                addReply(c,shared.crlf);
-                ln = ln->next;
+            if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+                unsigned char *p = ziplistIndex(o->ptr,start);
+                unsigned char *vstr;
+                unsigned int vlen;
+
+                for (j = 0; j < rangelen; j++) {
+                    ziplistGet(p,&vstr,&vlen);
+                    addReplySds(c,sdscatprintf(sdsempty(),"$%u\r\n",vlen));
+                    addReplySds(c,sdsnewlen(vstr,vlen));
+                    addReply(c,shared.crlf);
+                    p = ziplistNext(o->ptr,p);
+                }
+            } else {
+                quicklistIter *iter;
+                quicklistEntry entry;
+
+                iter = quicklistGetIteratorAtIdx(o->ptr,QUICKLIST_HEAD,start);
+                if (!iter) oom("quicklistGetIteratorAtIdx");
+                for (j = 0; j < rangelen && quicklistNext(iter,&entry); j++) {
+                    addReplySds(c,sdscatprintf(sdsempty(),"$%u\r\n",entry.sz));
+                    addReplySds(c,sdsnewlen(entry.value,entry.sz));
+                    addReply(c,shared.crlf);
+                }
+                quicklistReleaseIterator(iter);
             }
         }
     }
@@ -624,10 +1084,8 @@ void ltrimCommand(redisClient *c) {
         if (o->type != REDIS_LIST) {
             addReply(c,shared.wrongtypeerr);
         } else {
-            list *list = o->ptr;
-            listNode *ln;
-            int llen = listLength(list);
-            int j, ltrim, rtrim;
+            int llen = listTypeLength(o);
+            int ltrim, rtrim;
 
             /* convert negative indexes */
             if (start < 0) start = llen+start;
@@ -647,13 +1105,13 @@ void ltrimCommand(redisClient *c) {
             }
 
             /* Remove list elements to perform the trim */
-            for (j = 0; j < ltrim; j++) {
-                ln = listFirst(list);
-                listDelNode(list,ln);
-            }
-            for (j = 0; j < rtrim; j++) {
-                ln = listLast(list);
-                listDelNode(list,ln);
+            if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+                o->ptr = ziplistDeleteRange(o->ptr,0,ltrim);
+                o->ptr = ziplistDeleteRange(o->ptr,llen-ltrim-rtrim,rtrim);
+            } else {
+                /* Whole nodes inside the ranges are just released */
+                quicklistDelRange(o->ptr,0,ltrim);
+                quicklistDelRange(o->ptr,-rtrim,rtrim);
             }
             addReply(c,shared.ok);
             server.dirty++;
@@ -671,29 +1129,26 @@ void lremCommand(redisClient *c) {
         if (o->type != REDIS_LIST) {
             addReply(c,shared.wrongtypeerr);
         } else {
-            list *list = o->ptr;
-            listNode *ln, *next;
+            listTypeIterator *li;
+            listTypeEntry entry;
             int toremove = atoi(c->argv[2]->ptr);
             int removed = 0;
-            int fromtail = 0;
 
             if (toremove < 0) {
                 toremove = -toremove;
-                fromtail = 1;
+                li = listTypeInitIterator(o,-1,AL_START_TAIL);
+            } else {
+                li = listTypeInitIterator(o,0,AL_START_HEAD);
             }
-            ln = fromtail ? list->tail : list->head;
-            while (ln) {
-                robj *ele = listNodeValue(ln);
-
-                next = fromtail ? ln->prev : ln->next;
-                if (sdscmp(ele->ptr,c->argv[3]->ptr) == 0) {
-                    listDelNode(list,ln);
+            while (listTypeNext(li,&entry)) {
+                if (listTypeEqual(&entry,c->argv[3])) {
+                    listTypeDelete(&entry);
                     server.dirty++;
                     removed++;
                     if (toremove && removed == toremove) break;
                 }
-                ln = next;
             }
+            listTypeReleaseIterator(li);
             addReplySds(c,sdscatprintf(sdsempty(),":%d\r\n",removed));
         }
     }
@@ -701,22 +1156,196 @@ void lremCommand(redisClient *c) {
 
 /* ==================================== Sets ================================ */
 
+/*----------------------------------------------------------------------------
+ * Set API
+ *
+ * Sets only made of integers are created intset encoded, and converted to
+ * a hash table once they get more than set-max-intset-entries elements or
+ * a member that is not an integer is added.
+ *----------------------------------------------------------------------------*/
+
+/* Create a set object able to hold 'value' */
+robj *setTypeCreate(robj *value) {
+    if (isObjectRepresentableAsLongLong(value,NULL) == REDIS_OK)
+        return createIntsetObject();
+    return createSetObject();
+}
+
+/* Return 1 if the value was added, 0 if it was already a member */
+int setTypeAdd(robj *subject, robj *value) {
+    long long llval;
+
+    if (subject->encoding == REDIS_ENCODING_HT) {
+        if (objDictAdd(subject->ptr,value,NULL) == DICT_OK) {
+            incrRefCount(value);
+            return 1;
+        }
+    } else if (subject->encoding == REDIS_ENCODING_INTSET) {
+        if (isObjectRepresentableAsLongLong(value,&llval) == REDIS_OK) {
+            uint8_t success = 0;
+
+            subject->ptr = intsetAdd(subject->ptr,llval,&success);
+            if (success) {
+                /* Convert to regular set when the intset contains
+                 * too many entries. */
+                if (intsetLen(subject->ptr) > server.set_max_intset_entries)
+                    setTypeConvert(subject,REDIS_ENCODING_HT);
+                return 1;
+            }
+        } else {
+            /* Failed to get integer from object, convert to regular set. */
+            setTypeConvert(subject,REDIS_ENCODING_HT);
+            /* The set *was* an intset and this value is not integer
+             * encodable, so dictAdd should always work. */
+            if (objDictAdd(subject->ptr,value,NULL) != DICT_OK) assert(0 != 0);
+            incrRefCount(value);
+            return 1;
+        }
+    } else {
+        assert(0 != 0);
+    }
+    return 0;
+}
+
+int setTypeRemove(robj *subject, robj *value) {
+    long long llval;
+
+    if (subject->encoding == REDIS_ENCODING_HT) {
+        if (objDictDelete(subject->ptr,value) == DICT_OK) return 1;
+    } else if (subject->encoding == REDIS_ENCODING_INTSET) {
+        if (isObjectRepresentableAsLongLong(value,&llval) == REDIS_OK) {
+            int success;
+
+            subject->ptr = intsetRemove(subject->ptr,llval,&success);
+            if (success) return 1;
+        }
+    } else {
+        assert(0 != 0);
+    }
+    return 0;
+}
+
+int setTypeIsMember(robj *subject, robj *value) {
+    long long llval;
+
+    if (subject->encoding == REDIS_ENCODING_HT) {
+        return objDictFind((dict*)subject->ptr,value) != NULL;
+    } else if (subject->encoding == REDIS_ENCODING_INTSET) {
+        if (isObjectRepresentableAsLongLong(value,&llval) == REDIS_OK)
+            return intsetFind((intset*)subject->ptr,llval);
+    } else {
+        assert(0 != 0);
+    }
+    return 0;
+}
+
+unsigned long setTypeSize(robj *subject) {
+    if (subject->encoding == REDIS_ENCODING_HT) {
+        return dictSize((dict*)subject->ptr);
+    } else if (subject->encoding == REDIS_ENCODING_INTSET) {
+        return intsetLen((intset*)subject->ptr);
+    } else {
+        assert(0 != 0);
+        return 0;
+    }
+}
+
+setTypeIterator *setTypeInitIterator(robj *subject) {
+    setTypeIterator *si = zmalloc(sizeof(setTypeIterator));
+
+    if (!si) oom("setTypeInitIterator");
+    si->subject = subject;
+    si->encoding = subject->encoding;
+    si->ii = 0;
+    si->di = NULL;
+    if (si->encoding == REDIS_ENCODING_HT) {
+        si->di = dictGetIterator(subject->ptr);
+        if (!si->di) oom("dictGetIterator");
+    } else if (si->encoding != REDIS_ENCODING_INTSET) {
+        assert(0 != 0);
+    }
+    return si;
+}
+
+void setTypeReleaseIterator(setTypeIterator *si) {
+    if (si->di) dictReleaseIterator(si->di);
+    zfree(si);
+}
+
+/* Move to the next element without creating objects. Depending on the
+ * encoding either '*objele' (not a new reference) or '*llele' is set, and
+ * the encoding is returned. -1 at the end of the set. */
+int setTypeNextRaw(setTypeIterator *si, robj **objele, int64_t *llele) {
+    if (si->encoding == REDIS_ENCODING_HT) {
+        dictEntry *de = dictNext(si->di);
+
+        if (de == NULL) return -1;
+        *objele = dictGetEntryKey(de);
+    } else {
+        if (!intsetGet(si->subject->ptr,si->ii++,llele)) return -1;
+    }
+    return si->encoding;
+}
+
+/* Return the next element as an object, NULL at the end of the set.
+ * The caller owns the returned reference. */
+robj *setTypeNext(setTypeIterator *si) {
+    robj *objele = NULL;
+    int64_t llele = 0;
+    int encoding = setTypeNextRaw(si,&objele,&llele);
+
+    if (encoding == REDIS_ENCODING_HT) {
+        incrRefCount(objele);
+        return objele;
+    } else if (encoding == REDIS_ENCODING_INTSET) {
+        return createStringObjectFromLongLong(llele);
+    }
+    return NULL;
+}
+
+void setTypeConvert(robj *subject, int enc) {
+    assert(subject->type == REDIS_SET);
+    assert(subject->encoding == REDIS_ENCODING_INTSET);
+    if (enc == REDIS_ENCODING_HT) {
+        intset *is = subject->ptr;
+        dict *d = dictCreateLayout(&setDictType,NULL,server.set_dict_layout);
+        int64_t llele;
+        uint32_t ii = 0;
+
+        if (!d) oom("dictCreate");
+        /* Presize the dict to avoid rehashing */
+        dictExpand(d,intsetLen(is));
+        while (intsetGet(is,ii++,&llele)) {
+            if (objDictAdd(d,createStringObjectFromLongLong(llele),NULL) != DICT_OK)
+                assert(0 != 0);
+        }
+
+        subject->encoding = REDIS_ENCODING_HT;
+        zfree(is);
+        subject->ptr = d;
+    } else {
+        assert(0 != 0);
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * Set Commands
+ *----------------------------------------------------------------------------*/
+
 void saddCommand(redisClient *c) {
     robj *set;
 
     set = lookupKeyWrite(c->db,c->argv[1]);
     if (set == NULL) {
-        set = createSetObject();
-        dictAdd(c->db->dict,c->argv[1],set);
-        incrRefCount(c->argv[1]);
+        set = setTypeCreate(c->argv[2]);
+        dbAdd(c->db,c->argv[1],set);
     } else {
         if (set->type != REDIS_SET) {
             addReply(c,shared.wrongtypeerr);
             return;
         }
     }
-    if (dictAdd(set->ptr,c->argv[2],NULL) == DICT_OK) {
-        incrRefCount(c->argv[2]);
+    if (setTypeAdd(set,c->argv[2])) {
         server.dirty++;
         addReply(c,shared.cone);
     } else {
@@ -735,7 +1364,7 @@ void sremCommand(redisClient *c) {
             addReply(c,shared.wrongtypeerr);
             return;
         }
-        if (dictDelete(set->ptr,c->argv[2]) == DICT_OK) {
+        if (setTypeRemove(set,c->argv[2])) {
             server.dirty++;
             addReply(c,shared.cone);
         } else {
@@ -762,7 +1391,7 @@ void smoveCommand(redisClient *c) {
         return;
     }
     /* Remove the element from the source set */
-    if (dictDelete(srcset->ptr,c->argv[3]) == DICT_ERR) {
+    if (!setTypeRemove(srcset,c->argv[3])) {
         /* Key not found in the src set! return zero */
         addReply(c,shared.czero);
         return;
@@ -770,12 +1399,10 @@ void smoveCommand(redisClient *c) {
     server.dirty++;
     /* Add the element to the destination set */
     if (!dstset) {
-        dstset = createSetObject();
-        dictAdd(c->db->dict,c->argv[2],dstset);
-        incrRefCount(c->argv[2]);
+        dstset = setTypeCreate(c->argv[3]);
+        dbAdd(c->db,c->argv[2],dstset);
     }
-    if (dictAdd(dstset->ptr,c->argv[3],NULL) == DICT_OK)
-        incrRefCount(c->argv[3]);
+    setTypeAdd(dstset,c->argv[3]);
     addReply(c,shared.cone);
 }
 
@@ -790,7 +1417,7 @@ void sismemberCommand(redisClient *c) {
             addReply(c,shared.wrongtypeerr);
             return;
         }
-        if (dictFind(set->ptr,c->argv[2]))
+        if (setTypeIsMember(set,c->argv[2]))
             addReply(c,shared.cone);
         else
             addReply(c,shared.czero);
@@ -799,7 +1426,6 @@ void sismemberCommand(redisClient *c) {
 
 void scardCommand(redisClient *c) {
     robj *o;
-    dict *s;
     
     o = lookupKeyRead(c->db,c->argv[1]);
     if (o == NULL) {
@@ -809,74 +1435,1728 @@ void scardCommand(redisClient *c) {
         if (o->type != REDIS_SET) {
             addReply(c,shared.wrongtypeerr);
         } else {
-            s = o->ptr;
-            addReplySds(c,sdscatprintf(sdsempty(),":%d\r\n",
-                dictSize(s)));
+            addReplySds(c,sdscatprintf(sdsempty(),":%lu\r\n",
+                setTypeSize(o)));
         }
     }
 }
 
-/* ================================= Expire ================================= */
-int removeExpire(redisDb *db, robj *key) {
-    if (dictDelete(db->expires,key) == DICT_OK) {
-        return 1;
-    } else {
-        return 0;
+/* ================================ Sorted sets ============================= */
+
+/*----------------------------------------------------------------------------
+ * Skiplist API
+ *
+ * The skiplist keeps the members ordered by score, members with the same
+ * score ordered by memcmp(). level[i].span is the number of nodes the
+ * forward pointer at level i jumps over, so summing the spans while walking
+ * down gives the rank of a node in O(log N). The skiplist owns the member
+ * objects, the dict of the zset only borrows them.
+ *----------------------------------------------------------------------------*/
+
+static zskiplistNode *zslCreateNode(int level, double score, robj *obj) {
+    zskiplistNode *zn = zmalloc(sizeof(*zn)+level*sizeof(struct zskiplistLevel));
+
+    if (!zn) oom("zslCreateNode");
+    zn->score = score;
+    zn->obj = obj;
+    return zn;
+}
+
+zskiplist *zslCreate(void) {
+    int j;
+    zskiplist *zsl;
+
+    zsl = zmalloc(sizeof(*zsl));
+    if (!zsl) oom("zslCreate");
+    zsl->level = 1;
+    zsl->length = 0;
+    zsl->header = zslCreateNode(ZSKIPLIST_MAXLEVEL,0,NULL);
+    for (j = 0; j < ZSKIPLIST_MAXLEVEL; j++) {
+        zsl->header->level[j].forward = NULL;
+        zsl->header->level[j].span = 0;
     }
+    zsl->header->backward = NULL;
+    zsl->tail = NULL;
+    return zsl;
 }
 
-int setExpire(redisDb *db, robj *key, time_t when) {
-    if (dictAdd(db->expires,key,(void*)when) == DICT_ERR) {
-        return 0;
-    } else {
-        incrRefCount(key);
-        return 1;
+/* obj is NULL when a lazy free already released the member */
+static void zslFreeNode(zskiplistNode *node) {
+    if (node->obj) decrRefCount(node->obj);
+    zfree(node);
+}
+
+void zslFree(zskiplist *zsl) {
+    zskiplistNode *node = zsl->header->level[0].forward, *next;
+
+    zfree(zsl->header);
+    while(node) {
+        next = node->level[0].forward;
+        zslFreeNode(node);
+        node = next;
     }
+    zfree(zsl);
 }
 
-/* Return the expire time of the specified key, or -1 if no expire
- * is associated with this key (i.e. the key is non volatile) */
-time_t getExpire(redisDb *db, robj *key) {
-    dictEntry *de;
+/* 返回1..ZSKIPLIST_MAXLEVEL, 层数每高一层的概率为ZSKIPLIST_P */
+static int zslRandomLevel(void) {
+    int level = 1;
 
-    /* No expire? return ASAP */
-    if (dictSize(db->expires) == 0 ||
-       (de = dictFind(db->expires,key)) == NULL) return -1;
+    while ((random()&0xFFFF) < (ZSKIPLIST_P * 0xFFFF))
+        level += 1;
+    return (level < ZSKIPLIST_MAXLEVEL) ? level : ZSKIPLIST_MAXLEVEL;
+}
+
+static int zslCompareObjects(robj *a, robj *b) {
+    size_t la = sdslen(a->ptr), lb = sdslen(b->ptr);
+    int cmp = memcmp(a->ptr,b->ptr,la < lb ? la : lb);
 
-    return (time_t) dictGetEntryVal(de);
+    if (cmp) return cmp;
+    return (la < lb) ? -1 : (la > lb);
 }
 
-void expireCommand(redisClient *c) {
-    dictEntry *de;
-    int seconds = atoi(c->argv[2]->ptr);
+/* True if node x sorts before the (score,obj) pair */
+static int zslNodeBefore(zskiplistNode *x, double score, robj *obj) {
+    return x->score < score ||
+           (x->score == score && zslCompareObjects(x->obj,obj) < 0);
+}
 
-    de = dictFind(c->db->dict,c->argv[1]);
-    if (de == NULL) {
+/* Insert a new node, the skiplist takes the reference of 'obj'. The caller
+ * makes sure the member is not already there. */
+zskiplistNode *zslInsert(zskiplist *zsl, double score, robj *obj) {
+    zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
+    unsigned long rank[ZSKIPLIST_MAXLEVEL];
+    int i, level;
+
+    x = zsl->header;
+    for (i = zsl->level-1; i >= 0; i--) {
+        /* rank[i] is the rank of update[i] */
+        rank[i] = (i == zsl->level-1) ? 0 : rank[i+1];
+        while (x->level[i].forward &&
+               zslNodeBefore(x->level[i].forward,score,obj)) {
+            rank[i] += x->level[i].span;
+            x = x->level[i].forward;
+        }
+        update[i] = x;
+    }
+    level = zslRandomLevel();
+    if (level > zsl->level) {
+        for (i = zsl->level; i < level; i++) {
+            rank[i] = 0;
+            update[i] = zsl->header;
+            update[i]->level[i].span = zsl->length;
+        }
+        zsl->level = level;
+    }
+    x = zslCreateNode(level,score,obj);
+    for (i = 0; i < level; i++) {
+        x->level[i].forward = update[i]->level[i].forward;
+        update[i]->level[i].forward = x;
+        /* update[i]到x跨过了(rank[0]-rank[i])个节点 */
+        x->level[i].span = update[i]->level[i].span - (rank[0] - rank[i]);
+        update[i]->level[i].span = (rank[0] - rank[i]) + 1;
+    }
+    /* The levels above the new node now jump over one more node */
+    for (i = level; i < zsl->level; i++)
+        update[i]->level[i].span++;
+
+    x->backward = (update[0] == zsl->header) ? NULL : update[0];
+    if (x->level[0].forward)
+        x->level[0].forward->backward = x;
+    else
+        zsl->tail = x;
+    zsl->length++;
+    return x;
+}
+
+/* Unlink x, update[i] being the last node before x at level i */
+static void zslDeleteNode(zskiplist *zsl, zskiplistNode *x, zskiplistNode **update) {
+    int i;
+
+    for (i = 0; i < zsl->level; i++) {
+        if (update[i]->level[i].forward == x) {
+            update[i]->level[i].span += x->level[i].span - 1;
+            update[i]->level[i].forward = x->level[i].forward;
+        } else {
+            update[i]->level[i].span -= 1;
+        }
+    }
+    if (x->level[0].forward)
+        x->level[0].forward->backward = x->backward;
+    else
+        zsl->tail = x->backward;
+    while(zsl->level > 1 && zsl->header->level[zsl->level-1].forward == NULL)
+        zsl->level--;
+    zsl->length--;
+}
+
+/* Delete the node with the given score and member, 1 if found */
+int zslDelete(zskiplist *zsl, double score, robj *obj) {
+    zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
+    int i;
+
+    x = zsl->header;
+    for (i = zsl->level-1; i >= 0; i--) {
+        while (x->level[i].forward &&
+               zslNodeBefore(x->level[i].forward,score,obj))
+            x = x->level[i].forward;
+        update[i] = x;
+    }
+    x = x->level[0].forward;
+    if (x && score == x->score && zslCompareObjects(x->obj,obj) == 0) {
+        zslDeleteNode(zsl,x,update);
+        zslFreeNode(x);
+        return 1;
+    }
+    return 0;
+}
+
+/* 1 based rank of the member, 0 if not found */
+unsigned long zslGetRank(zskiplist *zsl, double score, robj *obj) {
+    zskiplistNode *x;
+    unsigned long rank = 0;
+    int i;
+
+    x = zsl->header;
+    for (i = zsl->level-1; i >= 0; i--) {
+        while (x->level[i].forward &&
+            (x->level[i].forward->score < score ||
+                (x->level[i].forward->score == score &&
+                zslCompareObjects(x->level[i].forward->obj,obj) <= 0))) {
+            rank += x->level[i].span;
+            x = x->level[i].forward;
+        }
+        /* x might be the header, whose obj is NULL */
+        if (x->obj && x->score == score && zslCompareObjects(x->obj,obj) == 0)
+            return rank;
+    }
+    return 0;
+}
+
+/* Node at the 1 based 'rank', NULL if out of range */
+zskiplistNode *zslGetElementByRank(zskiplist *zsl, unsigned long rank) {
+    zskiplistNode *x;
+    unsigned long traversed = 0;
+    int i;
+
+    x = zsl->header;
+    for (i = zsl->level-1; i >= 0; i--) {
+        while (x->level[i].forward && (traversed + x->level[i].span) <= rank) {
+            traversed += x->level[i].span;
+            x = x->level[i].forward;
+        }
+        if (traversed == rank) return x;
+    }
+    return NULL;
+}
+
+/* Parse a score, NaN and trailing garbage are rejected. "inf", "+inf" and
+ * "-inf" are accepted by strtod(). */
+static int zsetParseScore(char *s, double *score) {
+    char *eptr;
+    double value;
+
+    if (*s == '\0') return REDIS_ERR;
+    value = strtod(s,&eptr);
+    if (*eptr != '\0' || isnan(value)) return REDIS_ERR;
+    *score = value;
+    return REDIS_OK;
+}
+
+/* Range bounds are scores, "(" in front of a bound makes it exclusive */
+int zslParseRange(robj *min, robj *max, zrangespec *spec) {
+    char *s;
+
+    spec->minex = spec->maxex = 0;
+    s = min->ptr;
+    if (*s == '(') {
+        spec->minex = 1;
+        s++;
+    }
+    if (zsetParseScore(s,&spec->min) == REDIS_ERR) return REDIS_ERR;
+    s = max->ptr;
+    if (*s == '(') {
+        spec->maxex = 1;
+        s++;
+    }
+    if (zsetParseScore(s,&spec->max) == REDIS_ERR) return REDIS_ERR;
+    return REDIS_OK;
+}
+
+static int zslValueGteMin(double value, zrangespec *spec) {
+    return spec->minex ? (value > spec->min) : (value >= spec->min);
+}
+
+static int zslValueLteMax(double value, zrangespec *spec) {
+    return spec->maxex ? (value < spec->max) : (value <= spec->max);
+}
+
+/* First node with a score in range, NULL if none */
+zskiplistNode *zslFirstInRange(zskiplist *zsl, zrangespec *range) {
+    zskiplistNode *x;
+    int i;
+
+    x = zsl->header;
+    for (i = zsl->level-1; i >= 0; i--) {
+        while (x->level[i].forward &&
+               !zslValueGteMin(x->level[i].forward->score,range))
+            x = x->level[i].forward;
+    }
+    x = x->level[0].forward;
+    if (x == NULL || !zslValueLteMax(x->score,range)) return NULL;
+    return x;
+}
+
+/*----------------------------------------------------------------------------
+ * Ziplist encoded sorted sets
+ *
+ * Small sorted sets are a ziplist of member,score,member,score... entries
+ * kept in the skiplist order, the scores stored as strings. They are
+ * converted to a skiplist once they get more than zset-max-ziplist-entries
+ * members or a member longer than zset-max-ziplist-value bytes.
+ *----------------------------------------------------------------------------*/
+
+/* Format a score the way it is stored in ziplists and replied */
+static int zsetFormatScore(char *buf, size_t len, double score) {
+    return snprintf(buf,len,"%.17g",score);
+}
+
+double zzlGetScore(unsigned char *sptr) {
+    unsigned char *vstr;
+    unsigned int vlen;
+    char buf[128];
+
+    if (!ziplistGet(sptr,&vstr,&vlen)) assert(0 != 0);
+    if (vlen >= sizeof(buf)) vlen = sizeof(buf)-1;
+    memcpy(buf,vstr,vlen);
+    buf[vlen] = '\0';
+    return strtod(buf,NULL);
+}
+
+/* Compare the member at 'eptr' with 'ele' like zslCompareObjects() */
+static int zzlCompareElements(unsigned char *eptr, robj *ele) {
+    unsigned char *vstr;
+    unsigned int vlen;
+    size_t elen = sdslen(ele->ptr);
+    int cmp;
+
+    if (!ziplistGet(eptr,&vstr,&vlen)) assert(0 != 0);
+    cmp = memcmp(vstr,ele->ptr,vlen < elen ? vlen : elen);
+    if (cmp) return cmp;
+    return (vlen < elen) ? -1 : (vlen > elen);
+}
+
+/* Return the entry of the member 'ele' and set *score, NULL if missing */
+static unsigned char *zzlFind(unsigned char *zl, robj *ele, double *score) {
+    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+
+    while (eptr != NULL) {
+        sptr = ziplistNext(zl,eptr);
+        if (ziplistCompare(eptr,(unsigned char*)ele->ptr,sdslen(ele->ptr))) {
+            if (score) *score = zzlGetScore(sptr);
+            return eptr;
+        }
+        eptr = ziplistNext(zl,sptr);
+    }
+    return NULL;
+}
+
+/* Delete the member at 'eptr' and its score */
+static unsigned char *zzlDelete(unsigned char *zl, unsigned char *eptr) {
+    zl = ziplistDelete(zl,&eptr);
+    zl = ziplistDelete(zl,&eptr);
+    return zl;
+}
+
+/* Insert 'ele' with 'score' at its place, the member must be missing */
+static unsigned char *zzlInsert(unsigned char *zl, robj *ele, double score) {
+    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    char buf[128];
+    int len = zsetFormatScore(buf,sizeof(buf),score);
+    double s;
+
+    while (eptr != NULL) {
+        sptr = ziplistNext(zl,eptr);
+        s = zzlGetScore(sptr);
+        if (s > score || (s == score && zzlCompareElements(eptr,ele) > 0))
+            break;
+        eptr = ziplistNext(zl,sptr);
+    }
+    if (eptr == NULL) {
+        zl = ziplistPush(zl,(unsigned char*)ele->ptr,sdslen(ele->ptr),ZIPLIST_TAIL);
+        zl = ziplistPush(zl,(unsigned char*)buf,len,ZIPLIST_TAIL);
+    } else {
+        /* 在eptr前插入member, 再在原eptr指向的元素前插入score */
+        size_t offset = eptr-zl;
+
+        zl = ziplistInsert(zl,eptr,(unsigned char*)ele->ptr,sdslen(ele->ptr));
+        sptr = ziplistNext(zl,zl+offset);
+        zl = ziplistInsert(zl,sptr,(unsigned char*)buf,len);
+    }
+    return zl;
+}
+
+/*----------------------------------------------------------------------------
+ * Sorted set API
+ *----------------------------------------------------------------------------*/
+
+unsigned long zsetLength(robj *zobj) {
+    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+        return ziplistLen(zobj->ptr)/2;
+    } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
+        return ((zset*)zobj->ptr)->zsl->length;
+    } else {
+        assert(0 != 0);
+    }
+    return 0;
+}
+
+void zsetConvert(robj *zobj, int encoding) {
+    assert(zobj->type == REDIS_ZSET);
+    assert(zobj->encoding == REDIS_ENCODING_ZIPLIST);
+    if (encoding == REDIS_ENCODING_SKIPLIST) {
+        unsigned char *zl = zobj->ptr, *eptr, *sptr, *vstr;
+        unsigned int vlen;
+        zskiplistNode *node;
+        zset *zs;
+        robj *ele;
+
+        zs = zmalloc(sizeof(*zs));
+        if (!zs) oom("zsetConvert");
+        zs->dict = dictCreateLayout(&zsetDictType,NULL,server.set_dict_layout);
+        if (!zs->dict) oom("dictCreate");
+        zs->zsl = zslCreate();
+        dictExpand(zs->dict,ziplistLen(zl)/2);
+
+        /* The ziplist is already sorted: every insert appends */
+        eptr = ziplistIndex(zl,0);
+        while (eptr != NULL) {
+            sptr = ziplistNext(zl,eptr);
+            ziplistGet(eptr,&vstr,&vlen);
+            ele = createStringObject((char*)vstr,vlen);
+            node = zslInsert(zs->zsl,zzlGetScore(sptr),ele);
+            if (objDictAdd(zs->dict,ele,&node->score) != DICT_OK)
+                assert(0 != 0);
+            eptr = ziplistNext(zl,sptr);
+        }
+
+        zobj->encoding = REDIS_ENCODING_SKIPLIST;
+        zfree(zl);
+        zobj->ptr = zs;
+    } else {
+        assert(0 != 0);
+    }
+}
+
+/* Add 'ele' with 'score' or update its score: 1 if added, 0 if it was
+ * already a member */
+int zsetAdd(robj *zobj, robj *ele, double score) {
+    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+        unsigned char *eptr;
+        double curscore;
+
+        if ((eptr = zzlFind(zobj->ptr,ele,&curscore)) != NULL) {
+            if (curscore != score) {
+                zobj->ptr = zzlDelete(zobj->ptr,eptr);
+                zobj->ptr = zzlInsert(zobj->ptr,ele,score);
+            }
+            return 0;
+        }
+        if (zsetLength(zobj)+1 <= server.zset_max_ziplist_entries &&
+            sdslen(ele->ptr) <= server.zset_max_ziplist_value) {
+            zobj->ptr = zzlInsert(zobj->ptr,ele,score);
+            return 1;
+        }
+        zsetConvert(zobj,REDIS_ENCODING_SKIPLIST);
+    }
+
+    if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
+        zset *zs = zobj->ptr;
+        dictEntry *de = objDictFind(zs->dict,ele);
+        zskiplistNode *node;
+
+        if (de) {
+            robj *cur = dictGetEntryKey(de);
+            double curscore = *(double*)dictGetEntryVal(de);
+
+            if (curscore != score) {
+                /* 删除再插入, 新节点继续使用dict中的key对象 */
+                incrRefCount(cur);
+                zslDelete(zs->zsl,curscore,cur);
+                node = zslInsert(zs->zsl,score,cur);
+                dictGetEntryVal(de) = &node->score;
+            }
+            return 0;
+        }
+        incrRefCount(ele);
+        node = zslInsert(zs->zsl,score,ele);
+        if (objDictAdd(zs->dict,ele,&node->score) != DICT_OK)
+            assert(0 != 0);
+        return 1;
+    }
+    assert(0 != 0);
+    return 0;
+}
+
+/* 1 if the member was removed */
+static int zsetDelete(robj *zobj, robj *ele) {
+    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+        unsigned char *eptr = zzlFind(zobj->ptr,ele,NULL);
+
+        if (eptr == NULL) return 0;
+        zobj->ptr = zzlDelete(zobj->ptr,eptr);
+        return 1;
+    } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
+        zset *zs = zobj->ptr;
+        dictEntry *de = objDictFind(zs->dict,ele);
+        robj *cur;
+        double score;
+
+        if (de == NULL) return 0;
+        /* The dict only borrows the member: the skiplist frees it */
+        cur = dictGetEntryKey(de);
+        score = *(double*)dictGetEntryVal(de);
+        objDictDelete(zs->dict,ele);
+        zslDelete(zs->zsl,score,cur);
+        return 1;
+    }
+    assert(0 != 0);
+    return 0;
+}
+
+static int zsetScore(robj *zobj, robj *ele, double *score) {
+    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+        return zzlFind(zobj->ptr,ele,score) ? REDIS_OK : REDIS_ERR;
+    } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
+        dictEntry *de = objDictFind(((zset*)zobj->ptr)->dict,ele);
+
+        if (de == NULL) return REDIS_ERR;
+        *score = *(double*)dictGetEntryVal(de);
+        return REDIS_OK;
+    }
+    assert(0 != 0);
+    return REDIS_ERR;
+}
+
+/* 0 based rank of the member, -1 if missing */
+static long zsetRank(robj *zobj, robj *ele, int reverse) {
+    unsigned long llen = zsetLength(zobj), rank;
+
+    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+        unsigned char *zl = zobj->ptr, *eptr = ziplistIndex(zl,0);
+
+        rank = 0;
+        while (eptr != NULL) {
+            if (ziplistCompare(eptr,(unsigned char*)ele->ptr,sdslen(ele->ptr)))
+                return reverse ? (long)(llen-1-rank) : (long)rank;
+            eptr = ziplistNext(zl,ziplistNext(zl,eptr));
+            rank++;
+        }
+        return -1;
+    } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
+        zset *zs = zobj->ptr;
+        dictEntry *de = objDictFind(zs->dict,ele);
+
+        if (de == NULL) return -1;
+        rank = zslGetRank(zs->zsl,*(double*)dictGetEntryVal(de),dictGetEntryKey(de));
+        assert(rank != 0);
+        return reverse ? (long)(llen-rank) : (long)(rank-1);
+    }
+    assert(0 != 0);
+    return -1;
+}
+
+/*----------------------------------------------------------------------------
+ * Sorted set Commands
+ *----------------------------------------------------------------------------*/
+
+static void addReplyDouble(redisClient *c, double d) {
+    char buf[128];
+    int len = zsetFormatScore(buf,sizeof(buf),d);
+
+    addReplySds(c,sdscatprintf(sdsempty(),"$%d\r\n%s\r\n",len,buf));
+}
+
+/* Reply the ziplist entry at 'p' as a bulk */
+static void addReplyZiplistEntry(redisClient *c, unsigned char *p) {
+    unsigned char *vstr;
+    unsigned int vlen;
+    sds s;
+
+    ziplistGet(p,&vstr,&vlen);
+    s = sdscatprintf(sdsempty(),"$%u\r\n",vlen);
+    s = sdscatlen(s,vstr,vlen);
+    s = sdscatlen(s,"\r\n",2);
+    addReplySds(c,s);
+}
+
+static void zaddGenericCommand(redisClient *c, int incr) {
+    robj *key = c->argv[1], *ele = c->argv[3], *zobj;
+    double score, curscore;
+    int added;
+
+    if (zsetParseScore(c->argv[2]->ptr,&score) == REDIS_ERR) {
+        addReplySds(c,sdsnew("-ERR value is not a valid float\r\n"));
+        return;
+    }
+    zobj = lookupKeyWrite(c->db,key);
+    if (zobj != NULL && zobj->type != REDIS_ZSET) {
+        addReply(c,shared.wrongtypeerr);
+        return;
+    }
+    if (incr && zobj != NULL && zsetScore(zobj,ele,&curscore) == REDIS_OK) {
+        score += curscore;
+        if (isnan(score)) {
+            addReplySds(c,sdsnew("-ERR resulting score is not a number (NaN)\r\n"));
+            return;
+        }
+    }
+    if (zobj == NULL) {
+        if (server.zset_max_ziplist_entries == 0 ||
+            sdslen(ele->ptr) > server.zset_max_ziplist_value)
+            zobj = createZsetObject();
+        else
+            zobj = createZsetZiplistObject();
+        dbAdd(c->db,key,zobj);
+    }
+    added = zsetAdd(zobj,ele,score);
+    server.dirty++;
+    if (incr)
+        addReplyDouble(c,score);
+    else
+        addReply(c,added ? shared.cone : shared.czero);
+}
+
+void zaddCommand(redisClient *c) {
+    zaddGenericCommand(c,0);
+}
+
+void zincrbyCommand(redisClient *c) {
+    zaddGenericCommand(c,1);
+}
+
+void zremCommand(redisClient *c) {
+    robj *zobj;
+
+    zobj = lookupKeyWrite(c->db,c->argv[1]);
+    if (zobj == NULL) {
+        addReply(c,shared.czero);
+    } else if (zobj->type != REDIS_ZSET) {
+        addReply(c,shared.wrongtypeerr);
+    } else if (zsetDelete(zobj,c->argv[2])) {
+        server.dirty++;
+        addReply(c,shared.cone);
+    } else {
+        addReply(c,shared.czero);
+    }
+}
+
+void zscoreCommand(redisClient *c) {
+    robj *zobj;
+    double score;
+
+    zobj = lookupKeyRead(c->db,c->argv[1]);
+    if (zobj == NULL) {
+        addReply(c,shared.nullbulk);
+    } else if (zobj->type != REDIS_ZSET) {
+        addReply(c,shared.wrongtypeerr);
+    } else if (zsetScore(zobj,c->argv[2],&score) == REDIS_OK) {
+        addReplyDouble(c,score);
+    } else {
+        addReply(c,shared.nullbulk);
+    }
+}
+
+static void zrankGenericCommand(redisClient *c, int reverse) {
+    robj *zobj;
+    long rank;
+
+    zobj = lookupKeyRead(c->db,c->argv[1]);
+    if (zobj == NULL) {
+        addReply(c,shared.nullbulk);
+    } else if (zobj->type != REDIS_ZSET) {
+        addReply(c,shared.wrongtypeerr);
+    } else if ((rank = zsetRank(zobj,c->argv[2],reverse)) >= 0) {
+        addReplySds(c,sdscatprintf(sdsempty(),":%ld\r\n",rank));
+    } else {
+        addReply(c,shared.nullbulk);
+    }
+}
+
+void zrankCommand(redisClient *c) {
+    zrankGenericCommand(c,0);
+}
+
+void zrevrankCommand(redisClient *c) {
+    zrankGenericCommand(c,1);
+}
+
+static void zrangeGenericCommand(redisClient *c, int reverse) {
+    robj *zobj;
+    int start = atoi(c->argv[2]->ptr);
+    int end = atoi(c->argv[3]->ptr);
+    int withscores = 0;
+    int llen, rangelen, j;
+
+    if (c->argc == 5 && !strcasecmp(c->argv[4]->ptr,"withscores")) {
+        withscores = 1;
+    } else if (c->argc >= 5) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+
+    zobj = lookupKeyRead(c->db,c->argv[1]);
+    if (zobj == NULL) {
+        addReply(c,shared.emptymultibulk);
+        return;
+    } else if (zobj->type != REDIS_ZSET) {
+        addReply(c,shared.wrongtypeerr);
+        return;
+    }
+
+    /* convert negative indexes */
+    llen = zsetLength(zobj);
+    if (start < 0) start = llen+start;
+    if (end < 0) end = llen+end;
+    if (start < 0) start = 0;
+    if (end < 0) end = 0;
+
+    /* indexes sanity checks */
+    if (start > end || start >= llen) {
+        addReply(c,shared.emptymultibulk);
+        return;
+    }
+    if (end >= llen) end = llen-1;
+    rangelen = (end-start)+1;
+
+    addReplySds(c,sdscatprintf(sdsempty(),"*%d\r\n",
+        withscores ? rangelen*2 : rangelen));
+    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+        unsigned char *zl = zobj->ptr, *eptr, *sptr;
+
+        eptr = reverse ? ziplistIndex(zl,-2-(2*start)) : ziplistIndex(zl,2*start);
+        for (j = 0; j < rangelen; j++) {
+            sptr = ziplistNext(zl,eptr);
+            addReplyZiplistEntry(c,eptr);
+            if (withscores) addReplyZiplistEntry(c,sptr);
+            if (reverse)
+                eptr = (j+1 < rangelen) ? ziplistPrev(zl,ziplistPrev(zl,eptr)) : NULL;
+            else
+                eptr = ziplistNext(zl,sptr);
+        }
+    } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
+        zskiplist *zsl = ((zset*)zobj->ptr)->zsl;
+        zskiplistNode *ln;
+
+        /* zslGetElementByRank() is O(log N), the rest is a walk */
+        if (reverse)
+            ln = start ? zslGetElementByRank(zsl,llen-start) : zsl->tail;
+        else
+            ln = start ? zslGetElementByRank(zsl,start+1) : zsl->header->level[0].forward;
+        for (j = 0; j < rangelen; j++) {
+            addReplyBulk(c,ln->obj);
+            if (withscores) addReplyDouble(c,ln->score);
+            ln = reverse ? ln->backward : ln->level[0].forward;
+        }
+    } else {
+        assert(0 != 0);
+    }
+}
+
+void zrangeCommand(redisClient *c) {
+    zrangeGenericCommand(c,0);
+}
+
+void zrevrangeCommand(redisClient *c) {
+    zrangeGenericCommand(c,1);
+}
+
+/* ZRANGEBYSCORE key min max [LIMIT offset count] [WITHSCORES] */
+void zrangebyscoreCommand(redisClient *c) {
+    zrangespec range;
+    robj *zobj, *lenobj;
+    long long offset = 0, limit = -1;
+    int withscores = 0, j;
+    unsigned long rangelen = 0;
+
+    if (zslParseRange(c->argv[2],c->argv[3],&range) == REDIS_ERR) {
+        addReplySds(c,sdsnew("-ERR min or max is not a float\r\n"));
+        return;
+    }
+    for (j = 4; j < c->argc; j++) {
+        if (!strcasecmp(c->argv[j]->ptr,"withscores")) {
+            withscores = 1;
+        } else if (!strcasecmp(c->argv[j]->ptr,"limit") && j+2 < c->argc) {
+            /* A negative count returns everything after the offset */
+            if (isObjectRepresentableAsLongLong(c->argv[j+1],&offset) == REDIS_ERR ||
+                isObjectRepresentableAsLongLong(c->argv[j+2],&limit) == REDIS_ERR ||
+                offset < 0)
+            {
+                addReply(c,shared.syntaxerr);
+                return;
+            }
+            j += 2;
+        } else {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+    }
+
+    zobj = lookupKeyRead(c->db,c->argv[1]);
+    if (zobj == NULL) {
+        addReply(c,shared.emptymultibulk);
+        return;
+    } else if (zobj->type != REDIS_ZSET) {
+        addReply(c,shared.wrongtypeerr);
+        return;
+    }
+
+    /* The number of elements is known only at the end: deferred length */
+    lenobj = createObject(REDIS_STRING,NULL);
+    addReply(c,lenobj);
+    decrRefCount(lenobj);
+    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+        unsigned char *zl = zobj->ptr, *eptr, *sptr;
+        double score;
+
+        eptr = ziplistIndex(zl,0);
+        while (eptr != NULL && limit != 0) {
+            sptr = ziplistNext(zl,eptr);
+            score = zzlGetScore(sptr);
+            if (!zslValueLteMax(score,&range)) break;
+            if (zslValueGteMin(score,&range)) {
+                if (offset > 0) {
+                    offset--;
+                } else {
+                    addReplyZiplistEntry(c,eptr);
+                    if (withscores) addReplyZiplistEntry(c,sptr);
+                    rangelen++;
+                    if (limit > 0) limit--;
+                }
+            }
+            eptr = ziplistNext(zl,sptr);
+        }
+    } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
+        zskiplistNode *ln = zslFirstInRange(((zset*)zobj->ptr)->zsl,&range);
+
+        for (; ln && offset > 0; offset--)
+            ln = ln->level[0].forward;
+        while (ln && limit != 0 && zslValueLteMax(ln->score,&range)) {
+            addReplyBulk(c,ln->obj);
+            if (withscores) addReplyDouble(c,ln->score);
+            rangelen++;
+            if (limit > 0) limit--;
+            ln = ln->level[0].forward;
+        }
+    } else {
+        assert(0 != 0);
+    }
+    lenobj->ptr = sdscatprintf(sdsempty(),"*%lu\r\n",
+        withscores ? rangelen*2 : rangelen);
+    c->reply_bytes += sdslen(lenobj->ptr); /* deferred length */
+}
+
+void zcardCommand(redisClient *c) {
+    robj *zobj;
+
+    zobj = lookupKeyRead(c->db,c->argv[1]);
+    if (zobj == NULL) {
+        addReply(c,shared.czero);
+    } else if (zobj->type != REDIS_ZSET) {
+        addReply(c,shared.wrongtypeerr);
+    } else {
+        addReplySds(c,sdscatprintf(sdsempty(),":%lu\r\n",zsetLength(zobj)));
+    }
+}
+
+/* =================================== Hashes =============================== */
+
+/*----------------------------------------------------------------------------
+ * Hash API
+ *
+ * Hashes are created as a ziplist of field,value,field,value... entries and
+ * converted to a hash table (hashDictType, robj fields and values like the
+ * keyspace) once they get more than hash-max-ziplist-entries fields or a
+ * field or value longer than hash-max-ziplist-value bytes. A small hash
+ * costs a single allocation instead of a dictEntry and two objects per field.
+ *----------------------------------------------------------------------------*/
+
+/* Return the entry of 'field' in a ziplist hash (its value is the next
+ * entry), NULL if missing */
+static unsigned char *hashZiplistFind(unsigned char *zl, robj *field) {
+    unsigned char *fptr = ziplistIndex(zl,0);
+
+    while (fptr != NULL) {
+        if (ziplistCompare(fptr,(unsigned char*)field->ptr,sdslen(field->ptr)))
+            return fptr;
+        fptr = ziplistNext(zl,ziplistNext(zl,fptr));
+    }
+    return NULL;
+}
+
+unsigned long hashTypeLength(robj *o) {
+    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+        return ziplistLen(o->ptr)/2;
+    } else if (o->encoding == REDIS_ENCODING_HT) {
+        return dictSize((dict*)o->ptr);
+    } else {
+        assert(0 != 0);
+    }
+    return 0;
+}
+
+void hashTypeConvert(robj *o, int enc) {
+    assert(o->type == REDIS_HASH);
+    assert(o->encoding == REDIS_ENCODING_ZIPLIST);
+    if (enc == REDIS_ENCODING_HT) {
+        unsigned char *zl = o->ptr, *fptr, *vptr, *vstr;
+        unsigned int vlen;
+        dict *d = dictCreateLayout(&hashDictType,NULL,server.set_dict_layout);
+        robj *field, *value;
+
+        if (!d) oom("dictCreate");
+        /* Presize the dict to avoid rehashing */
+        dictExpand(d,ziplistLen(zl)/2);
+        fptr = ziplistIndex(zl,0);
+        while (fptr != NULL) {
+            vptr = ziplistNext(zl,fptr);
+            ziplistGet(fptr,&vstr,&vlen);
+            field = createStringObject((char*)vstr,vlen);
+            ziplistGet(vptr,&vstr,&vlen);
+            value = tryObjectEncoding(createStringObject((char*)vstr,vlen));
+            if (objDictAdd(d,field,value) != DICT_OK)
+                assert(0 != 0);
+            fptr = ziplistNext(zl,vptr);
+        }
+
+        o->encoding = REDIS_ENCODING_HT;
+        zfree(zl);
+        o->ptr = d;
+    } else {
+        assert(0 != 0);
+    }
+}
+
+/* Set 'field' to 'value': 1 if the field is new, 0 if it was updated */
+int hashTypeSet(robj *o, robj *field, robj *value) {
+    dictEntry *de;
+
+    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+        robj *dec = getDecodedObject(value);
+
+        if (sdslen(field->ptr) > server.hash_max_ziplist_value ||
+            sdslen(dec->ptr) > server.hash_max_ziplist_value)
+        {
+            decrRefCount(dec);
+            hashTypeConvert(o,REDIS_ENCODING_HT);
+        } else {
+            unsigned char *zl = o->ptr, *fptr, *vptr;
+            int update = 0;
+
+            if ((fptr = hashZiplistFind(zl,field)) != NULL) {
+                /* 删除旧值后vptr指向下一个field(或结尾), 新值插入在它之前 */
+                vptr = ziplistNext(zl,fptr);
+                zl = ziplistDelete(zl,&vptr);
+                zl = ziplistInsert(zl,vptr,(unsigned char*)dec->ptr,
+                    sdslen(dec->ptr));
+                update = 1;
+            } else {
+                zl = ziplistPush(zl,(unsigned char*)field->ptr,
+                    sdslen(field->ptr),ZIPLIST_TAIL);
+                zl = ziplistPush(zl,(unsigned char*)dec->ptr,
+                    sdslen(dec->ptr),ZIPLIST_TAIL);
+            }
+            o->ptr = zl;
+            decrRefCount(dec);
+            if (!update && hashTypeLength(o) > server.hash_max_ziplist_entries)
+                hashTypeConvert(o,REDIS_ENCODING_HT);
+            return !update;
+        }
+    }
+
+    if (o->encoding != REDIS_ENCODING_HT) assert(0 != 0);
+    incrRefCount(value);
+    if ((de = objDictFind(o->ptr,field)) != NULL) {
+        robj *old = dictGetEntryVal(de);
+
+        dictGetEntryVal(de) = value;
+        decrRefCount(old);
+        return 0;
+    }
+    incrRefCount(field);
+    if (objDictAdd(o->ptr,field,value) != DICT_OK) assert(0 != 0);
+    return 1;
+}
+
+/* 1 if the field was removed */
+int hashTypeDelete(robj *o, robj *field) {
+    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+        unsigned char *fptr = hashZiplistFind(o->ptr,field);
+
+        if (fptr == NULL) return 0;
+        o->ptr = ziplistDelete(o->ptr,&fptr);
+        o->ptr = ziplistDelete(o->ptr,&fptr);
+        return 1;
+    } else if (o->encoding == REDIS_ENCODING_HT) {
+        return objDictDelete(o->ptr,field) == DICT_OK;
+    }
+    assert(0 != 0);
+    return 0;
+}
+
+/* Integer value of 'field' (strtoll(), like INCR), 0 if missing */
+static long long hashTypeGetLongLong(robj *o, robj *field) {
+    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+        unsigned char *fptr = hashZiplistFind(o->ptr,field), *vstr;
+        unsigned int vlen;
+        char buf[32];
+
+        if (fptr == NULL) return 0;
+        ziplistGet(ziplistNext(o->ptr,fptr),&vstr,&vlen);
+        if (vlen >= sizeof(buf)) vlen = sizeof(buf)-1;
+        memcpy(buf,vstr,vlen);
+        buf[vlen] = '\0';
+        return strtoll(buf,NULL,10);
+    } else if (o->encoding == REDIS_ENCODING_HT) {
+        dictEntry *de = objDictFind(o->ptr,field);
+        robj *value;
+
+        if (de == NULL) return 0;
+        value = dictGetEntryVal(de);
+        if (value->encoding == REDIS_ENCODING_INT) return (long)value->ptr;
+        return strtoll(value->ptr,NULL,10);
+    }
+    assert(0 != 0);
+    return 0;
+}
+
+/*----------------------------------------------------------------------------
+ * Hash Commands
+ *----------------------------------------------------------------------------*/
+
+/* Reply the value of 'field' as a bulk, or a nil bulk */
+static void addReplyHashField(redisClient *c, robj *o, robj *field) {
+    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+        unsigned char *fptr = hashZiplistFind(o->ptr,field);
+
+        if (fptr)
+            addReplyZiplistEntry(c,ziplistNext(o->ptr,fptr));
+        else
+            addReply(c,shared.nullbulk);
+    } else if (o->encoding == REDIS_ENCODING_HT) {
+        dictEntry *de = objDictFind(o->ptr,field);
+
+        if (de)
+            addReplyBulk(c,dictGetEntryVal(de));
+        else
+            addReply(c,shared.nullbulk);
+    } else {
+        assert(0 != 0);
+    }
+}
+
+/* Lookup the hash at 'key' for writing, creating it if missing. NULL (and
+ * the error already replied) if the key holds another type. */
+static robj *hashTypeLookupWriteOrCreate(redisClient *c, robj *key) {
+    robj *o = lookupKeyWrite(c->db,key);
+
+    if (o == NULL) {
+        o = createHashObject();
+        dbAdd(c->db,key,o);
+    } else if (o->type != REDIS_HASH) {
+        addReply(c,shared.wrongtypeerr);
+        return NULL;
+    }
+    return o;
+}
+
+void hsetCommand(redisClient *c) {
+    robj *o;
+    int added;
+
+    if ((o = hashTypeLookupWriteOrCreate(c,c->argv[1])) == NULL) return;
+    c->argv[3] = tryObjectEncoding(c->argv[3]);
+    added = hashTypeSet(o,c->argv[2],c->argv[3]);
+    server.dirty++;
+    addReply(c,added ? shared.cone : shared.czero);
+}
+
+void hgetCommand(redisClient *c) {
+    robj *o;
+
+    o = lookupKeyRead(c->db,c->argv[1]);
+    if (o == NULL) {
+        addReply(c,shared.nullbulk);
+    } else if (o->type != REDIS_HASH) {
+        addReply(c,shared.wrongtypeerr);
+    } else {
+        addReplyHashField(c,o,c->argv[2]);
+    }
+}
+
+void hmgetCommand(redisClient *c) {
+    robj *o;
+    int j;
+
+    o = lookupKeyRead(c->db,c->argv[1]);
+    if (o != NULL && o->type != REDIS_HASH) {
+        addReply(c,shared.wrongtypeerr);
+        return;
+    }
+    addReplySds(c,sdscatprintf(sdsempty(),"*%d\r\n",c->argc-2));
+    for (j = 2; j < c->argc; j++) {
+        if (o == NULL)
+            addReply(c,shared.nullbulk);
+        else
+            addReplyHashField(c,o,c->argv[j]);
+    }
+}
+
+void hincrbyCommand(redisClient *c) {
+    long long value, incr = strtoll(c->argv[3]->ptr,NULL,10);
+    robj *o, *new;
+
+    if ((o = hashTypeLookupWriteOrCreate(c,c->argv[1])) == NULL) return;
+    value = hashTypeGetLongLong(o,c->argv[2]) + incr;
+    new = createIntegerObject(value);
+    hashTypeSet(o,c->argv[2],new);
+    decrRefCount(new);
+    server.dirty++;
+    addReplySds(c,sdscatprintf(sdsempty(),":%lld\r\n",value));
+}
+
+void hdelCommand(redisClient *c) {
+    robj *o;
+
+    o = lookupKeyWrite(c->db,c->argv[1]);
+    if (o == NULL) {
+        addReply(c,shared.czero);
+    } else if (o->type != REDIS_HASH) {
+        addReply(c,shared.wrongtypeerr);
+    } else if (hashTypeDelete(o,c->argv[2])) {
+        server.dirty++;
+        addReply(c,shared.cone);
+    } else {
+        addReply(c,shared.czero);
+    }
+}
+
+void hlenCommand(redisClient *c) {
+    robj *o;
+
+    o = lookupKeyRead(c->db,c->argv[1]);
+    if (o == NULL) {
         addReply(c,shared.czero);
+    } else if (o->type != REDIS_HASH) {
+        addReply(c,shared.wrongtypeerr);
+    } else {
+        addReplySds(c,sdscatprintf(sdsempty(),":%lu\r\n",hashTypeLength(o)));
+    }
+}
+
+void hgetallCommand(redisClient *c) {
+    robj *o;
+
+    o = lookupKeyRead(c->db,c->argv[1]);
+    if (o == NULL) {
+        addReply(c,shared.emptymultibulk);
+        return;
+    } else if (o->type != REDIS_HASH) {
+        addReply(c,shared.wrongtypeerr);
         return;
     }
-    if (seconds <= 0) {
-        addReply(c, shared.czero);
+
+    addReplySds(c,sdscatprintf(sdsempty(),"*%lu\r\n",hashTypeLength(o)*2));
+    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+        unsigned char *p = ziplistIndex(o->ptr,0);
+
+        while (p != NULL) {
+            addReplyZiplistEntry(c,p);
+            p = ziplistNext(o->ptr,p);
+        }
+    } else if (o->encoding == REDIS_ENCODING_HT) {
+        dictIterator *di = dictGetIterator(o->ptr);
+        dictEntry *de;
+
+        if (!di) oom("dictGetIterator");
+        while((de = dictNext(di)) != NULL) {
+            addReplyBulk(c,dictGetEntryKey(de));
+            addReplyBulk(c,dictGetEntryVal(de));
+        }
+        dictReleaseIterator(di);
+    } else {
+        assert(0 != 0);
+    }
+}
+
+/* ================================== Bitmaps =============================== */
+
+/* Bitmaps are plain string values: bit 0 is the most significant bit of the
+ * first byte. SETBIT grows the string with zeros, the heavy lifting of
+ * BITCOUNT, BITOP and BITPOS is done by the bitops.c kernels. */
+
+/* Parse a bit offset: an integer in 0..REDIS_BITMAP_MAX_BYTES*8-1 */
+static int getBitOffsetFromArgument(redisClient *c, robj *o, size_t *offset) {
+    long long loffset;
+
+    if (isObjectRepresentableAsLongLong(o,&loffset) == REDIS_ERR ||
+        loffset < 0 || loffset >= (long long)REDIS_BITMAP_MAX_BYTES*8)
+    {
+        addReplySds(c,sdsnew("-ERR bit offset is not an integer or out of range\r\n"));
+        return REDIS_ERR;
+    }
+    *offset = (size_t)loffset;
+    return REDIS_OK;
+}
+
+/* Parse a bit value, "0" or "1" */
+static int getBitValueFromArgument(redisClient *c, robj *o, int *bit) {
+    char *s = o->ptr;
+
+    if ((s[0] != '0' && s[0] != '1') || s[1] != '\0') {
+        addReplySds(c,sdsnew("-ERR bit is not an integer or out of range\r\n"));
+        return REDIS_ERR;
+    }
+    *bit = s[0] - '0';
+    return REDIS_OK;
+}
+
+/* Bytes of the string 'o', an INT encoded value is formatted in 'buf' */
+static unsigned char *getBitmapBytes(robj *o, char *buf, size_t buflen,
+        size_t *len)
+{
+    if (o->encoding == REDIS_ENCODING_INT) {
+        *len = snprintf(buf,buflen,"%ld",(long)o->ptr);
+        return (unsigned char*)buf;
+    }
+    *len = sdslen(o->ptr);
+    return (unsigned char*)o->ptr;
+}
+
+/* A start or end byte index of BITCOUNT/BITPOS, negative from the end */
+static int getBitmapIndexFromArgument(redisClient *c, robj *o, long *index) {
+    long long value;
+
+    if (isObjectRepresentableAsLongLong(o,&value) == REDIS_ERR ||
+        value < LONG_MIN || value > LONG_MAX)
+    {
+        addReplySds(c,sdsnew("-ERR value is not an integer or out of range\r\n"));
+        return REDIS_ERR;
+    }
+    *index = (long)value;
+    return REDIS_OK;
+}
+
+/* Convert the byte range start..end (negative from the end) to offsets in a
+ * string of 'len' bytes. Returns REDIS_ERR if the range is empty. */
+static int getBitmapRange(long start, long end, size_t len,
+        size_t *first, size_t *last)
+{
+    if (len == 0) return REDIS_ERR;
+    if (start < 0) start = (long)len+start;
+    if (end < 0) end = (long)len+end;
+    if (start < 0) start = 0;
+    if (end < 0) end = 0;
+    if ((size_t)end >= len) end = (long)len-1;
+    if (start > end) return REDIS_ERR;
+    *first = start;
+    *last = end;
+    return REDIS_OK;
+}
+
+/* The string value of the entry 'de', replaced by a private raw copy if it
+ * is shared or not raw encoded, before its bytes are changed in place */
+static robj *unshareStringValue(dictEntry *de) {
+    robj *o = dictGetEntryVal(de);
+
+    if (o->refcount != 1 || o->encoding != REDIS_ENCODING_RAW) {
+        robj *dec = getDecodedObject(o), *copy;
+
+        copy = createObject(REDIS_STRING,sdsnewlen(dec->ptr,sdslen(dec->ptr)));
+        decrRefCount(dec);
+        /* Non volatile (see lookupKeyWriteEntry): just swap the value */
+        dictGetEntryVal(de) = copy;
+        decrRefCount(o);
+        o = copy;
+    }
+    return o;
+}
+
+/* Lookup the string at 'key' for SETBIT, making it at least 'minlen' bytes.
+ * NULL (and the error already replied) if the key holds another type. */
+static robj *lookupBitmapWriteOrCreate(redisClient *c, robj *key, size_t minlen) {
+    dictEntry *de = lookupKeyWriteEntry(c->db,key);
+    robj *o;
+
+    sds s;
+
+    if (de == NULL) {
+        if ((s = sdsnewlen(NULL,minlen)) == NULL) oom("sdsnewlen");
+        o = createObject(REDIS_STRING,s);
+        dbAdd(c->db,key,o);
+        return o;
+    }
+    o = dictGetEntryVal(de);
+    if (o->type != REDIS_STRING) {
+        addReply(c,shared.wrongtypeerr);
+        return NULL;
+    }
+    o = unshareStringValue(de);
+    if ((s = sdsGrowZero(o->ptr,minlen)) == NULL) oom("sdsGrowZero");
+    o->ptr = s;
+    return o;
+}
+
+/* SETBIT key offset value */
+void setbitCommand(redisClient *c) {
+    size_t offset, byte;
+    int on, bit, old;
+    unsigned char *p;
+    robj *o;
+
+    if (getBitOffsetFromArgument(c,c->argv[2],&offset) == REDIS_ERR ||
+        getBitValueFromArgument(c,c->argv[3],&on) == REDIS_ERR) return;
+    byte = offset >> 3;
+    if ((o = lookupBitmapWriteOrCreate(c,c->argv[1],byte+1)) == NULL) return;
+
+    p = (unsigned char*)o->ptr+byte;
+    bit = 7 - (offset & 7);
+    old = (*p >> bit) & 1;
+    *p = (*p & ~(1 << bit)) | (on << bit);
+    server.dirty++;
+    addReply(c,old ? shared.cone : shared.czero);
+}
+
+/* GETBIT key offset */
+void getbitCommand(redisClient *c) {
+    char buf[32];
+    size_t offset, byte, len;
+    unsigned char *p;
+    robj *o;
+
+    if (getBitOffsetFromArgument(c,c->argv[2],&offset) == REDIS_ERR) return;
+    o = lookupKeyRead(c->db,c->argv[1]);
+    if (o == NULL) {
+        addReply(c,shared.czero);
+        return;
+    } else if (o->type != REDIS_STRING) {
+        addReply(c,shared.wrongtypeerr);
+        return;
+    }
+    p = getBitmapBytes(o,buf,sizeof(buf),&len);
+    byte = offset >> 3;
+    if (byte < len && (p[byte] & (0x80 >> (offset & 7))))
+        addReply(c,shared.cone);
+    else
+        addReply(c,shared.czero);
+}
+
+/* BITCOUNT key [start end] */
+void bitcountCommand(redisClient *c) {
+    char buf[32];
+    size_t len, first, last;
+    long start = 0, end = -1;
+    unsigned char *p;
+    robj *o;
+
+    if (c->argc != 2 && c->argc != 4) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+    if (c->argc == 4 &&
+        (getBitmapIndexFromArgument(c,c->argv[2],&start) == REDIS_ERR ||
+         getBitmapIndexFromArgument(c,c->argv[3],&end) == REDIS_ERR)) return;
+    o = lookupKeyRead(c->db,c->argv[1]);
+    if (o == NULL) {
+        addReply(c,shared.czero);
+        return;
+    } else if (o->type != REDIS_STRING) {
+        addReply(c,shared.wrongtypeerr);
+        return;
+    }
+    p = getBitmapBytes(o,buf,sizeof(buf),&len);
+    if (c->argc == 2) {
+        first = 0;
+        last = len-1;
+        if (len == 0) {
+            addReply(c,shared.czero);
+            return;
+        }
+    } else if (getBitmapRange(start,end,len,&first,&last) == REDIS_ERR) {
+        addReply(c,shared.czero);
+        return;
+    }
+    addReplySds(c,sdscatprintf(sdsempty(),":%zu\r\n",
+        bitopsPopcount(p+first,last-first+1)));
+}
+
+/* BITOP AND|OR|XOR|NOT destkey key [key ...] */
+void bitopCommand(redisClient *c) {
+    char *opname = c->argv[1]->ptr;
+    int op, numkeys = c->argc-3, j;
+    robj **objs, *o;
+    const unsigned char **src;
+    size_t *len, maxlen = 0;
+
+    if (!strcasecmp(opname,"and")) op = BITOPS_AND;
+    else if (!strcasecmp(opname,"or")) op = BITOPS_OR;
+    else if (!strcasecmp(opname,"xor")) op = BITOPS_XOR;
+    else if (!strcasecmp(opname,"not")) op = BITOPS_NOT;
+    else {
+        addReply(c,shared.syntaxerr);
         return;
+    }
+    if (op == BITOPS_NOT && numkeys != 1) {
+        addReplySds(c,sdsnew("-ERR BITOP NOT must be called with a single source key.\r\n"));
+        return;
+    }
+
+    objs = zmalloc(sizeof(robj*)*numkeys);
+    src = zmalloc(sizeof(unsigned char*)*numkeys);
+    len = zmalloc(sizeof(size_t)*numkeys);
+    if (!objs || !src || !len) oom("bitopCommand");
+    /* Missing keys are empty strings */
+    for (j = 0; j < numkeys; j++) {
+        o = lookupKeyRead(c->db,c->argv[j+3]);
+        if (o == NULL) {
+            objs[j] = NULL;
+            src[j] = NULL;
+            len[j] = 0;
+            continue;
+        }
+        if (o->type != REDIS_STRING) {
+            while (j--) if (objs[j]) decrRefCount(objs[j]);
+            zfree(objs);
+            zfree(src);
+            zfree(len);
+            addReply(c,shared.wrongtypeerr);
+            return;
+        }
+        objs[j] = getDecodedObject(o);
+        src[j] = objs[j]->ptr;
+        len[j] = sdslen(objs[j]->ptr);
+        if (len[j] > maxlen) maxlen = len[j];
+    }
+
+    if (maxlen) {
+        o = createObject(REDIS_STRING,sdsnewlen(NULL,maxlen));
+        bitopsCombine(op,o->ptr,src,len,numkeys,maxlen);
+        dbSetKey(c->db,c->argv[2],o);
     } else {
-        time_t when = time(NULL)+seconds;
-        if (setExpire(c->db,c->argv[1],when))
-            addReply(c,shared.cone);
-        else
+        /* The result is an empty string: no key */
+        deleteKey(c->db,c->argv[2]);
+    }
+    for (j = 0; j < numkeys; j++) if (objs[j]) decrRefCount(objs[j]);
+    zfree(objs);
+    zfree(src);
+    zfree(len);
+    server.dirty++;
+    addReplySds(c,sdscatprintf(sdsempty(),":%zu\r\n",maxlen));
+}
+
+/* BITPOS key bit [start [end]] */
+void bitposCommand(redisClient *c) {
+    char buf[32];
+    size_t len, first, last;
+    long start = 0, end = -1;
+    int bit;
+    long long pos;
+    unsigned char *p;
+    robj *o;
+
+    if (c->argc > 5) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+    if (getBitValueFromArgument(c,c->argv[2],&bit) == REDIS_ERR) return;
+    if ((c->argc >= 4 &&
+         getBitmapIndexFromArgument(c,c->argv[3],&start) == REDIS_ERR) ||
+        (c->argc == 5 &&
+         getBitmapIndexFromArgument(c,c->argv[4],&end) == REDIS_ERR)) return;
+    o = lookupKeyRead(c->db,c->argv[1]);
+    if (o == NULL) {
+        /* An empty string has all its (infinite) bits clear */
+        addReplySds(c,sdsnew(bit ? ":-1\r\n" : ":0\r\n"));
+        return;
+    } else if (o->type != REDIS_STRING) {
+        addReply(c,shared.wrongtypeerr);
+        return;
+    }
+    p = getBitmapBytes(o,buf,sizeof(buf),&len);
+    if (getBitmapRange(start,end,len,&first,&last) == REDIS_ERR)
+    {
+        addReplySds(c,sdsnew(":-1\r\n"));
+        return;
+    }
+    pos = bitopsFirstBit(p+first,last-first+1,bit);
+    if (pos != -1) {
+        pos += (long long)first*8;
+    } else if (bit == 0 && c->argc < 5) {
+        /* Looking for a clear bit without an end: the string is as if
+         * padded with zeros on the right */
+        pos = (long long)(last+1)*8;
+    }
+    addReplySds(c,sdscatprintf(sdsempty(),":%lld\r\n",pos));
+}
+
+/* ============================== HyperLogLog =============================== */
+
+/* HyperLogLogs are strings too (see hyperloglog.c): GET/SET, SAVE and the
+ * replication see the bytes. The commands check the header before use. */
+
+/* Non zero if 'o' is a string holding a HyperLogLog, else the error is
+ * replied */
+static int isHLLObjectOrReply(redisClient *c, robj *o) {
+    if (o->type != REDIS_STRING) {
+        addReply(c,shared.wrongtypeerr);
+        return 0;
+    }
+    if (o->encoding == REDIS_ENCODING_INT || !hllIsValid(o->ptr)) {
+        addReplySds(c,sdsnew("-ERR Key is not a valid HyperLogLog string value.\r\n"));
+        return 0;
+    }
+    return 1;
+}
+
+static void addReplyHLLCorrupted(redisClient *c) {
+    addReplySds(c,sdsnew("-ERR Corrupted HyperLogLog object detected\r\n"));
+}
+
+/* PFADD key element [element ...] */
+void pfaddCommand(redisClient *c) {
+    dictEntry *de = lookupKeyWriteEntry(c->db,c->argv[1]);
+    int updated = 0, j, retval;
+    robj *o;
+    sds hll;
+
+    if (de == NULL) {
+        o = createObject(REDIS_STRING,hllCreate());
+        dbAdd(c->db,c->argv[1],o);
+        updated = 1;
+    } else {
+        if (!isHLLObjectOrReply(c,dictGetEntryVal(de))) return;
+        o = unshareStringValue(de);
+    }
+
+    hll = o->ptr;
+    for (j = 2; j < c->argc; j++) {
+        retval = hllAdd(&hll,c->argv[j]->ptr,sdslen(c->argv[j]->ptr),
+                        server.hll_sparse_max_bytes);
+        if (retval == -1) {
+            o->ptr = hll;
+            addReplyHLLCorrupted(c);
+            return;
+        }
+        updated |= retval;
+    }
+    o->ptr = hll;
+    if (updated) server.dirty++;
+    addReply(c,updated ? shared.cone : shared.czero);
+}
+
+/* PFCOUNT key [key ...]
+ *
+ * A single key is counted from its header cache when not stale (it is
+ * written there otherwise: the same value for everybody sharing the object,
+ * so no copy is made). Many keys are merged into a temporary set of
+ * registers, the count of the union is not cached. */
+void pfcountCommand(redisClient *c) {
+    unsigned char *regs;
+    long long card;
+    robj *o;
+    int j;
+
+    if (c->argc == 2) {
+        o = lookupKeyRead(c->db,c->argv[1]);
+        if (o == NULL) {
             addReply(c,shared.czero);
+            return;
+        }
+        if (!isHLLObjectOrReply(c,o)) return;
+        if ((card = hllCount(o->ptr)) == -1) {
+            addReplyHLLCorrupted(c);
+            return;
+        }
+        addReplySds(c,sdscatprintf(sdsempty(),":%lld\r\n",card));
+        return;
+    }
+
+    if ((regs = zmalloc(HLL_REGISTERS)) == NULL) oom("pfcountCommand");
+    memset(regs,0,HLL_REGISTERS);
+    for (j = 1; j < c->argc; j++) {
+        o = lookupKeyRead(c->db,c->argv[j]);
+        if (o == NULL) continue;
+        if (!isHLLObjectOrReply(c,o)) {
+            zfree(regs);
+            return;
+        }
+        if (hllMergeRegisters(regs,o->ptr) == -1) {
+            zfree(regs);
+            addReplyHLLCorrupted(c);
+            return;
+        }
+    }
+    addReplySds(c,sdscatprintf(sdsempty(),":%llu\r\n",
+        (unsigned long long)hllCountRegisters(regs)));
+    zfree(regs);
+}
+
+/* PFMERGE destkey sourcekey [sourcekey ...]
+ *
+ * The destination, if it exists, is part of the union. As with any write a
+ * volatile destination is deleted first. The result is sparse if it fits in
+ * hll-sparse-max-bytes, dense otherwise. */
+void pfmergeCommand(redisClient *c) {
+    unsigned char *regs;
+    robj *o;
+    int j;
+
+    lookupKeyWriteEntry(c->db,c->argv[1]);
+    if ((regs = zmalloc(HLL_REGISTERS)) == NULL) oom("pfmergeCommand");
+    memset(regs,0,HLL_REGISTERS);
+    for (j = 1; j < c->argc; j++) {
+        o = lookupKeyRead(c->db,c->argv[j]);
+        if (o == NULL) continue;
+        if (!isHLLObjectOrReply(c,o)) {
+            zfree(regs);
+            return;
+        }
+        if (hllMergeRegisters(regs,o->ptr) == -1) {
+            zfree(regs);
+            addReplyHLLCorrupted(c);
+            return;
+        }
+    }
+    o = createObject(REDIS_STRING,hllFromRegisters(regs,server.hll_sparse_max_bytes));
+    zfree(regs);
+    dbSetKey(c->db,c->argv[1],o);
+    server.dirty++;
+    addReply(c,shared.ok);
+}
+
+/* ================================= Expire ================================= */
+/* The expire time of a volatile key is stored in the key object of the
+ * main dict (see createKeyObject()), so that reading it costs no further
+ * lookup. The expire index just lets the active expire cycle find the
+ * volatile keys: either db->expires (with NULL values, sharing the key
+ * objects) sampled at random, or db->wheel ordered by expire time. */
+
+/* Add the volatile key object 'key' of db->dict to the expire index */
+void expireIndexAdd(redisDb *db, robj *key) {
+    if (db->wheel) {
+        wheelAdd(db->wheel,keyGetWheelNode(key));
+    } else {
+        incrRefCount(key);
+        objDictAdd(db->expires,key,NULL);
+    }
+}
+
+/* Remove the volatile key object 'key' of db->dict from the expire index.
+ * The caller still owns the reference of db->dict. */
+void expireIndexRemove(redisDb *db, robj *key) {
+    if (db->wheel)
+        wheelRemove(db->wheel,keyGetWheelNode(key));
+    else
+        objDictDelete(db->expires,key);
+}
+
+/* Make the key of the entry 'de' of db->dict non volatile */
+void removeExpireEntry(redisDb *db, dictEntry *de) {
+    robj *key = dictGetEntryKey(de);
+
+    dictGetEntryKey(de) = createKeyObject(key,-1);
+    expireIndexRemove(db,key);
+    decrRefCount(key);
+}
+
+int removeExpire(redisDb *db, robj *key) {
+    dictEntry *de;
+
+    if (dbVolatileKeys(db) == 0 ||
+       (de = objDictFind(db->dict,key)) == NULL ||
+       keyGetExpire((robj*)dictGetEntryKey(de)) == -1) return 0;
+    removeExpireEntry(db,de);
+    return 1;
+}
+
+/* Set the expire (unix time in milliseconds) of an existing non volatile
+ * key, 0 if not possible */
+int setExpire(redisDb *db, robj *key, long long when) {
+    dictEntry *de = objDictFind(db->dict,key);
+    robj *old, *newkey;
+
+    if (de == NULL) return 0;
+    old = dictGetEntryKey(de);
+    if (keyGetExpire(old) != -1) return 0;
+    newkey = createKeyObject(old,when);
+    dictGetEntryKey(de) = newkey;
+    decrRefCount(old);
+    expireIndexAdd(db,newkey);
+    return 1;
+}
+
+/* Return the expire time of the specified key in milliseconds, or -1 if no
+ * expire is associated with this key (i.e. the key is non volatile) */
+long long getExpire(redisDb *db, robj *key) {
+    dictEntry *de;
+
+    /* No expire? return ASAP */
+    if (dbVolatileKeys(db) == 0 ||
+       (de = objDictFind(db->dict,key)) == NULL) return -1;
+
+    return keyGetExpire((robj*)dictGetEntryKey(de));
+}
+
+/* EXPIRE key seconds, PEXPIRE key milliseconds */
+void expireGenericCommand(redisClient *c, long long unit) {
+    long long ttl;
+
+    /* The unix time in milliseconds of the expire must fit a long long */
+    if (isObjectRepresentableAsLongLong(c->argv[2],&ttl) == REDIS_ERR ||
+        ttl > (LLONG_MAX-server.mstime)/unit)
+    {
+        addReplySds(c,sdsnew("-ERR expire time is not an integer or out of range\r\n"));
         return;
     }
+    if (ttl <= 0) {
+        addReply(c, shared.czero);
+        return;
+    }
+    if (setExpire(c->db,c->argv[1],server.mstime+ttl*unit))
+        addReply(c,shared.cone);
+    else
+        addReply(c,shared.czero);
 }
 
-void ttlCommand(redisClient *c) {
-    time_t expire;
-    int ttl = -1;
+void expireCommand(redisClient *c) {
+    expireGenericCommand(c,1000);
+}
+
+void pexpireCommand(redisClient *c) {
+    expireGenericCommand(c,1);
+}
+
+/* TTL key (seconds, rounded), PTTL key (milliseconds). -1 if the key does
+ * not exist or is not volatile */
+void ttlGenericCommand(redisClient *c, int ms) {
+    long long expire, ttl = -1;
 
     expire = getExpire(c->db,c->argv[1]);
     if (expire != -1) {
-        ttl = (int) (expire-time(NULL));
-        if (ttl < 0) ttl = -1;
+        ttl = expire-server.mstime;
+        if (ttl < 0)
+            ttl = -1;
+        else if (!ms)
+            ttl = (ttl+500)/1000;
     }
-    addReplySds(c,sdscatprintf(sdsempty(),":%d\r\n",ttl));
+    addReplySds(c,sdscatprintf(sdsempty(),":%lld\r\n",ttl));
+}
+
+void ttlCommand(redisClient *c) {
+    ttlGenericCommand(c,0);
+}
+
+void pttlCommand(redisClient *c) {
+    ttlGenericCommand(c,1);
 }
 
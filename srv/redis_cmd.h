@@ -30,11 +30,17 @@ void lpushCommand(redisClient *c);
 void rpushCommand(redisClient *c);
 void lpopCommand(redisClient *c);
 void rpopCommand(redisClient *c);
+void blpopCommand(redisClient *c);
+void brpopCommand(redisClient *c);
+void unblockClientWaitingData(redisClient *c);
+void handleBlockedClientsTimeout(void);
 void llenCommand(redisClient *c);
 void lindexCommand(redisClient *c);
 void lrangeCommand(redisClient *c);
 void ltrimCommand(redisClient *c);
 void typeCommand(redisClient *c);
+char *strEncoding(int encoding);
+void objectCommand(redisClient *c);
 void lsetCommand(redisClient *c);
 void saddCommand(redisClient *c);
 void sremCommand(redisClient *c);
@@ -55,11 +61,78 @@ void lremCommand(redisClient *c);
 void infoCommand(redisClient *c);
 void mgetCommand(redisClient *c);
 void monitorCommand(redisClient *c);
+void clientCommand(redisClient *c);
 void expireCommand(redisClient *c);
 void getSetCommand(redisClient *c);
 void ttlCommand(redisClient *c);
+void pexpireCommand(redisClient *c);
+void pttlCommand(redisClient *c);
 void slaveofCommand(redisClient *c);
+void zaddCommand(redisClient *c);
+void zincrbyCommand(redisClient *c);
+void zremCommand(redisClient *c);
+void zscoreCommand(redisClient *c);
+void zrankCommand(redisClient *c);
+void zrevrankCommand(redisClient *c);
+void zrangeCommand(redisClient *c);
+void zrevrangeCommand(redisClient *c);
+void zrangebyscoreCommand(redisClient *c);
+void zcardCommand(redisClient *c);
+void hsetCommand(redisClient *c);
+void hgetCommand(redisClient *c);
+void hmgetCommand(redisClient *c);
+void hincrbyCommand(redisClient *c);
+void hdelCommand(redisClient *c);
+void hlenCommand(redisClient *c);
+void hgetallCommand(redisClient *c);
+void setbitCommand(redisClient *c);
+void getbitCommand(redisClient *c);
+void bitcountCommand(redisClient *c);
+void bitopCommand(redisClient *c);
+void bitposCommand(redisClient *c);
+void pfaddCommand(redisClient *c);
+void pfcountCommand(redisClient *c);
+void pfmergeCommand(redisClient *c);
 
 struct redisCommand *lookupCommand(char *name);
 
+/* List data type */
+void listTypeTryConversion(robj *subject, robj *value);
+void listTypePush(robj *subject, robj *value, int where);
+robj *listTypePop(robj *subject, int where);
+unsigned long listTypeLength(robj *subject);
+listTypeIterator *listTypeInitIterator(robj *subject, int index, unsigned char direction);
+void listTypeReleaseIterator(listTypeIterator *li);
+int listTypeNext(listTypeIterator *li, listTypeEntry *entry);
+robj *listTypeGet(listTypeEntry *entry);
+int listTypeEqual(listTypeEntry *entry, robj *o);
+void listTypeDelete(listTypeEntry *entry);
+void listTypeConvert(robj *subject, int enc);
+robj *setTypeCreate(robj *value);
+int setTypeAdd(robj *subject, robj *value);
+int setTypeRemove(robj *subject, robj *value);
+int setTypeIsMember(robj *subject, robj *value);
+unsigned long setTypeSize(robj *subject);
+setTypeIterator *setTypeInitIterator(robj *subject);
+void setTypeReleaseIterator(setTypeIterator *si);
+int setTypeNextRaw(setTypeIterator *si, robj **objele, int64_t *llele);
+robj *setTypeNext(setTypeIterator *si);
+void setTypeConvert(robj *subject, int enc);
+zskiplist *zslCreate(void);
+void zslFree(zskiplist *zsl);
+zskiplistNode *zslInsert(zskiplist *zsl, double score, robj *obj);
+int zslDelete(zskiplist *zsl, double score, robj *obj);
+unsigned long zslGetRank(zskiplist *zsl, double score, robj *obj);
+zskiplistNode *zslGetElementByRank(zskiplist *zsl, unsigned long rank);
+int zslParseRange(robj *min, robj *max, zrangespec *spec);
+zskiplistNode *zslFirstInRange(zskiplist *zsl, zrangespec *range);
+unsigned long zsetLength(robj *zobj);
+int zsetAdd(robj *zobj, robj *ele, double score);
+void zsetConvert(robj *zobj, int encoding);
+double zzlGetScore(unsigned char *sptr);
+unsigned long hashTypeLength(robj *o);
+void hashTypeConvert(robj *o, int enc);
+int hashTypeSet(robj *o, robj *field, robj *value);
+int hashTypeDelete(robj *o, robj *field);
+
 #endif
@@ -4,9 +4,9 @@ int rdbSaveType(FILE *fp, unsigned char type) {
     return 0;
 }
 
-int rdbSaveTime(FILE *fp, time_t t) {
-    int32_t t32 = (int32_t) t;
-    if (fwrite(&t32,4,1,fp) == 0) return -1;
+int rdbSaveMillisecondTime(FILE *fp, long long t) {
+    int64_t t64 = (int64_t) t;
+    if (fwrite(&t64,8,1,fp) == 0) return -1;
     return 0;
 }
 
@@ -33,23 +33,9 @@ int rdbSaveLen(FILE *fp, uint32_t len) {
     return 0;
 }
 
-/* String objects in the form "2391" "-100" without any space and with a
- * range of values that can fit in an 8, 16 or 32 bit signed value can be
- * encoded as integers to save space */
-int rdbTryIntegerEncoding(sds s, unsigned char *enc) {
-    long long value;
-    char *endptr, buf[32];
-
-    /* Check if it's possible to encode this value as a number */
-    value = strtoll(s, &endptr, 10);
-    if (endptr[0] != '\0') return 0;
-    snprintf(buf,32,"%lld",value);
-
-    /* If the number converted back into a string is not identical
-     * then it's not possible to encode the string as integer */
-    if (strlen(buf) != sdslen(s) || memcmp(buf,s,sdslen(s))) return 0;
-
-    /* Finally check if it fits in our ranges */
+/* Encode value as an 8, 16 or 32 bit integer if it fits in one of these
+ * ranges. Returns the number of bytes written in enc, or 0. */
+int rdbEncodeInteger(long long value, unsigned char *enc) {
     if (value >= -(1<<7) && value <= (1<<7)-1) {
         enc[0] = (REDIS_RDB_ENCVAL<<6)|REDIS_RDB_ENC_INT8;
         enc[1] = value&0xFF;
@@ -71,16 +57,35 @@ int rdbTryIntegerEncoding(sds s, unsigned char *enc) {
     }
 }
 
-int rdbSaveLzfStringObject(FILE *fp, robj *obj) {
+/* String objects in the form "2391" "-100" without any space and with a
+ * range of values that can fit in an 8, 16 or 32 bit signed value can be
+ * encoded as integers to save space */
+int rdbTryIntegerEncoding(char *s, size_t len, unsigned char *enc) {
+    long long value;
+    char *endptr, buf[32];
+
+    /* Check if it's possible to encode this value as a number */
+    value = strtoll(s, &endptr, 10);
+    if (endptr[0] != '\0') return 0;
+    snprintf(buf,32,"%lld",value);
+
+    /* If the number converted back into a string is not identical
+     * then it's not possible to encode the string as integer */
+    if (strlen(buf) != len || memcmp(buf,s,len)) return 0;
+
+    return rdbEncodeInteger(value,enc);
+}
+
+int rdbSaveLzfString(FILE *fp, unsigned char *s, size_t len) {
     unsigned int comprlen, outlen;
     unsigned char byte;
     void *out;
 
     /* We require at least four bytes compression for this to be worth it */
-    outlen = sdslen(obj->ptr)-4;
+    outlen = len-4;
     if (outlen <= 0) return 0;
     if ((out = zmalloc(outlen+1)) == NULL) return 0;
-    comprlen = lzf_compress(obj->ptr, sdslen(obj->ptr), out, outlen);
+    comprlen = lzf_compress(s, len, out, outlen);
     if (comprlen == 0) {
         zfree(out);
         return 0;
@@ -89,7 +94,7 @@ int rdbSaveLzfStringObject(FILE *fp, robj *obj) {
     byte = (REDIS_RDB_ENCVAL<<6)|REDIS_RDB_ENC_LZF;
     if (fwrite(&byte,1,1,fp) == 0) goto writeerr;
     if (rdbSaveLen(fp,comprlen) == -1) goto writeerr;
-    if (rdbSaveLen(fp,sdslen(obj->ptr)) == -1) goto writeerr;
+    if (rdbSaveLen(fp,len) == -1) goto writeerr;
     if (fwrite(out,comprlen,1,fp) == 0) goto writeerr;
     zfree(out);
     return comprlen;
@@ -99,16 +104,20 @@ writeerr:
     return -1;
 }
 
-/* Save a string objet as [len][data] on disk. If the object is a string
- * representation of an integer value we try to safe it in a special form */
-int rdbSaveStringObject(FILE *fp, robj *obj) {
-    size_t len = sdslen(obj->ptr);
+/* Save a string as [len][data] on disk. If the string is the
+ * representation of an integer value we try to safe it in a special form.
+ * The string does not need to be null terminated (ziplist entries). */
+int rdbSaveRawString(FILE *fp, unsigned char *s, size_t len) {
     int enclen;
 
     /* Try integer encoding */
     if (len <= 11) {
         unsigned char buf[5];
-        if ((enclen = rdbTryIntegerEncoding(obj->ptr,buf)) > 0) {	/* string可以当作int保存-节省了SPACE */
+        char num[12];
+
+        memcpy(num,s,len);
+        num[len] = '\0';
+        if ((enclen = rdbTryIntegerEncoding(num,len,buf)) > 0) {	/* string可以当作int保存-节省了SPACE */
             if (fwrite(buf,enclen,1,fp) == 0) return -1;
             return 0;
         }
@@ -119,7 +128,7 @@ int rdbSaveStringObject(FILE *fp, robj *obj) {
     if (1 && len > 20) {
         int retval;
 
-        retval = rdbSaveLzfStringObject(fp,obj);
+        retval = rdbSaveLzfString(fp,s,len);
         if (retval == -1) return -1;
         if (retval > 0) return 0;
         /* retval == 0 means data can't be compressed, save the old way */
@@ -127,7 +136,52 @@ int rdbSaveStringObject(FILE *fp, robj *obj) {
 
     /* Store verbatim(逐字) */
     if (rdbSaveLen(fp,len) == -1) return -1;
-    if (len && fwrite(obj->ptr,len,1,fp) == 0) return -1;
+    if (len && fwrite(s,len,1,fp) == 0) return -1;
+    return 0;
+}
+
+/* Save a long long value as a string object: INT encoded objects don't
+ * need the strtoll/snprintf round trip of rdbTryIntegerEncoding() */
+int rdbSaveLongLongAsStringObject(FILE *fp, long long value) {
+    unsigned char buf[32];
+    int enclen;
+
+    if ((enclen = rdbEncodeInteger(value,buf)) > 0) {
+        if (fwrite(buf,enclen,1,fp) == 0) return -1;
+    } else {
+        /* Too big for the on disk integer encodings, store the digits */
+        enclen = snprintf((char*)buf,sizeof(buf),"%lld",value);
+        if (rdbSaveLen(fp,enclen) == -1) return -1;
+        if (fwrite(buf,enclen,1,fp) == 0) return -1;
+    }
+    return 0;
+}
+
+/* Save a string objet as [len][data] on disk */
+int rdbSaveStringObject(FILE *fp, robj *obj) {
+    if (obj->encoding == REDIS_ENCODING_INT)
+        return rdbSaveLongLongAsStringObject(fp,(long)obj->ptr);
+    return rdbSaveRawString(fp,obj->ptr,sdslen(obj->ptr));
+}
+
+/* Save a double value as [len][string]: 253, 254 and 255 as len stand
+ * for NaN, +inf and -inf, with no string following */
+int rdbSaveDoubleValue(FILE *fp, double val) {
+    unsigned char buf[128];
+    int len;
+
+    if (isnan(val)) {
+        buf[0] = 253;
+        len = 1;
+    } else if (!isfinite(val)) {
+        buf[0] = (val < 0) ? 255 : 254;
+        len = 1;
+    } else {
+        snprintf((char*)buf+1,sizeof(buf)-1,"%.17g",val);
+        buf[0] = strlen((char*)buf+1);
+        len = buf[0]+1;
+    }
+    if (fwrite(buf,len,1,fp) == 0) return -1;
     return 0;
 }
 
@@ -138,7 +192,7 @@ int rdbSave(char *filename) {
     FILE *fp;
     char tmpfile[256];
     int j;
-    time_t now = time(NULL);
+    long long now = mstime();
 
 	/* 生成带时间戳的随机文件名 */
     snprintf(tmpfile,256,"temp-%d.%ld.rdb",(int)time(NULL),(long int)random());
@@ -148,7 +202,7 @@ int rdbSave(char *filename) {
         return REDIS_ERR;
     }
 	/* 写入标识符 */
-    if (fwrite("REDIS0001",9,1,fp) == 0) goto werr;
+    if (fwrite("REDIS0002",9,1,fp) == 0) goto werr;
 	/* 挨个保存db */
     for (j = 0; j < server.dbnum; j++) {
         redisDb *db = server.db+j;
@@ -168,14 +222,14 @@ int rdbSave(char *filename) {
         while((de = dictNext(di)) != NULL) {
             robj *key = dictGetEntryKey(de);
             robj *o = dictGetEntryVal(de);
-            time_t expiretime = getExpire(db,key);
+            long long expiretime = keyGetExpire(key);
 
             /* Save the expire time */
             if (expiretime != -1) {
                 /* If this key is already expired skip it */
                 if (expiretime < now) continue;
-                if (rdbSaveType(fp,REDIS_EXPIRETIME) == -1) goto werr;
-                if (rdbSaveTime(fp,expiretime) == -1) goto werr;
+                if (rdbSaveType(fp,REDIS_EXPIRETIME_MS) == -1) goto werr;
+                if (rdbSaveMillisecondTime(fp,expiretime) == -1) goto werr;
             }
 			
             /* Save the key and associated(关联) value
@@ -187,31 +241,112 @@ int rdbSave(char *filename) {
                 /* Save a string value */
                 if (rdbSaveStringObject(fp,o) == -1) goto werr;
             } else if (o->type == REDIS_LIST) {
-                /* Save a list value */
-                list *list = o->ptr;
-                listNode *ln;
-
-                listRewind(list);
-                if (rdbSaveLen(fp,listLength(list)) == -1) goto werr;
-                while((ln = listYield(list))) {
-                    robj *eleobj = listNodeValue(ln);
-
-                    if (rdbSaveStringObject(fp,eleobj) == -1) goto werr;
+                /* Save a list value. The on disk format is the same for
+                 * every encoding. */
+                if (rdbSaveLen(fp,listTypeLength(o)) == -1) goto werr;
+                if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+                    unsigned char *p = ziplistIndex(o->ptr,0);
+                    unsigned char *vstr;
+                    unsigned int vlen;
+
+                    while(ziplistGet(p,&vstr,&vlen)) {
+                        if (rdbSaveRawString(fp,vstr,vlen) == -1) goto werr;
+                        p = ziplistNext(o->ptr,p);
+                    }
+                } else {
+                    quicklistIter *iter = quicklistGetIterator(o->ptr,QUICKLIST_HEAD);
+                    quicklistEntry entry;
+
+                    if (!iter) oom("quicklistGetIterator");
+                    while(quicklistNext(iter,&entry)) {
+                        if (rdbSaveRawString(fp,entry.value,entry.sz) == -1) {
+                            quicklistReleaseIterator(iter);
+                            goto werr;
+                        }
+                    }
+                    quicklistReleaseIterator(iter);
                 }
             } else if (o->type == REDIS_SET) {
-                /* Save a set value */
-                dict *set = o->ptr;
-                dictIterator *di = dictGetIterator(set);
-                dictEntry *de;
+                /* Save a set value. Integers of intsets are saved as
+                 * strings, the same format of the hash table encoding. */
+                if (rdbSaveLen(fp,setTypeSize(o)) == -1) goto werr;
+                if (o->encoding == REDIS_ENCODING_INTSET) {
+                    int64_t llele;
+                    uint32_t ii = 0;
+                    char buf[32];
+                    int len;
+
+                    while (intsetGet(o->ptr,ii++,&llele)) {
+                        len = snprintf(buf,sizeof(buf),"%lld",(long long)llele);
+                        if (rdbSaveRawString(fp,(unsigned char*)buf,len) == -1)
+                            goto werr;
+                    }
+                } else {
+                    dict *set = o->ptr;
+                    dictIterator *di = dictGetIterator(set);
+                    dictEntry *de;
+
+                    if (!set) oom("dictGetIteraotr");
+                    while((de = dictNext(di)) != NULL) {
+                        robj *eleobj = dictGetEntryKey(de);
 
-                if (!set) oom("dictGetIteraotr");
-                if (rdbSaveLen(fp,dictSize(set)) == -1) goto werr;
-                while((de = dictNext(di)) != NULL) {
-                    robj *eleobj = dictGetEntryKey(de);
+                        if (rdbSaveStringObject(fp,eleobj) == -1) goto werr;
+                    }
+                    dictReleaseIterator(di);
+                }
+            } else if (o->type == REDIS_ZSET) {
+                /* Save a sorted set value as member,score pairs */
+                if (rdbSaveLen(fp,zsetLength(o)) == -1) goto werr;
+                if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+                    unsigned char *zl = o->ptr, *eptr, *sptr;
+                    unsigned char *vstr;
+                    unsigned int vlen;
+
+                    eptr = ziplistIndex(zl,0);
+                    while (eptr != NULL) {
+                        sptr = ziplistNext(zl,eptr);
+                        ziplistGet(eptr,&vstr,&vlen);
+                        if (rdbSaveRawString(fp,vstr,vlen) == -1) goto werr;
+                        if (rdbSaveDoubleValue(fp,zzlGetScore(sptr)) == -1)
+                            goto werr;
+                        eptr = ziplistNext(zl,sptr);
+                    }
+                } else {
+                    zskiplistNode *ln = ((zset*)o->ptr)->zsl->header->level[0].forward;
 
-                    if (rdbSaveStringObject(fp,eleobj) == -1) goto werr;
+                    while (ln) {
+                        if (rdbSaveStringObject(fp,ln->obj) == -1) goto werr;
+                        if (rdbSaveDoubleValue(fp,ln->score) == -1) goto werr;
+                        ln = ln->level[0].forward;
+                    }
+                }
+            } else if (o->type == REDIS_HASH) {
+                /* Save a hash value as field,value pairs */
+                if (rdbSaveLen(fp,hashTypeLength(o)) == -1) goto werr;
+                if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+                    unsigned char *p = ziplistIndex(o->ptr,0);
+                    unsigned char *vstr;
+                    unsigned int vlen;
+
+                    while(ziplistGet(p,&vstr,&vlen)) {
+                        if (rdbSaveRawString(fp,vstr,vlen) == -1) goto werr;
+                        p = ziplistNext(o->ptr,p);
+                    }
+                } else {
+                    dictIterator *di = dictGetIterator(o->ptr);
+                    dictEntry *de;
+
+                    if (!di) oom("dictGetIterator");
+                    while((de = dictNext(di)) != NULL) {
+                        if (rdbSaveStringObject(fp,dictGetEntryKey(de)) == -1 ||
+                            rdbSaveStringObject(fp,dictGetEntryVal(de)) == -1)
+                        {
+                            dictReleaseIterator(di);
+                            goto werr;
+                        }
+                    }
+                    dictReleaseIterator(di);
                 }
-                dictReleaseIterator(di);
             } else {
                 assert(0 != 0);
             }
@@ -285,6 +420,14 @@ time_t rdbLoadTime(FILE *fp) {
     return (time_t) t32;
 }
 
+/* -1 is a valid time here: the error is returned apart */
+int rdbLoadMillisecondTime(FILE *fp, long long *t) {
+    int64_t t64;
+    if (fread(&t64,8,1,fp) == 0) return -1;
+    *t = (long long) t64;
+    return 0;
+}
+
 /* Load an encoded length from the DB, see the REDIS_RDB_* defines on the top
  * of this file for a description of how this are stored on disk.
  *
@@ -344,7 +487,7 @@ robj *rdbLoadIntegerObject(FILE *fp, int enctype) {
         val = 0; /* anti-warning */
         assert(0!=0);
     }
-    return createObject(REDIS_STRING,sdscatprintf(sdsempty(),"%lld",val));
+    return createStringObjectFromLongLong(val);
 }
 
 robj *rdbLoadLzfStringObject(FILE*fp, int rdbver) {
@@ -359,7 +502,7 @@ robj *rdbLoadLzfStringObject(FILE*fp, int rdbver) {
     if (fread(c,clen,1,fp) == 0) goto err;
     if (lzf_decompress(c,clen,val,len) == 0) goto err;
     zfree(c);
-    return createObject(REDIS_STRING,val);
+    return createStringObjectFromSds(val);
 err:
     zfree(c);
     sdsfree(val);
@@ -391,7 +534,25 @@ robj *rdbLoadStringObject(FILE*fp, int rdbver) {
         sdsfree(val);
         return NULL;
     }
-    return tryObjectSharing(createObject(REDIS_STRING,val));
+    return tryObjectSharing(createStringObjectFromSds(val));
+}
+
+/* Load a double saved by rdbSaveDoubleValue() */
+int rdbLoadDoubleValue(FILE *fp, double *val) {
+    char buf[256];
+    unsigned char len;
+
+    if (fread(&len,1,1,fp) == 0) return -1;
+    switch(len) {
+    case 255: *val = -HUGE_VAL; return 0;
+    case 254: *val = HUGE_VAL; return 0;
+    case 253: *val = NAN; return 0;
+    default:
+        if (fread(buf,len,1,fp) == 0) return -1;
+        buf[len] = '\0';
+        sscanf(buf,"%lg",val);
+        return 0;
+    }
 }
 
 /*============================ DB saving/loading ============================ */
@@ -402,10 +563,9 @@ int rdbLoad(char *filename) {
     robj *keyobj = NULL;
     uint32_t dbid;
     int type, retval, rdbver;
-    dict *d = server.db[0].dict;
     redisDb *db = server.db+0;
     char buf[1024];
-    time_t expiretime = -1, now = time(NULL);
+    long long expiretime = -1, now = mstime();
 
     fp = fopen(filename,"r");
     if (!fp) return REDIS_ERR;
@@ -418,7 +578,7 @@ int rdbLoad(char *filename) {
         return REDIS_ERR;
     }
     rdbver = atoi(buf+5);
-    if (rdbver > 1) {
+    if (rdbver > 2) {
         fclose(fp);
         redisLog(REDIS_WARNING,"Can't handle RDB format version %d",rdbver);
         return REDIS_ERR;
@@ -429,9 +589,14 @@ int rdbLoad(char *filename) {
         /* Read type. */
         if ((type = rdbLoadType(fp)) == -1) goto eoferr;
         if (type == REDIS_EXPIRETIME) {
+            /* Seconds, as saved by RDB version 1 */
             if ((expiretime = rdbLoadTime(fp)) == -1) goto eoferr;
+            expiretime *= 1000;
             /* We read the time so we need to read the object type again */
             if ((type = rdbLoadType(fp)) == -1) goto eoferr;
+        } else if (type == REDIS_EXPIRETIME_MS) {
+            if (rdbLoadMillisecondTime(fp,&expiretime) == -1) goto eoferr;
+            if ((type = rdbLoadType(fp)) == -1) goto eoferr;
         }
         if (type == REDIS_EOF) break;
         /* Handle SELECT DB opcode as a special case */
@@ -443,7 +608,6 @@ int rdbLoad(char *filename) {
                 exit(1);
             }
             db = server.db+dbid;
-            d = db->dict;
             continue;
         }
         /* Read key */
@@ -452,31 +616,86 @@ int rdbLoad(char *filename) {
         if (type == REDIS_STRING) {
             /* Read string value */
             if ((o = rdbLoadStringObject(fp,rdbver)) == NULL) goto eoferr;
+            o = tryObjectEncoding(o);
         } else if (type == REDIS_LIST || type == REDIS_SET) {
             /* Read list/set value */
             uint32_t listlen;
 
             if ((listlen = rdbLoadLen(fp,rdbver,NULL)) == REDIS_RDB_LENERR)
                 goto eoferr;
-            o = (type == REDIS_LIST) ? createListObject() : createSetObject();
+            if (type == REDIS_LIST) {
+                o = (listlen > server.list_max_ziplist_entries) ?
+                    createQuicklistObject() : createZiplistObject();
+            } else {
+                o = (listlen > server.set_max_intset_entries) ?
+                    createSetObject() : createIntsetObject();
+            }
             /* Load every single element of the list/set */
             while(listlen--) {
                 robj *ele;
 
                 if ((ele = rdbLoadStringObject(fp,rdbver)) == NULL) goto eoferr;
                 if (type == REDIS_LIST) {
-                    if (!listAddNodeTail((list*)o->ptr,ele))
-                        oom("listAddNodeTail");
+                    /* Both the encodings copy the element */
+                    listTypePush(o,ele,REDIS_TAIL);
+                    decrRefCount(ele);
                 } else {
-                    if (dictAdd((dict*)o->ptr,ele,NULL) == DICT_ERR)
-                        oom("dictAdd");
+                    /* Converted to a hash table by the first non integer */
+                    setTypeAdd(o,ele);
+                    decrRefCount(ele);
+                }
+            }
+        } else if (type == REDIS_ZSET) {
+            /* Read sorted set value */
+            uint32_t zsetlen;
+
+            if ((zsetlen = rdbLoadLen(fp,rdbver,NULL)) == REDIS_RDB_LENERR)
+                goto eoferr;
+            o = (zsetlen > server.zset_max_ziplist_entries) ?
+                createZsetObject() : createZsetZiplistObject();
+            /* Converted to a skiplist by the first long member */
+            while(zsetlen--) {
+                robj *ele;
+                double score;
+
+                if ((ele = rdbLoadStringObject(fp,rdbver)) == NULL) goto eoferr;
+                if (rdbLoadDoubleValue(fp,&score) == -1) {
+                    decrRefCount(ele);
+                    goto eoferr;
+                }
+                zsetAdd(o,ele,score);
+                decrRefCount(ele);
+            }
+        } else if (type == REDIS_HASH) {
+            /* Read hash value */
+            uint32_t hashlen;
+
+            if ((hashlen = rdbLoadLen(fp,rdbver,NULL)) == REDIS_RDB_LENERR)
+                goto eoferr;
+            o = createHashObject();
+            if (hashlen > server.hash_max_ziplist_entries) {
+                hashTypeConvert(o,REDIS_ENCODING_HT);
+                dictExpand(o->ptr,hashlen);
+            }
+            /* Converted to a hash table by the first long field or value */
+            while(hashlen--) {
+                robj *field, *value;
+
+                if ((field = rdbLoadStringObject(fp,rdbver)) == NULL) goto eoferr;
+                if ((value = rdbLoadStringObject(fp,rdbver)) == NULL) {
+                    decrRefCount(field);
+                    goto eoferr;
                 }
+                value = tryObjectEncoding(value);
+                hashTypeSet(o,field,value);
+                decrRefCount(field);
+                decrRefCount(value);
             }
         } else {
             assert(0 != 0);
         }
         /* Add the new object in the hash table */
-        retval = dictAdd(d,keyobj,o);
+        retval = dbAdd(db,keyobj,o);
         if (retval == DICT_ERR) {
             redisLog(REDIS_WARNING,"Loading DB, duplicated key (%s) found! Unrecoverable error, exiting now.", keyobj->ptr);
             exit(1);
@@ -488,6 +707,7 @@ int rdbLoad(char *filename) {
             if (expiretime < now) deleteKey(db,keyobj);
             expiretime = -1;
         }
+        decrRefCount(keyobj);
         keyobj = o = NULL;
     }
     fclose(fp);
@@ -2,19 +2,25 @@
 #define __REDIS_DB_H
 
 int rdbSaveType(FILE *fp, unsigned char type);
-int rdbSaveTime(FILE *fp, time_t t);
+int rdbSaveMillisecondTime(FILE *fp, long long t);
 int rdbSaveLen(FILE *fp, uint32_t len);
-int rdbTryIntegerEncoding(sds s, unsigned char *enc);
-int rdbSaveLzfStringObject(FILE *fp, robj *obj);
+int rdbTryIntegerEncoding(char *s, size_t len, unsigned char *enc);
+int rdbEncodeInteger(long long value, unsigned char *enc);
+int rdbSaveLzfString(FILE *fp, unsigned char *s, size_t len);
+int rdbSaveRawString(FILE *fp, unsigned char *s, size_t len);
+int rdbSaveLongLongAsStringObject(FILE *fp, long long value);
 int rdbSaveStringObject(FILE *fp, robj *obj);
+int rdbSaveDoubleValue(FILE *fp, double val);
 int rdbSave(char *filename);
 int rdbSaveBackground(char *filename);
 int rdbLoadType(FILE *fp);
 time_t rdbLoadTime(FILE *fp);
+int rdbLoadMillisecondTime(FILE *fp, long long *t);
 uint32_t rdbLoadLen(FILE *fp, int rdbver, int *isencoded);
 robj *rdbLoadIntegerObject(FILE *fp, int enctype);
 robj *rdbLoadLzfStringObject(FILE*fp, int rdbver);
 robj *rdbLoadStringObject(FILE*fp, int rdbver);
+int rdbLoadDoubleValue(FILE *fp, double *val);
 rdbLoad(char *filename);
 
 #endif
@@ -34,6 +34,7 @@
 #include <stdarg.h>
 #include <string.h>
 #include <ctype.h>
+#include <assert.h>
 #include "zmalloc.h"
 
 static void sdsOomAbort(void) {
@@ -41,6 +42,27 @@ static void sdsOomAbort(void) {
     abort();
 }
 
+static size_t sds_max_prealloc = SDS_MAX_PREALLOC;
+
+/* 各种头部的大小 */
+static int sdsHdrSize(char type) {
+    switch(type&SDS_TYPE_MASK) {
+    case SDS_TYPE_8: return sizeof(struct sdshdr8);
+    case SDS_TYPE_16: return sizeof(struct sdshdr16);
+    case SDS_TYPE_32: return sizeof(struct sdshdr32);
+    case SDS_TYPE_64: return sizeof(struct sdshdr64);
+    }
+    return 0;
+}
+
+/* 能表示size字节容量的最小头部 */
+static char sdsReqType(size_t size) {
+    if (size < 1<<8) return SDS_TYPE_8;
+    if (size < 1<<16) return SDS_TYPE_16;
+    if ((unsigned long long)size < 1ULL<<32) return SDS_TYPE_32;
+    return SDS_TYPE_64;
+}
+
 /* 
  * KEYCODE 按照指定的字符串长度申请一个sds
  * 
@@ -48,25 +70,52 @@ static void sdsOomAbort(void) {
  * NOTE: initlen可以为0
  */
 sds sdsnewlen(const void *init, size_t initlen) {
-    struct sdshdr *sh;
+    char type = sdsReqType(initlen);
+    int hdrlen = sdsHdrSize(type);
+    char *sh;
+    sds s;
 
-	/* 看到这里的内存布局了么？不明白的，看下面的sdslen的实现 */
-    sh = zmalloc(sizeof(struct sdshdr)+initlen+1);	/* +1：自动在末位添加\0 */
+	/* 内存布局: [len][alloc][flags][buf...][\0] */
+    sh = zmalloc(hdrlen+initlen+1);	/* +1：自动在末位添加\0 */
 #ifdef SDS_ABORT_ON_OOM
     if (sh == NULL) sdsOomAbort();
 #else
     if (sh == NULL) return NULL;
 #endif
-    sh->len = initlen;	/* 这里不包含下面自动添加的\0,做到上层的透明 */
-    sh->free = 0;
+    s = sh+hdrlen;
+    s[-1] = type;
+    sdssetlen(s,initlen);	/* 这里不包含下面自动添加的\0,做到上层的透明 */
+    sdssetalloc(s,initlen);
     if (initlen) {
         if (init) 
-			memcpy(sh->buf, init, initlen);	/* NOTE: 这里不是strcpy而是memcpy */
+			memcpy(s, init, initlen);	/* NOTE: 这里不是strcpy而是memcpy */
         else 
-			memset(sh->buf,0,initlen);
+			memset(s,0,initlen);
     }
-    sh->buf[initlen] = '\0';	/* 自动添加\0 */
-    return (char*)sh->buf;
+    s[initlen] = '\0';	/* 自动添加\0 */
+    return s;
+}
+
+/* 容纳len字节数据的最小sds(头部+数据+\0)占用的字节数 */
+size_t sdsEmbeddedSize(size_t len) {
+    return sdsHdrSize(sdsReqType(len))+len+1;
+}
+
+/*
+ * 在调用者提供的内存buf(至少sdsEmbeddedSize(len)字节)中构建一个sds,
+ * 用于把字符串和其他结构放在同一块内存中. 不预留free, 结果不能被
+ * sdsfree()释放, 也不能执行任何可能重新分配的操作
+ */
+sds sdsNewEmbedded(void *buf, const void *init, size_t len) {
+    char type = sdsReqType(len);
+    sds s = (char*)buf+sdsHdrSize(type);
+
+    s[-1] = type;
+    sdssetlen(s,len);
+    sdssetalloc(s,len);
+    if (len) memcpy(s,init,len);
+    s[len] = '\0';
+    return s;
 }
 
 sds sdsempty(void) {
@@ -80,67 +129,146 @@ sds sdsnew(const char *init) {
     return sdsnewlen(init, initlen);
 }
 
-/* 存储的数据长度 */
-size_t sdslen(const sds s) {
-	/* 这里提取sdshdr的方法可以整理成一个宏定义,后面蛮多地方都用到了 */
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
-    return sh->len;
-}
-
 sds sdsdup(const sds s) {
     return sdsnewlen(s, sdslen(s));
 }
 
 void sdsfree(sds s) {
     if (s == NULL) return;
-    zfree(s-sizeof(struct sdshdr));
+    zfree(s-sdsHdrSize(s[-1]));
 }
 
-size_t sdsavail(sds s) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
-    return sh->free;
+void sdsupdatelen(sds s) {
+    sdssetlen(s,strlen(s));
 }
 
-void sdsupdatelen(sds s) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
-    int reallen = strlen(s);
-    sh->free += (sh->len-reallen);
-    sh->len = reallen;
+void sdsSetMaxPrealloc(size_t maxprealloc) {
+    sds_max_prealloc = maxprealloc;
 }
 
-/* 准备一个不短于addlen长度的free内存空间 */
-static sds sdsMakeRoomFor(sds s, size_t addlen) {
-    struct sdshdr *sh, *newsh;
-    size_t free = sdsavail(s);
-    size_t len, newlen;
+/* 把s搬到一块新的内存中,使用type类型的头部,容量为alloc */
+static sds sdsMoveToType(sds s, char type, size_t alloc) {
+    int hdrlen = sdsHdrSize(type);
+    size_t len = sdslen(s);
+    char *newsh = zmalloc(hdrlen+alloc+1);
+    sds news;
 
-    if (free >= addlen) return s;	/* 剩余空间足够，无需另外申请空间，直接返回 */
-	
-    len = sdslen(s);
-    sh = (void*) (s-(sizeof(struct sdshdr)));
-    newlen = (len+addlen)*2;	// 直接申请多一倍的冗余空间
-    newsh = zrealloc(sh, sizeof(struct sdshdr)+newlen+1);
 #ifdef SDS_ABORT_ON_OOM
     if (newsh == NULL) sdsOomAbort();
 #else
     if (newsh == NULL) return NULL;
 #endif
+    news = newsh+hdrlen;
+    memcpy(news,s,len+1);
+    news[-1] = type;
+    sdssetlen(news,len);
+    sdssetalloc(news,alloc);
+    sdsfree(s);
+    return news;
+}
+
+/* 调整s的容量为alloc(不小于sdslen(s)). 头部类型不变时realloc,
+ * 否则头部的大小变了,需要搬到新的内存中 */
+static sds sdsResize(sds s, size_t alloc) {
+    char oldtype = s[-1]&SDS_TYPE_MASK, type = sdsReqType(alloc);
+    int hdrlen = sdsHdrSize(oldtype);
+    char *newsh;
+
+    if (type != oldtype) return sdsMoveToType(s,type,alloc);
+    newsh = zrealloc(s-hdrlen, hdrlen+alloc+1);
+#ifdef SDS_ABORT_ON_OOM
+    if (newsh == NULL) sdsOomAbort();
+#else
+    if (newsh == NULL) return NULL;
+#endif
+    s = newsh+hdrlen;
+    sdssetalloc(s,alloc);
+    return s;
+}
 
-    newsh->free = newlen - len;
-    return newsh->buf;
+/* 准备一个不短于addlen长度的free内存空间. 贪婪预分配: 新长度小于
+ * sds_max_prealloc时容量翻倍,否则只多预留sds_max_prealloc字节,避免
+ * 一个100MB的字符串白白浪费100MB */
+static sds sdsMakeRoomFor(sds s, size_t addlen) {
+    size_t newlen;
+
+    if (sdsavail(s) >= addlen) return s;	/* 剩余空间足够，无需另外申请空间，直接返回 */
+    newlen = sdslen(s)+addlen;
+    if (newlen < sds_max_prealloc)
+        newlen *= 2;
+    else
+        newlen += sds_max_prealloc;
+    return sdsResize(s,newlen);
+}
+
+/* Like sdsMakeRoomFor() but without any greedy preallocation: after the
+ * call the string has exactly 'addlen' bytes of free space (or more if it
+ * already had more). Useful when the final size is known in advance, like
+ * for big bulk arguments read from the network. */
+sds sdsMakeRoomForExact(sds s, size_t addlen) {
+    if (sdsavail(s) >= addlen) return s;
+    return sdsResize(s,sdslen(s)+addlen);
+}
+
+/* Grow the string to 'len' bytes, the new bytes set to zero. Bitmaps grow
+ * this way a few bytes at a time: past sds_max_prealloc the room made is
+ * still proportional to the length (1/8), so that reaching N bytes costs
+ * O(N) copies and not O(N^2/sds_max_prealloc). */
+sds sdsGrowZero(sds s, size_t len) {
+    size_t curlen = sdslen(s), alloc;
+
+    if (len <= curlen) return s;
+    if (sdsalloc(s) < len) {
+        if (len < sds_max_prealloc)
+            alloc = len*2;
+        else
+            alloc = len + (len/8 > sds_max_prealloc ? len/8 : sds_max_prealloc);
+        s = sdsResize(s,alloc);
+        if (s == NULL) return NULL;
+    }
+    memset(s+curlen,0,len-curlen+1); /* also the null term */
+    sdssetlen(s,len);
+    return s;
+}
+
+/* Reallocate the string so that it has no free space at the end, also
+ * switching to a smaller header if the length allows it. Used for strings
+ * stored as values, that are not going to grow. */
+sds sdsRemoveFreeSpace(sds s) {
+    size_t len = sdslen(s);
+
+    if (sdsavail(s) == 0) return s;
+    if (sdsReqType(len) != (s[-1]&SDS_TYPE_MASK))
+        return sdsMoveToType(s,sdsReqType(len),len);
+    return sdsResize(s,len);
+}
+
+/* Increment the length of the string and decrement the free space by
+ * 'incr' (that can be negative to right-trim the string), setting the
+ * new null term. This is used after writing directly at the end of the
+ * string, for example with read(2), in order to fix the length:
+ *
+ * s = sdsMakeRoomForExact(s,len);
+ * nread = read(fd, s+sdslen(s), len);
+ * sdsIncrLen(s,nread);
+ */
+void sdsIncrLen(sds s, int incr) {
+    size_t len = sdslen(s);
+
+    assert(incr >= 0 ? sdsavail(s) >= (size_t)incr : len >= (size_t)-incr);
+    len += incr;
+    sdssetlen(s,len);
+    s[len] = '\0';
 }
 
 /* 将指定长度len的内存空间tcat到s的尾上 */
 sds sdscatlen(sds s, void *t, size_t len) {
-    struct sdshdr *sh;
     size_t curlen = sdslen(s);
 
     s = sdsMakeRoomFor(s,len);	/* 扩展free内存以便增加len */
     if (s == NULL) return NULL;
-    sh = (void*) (s-(sizeof(struct sdshdr)));
     memcpy(s+curlen, t, len);
-    sh->len = curlen+len;
-    sh->free = sh->free-len;
+    sdssetlen(s,curlen+len);
     s[curlen+len] = '\0';		/* 不忘自动添加一个\0 */
     return s;
 }
@@ -153,19 +281,13 @@ sds sdscat(sds s, char *t) {
 ** 放弃原来s的数据
 */
 sds sdscpylen(sds s, char *t, size_t len) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
-    size_t totlen = sh->free+sh->len;
-
-    if (totlen < len) {
-        s = sdsMakeRoomFor(s,len-totlen);
+    if (sdsalloc(s) < len) {
+        s = sdsMakeRoomFor(s,len-sdslen(s));
         if (s == NULL) return NULL;
-        sh = (void*) (s-(sizeof(struct sdshdr)));
-        totlen = sh->free+sh->len;
     }
     memcpy(s, t, len);
     s[len] = '\0';
-    sh->len = len;
-    sh->free = totlen-len;
+    sdssetlen(s,len);
     return s;
 }
 
@@ -207,7 +329,6 @@ sds sdscatprintf(sds s, const char *fmt, ...) {
 **比如 sdsstrim(xxyyabcyyxy, "xy") 将返回 "abc"
 */
 sds sdstrim(sds s, const char *cset) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
     char *start, *end, *sp, *ep;
     size_t len;
 
@@ -223,17 +344,15 @@ sds sdstrim(sds s, const char *cset) {
     len = (sp > ep) ? 0 : ((ep-sp)+1);
 	
 	/* 开头的这一部分需要被trim掉 */
-    if (sh->buf != sp) 
-	    memmove(sh->buf, sp, len);
+    if (s != sp) 
+	    memmove(s, sp, len);
 	
-    sh->buf[len] = '\0';
-    sh->free = sh->free+(sh->len-len);
-    sh->len = len;
+    s[len] = '\0';
+    sdssetlen(s,len);
     return s;
 }
 
 sds sdsrange(sds s, long start, long end) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
     size_t newlen, len = sdslen(s);
 
 	/* 这个前置判断很有必要 */
@@ -260,10 +379,9 @@ sds sdsrange(sds s, long start, long end) {
     } else {
         start = 0;
     }
-    if (start != 0) memmove(sh->buf, sh->buf+start, newlen);
-    sh->buf[newlen] = 0;
-    sh->free = sh->free+(sh->len-newlen);
-    sh->len = newlen;
+    if (start != 0) memmove(s, s+start, newlen);
+    s[newlen] = 0;
+    sdssetlen(s,newlen);
     return s;
 }
 
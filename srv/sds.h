@@ -32,21 +32,101 @@
 #define __SDS_H
 
 #include <sys/types.h>
+#include <stdint.h>
 
 typedef char *sds;
 
 /* 
  * context : str = "hello"
  * len  = 5
- * free = 5
- * 整个byte.space=5+1+5   自动多一个字节出来用于保存'\0'
+ * alloc = 10
+ * 整个byte.space=header+10+1   自动多一个字节出来用于保存'\0'
  * buf放在结构体的最后，这个设计是故意的，其它的函数对此有依赖，不能随意改动
+ *
+ * 头部有4种,len/alloc分别是1,2,4,8字节,按照字符串的大小选择,短字符串的头部
+ * 只有3字节. 紧挨着buf的flags字节记录了头部的类型,所以从sds指针s总能通过
+ * s[-1]找到头部. 结构体是packed的,中间不能有填充.
  */
-struct sdshdr {
-    long len;		/* 已使用的空间长度（不包含'\0' */
-    long free;		/* 空间预分配，惰性释放 */
+struct __attribute__ ((__packed__)) sdshdr8 {
+    uint8_t len;	/* 已使用的空间长度（不包含'\0' */
+    uint8_t alloc;	/* buf的容量,不包含头部和'\0' */
+    unsigned char flags;	/* 低3位是头部类型 */
     char buf[]; 	/* 字节空间的首地址 */
 };
+struct __attribute__ ((__packed__)) sdshdr16 {
+    uint16_t len;
+    uint16_t alloc;
+    unsigned char flags;
+    char buf[];
+};
+struct __attribute__ ((__packed__)) sdshdr32 {
+    uint32_t len;
+    uint32_t alloc;
+    unsigned char flags;
+    char buf[];
+};
+struct __attribute__ ((__packed__)) sdshdr64 {
+    uint64_t len;
+    uint64_t alloc;
+    unsigned char flags;
+    char buf[];
+};
+
+#define SDS_TYPE_8  1
+#define SDS_TYPE_16 2
+#define SDS_TYPE_32 3
+#define SDS_TYPE_64 4
+#define SDS_TYPE_MASK 7
+#define SDS_HDR(T,s) ((struct sdshdr##T *)((s)-(sizeof(struct sdshdr##T))))
+
+/* Greedy preallocation doubles the string size up to this many bytes,
+ * then only this many bytes are added. See sdsSetMaxPrealloc(). */
+#define SDS_MAX_PREALLOC (1024*1024)
+
+/* 存储的数据长度(不包含自动添加的\0) */
+static inline size_t sdslen(const sds s) {
+    switch(s[-1]&SDS_TYPE_MASK) {
+    case SDS_TYPE_8: return SDS_HDR(8,s)->len;
+    case SDS_TYPE_16: return SDS_HDR(16,s)->len;
+    case SDS_TYPE_32: return SDS_HDR(32,s)->len;
+    case SDS_TYPE_64: return SDS_HDR(64,s)->len;
+    }
+    return 0;
+}
+
+/* 容量,不包含头部和'\0' */
+static inline size_t sdsalloc(const sds s) {
+    switch(s[-1]&SDS_TYPE_MASK) {
+    case SDS_TYPE_8: return SDS_HDR(8,s)->alloc;
+    case SDS_TYPE_16: return SDS_HDR(16,s)->alloc;
+    case SDS_TYPE_32: return SDS_HDR(32,s)->alloc;
+    case SDS_TYPE_64: return SDS_HDR(64,s)->alloc;
+    }
+    return 0;
+}
+
+/* 剩余的free空间大小 */
+static inline size_t sdsavail(const sds s) {
+    return sdsalloc(s)-sdslen(s);
+}
+
+static inline void sdssetlen(sds s, size_t newlen) {
+    switch(s[-1]&SDS_TYPE_MASK) {
+    case SDS_TYPE_8: SDS_HDR(8,s)->len = newlen; break;
+    case SDS_TYPE_16: SDS_HDR(16,s)->len = newlen; break;
+    case SDS_TYPE_32: SDS_HDR(32,s)->len = newlen; break;
+    case SDS_TYPE_64: SDS_HDR(64,s)->len = newlen; break;
+    }
+}
+
+static inline void sdssetalloc(sds s, size_t newlen) {
+    switch(s[-1]&SDS_TYPE_MASK) {
+    case SDS_TYPE_8: SDS_HDR(8,s)->alloc = newlen; break;
+    case SDS_TYPE_16: SDS_HDR(16,s)->alloc = newlen; break;
+    case SDS_TYPE_32: SDS_HDR(32,s)->alloc = newlen; break;
+    case SDS_TYPE_64: SDS_HDR(64,s)->alloc = newlen; break;
+    }
+}
 
 /* 构建包含指定长度数据的sds(数据内部可以有'\0') */
 sds sdsnewlen(const void *init, size_t initlen);
@@ -54,14 +134,13 @@ sds sdsnewlen(const void *init, size_t initlen);
 sds sdsnew(const char *init);
 /* 构建一个"空字符串"的sds */
 sds sdsempty();
-/* 存储的数据长度(不包含自动添加的\0) */
-size_t sdslen(const sds s);
 /* 复制sds */
 sds sdsdup(const sds s);
+/* 在给定的内存中构建不可修改的sds, 所需内存大小由sdsEmbeddedSize()给出 */
+size_t sdsEmbeddedSize(size_t len);
+sds sdsNewEmbedded(void *buf, const void *init, size_t len);
 /* 释放sds */
 void sdsfree(sds s);
-/* 剩余的free空间大小 */
-size_t sdsavail(sds s);
 /* 将指定长度的数据t,len拷贝到s的尾处 */
 sds sdscatlen(sds s, void *t, size_t len);
 sds sdscat(sds s, char *t);
@@ -75,6 +154,16 @@ sds sdstrim(sds s, const char *cset);
 /* 截取原始的部分内容 */
 sds sdsrange(sds s, long start, long end);
 void sdsupdatelen(sds s);
+/* 释放所有的free空间,必要时换成更小的头部 */
+sds sdsRemoveFreeSpace(sds s);
+/* 修改贪婪预分配的上限(默认SDS_MAX_PREALLOC) */
+void sdsSetMaxPrealloc(size_t maxprealloc);
+/* 准备恰好addlen字节的free空间(不做翻倍的预分配) */
+sds sdsMakeRoomForExact(sds s, size_t addlen);
+/* 扩展到len字节,新增的部分填0 */
+sds sdsGrowZero(sds s, size_t len);
+/* 直接写入free空间后修正len(incr可以为负数) */
+void sdsIncrLen(sds s, int incr);
 /* 比较两个s1,s2,当前仅当内容，长度相等才return.0 */
 int sdscmp(sds s1, sds s2);
 sds *sdssplitlen(char *s, int len, char *sep, int seplen, int *count);
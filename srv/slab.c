@@ -0,0 +1,223 @@
+/* slab.c - Size class pools for small fixed size structures
+ *
+ * robj, dictEntry and listNode are allocated and freed all the time and
+ * are all a few words long. Going through malloc() for every one of them
+ * costs the allocator per chunk overhead and scatters them in memory.
+ *
+ * Instead every size class (a multiple of 8 bytes up to SLAB_MAX_OBJSIZE)
+ * has a pool of SLAB_PAGE_SIZE pages. A page starts with a header and is
+ * then cut in slots of the class size, the free slots are linked in a
+ * free list inside the page itself. Pages are aligned to SLAB_PAGE_SIZE so
+ * slabFree() finds the header of a slot just masking the pointer.
+ *
+ * Pages with free slots are kept in the 'partial' list, pages without in
+ * the 'full' list. A page that gets completely free is released at once,
+ * except one empty page per pool that is cached to avoid allocating and
+ * freeing a page again and again on the boundary.
+ *
+ * Pages are allocated with zmalloc_aligned() so zmalloc_used_memory()
+ * counts the whole pages, that's the memory really used.
+ *
+ *
+ * Copyright (c) 2006-2009, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "slab.h"
+#include "zmalloc.h"
+
+#define SLAB_CLASSES (SLAB_MAX_OBJSIZE/8)
+
+typedef struct slabPage {
+    struct slabPage *prev;
+    struct slabPage *next;
+    struct slabPool *pool;
+    void *free;             /* first free slot, slots are linked by their first word */
+    unsigned int used;      /* slots handed out */
+} slabPage;
+
+typedef struct slabPool {
+    size_t objsize;
+    unsigned int perpage;   /* slots in a page */
+    slabPage *partial;      /* pages with at least a free slot */
+    slabPage *full;         /* pages without free slots */
+    slabPage *empty;        /* cached empty page, or NULL */
+    size_t pages;
+    size_t used;            /* slots handed out in all the pages */
+} slabPool;
+
+/* Slots start after the header, aligned to 16 bytes */
+#define SLAB_HEADER_SIZE ((sizeof(slabPage)+15) & ~((size_t)15))
+
+static slabPool pools[SLAB_CLASSES];
+
+/* The pools belong to the main thread. Other threads (the lazy free thread)
+ * can free slots: they are pushed to a lock free stack, linked by their
+ * first word, and given back to their page by slabReclaim(). */
+static void *remote_free = NULL;
+static __thread int slab_remote_thread = 0;
+
+static void slabPageLink(slabPage **list, slabPage *page) {
+    page->prev = NULL;
+    page->next = *list;
+    if (*list) (*list)->prev = page;
+    *list = page;
+}
+
+static void slabPageUnlink(slabPage **list, slabPage *page) {
+    if (page->prev)
+        page->prev->next = page->next;
+    else
+        *list = page->next;
+    if (page->next) page->next->prev = page->prev;
+    page->prev = page->next = NULL;
+}
+
+/* 新建一个页,所有的slot串成free list */
+static slabPage *slabPageCreate(slabPool *pool) {
+    slabPage *page = zmalloc_aligned(SLAB_PAGE_SIZE,SLAB_PAGE_SIZE);
+    char *slot;
+    unsigned int j;
+
+    if (page == NULL) return NULL;
+    page->prev = page->next = NULL;
+    page->pool = pool;
+    page->used = 0;
+    slot = (char*)page+SLAB_HEADER_SIZE;
+    page->free = slot;
+    for (j = 0; j < pool->perpage-1; j++) {
+        *(void**)slot = slot+pool->objsize;
+        slot += pool->objsize;
+    }
+    *(void**)slot = NULL;
+    pool->pages++;
+    return page;
+}
+
+static void slabPageRelease(slabPage *page) {
+    page->pool->pages--;
+    zfree_aligned(page,SLAB_PAGE_SIZE);
+}
+
+void *slabAlloc(size_t size) {
+    slabPool *pool;
+    slabPage *page;
+    void *slot;
+
+    if (size == 0 || size > SLAB_MAX_OBJSIZE) return NULL;
+    pool = pools+(size-1)/8;
+    if (pool->objsize == 0) {
+        pool->objsize = ((size-1)/8+1)*8;
+        pool->perpage = (SLAB_PAGE_SIZE-SLAB_HEADER_SIZE)/pool->objsize;
+    }
+
+    if ((page = pool->partial) == NULL) {
+        if (pool->empty) {
+            page = pool->empty;
+            pool->empty = NULL;
+        } else if ((page = slabPageCreate(pool)) == NULL) {
+            return NULL;
+        }
+        slabPageLink(&pool->partial,page);
+    }
+    slot = page->free;
+    page->free = *(void**)slot;
+    page->used++;
+    pool->used++;
+    if (page->free == NULL) {
+        slabPageUnlink(&pool->partial,page);
+        slabPageLink(&pool->full,page);
+    }
+    return slot;
+}
+
+void slabFree(void *ptr) {
+    slabPage *page;
+    slabPool *pool;
+
+    if (ptr == NULL) return;
+    if (slab_remote_thread) {
+        void *head = __atomic_load_n(&remote_free,__ATOMIC_RELAXED);
+
+        do {
+            *(void**)ptr = head;
+        } while (!__atomic_compare_exchange_n(&remote_free,&head,ptr,1,
+                    __ATOMIC_RELEASE,__ATOMIC_RELAXED));
+        return;
+    }
+    page = (slabPage*)((uintptr_t)ptr & ~((uintptr_t)SLAB_PAGE_SIZE-1));
+    pool = page->pool;
+    if (page->free == NULL) {
+        /* It was full, now it has a free slot */
+        slabPageUnlink(&pool->full,page);
+        slabPageLink(&pool->partial,page);
+    }
+    *(void**)ptr = page->free;
+    page->free = ptr;
+    page->used--;
+    pool->used--;
+    if (page->used == 0) {
+        /* The page is empty: keep it if there is no cached page yet,
+         * otherwise give the memory back */
+        slabPageUnlink(&pool->partial,page);
+        if (pool->empty == NULL)
+            pool->empty = page;
+        else
+            slabPageRelease(page);
+    }
+}
+
+/* Called once by a thread other than the main one before freeing slots */
+void slabSetRemoteThread(void) {
+    slab_remote_thread = 1;
+}
+
+/* Give back the slots freed by the other threads. Main thread only. */
+void slabReclaim(void) {
+    void *ptr, *next;
+
+    if (__atomic_load_n(&remote_free,__ATOMIC_RELAXED) == NULL) return;
+    ptr = __atomic_exchange_n(&remote_free,NULL,__ATOMIC_ACQUIRE);
+    while (ptr) {
+        next = *(void**)ptr;
+        slabFree(ptr);
+        ptr = next;
+    }
+}
+
+void slabGetStats(slabStats *stats) {
+    int j;
+
+    memset(stats,0,sizeof(*stats));
+    for (j = 0; j < SLAB_CLASSES; j++) {
+        stats->pages += pools[j].pages;
+        stats->used += pools[j].used*pools[j].objsize;
+    }
+    stats->allocated = stats->pages*SLAB_PAGE_SIZE;
+}
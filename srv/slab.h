@@ -0,0 +1,55 @@
+/* slab.h - Size class pools for small fixed size structures
+ *
+ * Copyright (c) 2006-2009, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <stddef.h>
+
+#define SLAB_PAGE_SIZE (16*1024)    /* pages are aligned to their size */
+#define SLAB_MAX_OBJSIZE 64         /* bigger allocations use zmalloc() */
+
+/* Memory usage of all the pools, reported by INFO */
+typedef struct slabStats {
+    size_t pages;           /* pages allocated, including cached empty ones */
+    size_t allocated;       /* bytes of memory held by the pages */
+    size_t used;            /* bytes handed out to the callers */
+} slabStats;
+
+/* 分配size(<= SLAB_MAX_OBJSIZE)字节, 失败返回NULL */
+void *slabAlloc(size_t size);
+/* 释放slabAlloc()返回的指针, 不需要给出大小 */
+void slabFree(void *ptr);
+void slabGetStats(slabStats *stats);
+/* 其他线程释放的slot先放入无锁栈, 由主线程调用slabReclaim()归还 */
+void slabSetRemoteThread(void);
+void slabReclaim(void);
+
+#endif /* __SLAB_H__ */
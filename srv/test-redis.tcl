@@ -180,6 +180,47 @@ proc main {server port} {
         format $res
     } {1xyzk1}
 
+    test {Big bulk values (direct read into the argument)} {
+        set err 0
+        foreach size {32767 32768 100000 1000000} {
+            set val [string repeat x $size]
+            $r set bigval $val
+            if {[$r get bigval] ne $val} {incr err}
+        }
+        format $err
+    } {0}
+
+    test {Big bulk value pipelined with other commands} {
+        set val [string repeat y 200000]
+        set fd [$r channel]
+        puts -nonewline $fd "SET k2 200000\r\n$val\r\nGET k1\r\nPING\r\n"
+        flush $fd
+        set res {}
+        append res [string match OK* [::redis::redis_read_reply $fd]]
+        append res [::redis::redis_read_reply $fd]
+        append res [string match PONG* [::redis::redis_read_reply $fd]]
+        append res [expr {[$r get k2] eq $val}]
+        format $res
+    } {1xyzk11}
+
+    test {CLIENT LIST reports query and output buffer sizes} {
+        set res [$r client list]
+        list [string match "*fd=*qbuf=*qbuf-free=*oll=*omem=*" $res] \
+             [string match "*class=normal*" $res]
+    } {1 1}
+
+    test {MONITOR client over the output buffer hard limit is disconnected} {
+        set m [redis $server $port]
+        $m monitor
+        set val [string repeat x 1000000]
+        for {set i 0} {$i < 64} {incr i} {$r set bigmon $val}
+        after 2000
+        set res [string match "*flags=O*" [$r client list]]
+        $m close
+        $r del bigmon
+        format $res
+    } {0}
+
     test {Non existing command} {
         catch {$r foobaredcommand} err
         string match ERR* $err
@@ -515,11 +556,577 @@ proc main {server port} {
         lsort [$r smembers sres]
     } {1 2 3 4}
 
+    test {Sets of integers are intset encoded} {
+        $r del iset
+        foreach v {5 -3 100000 0 5 -9223372036854775808} {$r sadd iset $v}
+        list [$r object encoding iset] [$r scard iset] \
+             [$r sismember iset 100000] [$r sismember iset 7] \
+             [$r sismember iset foo] [lsort -integer [$r smembers iset]]
+    } {intset 5 1 0 0 {-9223372036854775808 -3 0 5 100000}}
+
+    test {Non canonical integers are not intset encoded} {
+        $r del iset
+        $r sadd iset 007
+        list [$r object encoding iset] [$r smembers iset]
+    } {hashtable 007}
+
+    test {Intset converted to hashtable on a non integer member} {
+        $r del iset
+        $r sadd iset 1
+        $r sadd iset 2
+        $r sadd iset foo
+        list [$r object encoding iset] [lsort [$r smembers iset]] \
+             [$r sismember iset 2] [$r srem iset 1] [$r scard iset]
+    } {hashtable {1 2 foo} 1 1 2}
+
+    test {Intset converted to hashtable when too big} {
+        $r del iset
+        for {set i 0} {$i < 600} {incr i} {$r sadd iset $i}
+        list [$r object encoding iset] [$r scard iset] [$r sismember iset 599]
+    } {hashtable 600 1}
+
+    test {SREM and SMOVE on intsets} {
+        $r del iset1 iset2
+        foreach v {1 2 3 4} {$r sadd iset1 $v}
+        list [$r srem iset1 3] [$r srem iset1 3] [$r srem iset1 bar] \
+             [$r smove iset1 iset2 4] [$r object encoding iset2] \
+             [lsort [$r smembers iset1]] [$r smembers iset2]
+    } {1 0 0 1 intset {1 2} 4}
+
+    foreach {enc member} {intset 1000 hashtable x} {
+        test "SINTER/SUNION/SDIFF against intset and $enc sets" {
+            $r del a b c res
+            for {set i 0} {$i < 200} {incr i} {
+                $r sadd a $i
+                $r sadd b [expr $i*2]
+                if {$i % 3 == 0} {$r sadd c [expr $i*3]}
+            }
+            $r sadd c $member
+            set res {}
+            lappend res [$r object encoding a] [$r object encoding c]
+            lappend res [llength [$r sinter a b c]]
+            lappend res [lsort -integer [$r sinter a b c]]
+            lappend res [llength [$r sunion a b c]]
+            lappend res [llength [$r sdiff b a c]]
+            lappend res [$r sinterstore res a b] [$r object encoding res]
+            lappend res [$r sunionstore res a c] [$r object encoding res]
+            lappend res [$r sdiffstore res a b] [$r sismember res 199]
+            set res
+        } [list intset $enc 12 {0 18 36 54 72 90 108 126 144 162 180 198} \
+               334 89 100 intset 245 $enc 100 1]
+    }
+
+    test {ZADD, ZSCORE, ZINCRBY, ZREM, ZCARD basics} {
+        $r del zs
+        set res {}
+        lappend res [$r zadd zs 10 x] [$r zadd zs 20 y] [$r zadd zs 15 x]
+        lappend res [$r zscore zs x] [$r zincrby zs 2.5 y] [$r zincrby zs 1 z]
+        lappend res [$r zcard zs] [$r zrem zs y] [$r zrem zs y] [$r zcard zs]
+        lappend res [$r zscore zs y] [$r type zs]
+        catch {$r zadd zs nan x} err
+        lappend res [string match ERR* $err]
+        $r set zstr bar
+        catch {$r zadd zstr 1 x} err
+        lappend res [string match *kind* $err]
+    } {1 1 0 15 22.5 1 3 1 0 2 {} zset 1 1}
+
+    foreach enc {ziplist skiplist} {
+        test "ZRANK, ZRANGE, ZREVRANGE, ZRANGEBYSCORE against $enc" {
+            $r del zs
+            if {$enc eq {skiplist}} {
+                # The conversion is one way: fill and empty the zset
+                for {set i 0} {$i < 200} {incr i} {$r zadd zs $i filler$i}
+                for {set i 0} {$i < 200} {incr i} {$r zrem zs filler$i}
+            }
+            foreach {score member} {3 c 1 a 2 b 2 bb 5 e -inf min +inf max} {
+                $r zadd zs $score $member
+            }
+            set res [$r object encoding zs]
+            lappend res [$r zrank zs a] [$r zrevrank zs a] [$r zrank zs nosuch]
+            lappend res [$r zrange zs 0 -1] [$r zrange zs 1 2 withscores]
+            lappend res [$r zrevrange zs 0 2] [$r zrevrange zs -2 -1 withscores]
+            lappend res [$r zrangebyscore zs 2 5] [$r zrangebyscore zs (2 +inf]
+            lappend res [$r zrangebyscore zs -inf 3 limit 1 2 withscores]
+            lappend res [$r zrangebyscore zs 4 (5] [$r zrange zs 100 200]
+            lappend res [$r zrangebyscore zs 2 +inf limit 2 -1]
+            catch {$r zrangebyscore zs -inf +inf limit -1 2} e1
+            catch {$r zrangebyscore zs -inf +inf limit 0 x} e2
+            lappend res [string match *syntax* $e1] [string match *syntax* $e2]
+        } [list $enc 1 5 {} {min a b bb c e max} {a 1 b 2} {max e c} {a 1 min -inf} \
+               {b bb c e} {c e max} {a 1 b 2} {} {} {c e max} 1 1]
+    }
+
+    test {Sorted sets are converted to skiplists when they grow} {
+        $r del zs1 zs2
+        for {set i 0} {$i < 128} {incr i} {$r zadd zs1 [expr {$i%10}] m$i}
+        set res [$r object encoding zs1]
+        $r zadd zs1 0 onemore
+        lappend res [$r object encoding zs1] [$r zcard zs1] [$r zrank zs1 onemore]
+        lappend res [lrange [$r zrange zs1 0 -1] 0 3] [$r zrevrank zs1 m9]
+        $r zadd zs2 1 [string repeat x 100]
+        lappend res [$r object encoding zs2]
+    } {ziplist skiplist 129 13 {m0 m10 m100 m110} 1 skiplist}
+
+    foreach enc {ziplist hashtable} {
+        test "HSET, HGET, HMGET, HINCRBY, HDEL, HLEN against $enc" {
+            $r del h
+            if {$enc eq {hashtable}} {
+                # The conversion is one way: fill and empty the hash
+                for {set i 0} {$i < 200} {incr i} {$r hset h filler$i $i}
+                for {set i 0} {$i < 200} {incr i} {$r hdel h filler$i}
+            }
+            set res {}
+            lappend res [$r hset h name antirez] [$r hset h lang c]
+            lappend res [$r hset h name {salvatore sanfilippo}] [$r hlen h]
+            lappend res [$r hget h name] [$r hget h nosuch]
+            lappend res [$r hmget h lang nosuch name]
+            lappend res [$r hincrby h visits 10] [$r hincrby h visits -3]
+            lappend res [$r hincrby h lang 1] [$r hdel h lang] [$r hdel h lang]
+            lappend res [lsort [$r hgetall h]] [$r object encoding h] [$r type h]
+        } [list 1 1 0 2 {salvatore sanfilippo} {} {c {} {salvatore sanfilippo}} \
+               10 7 1 1 0 {7 name {salvatore sanfilippo} visits} $enc hash]
+    }
+
+    test {Hashes are converted to hash tables when they grow} {
+        $r del h1 h2 h3
+        for {set i 0} {$i < 128} {incr i} {$r hset h1 f$i v$i}
+        set res [$r object encoding h1]
+        $r hset h1 f0 updated
+        lappend res [$r object encoding h1]
+        $r hset h1 onemore x
+        lappend res [$r object encoding h1] [$r hlen h1] [$r hget h1 f0] [$r hget h1 f127]
+        $r hset h2 f [string repeat x 100]
+        $r hset h3 [string repeat x 100] v
+        lappend res [$r object encoding h2] [$r object encoding h3] [$r hget h3 [string repeat x 100]]
+        catch {$r hget zstr f} err
+        lappend res [string match *kind* $err]
+    } {ziplist ziplist hashtable 129 updated v127 hashtable hashtable v 1}
+
+    test {SETBIT, GETBIT and BITCOUNT against a random model} {
+        $r del bm
+        array set model {}
+        set err {}
+        for {set i 0} {$i < 1000} {incr i} {
+            set off [expr {int(rand()*5000)}]
+            set bit [expr {int(rand()*2)}]
+            set old [expr {[info exists model($off)] ? 1 : 0}]
+            if {[$r setbit bm $off $bit] != $old} {set err "setbit $off"}
+            if {$bit} {set model($off) 1} else {unset -nocomplain model($off)}
+        }
+        foreach off {0 7 8 100 4999 5000 99999} {
+            set exp [expr {[info exists model($off)] ? 1 : 0}]
+            if {[$r getbit bm $off] != $exp} {set err "getbit $off"}
+        }
+        if {[$r bitcount bm] != [array size model]} {set err bitcount}
+        set err
+    } {}
+
+    test {BITCOUNT ranges, SETBIT on shared and int values, bit errors} {
+        $r set fb foobar
+        set res [list [$r bitcount fb] [$r bitcount fb 1 1] [$r bitcount fb -2 -1]]
+        lappend res [$r bitcount fb 4 2] [$r bitcount nosuchkey]
+        $r set n 10
+        lappend res [$r getbit n 2] [$r setbit n 6 1] [$r get n]
+        $r set fb2 foobar
+        $r setbit fb2 7 1
+        lappend res [$r get fb2] [$r get fb] [$r setbit newbm 15 1] [string length [$r get newbm]]
+        catch {$r setbit fb -1 1} e1
+        catch {$r setbit fb 4294967296 1} e2
+        catch {$r setbit fb 0 2} e3
+        $r del bmlist
+        $r lpush bmlist x
+        catch {$r bitcount bmlist} e4
+        catch {$r bitcount fb 0 x} e5
+        catch {$r bitpos fb 1 1.5} e6
+        catch {$r bitpos nosuchkey 1 0 99999999999999999999} e7
+        lappend res [string match *ERR* $e1] [string match *ERR* $e2] \
+                    [string match *ERR* $e3] [string match *kind* $e4] \
+                    [string match *integer* $e5] [string match *integer* $e6] \
+                    [string match *integer* $e7]
+    } {26 6 7 0 0 1 0 30 goobar foobar 0 2 1 1 1 1 1 1 1}
+
+    test {BITOP AND, OR, XOR, NOT and BITPOS} {
+        $r del k1 k2 dest ones
+        # k1 is ff f0 00, k2 is 0f
+        for {set i 0} {$i < 12} {incr i} {$r setbit k1 $i 1}
+        $r setbit k1 23 0
+        for {set i 4} {$i < 8} {incr i} {$r setbit k2 $i 1}
+        set res [$r bitop and dest k1 k2 nosuchkey]
+        lappend res [$r bitcount dest]
+        $r bitop and dest k1 k2
+        lappend res [$r bitcount dest]
+        $r bitop or dest k1 k2
+        lappend res [$r bitcount dest] [$r bitop xor dest k1 k2] [$r bitcount dest]
+        lappend res [$r bitop not dest k1] [$r bitcount dest] [$r getbit dest 12]
+        lappend res [$r bitop or dest nosuch1 nosuch2] [$r exists dest]
+        lappend res [$r bitpos k1 0] [$r bitpos k1 1 1] [$r bitpos k1 1 2] [$r bitpos k1 0 0 0]
+        for {set i 0} {$i < 16} {incr i} {$r setbit ones $i 1}
+        lappend res [$r bitpos ones 0] [$r bitpos ones 0 0 -1] [$r bitpos nosuchkey 0]
+        catch {$r bitop not dest k1 k2} e1
+        catch {$r bitop nand dest k1} e2
+        lappend res [string match *ERR* $e1] [string match *ERR* $e2]
+    } {3 0 4 12 3 8 3 12 1 0 0 12 8 -1 -1 16 -1 0 1 1}
+
+    test {PFADD, PFCOUNT, sparse to dense} {
+        $r del hll
+        set res [list [$r pfadd hll a b c] [$r pfadd hll a b] [$r pfcount hll]]
+        lappend res [$r pfcount nosuchkey] [$r type hll] [string range [$r get hll] 0 3]
+        for {set i 0} {$i < 1000} {incr i} {$r pfadd hll ele:$i}
+        set card [$r pfcount hll]
+        lappend res [expr {abs($card-1003) < 30}] [expr {[string length [$r get hll]] < 3000}]
+        for {set i 1000} {$i < 20000} {incr i} {$r pfadd hll ele:$i}
+        set card [$r pfcount hll]
+        lappend res [expr {abs($card-20003) < 600}] [string length [$r get hll]]
+    } {1 0 3 0 string HYLL 1 1 1 12304}
+
+    test {PFMERGE and PFCOUNT of many keys} {
+        $r del h1 h2 h3 hdest hlist hstr
+        for {set i 0} {$i < 300} {incr i} {
+            $r pfadd h1 x:$i
+            $r pfadd h2 x:[expr {$i+200}]
+        }
+        for {set i 0} {$i < 5000} {incr i} {$r pfadd h3 y:$i}
+        set union [$r pfcount h1 h2 nosuchkey]
+        set res [list [expr {abs($union-500) < 15}] [$r pfmerge hdest h1 h2]]
+        lappend res [expr {[$r pfcount hdest] == $union}]
+        $r pfmerge hdest h3
+        set all [$r pfcount hdest]
+        lappend res [expr {abs($all-5500) < 170}] [expr {[$r pfcount h1 h2 h3] == $all}]
+        $r lpush hlist x
+        $r set hstr foo
+        catch {$r pfadd hlist a} e1
+        catch {$r pfcount hstr} e2
+        catch {$r pfmerge hdest h1 hstr} e3
+        lappend res [string match *kind* $e1] [string match *HyperLogLog* $e2] \
+                    [string match *HyperLogLog* $e3]
+        # A volatile destination is deleted before the write, as with PFADD
+        $r expire hdest 100
+        $r pfmerge hdest h1
+        lappend res [$r ttl hdest] [expr {[$r pfcount hdest] == [$r pfcount h1]}]
+    } {1 OK 1 1 1 1 1 1 -1 1}
+
+    test {PFADD, PFCOUNT reject sparse HyperLogLogs with bad opcodes} {
+        set hdr "HYLL\x01[string repeat \x00 11]"
+        set res {}
+        # XZERO cut by the end, too few registers, too many registers
+        foreach regs [list "\x7f" "\x00" "\x7f\xff\x00"] {
+            $r set hbad $hdr$regs
+            catch {$r pfadd hbad a} e1
+            catch {$r pfcount hbad} e2
+            lappend res [string match *HyperLogLog* $e1] [string match *HyperLogLog* $e2]
+        }
+        $r set hbad "$hdr\x7f\xff"
+        lappend res [$r pfadd hbad a] [$r pfcount hbad]
+    } {1 1 1 1 1 1 1 1}
+
+    test {BLPOP, BRPOP: served right away, or by a push to a waited key} {
+        $r del blist1 blist2
+        $r rpush blist1 a
+        $r rpush blist1 b
+        set res [list [$r blpop blist2 blist1 0] [$r brpop blist1 0]]
+        set rd [redis]
+        set bfd [$rd channel]
+        ::redis::redis_writenl $bfd "blpop blist1 blist2 0"
+        $r ping
+        lappend res [$r rpush blist2 foo] [$r llen blist2] [$r exists blist2]
+        lappend res [::redis::redis_read_reply $bfd]
+        lappend res [$r rpush blist2 bar] [$r llen blist2]
+        $rd close
+        set res
+    } {{blist1 a} {blist1 b} OK 0 0 {blist2 foo} OK 1}
+
+    test {BLPOP: FIFO among the waiting clients, timeouts and errors} {
+        $r del blist3 bstr
+        set rd1 [redis]
+        set rd2 [redis]
+        set bfd1 [$rd1 channel]
+        set bfd2 [$rd2 channel]
+        ::redis::redis_writenl $bfd1 "blpop blist3 0"
+        $r ping
+        ::redis::redis_writenl $bfd2 "brpop blist3 0"
+        $r ping
+        $r lpush blist3 first
+        $r lpush blist3 second
+        set res [list [::redis::redis_read_reply $bfd1] [::redis::redis_read_reply $bfd2]]
+        # The client answers the commands sent while it was blocked
+        ::redis::redis_writenl $bfd1 "blpop blist3 1"
+        ::redis::redis_writenl $bfd1 "ping"
+        lappend res [::redis::redis_read_reply $bfd1] [::redis::redis_read_reply $bfd1]
+        $r set bstr foo
+        catch {$r blpop bstr 0} e1
+        catch {$r blpop blist3 -1} e2
+        catch {$r blpop blist3 abc} e3
+        lappend res [string match *kind* $e1] [string match *negative* $e2] \
+                    [string match *ERR* $e3]
+        $rd1 close
+        $rd2 close
+        set res
+    } {{blist3 first} {blist3 second} {} PONG 1 1 1}
+
+    test {BLPOP: the input of a blocked client is bounded, and served later} {
+        $r del blist4
+        set rd [redis]
+        set bfd [$rd channel]
+        ::redis::redis_writenl $bfd "blpop blist4 0"
+        puts -nonewline $bfd [string repeat "PING\r\n" 30000]
+        flush $bfd
+        after 500
+        set qbuf -1
+        foreach line [split [$r client list] "\n"] {
+            if {[string match "*flags=b *" $line]} {
+                regexp {qbuf=(\d+)} $line - qbuf
+            }
+        }
+        set res [list [expr {$qbuf > 0 && $qbuf <= 70000}]]
+        $r rpush blist4 foo
+        lappend res [::redis::redis_read_reply $bfd]
+        set pongs 0
+        for {set i 0} {$i < 30000} {incr i} {
+            if {[::redis::redis_read_reply $bfd] eq "PONG"} {incr pongs}
+        }
+        lappend res $pongs
+        $rd close
+        set res
+    } {1 {blist4 foo} 30000}
+
+    test {Short strings are embedded in the object} {
+        $r set short foobar
+        $r set long [string repeat x 100]
+        $r set counter 10
+        $r incr counter
+        list [$r object encoding short] [$r get short] \
+             [$r object encoding long] [string length [$r get long]] \
+             [$r object encoding counter] [$r get counter]
+    } {embstr foobar raw 100 int 11}
+
+    test {Integer values are int encoded and decoded on demand} {
+        $r set n1 9999
+        $r set n2 -98765432109
+        $r set n3 007
+        $r set n4 1234567890123456789012
+        $r incr n1
+        $r incr n1
+        $r incrby n2 -1
+        list [$r object encoding n1] [$r get n1] \
+             [$r object encoding n2] [$r get n2] \
+             [$r object encoding n3] [$r get n3] \
+             [$r object encoding n4] [$r get n4] [$r mget n1 n3] \
+             [$r decrby n1 10002] [$r getset n1 abc] [$r get n1]
+    } {int 10001 int -98765432110 embstr 007 embstr 1234567890123456789012 {10001 007} -1 -1 abc}
+
+    test {OBJECT IDLETIME tracks the last access} {
+        $r set idlekey foo
+        after 2500
+        set idle1 [$r object idletime idlekey]
+        $r get idlekey
+        set idle2 [$r object idletime idlekey]
+        list [expr {$idle1 >= 2 && $idle1 <= 3}] [expr {$idle2 <= 1}]
+    } {1 1}
+
+    test {INFO reports keyspace hits and misses, OBJECT FREQ needs LFU} {
+        $r set hitkey foo
+        $r del misskey
+        set info [$r info]
+        regexp {keyspace_hits:(\d+)} $info - hits0
+        regexp {keyspace_misses:(\d+)} $info - misses0
+        $r get hitkey
+        $r get hitkey
+        $r get misskey
+        set info [$r info]
+        regexp {keyspace_hits:(\d+)} $info - hits1
+        regexp {keyspace_misses:(\d+)} $info - misses1
+        catch {$r object freq hitkey} err
+        list [expr {$hits1-$hits0}] [expr {$misses1-$misses0}] \
+             [string match {*LFU*} $err] [regexp {evicted_keys:0} $info]
+    } {2 1 1 1}
+
+    test {Slab pages are given back when the objects are freed} {
+        regexp {slab_pages:(\d+)} [$r info] - pages0
+        for {set i 0} {$i < 20000} {incr i} {
+            $r set slabkey:$i [string repeat x 50]
+        }
+        regexp {slab_pages:(\d+)} [$r info] - pages1
+        for {set i 0} {$i < 20000} {incr i} {
+            $r del slabkey:$i
+        }
+        set info [$r info]
+        regexp {slab_pages:(\d+)} $info - pages2
+        regexp {slab_fragmentation_ratio:([0-9.]+)} $info - ratio
+        list [expr {$pages1 > $pages0+10}] [expr {$pages2 < $pages0+10}] \
+             [expr {$ratio >= 1}]
+    } {1 1 1}
+
+    test {Big values are freed in background, shared members survive} {
+        $r del bigset bigcopy
+        for {set i 0} {$i < 1000} {incr i} {
+            $r sadd bigset m$i
+        }
+        regexp {lazyfreed_objects:(\d+)} [$r info] - freed0
+        $r sunionstore bigcopy bigset
+        $r del bigset
+        while {![regexp {lazyfree_pending_objects:0} [$r info]]} {
+            after 10
+        }
+        regexp {lazyfreed_objects:(\d+)} [$r info] - freed1
+        list [$r exists bigset] [$r scard bigcopy] [$r sismember bigcopy m7] \
+             [expr {$freed1-$freed0}]
+    } {0 1000 1 1}
+
+    test {FLUSHDB ASYNC} {
+        $r select 1
+        $r flushdb
+        for {set i 0} {$i < 100} {incr i} {
+            $r set asynckey:$i $i
+            if {$i % 2} {$r expire asynckey:$i 100}
+        }
+        $r sadd asyncset a
+        set res [list [$r flushdb async] [$r dbsize]]
+        $r set asynckey:1 foo
+        lappend res [$r get asynckey:1] [$r ttl asynckey:1]
+        catch {$r flushdb foo} err
+        lappend res [string match {*syntax*} $err]
+        $r select 0
+        set res
+    } {OK 0 foo -1 1}
+
+    test {INFO reports RSS and allocator fragmentation} {
+        set info [$r info]
+        regexp {used_memory:(\d+)} $info - used
+        regexp {used_memory_rss:(\d+)} $info - rss
+        regexp {mem_allocator:(\w+)} $info - allocator
+        list [expr {$used > 0}] [expr {$rss > 0}] \
+             [regexp {allocator_frag_ratio:[0-9.]+} $info] \
+             [expr {$allocator ne {}}]
+    } {1 1 1 1}
+
+    test {Values around the sds header size boundaries} {
+        set res {}
+        foreach len {255 256 65535 65536} {
+            set v [string repeat a $len]
+            $r set sdskey $v
+            lappend res [string equal [$r get sdskey] $v]
+        }
+        set res
+    } {1 1 1 1}
+
+    test {EXPIRE and TTL are kept in the key, SET clears them} {
+        set long [string repeat k 300]
+        $r set ek foo
+        $r set $long foo
+        set res [list [$r expire ek 100] [$r expire ek 200] [expr {[$r ttl ek] > 98}] \
+                     [$r expire $long 50] [expr {[$r ttl $long] > 48}] [$r get ek]]
+        $r set ek bar
+        $r incr $long
+        lappend res [$r ttl ek] [$r get ek] [$r ttl $long] [$r get $long]
+    } {1 0 1 1 1 foo -1 bar -1 1}
+
+    test {PEXPIRE and PTTL have millisecond precision} {
+        $r set pkey foo
+        set res [list [$r pexpire pkey 300] [expr {[$r pttl pkey] > 200}] \
+                     [$r ttl pkey]]
+        after 500
+        lappend res [$r get pkey] [$r pttl pkey]
+    } {1 1 0 {} -1}
+
+    test {EXPIRE and PEXPIRE reject out of range and non integer times} {
+        $r set bigexp foo
+        catch {$r expire bigexp 9223372036854775} e1
+        catch {$r pexpire bigexp 9223372036854775807} e2
+        catch {$r expire bigexp 10x} e3
+        set res [list [string match *range* $e1] [string match *range* $e2] \
+                     [string match *integer* $e3] [$r get bigexp] [$r ttl bigexp]]
+        lappend res [$r expire bigexp 1000000000] [expr {[$r ttl bigexp] > 999999990}]
+    } {1 1 1 foo -1 1 1}
+
+    test {Volatile keys are actively expired} {
+        regexp {expired_keys:(\d+)} [$r info] - expired0
+        set size0 [$r dbsize]
+        for {set i 0} {$i < 1000} {incr i} {
+            $r set expkey:$i foo
+            $r expire expkey:$i 1
+        }
+        after 3000
+        regexp {expired_keys:(\d+)} [$r info] - expired1
+        # DBSIZE doesn't touch the keys: only the active cycle removes them
+        list [expr {$expired1-$expired0}] [expr {[$r dbsize]-$size0}]
+    } {1000 0}
+
+    test {expire-index wheel: volatile keys actively expired, SET/DEL/FLUSHDB update the wheel} {
+        # A server of its own, started with the wheel expire index
+        set wbin [file join [file dirname [info script]] redis-server]
+        set wport [expr {$port+1000}]
+        set wconf [file join /tmp redis-test-wheel-[pid].conf]
+        set wcfd [open $wconf w]
+        puts $wcfd "port $wport\nexpire-index wheel\ndir /tmp\ndbfilename redis-test-wheel-[pid].rdb\nsave 900000000 1000000000\nloglevel warning"
+        close $wcfd
+        set wpid [exec $wbin $wconf >/dev/null 2>/dev/null &]
+        for {set i 0} {$i < 50} {incr i} {
+            if {![catch {set w [redis 127.0.0.1 $wport]}]} break
+            after 100
+        }
+        for {set i 0} {$i < 1000} {incr i} {
+            $w set wkey:$i foo
+            $w expire wkey:$i 1
+            $w set wkeep:$i foo
+        }
+        # SET clears the expire, DEL and FLUSHDB drop the key: no stale node
+        # of the wheel may delete the key set again afterwards
+        $w set wset foo
+        $w pexpire wset 300
+        $w set wset bar
+        $w set wdel foo
+        $w pexpire wdel 300
+        $w del wdel
+        $w set wdel bar
+        $w select 1
+        $w set wflush foo
+        $w pexpire wflush 300
+        $w flushdb
+        $w set wflush bar
+        $w set wlong foo
+        $w expire wlong 1000
+        $w select 0
+        after 2500
+        regexp {expired_keys:(\d+)} [$w info] - wexpired
+        set res [list $wexpired [$w dbsize] [$w get wset] [$w ttl wset] [$w get wdel]]
+        $w select 1
+        lappend res [$w get wflush] [expr {[$w ttl wlong] > 990}]
+        $w select 0
+        # Keys expired by the wheel can be set volatile again
+        $w set wkey:0 foo
+        $w pexpire wkey:0 200
+        after 600
+        regexp {expired_keys:(\d+)} [$w info] - wexpired
+        lappend res $wexpired [$w exists wkey:0]
+        $w close
+        exec kill $wpid
+        file delete $wconf
+        set res
+    } {1000 1002 bar -1 bar bar 1 1001 0}
+
+    test {SORT BY and GET with int encoded values} {
+        $r del intlist
+        $r rpush intlist 1
+        $r rpush intlist 2
+        $r rpush intlist 3
+        $r set weight_1 30
+        $r set weight_2 -10
+        $r set weight_3 20
+        $r set obj_1 100
+        $r set obj_2 200
+        $r set obj_3 300000
+        list [$r sort intlist by weight_* get obj_*] \
+             [$r sort intlist by weight_* alpha]
+    } {{200 300000 100} {2 3 1}}
+
     test {SAVE - make sure there are all the types as values} {
         $r lpush mysavelist hello
         $r lpush mysavelist world
         $r set myemptykey {}
         $r set mynormalkey {blablablba}
+        $r zadd mysavezset 1 hello
+        $r zadd mysavezset 2.5 world
+        $r hset mysavehash field value
         $r save
     } {OK}
     
@@ -643,6 +1250,139 @@ proc main {server port} {
         list [$r lrange mylist 0 -1] $res
     } {{foo bar foobar foobared zap test} 2}
 
+    test {Small lists are ziplist encoded} {
+        $r flushall
+        $r rpush smalllist a
+        $r rpush smalllist b
+        $r lpush smalllist c
+        list [$r object encoding smalllist] [$r lrange smalllist 0 -1]
+    } {ziplist {c a b}}
+
+    test {List converted to quicklist when too many elements} {
+        $r del biglist
+        for {set i 0} {$i < 200} {incr i} {
+            $r rpush biglist $i
+        }
+        list [$r object encoding biglist] [$r llen biglist] \
+             [$r lindex biglist 150] [$r lindex biglist -1]
+    } {quicklist 200 150 199}
+
+    test {List converted to quicklist when an element is too big} {
+        $r del biglist
+        $r rpush biglist foo
+        $r rpush biglist [string repeat x 100]
+        list [$r object encoding biglist] [$r llen biglist] [$r rpop biglist]
+    } [list quicklist 2 [string repeat x 100]]
+
+    test {LSET on ziplist converts when the new value is too big} {
+        $r del smalllist
+        $r rpush smalllist a
+        $r rpush smalllist b
+        $r lset smalllist 1 [string repeat y 100]
+        list [$r object encoding smalllist] [$r lindex smalllist 1]
+    } [list quicklist [string repeat y 100]]
+
+    test {LSET of big values in the middle of quicklist nodes} {
+        $r del biglist
+        set lmodel {}
+        for {set i 0} {$i < 300} {incr i} {
+            $r rpush biglist $i
+            lappend lmodel $i
+        }
+        foreach idx {150 0 299 1 151 -2} {
+            set big [string repeat $idx 9000]
+            $r lset biglist $idx $big
+            lset lmodel [expr {$idx < 0 ? [llength $lmodel]+$idx : $idx}] $big
+        }
+        $r lset biglist 150 small
+        lset lmodel 150 small
+        $r lpush biglist head
+        set lmodel [linsert $lmodel 0 head]
+        list [$r llen biglist] [expr {[$r lrange biglist 0 -1] eq $lmodel}] \
+             [$r lindex biglist 151] [string length [$r lindex biglist 152]]
+    } {301 1 small 27000}
+
+    test {ziplist and quicklist lists behave the same} {
+        set err {}
+        $r del zl ll
+        for {set i 0} {$i < 200} {incr i} {$r rpush ll [string repeat z 70]}
+        $r ltrim ll 0 -1
+        for {set i 0} {$i < 200} {incr i} {$r rpop ll}
+        $r rpush zl x
+        $r rpop zl
+        for {set i 0} {$i < 2000} {incr i} {
+            set v [expr int(rand()*10)]
+            set a [expr int(rand()*12)-6]
+            set b [expr int(rand()*12)-6]
+            switch [expr int(rand()*8)] {
+                0 {set cmd [list lpush KEY $v]}
+                1 {set cmd [list rpush KEY $v]}
+                2 {set cmd [list lpop KEY]}
+                3 {set cmd [list rpop KEY]}
+                4 {set cmd [list lrem KEY $a $v]}
+                5 {set cmd [list ltrim KEY $a [expr $b+20]]}
+                6 {set cmd [list lset KEY $a $v]}
+                7 {set cmd [list lindex KEY $a]}
+            }
+            catch {eval $r [string map {KEY zl} $cmd]} r1
+            catch {eval $r [string map {KEY ll} $cmd]} r2
+            if {$r1 ne $r2 || [$r lrange zl 0 -1] ne [$r lrange ll 0 -1]} {
+                set err "$cmd: $r1 / $r2"
+                break
+            }
+        }
+        list $err [$r object encoding zl] [$r object encoding ll]
+    } {{} ziplist quicklist}
+
+    test {Big quicklist LINDEX/LSET/LRANGE/LTRIM/LREM against a Tcl list} {
+        set err {}
+        set mylist {}
+        $r del ql
+        for {set i 0} {$i < 2000} {incr i} {
+            $r rpush ql $i
+            lappend mylist $i
+        }
+        for {set i 0} {$i < 500} {incr i} {
+            set idx [expr int(rand()*[llength $mylist])]
+            switch [expr int(rand()*5)] {
+                0 {
+                    set got [$r lindex ql $idx]
+                    set exp [lindex $mylist $idx]
+                }
+                1 {
+                    $r lset ql $idx foo$i
+                    lset mylist $idx foo$i
+                    set got [$r lindex ql [expr $idx-[llength $mylist]]]
+                    set exp foo$i
+                }
+                2 {
+                    set got [$r lrange ql $idx [expr $idx+150]]
+                    set exp [lrange $mylist $idx [expr $idx+150]]
+                }
+                3 {
+                    $r lpush ql h$i
+                    $r rpush ql t$i
+                    set mylist [concat h$i $mylist t$i]
+                    set got [$r llen ql]
+                    set exp [llength $mylist]
+                }
+                4 {
+                    set v [lindex $mylist $idx]
+                    set got [$r lrem ql 1 $v]
+                    set mylist [lreplace $mylist $idx $idx]
+                    set exp 1
+                }
+            }
+            if {$got ne $exp} {
+                set err "step $i: $got / $exp"
+                break
+            }
+        }
+        $r ltrim ql 300 -300
+        set mylist [lrange $mylist 300 end-299]
+        list $err [$r object encoding ql] [expr {[$r lrange ql 0 -1] eq $mylist}]
+    } {{} quicklist 1}
+
     test {MGET} {
         $r flushall
         $r set foo BAR
@@ -0,0 +1,158 @@
+/* timewheel.c - Hierarchical timing wheel of intrusive nodes
+ *
+ * Copyright (c) 2006-2009, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Every node is in the slot of the level covering its distance from
+ * w->next, the slot index being the corresponding bits of node->when:
+ *
+ *   level 0: when-next < 2^8, slot when & 255
+ *   level l: when-next < 2^(8+6*l), slot (when >> (8+6*(l-1))) & 63
+ *
+ * The level 0 slot of w->next holds the nodes due now, the ones added
+ * when already due are kept apart in w->due. When w->next enters a new turn of level 0 the level 1 slot
+ * of the new turn is moved down, and so on for the upper levels: every
+ * node is moved at most WHEEL_LEVELS-1 times. Popping the due nodes then
+ * costs O(expired + elapsed ticks) with no scan of the pending nodes. */
+
+#include <string.h>
+
+#include "timewheel.h"
+#include "zmalloc.h"
+
+timeWheel *wheelCreate(long long now) {
+    timeWheel *w = zmalloc(sizeof(*w));
+
+    if (w == NULL) return NULL;
+    w->next = now;
+    wheelEmpty(w);
+    return w;
+}
+
+void wheelRelease(timeWheel *w) {
+    zfree(w);
+}
+
+void wheelEmpty(timeWheel *w) {
+    memset(w->slots,0,sizeof(w->slots));
+    w->due = NULL;
+    w->count = 0;
+}
+
+static wheelNode **wheelSlot(timeWheel *w, long long when) {
+    unsigned long long delta;
+    int level, shift;
+
+    if (when < w->next) return &w->due;
+    delta = when - w->next;
+    if (delta < WHEEL_L0_SIZE)
+        return w->slots+(when & (WHEEL_L0_SIZE-1));
+    /* Too far: park it in the last level, it will be moved down later */
+    if (delta >= 1ULL<<(WHEEL_L0_BITS+WHEEL_LN_BITS*(WHEEL_LEVELS-1)))
+        when = w->next+(1LL<<(WHEEL_L0_BITS+WHEEL_LN_BITS*(WHEEL_LEVELS-1)))-1;
+    for (level = 1, shift = WHEEL_L0_BITS; level < WHEEL_LEVELS-1; level++) {
+        if (delta < 1ULL<<(shift+WHEEL_LN_BITS)) break;
+        shift += WHEEL_LN_BITS;
+    }
+    return w->slots+WHEEL_L0_SIZE+(level-1)*WHEEL_LN_SIZE+
+           ((when >> shift) & (WHEEL_LN_SIZE-1));
+}
+
+static void wheelLink(wheelNode **slot, wheelNode *node) {
+    node->next = *slot;
+    if (node->next) node->next->pprev = &node->next;
+    node->pprev = slot;
+    *slot = node;
+}
+
+static void wheelUnlink(wheelNode *node) {
+    *node->pprev = node->next;
+    if (node->next) node->next->pprev = node->pprev;
+    node->pprev = NULL;
+}
+
+void wheelAdd(timeWheel *w, wheelNode *node) {
+    wheelLink(wheelSlot(w,node->when),node);
+    w->count++;
+}
+
+void wheelRemove(timeWheel *w, wheelNode *node) {
+    if (node->pprev == NULL) return;
+    wheelUnlink(node);
+    w->count--;
+}
+
+/* w->next just entered a new turn of level 0: move down the nodes of the
+ * upper level slots that start now */
+static void wheelCascade(timeWheel *w) {
+    int level, shift = WHEEL_L0_BITS;
+
+    for (level = 1; level < WHEEL_LEVELS; level++) {
+        int idx = (w->next >> shift) & (WHEEL_LN_SIZE-1);
+        wheelNode **slot = w->slots+WHEEL_L0_SIZE+(level-1)*WHEEL_LN_SIZE+idx;
+        wheelNode *node = *slot;
+
+        *slot = NULL;
+        while (node) {
+            wheelNode *next = node->next;
+
+            wheelLink(wheelSlot(w,node->when),node);
+            node = next;
+        }
+        /* The upper level only starts a new slot with this one */
+        if (idx != 0) break;
+        shift += WHEEL_LN_BITS;
+    }
+}
+
+wheelNode *wheelPop(timeWheel *w, long long upto) {
+    if (w->due) {
+        wheelNode *node = w->due;
+
+        wheelUnlink(node);
+        w->count--;
+        return node;
+    }
+    while (w->next <= upto) {
+        wheelNode *node = w->slots[w->next & (WHEEL_L0_SIZE-1)];
+
+        if (node) {
+            wheelUnlink(node);
+            w->count--;
+            return node;
+        }
+        if (w->count == 0) {
+            /* Nothing to move down: jump ahead */
+            w->next = upto+1;
+            return NULL;
+        }
+        w->next++;
+        if ((w->next & (WHEEL_L0_SIZE-1)) == 0) wheelCascade(w);
+    }
+    return NULL;
+}
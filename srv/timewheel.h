@@ -0,0 +1,72 @@
+/* timewheel.h - Hierarchical timing wheel of intrusive nodes
+ *
+ * Copyright (c) 2006-2009, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __TIMEWHEEL_H__
+#define __TIMEWHEEL_H__
+
+/* Level 0 has one slot per tick, every other level one slot per turn of the
+ * level below it. Nodes due within 2^(8+6*4) ticks are kept in order; the
+ * others wait in the last level and are moved down as time goes by. */
+#define WHEEL_L0_BITS 8
+#define WHEEL_LN_BITS 6
+#define WHEEL_LEVELS 5
+#define WHEEL_L0_SIZE (1<<WHEEL_L0_BITS)
+#define WHEEL_LN_SIZE (1<<WHEEL_LN_BITS)
+#define WHEEL_SLOTS (WHEEL_L0_SIZE+(WHEEL_LEVELS-1)*WHEEL_LN_SIZE)
+
+/* The node is embedded in the structure to schedule, no allocations */
+typedef struct wheelNode {
+    long long when;             /* due tick */
+    struct wheelNode *next;
+    struct wheelNode **pprev;   /* NULL if not in a wheel */
+} wheelNode;
+
+typedef struct timeWheel {
+    long long next;             /* next tick to process */
+    unsigned long count;        /* nodes in the wheel */
+    wheelNode *due;             /* nodes added when already due */
+    wheelNode *slots[WHEEL_SLOTS];
+} timeWheel;
+
+#define wheelCount(w) ((w)->count)
+
+/* 创建时间轮, 'now'是当前的tick */
+timeWheel *wheelCreate(long long now);
+void wheelRelease(timeWheel *w);
+/* 丢弃所有节点(不访问节点本身,它们可能已经被释放) */
+void wheelEmpty(timeWheel *w);
+/* 按node->when加入, when已经过去的节点会在下一次wheelPop()时返回 */
+void wheelAdd(timeWheel *w, wheelNode *node);
+/* 从时间轮中移除, 节点不在时间轮中时什么也不做 */
+void wheelRemove(timeWheel *w, wheelNode *node);
+/* 移除并返回一个when <= upto的节点, 没有则返回NULL */
+wheelNode *wheelPop(timeWheel *w, long long upto);
+
+#endif /* __TIMEWHEEL_H__ */
@@ -0,0 +1,486 @@
+/* ziplist.c - A compact list of strings stored in a single allocation
+ *
+ * The ziplist is used to encode small lists: instead of paying a listNode,
+ * an robj and an sds header for every element, all the elements are stored
+ * length-prefixed one after the other in a single contiguous buffer.
+ * Push and pop at both ends are O(1) plus the realloc/memmove of the buffer,
+ * that is cheap as long as the list is small.
+ *
+ * The general layout is:
+ *
+ * <zlbytes><zltail><zllen><entry><entry>...<entry><zlend>
+ *
+ * <zlbytes> is an unsigned 32 bit integer holding the number of bytes the
+ * ziplist occupies, so that it can be resized without a traversal.
+ *
+ * <zltail> is the offset of the last entry, to pop/push on the tail in O(1).
+ *
+ * <zllen> is the number of entries. When it is 2^16-1 the real number is
+ * only known traversing the whole list.
+ *
+ * <zlend> is a single byte set to 255. No entry can start with 255.
+ *
+ * Every entry is prefixed by two lengths. The first is the length of the
+ * previous entry, in order to traverse the list from back to front: one byte
+ * if it is less than 254, otherwise the byte 254 followed by a 4 bytes
+ * unsigned integer. The second is the length of the payload, encoded as the
+ * lengths of the dump file (see rdbSaveLen()):
+ *
+ * 00|xxxxxx => 6 bit length
+ * 01|xxxxxx xxxxxxxx => 14 bit length
+ * 10|000000 [32 bit length]
+ *
+ * Integers are stored in host byte order: ziplists are never written to disk
+ * as they are.
+ *
+ * Copyright (c) 2006-2009, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include "zmalloc.h"
+#include "ziplist.h"
+
+#define ZIP_END 255
+#define ZIP_BIGLEN 254
+
+/* Payload length encodings, see the top comment */
+#define ZIP_LEN_6BIT 0
+#define ZIP_LEN_14BIT 1
+#define ZIP_LEN_32BIT 2
+
+/* Utility macros */
+#define ZIPLIST_BYTES(zl) (*((uint32_t*)(zl)))
+#define ZIPLIST_TAIL_OFFSET(zl) (*((uint32_t*)((zl)+sizeof(uint32_t))))
+#define ZIPLIST_LENGTH(zl) (*((uint16_t*)((zl)+sizeof(uint32_t)*2)))
+#define ZIPLIST_HEADER_SIZE (sizeof(uint32_t)*2+sizeof(uint16_t))
+#define ZIPLIST_ENTRY_HEAD(zl) ((zl)+ZIPLIST_HEADER_SIZE)
+#define ZIPLIST_ENTRY_TAIL(zl) ((zl)+ZIPLIST_TAIL_OFFSET(zl))
+#define ZIPLIST_ENTRY_END(zl) ((zl)+ZIPLIST_BYTES(zl)-1)
+
+/* 长度未知(UINT16_MAX)时不再更新,由ziplistLen()遍历计算 */
+#define ZIPLIST_INCR_LENGTH(zl,incr) { \
+    if (ZIPLIST_LENGTH(zl) < UINT16_MAX) ZIPLIST_LENGTH(zl)+=incr; }
+
+typedef struct zlentry {
+    unsigned int prevrawlensize, prevrawlen;   /* 前一个entry的长度及其编码字节数 */
+    unsigned int lensize, len;                 /* payload的长度及其编码字节数 */
+    unsigned int headersize;
+    unsigned char *p;
+} zlentry;
+
+/* Return the number of bytes used to encode the payload length 'len'.
+ * When 'p' is not NULL the encoded length is written there as well. */
+static unsigned int zipEncodeLength(unsigned char *p, unsigned int len) {
+    unsigned char buf[5];
+    unsigned int size;
+
+    if (len < (1<<6)) {
+        buf[0] = (len&0x3f)|(ZIP_LEN_6BIT<<6);
+        size = 1;
+    } else if (len < (1<<14)) {
+        buf[0] = ((len>>8)&0x3f)|(ZIP_LEN_14BIT<<6);
+        buf[1] = len&0xff;
+        size = 2;
+    } else {
+        buf[0] = (ZIP_LEN_32BIT<<6);
+        memcpy(buf+1,&len,sizeof(len));
+        size = 1+sizeof(len);
+    }
+    if (p) memcpy(p,buf,size);
+    return size;
+}
+
+static unsigned int zipDecodeLength(unsigned char *p, unsigned int *lensize) {
+    unsigned int len = 0;
+
+    switch(p[0]>>6) {
+    case ZIP_LEN_6BIT:
+        len = p[0]&0x3f;
+        *lensize = 1;
+        break;
+    case ZIP_LEN_14BIT:
+        len = ((p[0]&0x3f)<<8)|p[1];
+        *lensize = 2;
+        break;
+    case ZIP_LEN_32BIT:
+        memcpy(&len,p+1,sizeof(len));
+        *lensize = 1+sizeof(len);
+        break;
+    default:
+        assert(NULL);
+    }
+    return len;
+}
+
+/* Return the number of bytes needed to encode the length of the previous
+ * entry, writing it in 'p' if it is not NULL. */
+static unsigned int zipPrevEncodeLength(unsigned char *p, unsigned int len) {
+    if (p == NULL) {
+        return (len < ZIP_BIGLEN) ? 1 : sizeof(len)+1;
+    } else if (len < ZIP_BIGLEN) {
+        p[0] = len;
+        return 1;
+    } else {
+        p[0] = ZIP_BIGLEN;
+        memcpy(p+1,&len,sizeof(len));
+        return 1+sizeof(len);
+    }
+}
+
+/* Store the previous entry length using exactly 'size' bytes. A 5 bytes
+ * field is allowed to hold a small length: fields are never shrunk, in
+ * order to avoid cascading updates when an entry gets smaller. */
+static void zipPrevStoreLength(unsigned char *p, unsigned int len, unsigned int size) {
+    if (size == 1) {
+        assert(len < ZIP_BIGLEN);
+        p[0] = len;
+    } else {
+        p[0] = ZIP_BIGLEN;
+        memcpy(p+1,&len,sizeof(len));
+    }
+}
+
+static unsigned int zipPrevDecodeLength(unsigned char *p, unsigned int *lensize) {
+    unsigned int len;
+
+    if (p[0] < ZIP_BIGLEN) {
+        *lensize = 1;
+        return p[0];
+    }
+    *lensize = 1+sizeof(len);
+    memcpy(&len,p+1,sizeof(len));
+    return len;
+}
+
+static zlentry zipEntry(unsigned char *p) {
+    zlentry e;
+
+    e.prevrawlen = zipPrevDecodeLength(p,&e.prevrawlensize);
+    e.len = zipDecodeLength(p+e.prevrawlensize,&e.lensize);
+    e.headersize = e.prevrawlensize+e.lensize;
+    e.p = p;
+    return e;
+}
+
+/* Return the total number of bytes used by the entry at 'p' */
+static unsigned int zipRawEntryLength(unsigned char *p) {
+    zlentry e = zipEntry(p);
+    return e.headersize+e.len;
+}
+
+static unsigned char *ziplistResize(unsigned char *zl, unsigned int len) {
+    zl = zrealloc(zl,len);
+    ZIPLIST_BYTES(zl) = len;
+    zl[len-1] = ZIP_END;
+    return zl;
+}
+
+unsigned char *ziplistNew(void) {
+    unsigned int bytes = ZIPLIST_HEADER_SIZE+1;
+    unsigned char *zl = zmalloc(bytes);
+
+    ZIPLIST_BYTES(zl) = bytes;
+    ZIPLIST_TAIL_OFFSET(zl) = ZIPLIST_HEADER_SIZE;
+    ZIPLIST_LENGTH(zl) = 0;
+    zl[bytes-1] = ZIP_END;
+    return zl;
+}
+
+/* When an entry grows, the length field of the previous entry length in
+ * the next entry may need to grow as well, making the next entry bigger,
+ * and so forth. Starting from the entry at 'p' fix the following entries
+ * until the previous length fields are consistent again. */
+static unsigned char *__ziplistCascadeUpdate(unsigned char *zl, unsigned char *p) {
+    size_t curlen = ZIPLIST_BYTES(zl), rawlen, offset, noffset;
+    unsigned char *np;
+    zlentry cur, next;
+
+    while (p[0] != ZIP_END) {
+        cur = zipEntry(p);
+        rawlen = cur.headersize+cur.len;
+        np = p+rawlen;
+        if (np[0] == ZIP_END) break;
+        next = zipEntry(np);
+        if (next.prevrawlen == rawlen) break;
+
+        if (next.prevrawlensize > 1 || rawlen < ZIP_BIGLEN) {
+            /* The field is big enough, the length of the next entry does
+             * not change so we can stop here. */
+            zipPrevStoreLength(np,rawlen,next.prevrawlensize);
+            break;
+        }
+
+        /* The next entry needs 4 more bytes to store our length */
+        offset = p-zl;
+        zl = ziplistResize(zl,curlen+4);
+        p = zl+offset;
+        np = p+rawlen;
+        noffset = np-zl;
+        if ((zl+ZIPLIST_TAIL_OFFSET(zl)) != np)
+            ZIPLIST_TAIL_OFFSET(zl) += 4;
+        memmove(np+5,np+1,curlen-noffset-1-1);
+        zipPrevStoreLength(np,rawlen,5);
+        p = np;
+        curlen += 4;
+    }
+    return zl;
+}
+
+/* Insert the string 's' before the entry at 'p' ('p' can point to the
+ * end of the ziplist in order to append). */
+static unsigned char *__ziplistInsert(unsigned char *zl, unsigned char *p, unsigned char *s, unsigned int slen) {
+    size_t curlen = ZIPLIST_BYTES(zl), offset;
+    unsigned int prevlen = 0, reqlen, nextsize = 0;
+    int nextdiff = 0;
+    zlentry entry, tail;
+
+    /* Find out the length of the entry before the insert position */
+    if (p[0] != ZIP_END) {
+        entry = zipEntry(p);
+        prevlen = entry.prevrawlen;
+        nextsize = entry.prevrawlensize;
+    } else {
+        unsigned char *ptail = ZIPLIST_ENTRY_TAIL(zl);
+        if (ptail[0] != ZIP_END) prevlen = zipRawEntryLength(ptail);
+    }
+
+    reqlen = zipPrevEncodeLength(NULL,prevlen)+zipEncodeLength(NULL,slen)+slen;
+
+    /* The next entry must be able to hold the length of the new entry */
+    if (p[0] != ZIP_END && nextsize < zipPrevEncodeLength(NULL,reqlen)) {
+        nextdiff = zipPrevEncodeLength(NULL,reqlen)-nextsize;
+        nextsize += nextdiff;
+    }
+
+    offset = p-zl;
+    zl = ziplistResize(zl,curlen+reqlen+nextdiff);
+    p = zl+offset;
+
+    if (p[0] != ZIP_END) {
+        /* Make room for the new entry. When the previous length field of
+         * the next entry grows, its first bytes come from before 'p' and
+         * are overwritten below. */
+        memmove(p+reqlen,p-nextdiff,curlen-offset-1+nextdiff);
+        zipPrevStoreLength(p+reqlen,reqlen,nextsize);
+
+        ZIPLIST_TAIL_OFFSET(zl) += reqlen;
+        /* When the next entry is not the tail the tail moved by nextdiff
+         * bytes as well. */
+        tail = zipEntry(p+reqlen);
+        if (p[reqlen+tail.headersize+tail.len] != ZIP_END)
+            ZIPLIST_TAIL_OFFSET(zl) += nextdiff;
+    } else {
+        /* This entry is the new tail */
+        ZIPLIST_TAIL_OFFSET(zl) = p-zl;
+    }
+
+    if (nextdiff != 0) {
+        offset = p-zl;
+        zl = __ziplistCascadeUpdate(zl,p+reqlen);
+        p = zl+offset;
+    }
+
+    /* Write the entry */
+    p += zipPrevEncodeLength(p,prevlen);
+    p += zipEncodeLength(p,slen);
+    memcpy(p,s,slen);
+    ZIPLIST_INCR_LENGTH(zl,1);
+    return zl;
+}
+
+/* Delete 'num' consecutive entries starting at 'p' */
+static unsigned char *__ziplistDelete(unsigned char *zl, unsigned char *p, unsigned int num) {
+    unsigned int i, totlen, deleted = 0, nextsize;
+    size_t offset;
+    int nextdiff = 0;
+    zlentry first, tail;
+
+    first = zipEntry(p);
+    for (i = 0; p[0] != ZIP_END && i < num; i++) {
+        p += zipRawEntryLength(p);
+        deleted++;
+    }
+
+    totlen = p-first.p;
+    if (totlen == 0) return zl;
+
+    if (p[0] != ZIP_END) {
+        /* The entry at 'p' now follows the entry before 'first': store
+         * that length, growing the field if needed using bytes of the
+         * deleted entries. */
+        zipPrevDecodeLength(p,&nextsize);
+        if (nextsize < zipPrevEncodeLength(NULL,first.prevrawlen)) {
+            nextdiff = zipPrevEncodeLength(NULL,first.prevrawlen)-nextsize;
+            nextsize += nextdiff;
+        }
+        p -= nextdiff;
+        zipPrevStoreLength(p,first.prevrawlen,nextsize);
+
+        ZIPLIST_TAIL_OFFSET(zl) -= totlen;
+        tail = zipEntry(p);
+        if (p[tail.headersize+tail.len] != ZIP_END)
+            ZIPLIST_TAIL_OFFSET(zl) += nextdiff;
+
+        memmove(first.p,p,ZIPLIST_BYTES(zl)-(p-zl)-1);
+    } else {
+        /* The whole tail was deleted */
+        ZIPLIST_TAIL_OFFSET(zl) = (first.p-zl)-first.prevrawlen;
+    }
+
+    offset = first.p-zl;
+    zl = ziplistResize(zl,ZIPLIST_BYTES(zl)-totlen+nextdiff);
+    ZIPLIST_INCR_LENGTH(zl,-deleted);
+    p = zl+offset;
+
+    if (nextdiff != 0)
+        zl = __ziplistCascadeUpdate(zl,p);
+    return zl;
+}
+
+unsigned char *ziplistPush(unsigned char *zl, unsigned char *s, unsigned int slen, int where) {
+    unsigned char *p;
+
+    p = (where == ZIPLIST_HEAD) ? ZIPLIST_ENTRY_HEAD(zl) : ZIPLIST_ENTRY_END(zl);
+    return __ziplistInsert(zl,p,s,slen);
+}
+
+/* Return a pointer to the entry at the specified index. Negative indexes
+ * count from the tail, -1 is the last entry. NULL is returned when the
+ * index is out of range. */
+unsigned char *ziplistIndex(unsigned char *zl, int index) {
+    unsigned char *p;
+    unsigned int prevlensize, prevlen;
+
+    if (index < 0) {
+        index = (-index)-1;
+        p = ZIPLIST_ENTRY_TAIL(zl);
+        if (p[0] != ZIP_END) {
+            prevlen = zipPrevDecodeLength(p,&prevlensize);
+            while (prevlen > 0 && index--) {
+                p -= prevlen;
+                prevlen = zipPrevDecodeLength(p,&prevlensize);
+            }
+        }
+    } else {
+        p = ZIPLIST_ENTRY_HEAD(zl);
+        while (p[0] != ZIP_END && index--)
+            p += zipRawEntryLength(p);
+    }
+    return (p[0] == ZIP_END || index > 0) ? NULL : p;
+}
+
+/* Return the entry after 'p', or NULL at the end of the list */
+unsigned char *ziplistNext(unsigned char *zl, unsigned char *p) {
+    ((void) zl);
+
+    if (p[0] == ZIP_END) return NULL;
+    p += zipRawEntryLength(p);
+    if (p[0] == ZIP_END) return NULL;
+    return p;
+}
+
+/* Return the entry before 'p', or NULL at the start of the list */
+unsigned char *ziplistPrev(unsigned char *zl, unsigned char *p) {
+    unsigned int prevlensize, prevlen;
+
+    if (p[0] == ZIP_END) {
+        p = ZIPLIST_ENTRY_TAIL(zl);
+        return (p[0] == ZIP_END) ? NULL : p;
+    } else if (p == ZIPLIST_ENTRY_HEAD(zl)) {
+        return NULL;
+    }
+    prevlen = zipPrevDecodeLength(p,&prevlensize);
+    assert(prevlen > 0);
+    return p-prevlen;
+}
+
+unsigned int ziplistGet(unsigned char *p, unsigned char **sval, unsigned int *slen) {
+    zlentry entry;
+
+    if (p == NULL || p[0] == ZIP_END) return 0;
+    entry = zipEntry(p);
+    *sval = p+entry.headersize;
+    *slen = entry.len;
+    return 1;
+}
+
+unsigned char *ziplistInsert(unsigned char *zl, unsigned char *p, unsigned char *s, unsigned int slen) {
+    return __ziplistInsert(zl,p,s,slen);
+}
+
+/* Delete the entry at '*p'. On return '*p' points to the entry that
+ * followed the deleted one (or to the end of the list), so that the
+ * list can be deleted while iterating. */
+unsigned char *ziplistDelete(unsigned char *zl, unsigned char **p) {
+    size_t offset = *p-zl;
+
+    zl = __ziplistDelete(zl,*p,1);
+    *p = zl+offset;
+    return zl;
+}
+
+/* Delete 'num' entries starting at 'index' */
+unsigned char *ziplistDeleteRange(unsigned char *zl, unsigned int index, unsigned int num) {
+    unsigned char *p = ziplistIndex(zl,(int)index);
+    return (p == NULL) ? zl : __ziplistDelete(zl,p,num);
+}
+
+/* Return 1 if the entry at 'p' is equal to the string 's' */
+unsigned int ziplistCompare(unsigned char *p, unsigned char *s, unsigned int slen) {
+    zlentry entry;
+
+    if (p[0] == ZIP_END) return 0;
+    entry = zipEntry(p);
+    if (entry.len != slen) return 0;
+    return memcmp(p+entry.headersize,s,slen) == 0;
+}
+
+unsigned int ziplistLen(unsigned char *zl) {
+    unsigned int len = 0;
+
+    if (ZIPLIST_LENGTH(zl) < UINT16_MAX) {
+        len = ZIPLIST_LENGTH(zl);
+    } else {
+        unsigned char *p = ZIPLIST_ENTRY_HEAD(zl);
+        while (*p != ZIP_END) {
+            p += zipRawEntryLength(p);
+            len++;
+        }
+        /* Re-store the length if it is small enough */
+        if (len < UINT16_MAX) ZIPLIST_LENGTH(zl) = len;
+    }
+    return len;
+}
+
+size_t ziplistBlobLen(unsigned char *zl) {
+    return ZIPLIST_BYTES(zl);
+}
@@ -28,54 +28,126 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _POSIX_C_SOURCE 200112L /* posix_memalign() */
+#include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include "zmalloc.h"
+
+/* 没有HAVE_MALLOC_SIZE时才需要在每块内存前面保存size */
+#ifdef HAVE_MALLOC_SIZE
+#define PREFIX_SIZE (0)
+#else
+#define PREFIX_SIZE (sizeof(size_t))
+#endif
+
+/* used_memory may be updated by other threads (freeing objects in the
+ * background for example), so it is updated atomically */
+#if defined(__ATOMIC_RELAXED)
+#define update_zmalloc_stat_add(n) __atomic_add_fetch(&used_memory,(n),__ATOMIC_RELAXED)
+#define update_zmalloc_stat_sub(n) __atomic_sub_fetch(&used_memory,(n),__ATOMIC_RELAXED)
+#define read_zmalloc_stat() __atomic_load_n(&used_memory,__ATOMIC_RELAXED)
+#elif defined(__GNUC__)
+#define update_zmalloc_stat_add(n) __sync_add_and_fetch(&used_memory,(n))
+#define update_zmalloc_stat_sub(n) __sync_sub_and_fetch(&used_memory,(n))
+#define read_zmalloc_stat() __sync_add_and_fetch(&used_memory,0)
+#else
+#error "zmalloc needs the __atomic or __sync compiler builtins"
+#endif
 
 static size_t used_memory = 0;
 
-/* 申请内存, 自带size.head
- * mem: size.head + free.mem */
+/* 申请内存. 分配器可以给出指针的实际大小时不再需要size头,
+ * 否则mem: size.head + free.mem */
 void *zmalloc(size_t size) {
-	/* The  malloc()  function  allocates  size bytes and returns a pointer to the allocated memory.  
-	 * The memory is not initialized */
-    void *ptr = malloc(size+sizeof(size_t));
+    void *ptr = malloc(size+PREFIX_SIZE);
 
     if (!ptr) return NULL;
+#ifdef HAVE_MALLOC_SIZE
+    update_zmalloc_stat_add(zmalloc_size(ptr));
+    return ptr;
+#else
     *((size_t*)ptr) = size;
-    used_memory += size+sizeof(size_t);
-    return (char*)ptr+sizeof(size_t);
+    update_zmalloc_stat_add(size+PREFIX_SIZE);
+    return (char*)ptr+PREFIX_SIZE;
+#endif
 }
 
 /* 调整已申请的内存块 */
 void *zrealloc(void *ptr, size_t size) {
+#ifndef HAVE_MALLOC_SIZE
     void *realptr;
+#endif
     size_t oldsize;
     void *newptr;
 
     if (ptr == NULL) return zmalloc(size);	/* 申请崭新的MEM */
-	
-    realptr = (char*)ptr-sizeof(size_t);
+#ifdef HAVE_MALLOC_SIZE
+    oldsize = zmalloc_size(ptr);
+    newptr = realloc(ptr,size);
+    if (!newptr) return NULL;				/* 调整失败则直接返回NULL */
+
+    update_zmalloc_stat_sub(oldsize);
+    update_zmalloc_stat_add(zmalloc_size(newptr));
+    return newptr;
+#else
+    realptr = (char*)ptr-PREFIX_SIZE;
     oldsize = *((size_t*)realptr);
-    newptr = realloc(realptr,size+sizeof(size_t));
+    newptr = realloc(realptr,size+PREFIX_SIZE);
     if (!newptr) return NULL;				/* 调整失败则直接返回NULL */
 
     *((size_t*)newptr) = size;
 	/* 更新内存使用量 */
-    used_memory -= oldsize;
-    used_memory += size;
-    return (char*)newptr+sizeof(size_t);	/* 返回 */
+    update_zmalloc_stat_sub(oldsize);
+    update_zmalloc_stat_add(size);
+    return (char*)newptr+PREFIX_SIZE;	/* 返回 */
+#endif
 }
 
 /* 释放内存 */
 void zfree(void *ptr) {
+#ifndef HAVE_MALLOC_SIZE
     void *realptr;
     size_t oldsize;
+#endif
 
     if (ptr == NULL) return;
-    realptr = (char*)ptr-sizeof(size_t);
+#ifdef HAVE_MALLOC_SIZE
+    update_zmalloc_stat_sub(zmalloc_size(ptr));
+    free(ptr);
+#else
+    realptr = (char*)ptr-PREFIX_SIZE;
     oldsize = *((size_t*)realptr);
-    used_memory -= oldsize+sizeof(size_t);
+    update_zmalloc_stat_sub(oldsize+PREFIX_SIZE);
     free(realptr);
+#endif
+}
+
+/* 申请按alignment对齐的内存(slab的页). 从不带size头,否则就无法对齐了,
+ * 所以释放时调用者要用zfree_aligned()并给出同样的size */
+void *zmalloc_aligned(size_t alignment, size_t size) {
+    void *ptr;
+
+    if (posix_memalign(&ptr,alignment,size) != 0) return NULL;
+#ifdef HAVE_MALLOC_SIZE
+    update_zmalloc_stat_add(zmalloc_size(ptr));
+#else
+    update_zmalloc_stat_add(size);
+#endif
+    return ptr;
+}
+
+void zfree_aligned(void *ptr, size_t size) {
+    if (ptr == NULL) return;
+#ifdef HAVE_MALLOC_SIZE
+    update_zmalloc_stat_sub(zmalloc_size(ptr));
+    (void) size;
+#else
+    update_zmalloc_stat_sub(size);
+#endif
+    free(ptr);
 }
 
 /* 申请全新的内存，将s指向的string拷贝到新内存中并返回 */
@@ -89,5 +161,50 @@ char *zstrdup(const char *s) {
 
 /* 返回已消耗的内存总量 */
 size_t zmalloc_used_memory(void) {
-    return used_memory;
+    return read_zmalloc_stat();
+}
+
+/* Resident set size of the process as seen by the kernel. Where there is
+ * no /proc we can only return the memory we allocated, so the
+ * fragmentation ratio is reported as 1 */
+size_t zmalloc_get_rss(void) {
+    unsigned long rsspages;
+    FILE *fp = fopen("/proc/self/statm","r");
+
+    if (fp) {
+        int ok = fscanf(fp,"%*s %lu",&rsspages) == 1;
+
+        fclose(fp);
+        if (ok) return (size_t)rsspages*sysconf(_SC_PAGESIZE);
+    }
+    return zmalloc_used_memory();
+}
+
+/* 分配器自己统计的内存: allocated是已分配给程序的字节数, active是分配器
+ * 从系统拿到并在使用中的字节数(包括碎片). 分配器不支持时返回0 */
+int zmalloc_get_allocator_info(size_t *allocated, size_t *active) {
+#if defined(USE_JEMALLOC)
+    size_t sz = sizeof(size_t);
+    uint64_t epoch = 1;
+
+    /* Update the statistics cached by mallctl */
+    mallctl("epoch",&epoch,&sz,&epoch,sz);
+    sz = sizeof(size_t);
+    mallctl("stats.allocated",allocated,&sz,NULL,0);
+    mallctl("stats.active",active,&sz,NULL,0);
+    return 1;
+#elif defined(USE_TCMALLOC)
+    *allocated = *active = 0;
+    return 0;
+#elif defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 mi = mallinfo2();
+
+    /* arena: sbrk heap, hblkhd: mmap()ed chunks, uordblks: in use */
+    *allocated = mi.uordblks+mi.hblkhd;
+    *active = mi.arena+mi.hblkhd;
+    return 1;
+#else
+    *allocated = *active = 0;
+    return 0;
+#endif
 }
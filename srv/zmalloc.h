@@ -31,11 +31,46 @@
 #ifndef _ZMALLOC_H
 #define _ZMALLOC_H
 
+#include <stddef.h>
+
+/* The allocator is chosen at build time, see the Makefile:
+ *   make USE_JEMALLOC=yes / make USE_TCMALLOC=yes
+ * Otherwise the libc malloc() is used. When the allocator can tell the
+ * usable size of a pointer (HAVE_MALLOC_SIZE) no size header is stored in
+ * front of the allocations. */
+#if defined(USE_TCMALLOC)
+#include <google/tcmalloc.h>
+#define ZMALLOC_LIB "tcmalloc"
+#define HAVE_MALLOC_SIZE 1
+#define zmalloc_size(p) tc_malloc_size(p)
+#elif defined(USE_JEMALLOC)
+#include <jemalloc/jemalloc.h>
+#define ZMALLOC_LIB "jemalloc"
+#define HAVE_MALLOC_SIZE 1
+#define zmalloc_size(p) malloc_usable_size(p)
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#define ZMALLOC_LIB "libc"
+#define HAVE_MALLOC_SIZE 1
+#define zmalloc_size(p) malloc_size(p)
+#elif defined(__linux__)
+#include <malloc.h>
+#define ZMALLOC_LIB "libc"
+#define HAVE_MALLOC_SIZE 1
+#define zmalloc_size(p) malloc_usable_size(p)
+#else
+#define ZMALLOC_LIB "libc"
+#endif
+
 void *zmalloc(size_t size);
 void *zrealloc(void *ptr, size_t size);
 void zfree(void *ptr);
+void *zmalloc_aligned(size_t alignment, size_t size);
+void zfree_aligned(void *ptr, size_t size);
 /* 拷贝一份全新的string到崭新的内存块并返回 */
 char *zstrdup(const char *s);
 size_t zmalloc_used_memory(void);
+size_t zmalloc_get_rss(void);
+int zmalloc_get_allocator_info(size_t *allocated, size_t *active);
 
 #endif /* _ZMALLOC_H */